@@ -52,6 +52,7 @@ typedef struct
 	gboolean	 show_update;
 	gboolean	 selectable;
 	guint		 pending_refresh_id;
+	GCancellable	*icon_cancellable;
 } GsAppRowPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GsAppRow, gs_app_row, GTK_TYPE_LIST_BOX_ROW)
@@ -110,6 +111,66 @@ gs_app_row_get_description (GsAppRow *app_row)
 	return g_string_new (escaped);
 }
 
+/**
+ * gs_app_row_load_icon_cb:
+ **/
+static void
+gs_app_row_load_icon_cb (GObject *source,
+			 GAsyncResult *res,
+			 gpointer user_data)
+{
+	GsApp *app = GS_APP (source);
+	g_autoptr(GsAppRow) app_row = GS_APP_ROW (user_data);
+	GsAppRowPrivate *priv = gs_app_row_get_instance_private (app_row);
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+
+	ret = gs_app_load_icon_finish (app, res, &error);
+
+	/* cancelled, or superseded by a load for another app */
+	if (priv->icon_cancellable != g_task_get_cancellable (G_TASK (res)))
+		return;
+	g_clear_object (&priv->icon_cancellable);
+	if (!ret) {
+		g_warning ("failed to load icon: %s", error->message);
+		return;
+	}
+	gs_image_set_from_pixbuf (GTK_IMAGE (priv->image),
+				  gs_app_get_pixbuf (app));
+}
+
+/**
+ * gs_app_row_load_icon:
+ **/
+static void
+gs_app_row_load_icon (GsAppRow *app_row)
+{
+	GsAppRowPrivate *priv = gs_app_row_get_instance_private (app_row);
+
+	/* already loading */
+	if (priv->icon_cancellable != NULL)
+		return;
+	priv->icon_cancellable = g_cancellable_new ();
+	gs_app_load_icon_async (priv->app,
+				priv->icon_cancellable,
+				gs_app_row_load_icon_cb,
+				g_object_ref (app_row));
+}
+
+/**
+ * gs_app_row_map:
+ **/
+static void
+gs_app_row_map (GtkWidget *widget)
+{
+	GsAppRow *app_row = GS_APP_ROW (widget);
+	GsAppRowPrivate *priv = gs_app_row_get_instance_private (app_row);
+
+	GTK_WIDGET_CLASS (gs_app_row_parent_class)->map (widget);
+	if (priv->app != NULL && gs_app_get_icon_deferred (priv->app))
+		gs_app_row_load_icon (app_row);
+}
+
 /**
  * gs_app_row_refresh:
  **/
@@ -183,9 +244,18 @@ gs_app_row_refresh (GsAppRow *app_row)
 		gtk_widget_set_visible (priv->folder_label, folder != NULL);
 	}
 
-	if (gs_app_get_pixbuf (priv->app))
+	/* show a placeholder until the row is visible */
+	if (gs_app_get_icon_deferred (priv->app)) {
+		gtk_image_set_from_icon_name (GTK_IMAGE (priv->image),
+					      "application-x-executable",
+					      GTK_ICON_SIZE_DIALOG);
+		gtk_image_set_pixel_size (GTK_IMAGE (priv->image), 64);
+		if (gtk_widget_get_mapped (GTK_WIDGET (app_row)))
+			gs_app_row_load_icon (app_row);
+	} else if (gs_app_get_pixbuf (priv->app)) {
 		gs_image_set_from_pixbuf (GTK_IMAGE (priv->image),
 					  gs_app_get_pixbuf (priv->app));
+	}
 
 	context = gtk_widget_get_style_context (priv->image);
 	if (gs_app_get_kind (priv->app) == GS_APP_KIND_MISSING)
@@ -381,6 +451,10 @@ gs_app_row_destroy (GtkWidget *object)
 		g_signal_handlers_disconnect_by_func (priv->app, gs_app_row_notify_props_changed_cb, app_row);
 
 	g_clear_object (&priv->app);
+	if (priv->icon_cancellable != NULL) {
+		g_cancellable_cancel (priv->icon_cancellable);
+		g_clear_object (&priv->icon_cancellable);
+	}
 	if (priv->pending_refresh_id != 0) {
 		g_source_remove (priv->pending_refresh_id);
 		priv->pending_refresh_id = 0;
@@ -430,6 +504,7 @@ gs_app_row_class_init (GsAppRowClass *klass)
 	object_class->get_property = gs_app_row_get_property;
 
 	widget_class->destroy = gs_app_row_destroy;
+	widget_class->map = gs_app_row_map;
 
 	pspec = g_param_spec_boolean ("selected", NULL, NULL,
 				      FALSE, G_PARAM_READWRITE);
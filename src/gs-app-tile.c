@@ -39,6 +39,7 @@ struct _GsAppTile
 	GtkWidget	*eventbox;
 	GtkWidget	*stack;
 	GtkWidget	*stars;
+	GCancellable	*icon_cancellable;
 };
 
 G_DEFINE_TYPE (GsAppTile, gs_app_tile, GTK_TYPE_BUTTON)
@@ -117,6 +118,58 @@ app_state_changed (GsApp *app, GParamSpec *pspec, GsAppTile *tile)
 	g_idle_add (app_state_changed_idle, g_object_ref (tile));
 }
 
+static void
+gs_app_tile_load_icon_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GsApp *app = GS_APP (source);
+	g_autoptr(GsAppTile) tile = GS_APP_TILE (user_data);
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+
+	ret = gs_app_load_icon_finish (app, res, &error);
+
+	/* cancelled, or superseded by a load for another app */
+	if (tile->icon_cancellable != g_task_get_cancellable (G_TASK (res)))
+		return;
+	g_clear_object (&tile->icon_cancellable);
+	if (!ret) {
+		g_warning ("failed to load icon: %s", error->message);
+		return;
+	}
+	gs_image_set_from_pixbuf (GTK_IMAGE (tile->image), gs_app_get_pixbuf (app));
+}
+
+static void
+gs_app_tile_load_icon (GsAppTile *tile)
+{
+	if (tile->icon_cancellable != NULL)
+		return;
+	tile->icon_cancellable = g_cancellable_new ();
+	gs_app_load_icon_async (tile->app,
+				tile->icon_cancellable,
+				gs_app_tile_load_icon_cb,
+				g_object_ref (tile));
+}
+
+static void
+gs_app_tile_cancel_icon (GsAppTile *tile)
+{
+	if (tile->icon_cancellable == NULL)
+		return;
+	g_cancellable_cancel (tile->icon_cancellable);
+	g_clear_object (&tile->icon_cancellable);
+}
+
+static void
+gs_app_tile_map (GtkWidget *widget)
+{
+	GsAppTile *tile = GS_APP_TILE (widget);
+
+	GTK_WIDGET_CLASS (gs_app_tile_parent_class)->map (widget);
+	if (tile->app != NULL && gs_app_get_icon_deferred (tile->app))
+		gs_app_tile_load_icon (tile);
+}
+
 void
 gs_app_tile_set_app (GsAppTile *tile, GsApp *app)
 {
@@ -130,6 +183,7 @@ gs_app_tile_set_app (GsAppTile *tile, GsApp *app)
 
 	if (tile->app)
 		g_signal_handlers_disconnect_by_func (tile->app, app_state_changed, tile);
+	gs_app_tile_cancel_icon (tile);
 
 	g_set_object (&tile->app, app);
 	if (!app)
@@ -151,7 +205,16 @@ gs_app_tile_set_app (GsAppTile *tile, GsApp *app)
 			  G_CALLBACK (app_state_changed), tile);
 	app_state_changed (tile->app, NULL, tile);
 
-	gs_image_set_from_pixbuf (GTK_IMAGE (tile->image), gs_app_get_pixbuf (app));
+	/* show a placeholder until the tile is visible */
+	if (gs_app_get_icon_deferred (app)) {
+		gtk_image_set_from_icon_name (GTK_IMAGE (tile->image),
+					      "application-x-executable",
+					      GTK_ICON_SIZE_DIALOG);
+		if (gtk_widget_get_mapped (GTK_WIDGET (tile)))
+			gs_app_tile_load_icon (tile);
+	} else {
+		gs_image_set_from_pixbuf (GTK_IMAGE (tile->image), gs_app_get_pixbuf (app));
+	}
 	gtk_label_set_label (GTK_LABEL (tile->name), gs_app_get_name (app));
 	summary = gs_app_get_summary (app);
 	gtk_label_set_label (GTK_LABEL (tile->summary), summary);
@@ -166,6 +229,7 @@ gs_app_tile_destroy (GtkWidget *widget)
 	if (tile->app)
 		g_signal_handlers_disconnect_by_func (tile->app, app_state_changed, tile);
 	g_clear_object (&tile->app);
+	gs_app_tile_cancel_icon (tile);
 
 	GTK_WIDGET_CLASS (gs_app_tile_parent_class)->destroy (widget);
 }
@@ -184,6 +248,7 @@ gs_app_tile_class_init (GsAppTileClass *klass)
 	GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
 
 	widget_class->destroy = gs_app_tile_destroy;
+	widget_class->map = gs_app_tile_map;
 
 	gtk_widget_class_set_template_from_resource (widget_class, "/org/gnome/Software/app-tile.ui");
 
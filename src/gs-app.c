@@ -46,8 +46,10 @@
 #include <string.h>
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include "gs-app.h"
+#include "gs-icon-pack.h"
 #include "gs-utils.h"
 
 struct _GsApp
@@ -90,6 +92,7 @@ struct _GsApp
 	guint			 progress;
 	GHashTable		*metadata;
 	GdkPixbuf		*pixbuf;
+	gint			 pixbuf_scale;	/* 0 unless decoding was deferred */
 	GdkPixbuf		*featured_pixbuf;
 	GPtrArray		*addons; /* of GsApp */
 	GHashTable		*addons_hash; /* of "id" */
@@ -100,6 +103,11 @@ struct _GsApp
 	guint64			 kudos;
 	gboolean		 to_be_installed;
 	AsBundle		*bundle;
+	GMutex			 refined_mutex;	/* for the three below */
+	guint64			 refined_flags;
+	guint64			 refine_failed;
+	guint			 refined_generation;
+	guint			 refined_serial;
 };
 
 enum {
@@ -867,14 +875,199 @@ icon_theme_add_path (const gchar *path)
 	}
 }
 
+/* decoded icons are shared by every GsApp in the process, as search and
+ * category results create new GsApps for the same icons every time */
+#define GS_APP_PIXBUF_CACHE_SIZE	(16 * 1024 * 1024)	/* bytes */
+
+typedef struct {
+	gchar		*key;
+	GdkPixbuf	*pixbuf;
+	gsize		 size;
+} GsAppPixbufCacheItem;
+
+static GMutex		 pixbuf_cache_lock;
+static GHashTable	*pixbuf_cache;		/* key:GList of GsAppPixbufCacheItem */
+static GQueue		 pixbuf_cache_lru;	/* most recently used first */
+static gsize		 pixbuf_cache_size;
+static guint		 pixbuf_cache_hits;
+static guint		 pixbuf_cache_misses;
+static gboolean		 pixbuf_defer_decode;
+
+/**
+ * gs_app_pixbuf_cache_key:
+ *
+ * Local files include the modification time in the key, so that an icon
+ * replaced on disk is decoded again.
+ *
+ * Returns: A key for the decoded @icon at @scale, or %NULL if it cannot be
+ * cached.
+ */
+static gchar *
+gs_app_pixbuf_cache_key (AsIcon *icon, gint scale)
+{
+	GStatBuf st;
+	const gchar *prefix = as_icon_get_prefix (icon);
+
+	if (as_icon_get_name (icon) == NULL &&
+	    as_icon_get_kind (icon) != AS_ICON_KIND_LOCAL &&
+	    as_icon_get_kind (icon) != AS_ICON_KIND_REMOTE)
+		return NULL;
+	switch (as_icon_get_kind (icon)) {
+	case AS_ICON_KIND_REMOTE:
+		if (as_icon_get_url (icon) == NULL)
+			return NULL;
+		return g_strdup_printf ("remote:%i:%s", scale,
+					as_icon_get_url (icon));
+	case AS_ICON_KIND_LOCAL:
+		if (as_icon_get_filename (icon) == NULL)
+			return NULL;
+		if (g_stat (as_icon_get_filename (icon), &st) != 0)
+			return NULL;
+		return g_strdup_printf ("local:%i:%" G_GINT64_FORMAT ":%s", scale,
+					(gint64) st.st_mtime,
+					as_icon_get_filename (icon));
+	case AS_ICON_KIND_STOCK:
+		return g_strdup_printf ("stock:%i:%s:%s", scale,
+					prefix != NULL ? prefix : "",
+					as_icon_get_name (icon));
+	case AS_ICON_KIND_CACHED:
+		return g_strdup_printf ("cached:%i:%u:%s:%s", scale,
+					as_icon_get_width (icon),
+					prefix != NULL ? prefix : "",
+					as_icon_get_name (icon));
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * gs_app_pixbuf_cache_lookup:
+ *
+ * Returns: (transfer full): The decoded icon, or %NULL if not yet cached
+ */
+static GdkPixbuf *
+gs_app_pixbuf_cache_lookup (const gchar *key)
+{
+	GList *link;
+	GsAppPixbufCacheItem *item;
+	GdkPixbuf *pixbuf = NULL;
+
+	g_mutex_lock (&pixbuf_cache_lock);
+	link = pixbuf_cache != NULL ? g_hash_table_lookup (pixbuf_cache, key) : NULL;
+	if (link == NULL)
+		goto out;
+	pixbuf_cache_hits++;
+
+	/* move to the front */
+	g_queue_unlink (&pixbuf_cache_lru, link);
+	g_queue_push_head_link (&pixbuf_cache_lru, link);
+	item = link->data;
+	pixbuf = g_object_ref (item->pixbuf);
+out:
+	g_mutex_unlock (&pixbuf_cache_lock);
+	return pixbuf;
+}
+
+/**
+ * gs_app_pixbuf_cache_item_free:
+ */
+static void
+gs_app_pixbuf_cache_item_free (GsAppPixbufCacheItem *item)
+{
+	g_free (item->key);
+	g_object_unref (item->pixbuf);
+	g_slice_free (GsAppPixbufCacheItem, item);
+}
+
+/**
+ * gs_app_pixbuf_cache_add:
+ *
+ * Adds a decoded icon, dropping the least recently used icons to stay
+ * within %GS_APP_PIXBUF_CACHE_SIZE.
+ */
+static void
+gs_app_pixbuf_cache_add (const gchar *key, GdkPixbuf *pixbuf)
+{
+	GList *link;
+	GsAppPixbufCacheItem *item;
+
+	g_mutex_lock (&pixbuf_cache_lock);
+	if (pixbuf_cache == NULL)
+		pixbuf_cache = g_hash_table_new (g_str_hash, g_str_equal);
+
+	/* another thread got there first */
+	if (g_hash_table_contains (pixbuf_cache, key))
+		goto out;
+
+	item = g_slice_new0 (GsAppPixbufCacheItem);
+	item->key = g_strdup (key);
+	item->pixbuf = g_object_ref (pixbuf);
+	item->size = gdk_pixbuf_get_byte_length (pixbuf);
+	g_queue_push_head (&pixbuf_cache_lru, item);
+	g_hash_table_insert (pixbuf_cache, item->key, pixbuf_cache_lru.head);
+	pixbuf_cache_size += item->size;
+
+	/* keep the one just added, even if it is huge */
+	while (pixbuf_cache_size > GS_APP_PIXBUF_CACHE_SIZE &&
+	       pixbuf_cache_lru.length > 1) {
+		link = g_queue_pop_tail_link (&pixbuf_cache_lru);
+		item = link->data;
+		g_hash_table_remove (pixbuf_cache, item->key);
+		pixbuf_cache_size -= item->size;
+		gs_app_pixbuf_cache_item_free (item);
+		g_list_free_1 (link);
+	}
+out:
+	g_mutex_unlock (&pixbuf_cache_lock);
+}
+
+/**
+ * gs_app_set_defer_icon_decode:
+ * @defer: %TRUE to decode icons only when they are shown
+ *
+ * When set, gs_app_load_icon() only checks that the icon can be loaded,
+ * unless it was already decoded, and gs_app_load_icon_async() is used to
+ * decode it when the application is actually shown.
+ */
+void
+gs_app_set_defer_icon_decode (gboolean defer)
+{
+	pixbuf_defer_decode = defer;
+}
+
+/**
+ * gs_app_get_pixbuf_cache_stats:
+ * @hits: (out) (allow-none): The number of icons that did not need decoding
+ * @misses: (out) (allow-none): The number of icons that had to be decoded
+ *
+ * Gets the counters for the icon cache shared by all applications.
+ */
+void
+gs_app_get_pixbuf_cache_stats (guint *hits, guint *misses)
+{
+	g_mutex_lock (&pixbuf_cache_lock);
+	if (hits != NULL)
+		*hits = pixbuf_cache_hits;
+	if (misses != NULL)
+		*misses = pixbuf_cache_misses;
+	g_mutex_unlock (&pixbuf_cache_lock);
+}
+
 /**
  * gs_app_get_pixbuf:
+ *
+ * Returns: the icon, or %NULL if it was deferred and
+ * gs_app_load_icon_async() has not finished yet
  */
 GdkPixbuf *
 gs_app_get_pixbuf (GsApp *app)
 {
 	g_return_val_if_fail (GS_IS_APP (app), NULL);
 
+	/* never decode here, as this is called from the main thread */
+	if (gs_app_get_icon_deferred (app))
+		return NULL;
+
 	g_mutex_lock (&icon_theme_lock);
 	/* has an icon */
 	if (app->pixbuf == NULL &&
@@ -945,19 +1138,29 @@ gs_app_set_icon (GsApp *app, AsIcon *icon)
 }
 
 /**
- * gs_app_load_icon:
+ * gs_app_decode_icon:
+ *
+ * Returns: (transfer full): The decoded @icon at @scale, from the cache if
+ * possible.
  */
-gboolean
-gs_app_load_icon (GsApp *app, gint scale, GError **error)
+static GdkPixbuf *
+gs_app_decode_icon (AsIcon *icon, gint scale, GError **error)
 {
-	AsIcon *icon;
+	g_autofree gchar *key = NULL;
 	g_autoptr(GdkPixbuf) pixbuf = NULL;
 
-	g_return_val_if_fail (GS_IS_APP (app), FALSE);
-	g_return_val_if_fail (app->icon != NULL, FALSE);
+	/* already decoded */
+	key = gs_app_pixbuf_cache_key (icon, scale);
+	if (key != NULL) {
+		pixbuf = gs_app_pixbuf_cache_lookup (key);
+		if (pixbuf != NULL)
+			return g_steal_pointer (&pixbuf);
+	}
+	g_mutex_lock (&pixbuf_cache_lock);
+	pixbuf_cache_misses++;
+	g_mutex_unlock (&pixbuf_cache_lock);
 
 	/* either load from the theme or from a file */
-	icon = gs_app_get_icon (app);
 	switch (as_icon_get_kind (icon)) {
 	case AS_ICON_KIND_LOCAL:
 		if (as_icon_get_filename (icon) == NULL) {
@@ -966,7 +1169,7 @@ gs_app_load_icon (GsApp *app, gint scale, GError **error)
 				     GS_PLUGIN_ERROR_FAILED,
 				     "%s icon has no filename",
 				     as_icon_get_name (icon));
-			return FALSE;
+			return NULL;
 		}
 		pixbuf = gdk_pixbuf_new_from_file_at_size (as_icon_get_filename (icon),
 							   64 * scale,
@@ -984,6 +1187,26 @@ gs_app_load_icon (GsApp *app, gint scale, GError **error)
 						   error);
 		g_mutex_unlock (&icon_theme_lock);
 		break;
+	case AS_ICON_KIND_CACHED:
+		if (!as_icon_load (icon, AS_ICON_LOAD_FLAG_SEARCH_SIZE, error))
+			return NULL;
+		pixbuf = g_object_ref (as_icon_get_pixbuf (icon));
+		break;
+	case AS_ICON_KIND_REMOTE:
+		/* downloaded into the icon pack by the icons plugin */
+		if (as_icon_get_url (icon) != NULL) {
+			pixbuf = gs_icon_pack_lookup (gs_icon_pack_get_default (),
+						      as_icon_get_url (icon),
+						      scale);
+		}
+		if (pixbuf == NULL) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "%s icon has not been downloaded",
+				     as_icon_get_url (icon));
+		}
+		break;
 	default:
 		g_set_error (error,
 			     GS_PLUGIN_ERROR,
@@ -992,12 +1215,266 @@ gs_app_load_icon (GsApp *app, gint scale, GError **error)
 			     as_icon_kind_to_string (as_icon_get_kind (icon)));
 		break;
 	}
-	if (pixbuf == NULL)
+	if (pixbuf != NULL && key != NULL)
+		gs_app_pixbuf_cache_add (key, pixbuf);
+	return g_steal_pointer (&pixbuf);
+}
+
+/**
+ * gs_app_icon_is_loadable:
+ *
+ * Checks the icon metadata without decoding anything, which is enough to
+ * decide if the application can be shown.
+ */
+static gboolean
+gs_app_icon_is_loadable (AsIcon *icon, GError **error)
+{
+	switch (as_icon_get_kind (icon)) {
+	case AS_ICON_KIND_LOCAL:
+		if (as_icon_get_filename (icon) == NULL ||
+		    !g_file_test (as_icon_get_filename (icon), G_FILE_TEST_EXISTS)) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "%s icon has no file",
+				     as_icon_get_name (icon));
+			return FALSE;
+		}
+		return TRUE;
+	case AS_ICON_KIND_STOCK:
+	case AS_ICON_KIND_CACHED:
+		if (as_icon_get_name (icon) == NULL) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "%s icon has no name",
+				     as_icon_kind_to_string (as_icon_get_kind (icon)));
+			return FALSE;
+		}
+		return TRUE;
+	case AS_ICON_KIND_REMOTE:
+		if (as_icon_get_url (icon) == NULL ||
+		    !gs_icon_pack_contains (gs_icon_pack_get_default (),
+					    as_icon_get_url (icon), 1)) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "%s icon has not been downloaded",
+				     as_icon_get_url (icon));
+			return FALSE;
+		}
+		return TRUE;
+	default:
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "%s icon cannot be loaded",
+			     as_icon_kind_to_string (as_icon_get_kind (icon)));
 		return FALSE;
+	}
+}
+
+/**
+ * gs_app_load_icon:
+ *
+ * Sets the pixbuf from the icon, which is only decoded if no other
+ * application has already loaded the same icon at @scale.
+ *
+ * If gs_app_set_defer_icon_decode() was used then an icon that is not
+ * already decoded is just checked, and decoded later.
+ */
+gboolean
+gs_app_load_icon (GsApp *app, gint scale, GError **error)
+{
+	g_autofree gchar *key = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+
+	g_return_val_if_fail (GS_IS_APP (app), FALSE);
+	g_return_val_if_fail (app->icon != NULL, FALSE);
+
+	/* only decode when shown, unless we already have it */
+	if (pixbuf_defer_decode) {
+		key = gs_app_pixbuf_cache_key (app->icon, scale);
+		if (key != NULL)
+			pixbuf = gs_app_pixbuf_cache_lookup (key);
+		if (pixbuf == NULL) {
+			if (!gs_app_icon_is_loadable (app->icon, error))
+				return FALSE;
+			app->pixbuf_scale = scale;
+			return TRUE;
+		}
+	} else {
+		pixbuf = gs_app_decode_icon (app->icon, scale, error);
+		if (pixbuf == NULL)
+			return FALSE;
+	}
 	gs_app_set_pixbuf (app, pixbuf);
 	return TRUE;
 }
 
+/**
+ * gs_app_get_icon_pixbuf:
+ * @app: A #GsApp
+ * @scale: The window scale
+ *
+ * Gets the decoded icon of @app without changing it, sharing the decoded
+ * icons that gs_app_load_icon() uses.
+ *
+ * Returns: (transfer full): The decoded icon, or %NULL
+ */
+GdkPixbuf *
+gs_app_get_icon_pixbuf (GsApp *app, gint scale, GError **error)
+{
+	g_return_val_if_fail (GS_IS_APP (app), NULL);
+
+	if (app->pixbuf != NULL)
+		return g_object_ref (app->pixbuf);
+	if (app->icon == NULL) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "%s has no icon",
+			     gs_app_get_id (app));
+		return NULL;
+	}
+	return gs_app_decode_icon (app->icon, scale, error);
+}
+
+/**
+ * gs_app_get_icon_deferred:
+ *
+ * Returns: %TRUE if the icon has been checked but not yet decoded, in which
+ * case gs_app_load_icon_async() should be used before it is shown.
+ */
+gboolean
+gs_app_get_icon_deferred (GsApp *app)
+{
+	g_return_val_if_fail (GS_IS_APP (app), FALSE);
+	return app->pixbuf == NULL && app->pixbuf_scale > 0;
+}
+
+/**
+ * gs_app_icon_copy:
+ */
+static AsIcon *
+gs_app_icon_copy (AsIcon *icon)
+{
+	AsIcon *copy = as_icon_new ();
+	as_icon_set_kind (copy, as_icon_get_kind (icon));
+	as_icon_set_name (copy, as_icon_get_name (icon));
+	as_icon_set_prefix (copy, as_icon_get_prefix (icon));
+	as_icon_set_filename (copy, as_icon_get_filename (icon));
+	as_icon_set_url (copy, as_icon_get_url (icon));
+	as_icon_set_width (copy, as_icon_get_width (icon));
+	as_icon_set_height (copy, as_icon_get_height (icon));
+	return copy;
+}
+
+typedef struct {
+	AsIcon		*icon;
+	gint		 scale;
+} GsAppLoadIconHelper;
+
+/**
+ * gs_app_load_icon_helper_free:
+ */
+static void
+gs_app_load_icon_helper_free (GsAppLoadIconHelper *helper)
+{
+	g_object_unref (helper->icon);
+	g_slice_free (GsAppLoadIconHelper, helper);
+}
+
+/**
+ * gs_app_load_icon_thread_cb:
+ */
+static void
+gs_app_load_icon_thread_cb (GTask *task,
+			    gpointer source_object,
+			    gpointer task_data,
+			    GCancellable *cancellable)
+{
+	GsAppLoadIconHelper *helper = (GsAppLoadIconHelper *) task_data;
+	GError *error = NULL;
+	GdkPixbuf *pixbuf;
+
+	pixbuf = gs_app_decode_icon (helper->icon, helper->scale, &error);
+	if (pixbuf == NULL) {
+		g_task_return_error (task, error);
+		return;
+	}
+	g_task_return_pointer (task, pixbuf, g_object_unref);
+}
+
+/**
+ * gs_app_load_icon_async:
+ *
+ * Decodes an icon that gs_app_load_icon() deferred, in a worker thread.
+ *
+ * The worker uses a copy of the icon and the scale taken now, as loading
+ * a cached icon changes the #AsIcon and the application can be refined
+ * again while the icon is decoded.
+ */
+void
+gs_app_load_icon_async (GsApp *app,
+			GCancellable *cancellable,
+			GAsyncReadyCallback callback,
+			gpointer user_data)
+{
+	GsAppLoadIconHelper *helper;
+	g_autoptr(GTask) task = NULL;
+
+	g_return_if_fail (GS_IS_APP (app));
+
+	task = g_task_new (app, cancellable, callback, user_data);
+	if (!gs_app_get_icon_deferred (app)) {
+		g_task_return_pointer (task, NULL, NULL);
+		return;
+	}
+	helper = g_slice_new0 (GsAppLoadIconHelper);
+	helper->icon = gs_app_icon_copy (app->icon);
+	helper->scale = app->pixbuf_scale;
+	g_task_set_task_data (task, helper, (GDestroyNotify) gs_app_load_icon_helper_free);
+	g_task_run_in_thread (task, gs_app_load_icon_thread_cb);
+}
+
+/**
+ * gs_app_load_icon_finish:
+ *
+ * Returns: %TRUE if gs_app_get_pixbuf() now returns the decoded icon
+ */
+gboolean
+gs_app_load_icon_finish (GsApp *app, GAsyncResult *res, GError **error)
+{
+	GError *error_local = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+
+	g_return_val_if_fail (GS_IS_APP (app), FALSE);
+	g_return_val_if_fail (g_task_is_valid (res, app), FALSE);
+
+	pixbuf = g_task_propagate_pointer (G_TASK (res), &error_local);
+	if (error_local != NULL) {
+		/* use the fallback icon rather than trying again */
+		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			app->pixbuf_scale = 0;
+		g_propagate_error (error, error_local);
+		return FALSE;
+	}
+	if (pixbuf != NULL)
+		gs_app_set_pixbuf (app, pixbuf);
+
+	/* the icon was not deferred, and never loaded */
+	if (app->pixbuf == NULL) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "no icon was loaded for %s",
+			     app->id);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 /**
  * gs_app_set_pixbuf:
  */
@@ -1987,6 +2464,86 @@ gs_app_get_bundle (GsApp *app)
 	return app->bundle;
 }
 
+/**
+ * gs_app_get_refined_flags:
+ * @serial: (out) (allow-none): the value to pass to gs_app_add_refined_flags()
+ *
+ * Gets the refine flags that have already been satisfied for the app, or 0
+ * if the app was refined for a different cache @generation.
+ */
+guint64
+gs_app_get_refined_flags (GsApp *app, guint generation, guint *serial)
+{
+	guint64 refined_flags = 0;
+
+	g_return_val_if_fail (GS_IS_APP (app), 0);
+	g_mutex_lock (&app->refined_mutex);
+	if (app->refined_generation == generation)
+		refined_flags = app->refined_flags;
+	if (serial != NULL)
+		*serial = app->refined_serial;
+	g_mutex_unlock (&app->refined_mutex);
+	return refined_flags;
+}
+
+/**
+ * gs_app_add_refined_flags:
+ * @serial: the value gs_app_get_refined_flags() returned before the refine
+ *
+ * Records that @refined_flags have been satisfied for the app, apart from
+ * any reported with gs_app_add_refine_failed() since the last call.
+ * Nothing is recorded if gs_app_clear_refined_flags() was called since
+ * @serial was got, as the refine may have used data from before that.
+ */
+void
+gs_app_add_refined_flags (GsApp *app,
+			  guint64 refined_flags,
+			  guint generation,
+			  guint serial)
+{
+	g_return_if_fail (GS_IS_APP (app));
+	g_mutex_lock (&app->refined_mutex);
+	if (app->refined_serial != serial)
+		refined_flags = 0;
+	if (app->refined_generation != generation) {
+		app->refined_generation = generation;
+		app->refined_flags = 0;
+	}
+	app->refined_flags |= refined_flags & ~app->refine_failed;
+	app->refine_failed = 0;
+	g_mutex_unlock (&app->refined_mutex);
+}
+
+/**
+ * gs_app_add_refine_failed:
+ *
+ * Used by plugins when some of the data asked for by @refine_flags could
+ * not be added this time, for instance when a download failed, so that
+ * the app is refined for it again next time.
+ */
+void
+gs_app_add_refine_failed (GsApp *app, guint64 refine_flags)
+{
+	g_return_if_fail (GS_IS_APP (app));
+	g_mutex_lock (&app->refined_mutex);
+	app->refine_failed |= refine_flags;
+	g_mutex_unlock (&app->refined_mutex);
+}
+
+/**
+ * gs_app_clear_refined_flags:
+ */
+void
+gs_app_clear_refined_flags (GsApp *app)
+{
+	g_return_if_fail (GS_IS_APP (app));
+	g_mutex_lock (&app->refined_mutex);
+	app->refined_flags = 0;
+	app->refine_failed = 0;
+	app->refined_serial++;
+	g_mutex_unlock (&app->refined_mutex);
+}
+
 /**
  * gs_app_subsume:
  *
@@ -2213,6 +2770,7 @@ gs_app_finalize (GObject *object)
 {
 	GsApp *app = GS_APP (object);
 
+	g_mutex_clear (&app->refined_mutex);
 	g_free (app->id);
 	g_free (app->name);
 	g_hash_table_unref (app->urls);
@@ -2342,6 +2900,7 @@ gs_app_class_init (GsAppClass *klass)
 static void
 gs_app_init (GsApp *app)
 {
+	g_mutex_init (&app->refined_mutex);
 	app->rating = -1;
 	app->rating_confidence = -1;
 	app->rating_kind = GS_APP_RATING_KIND_UNKNOWN;
@@ -198,6 +198,20 @@ void		 gs_app_set_icon		(GsApp		*app,
 gboolean	 gs_app_load_icon		(GsApp		*app,
 						 gint		 scale,
 						 GError		**error);
+GdkPixbuf	*gs_app_get_icon_pixbuf		(GsApp		*app,
+						 gint		 scale,
+						 GError		**error);
+gboolean	 gs_app_get_icon_deferred	(GsApp		*app);
+void		 gs_app_load_icon_async		(GsApp		*app,
+						 GCancellable	*cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer	 user_data);
+gboolean	 gs_app_load_icon_finish	(GsApp		*app,
+						 GAsyncResult	*res,
+						 GError		**error);
+void		 gs_app_set_defer_icon_decode	(gboolean	 defer);
+void		 gs_app_get_pixbuf_cache_stats	(guint		*hits,
+						 guint		*misses);
 GdkPixbuf	*gs_app_get_featured_pixbuf	(GsApp		*app);
 void		 gs_app_set_featured_pixbuf	(GsApp		*app,
 						 GdkPixbuf	*pixbuf);
@@ -255,6 +269,16 @@ const gchar	*gs_app_get_search_sort_key	(GsApp		*app);
 AsBundle	*gs_app_get_bundle		(GsApp		*app);
 void		 gs_app_set_bundle		(GsApp		*app,
 						 AsBundle	*bundle);
+guint64		 gs_app_get_refined_flags	(GsApp		*app,
+						 guint		 generation,
+						 guint		*serial);
+void		 gs_app_add_refined_flags	(GsApp		*app,
+						 guint64	 refined_flags,
+						 guint		 generation,
+						 guint		 serial);
+void		 gs_app_add_refine_failed	(GsApp		*app,
+						 guint64	 refine_flags);
+void		 gs_app_clear_refined_flags	(GsApp		*app);
 
 G_END_DECLS
 
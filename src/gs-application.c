@@ -193,6 +193,9 @@ gs_application_initialize_plugins (GsApplication *app)
 
 	initialized = TRUE;
 
+	/* rows and tiles decode the icons as they are shown */
+	gs_app_set_defer_icon_decode (TRUE);
+
 	app->plugin_loader = gs_plugin_loader_new ();
 	gs_plugin_loader_set_location (app->plugin_loader, NULL);
 	if (!gs_plugin_loader_setup (app->plugin_loader, &error)) {
@@ -0,0 +1,1128 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "gs-icon-pack.h"
+#include "gs-utils.h"
+
+/*
+ * Remote icons are kept in one append-only pack file rather than as a file
+ * each, as opening and stat'ing thousands of small files is slow on network
+ * home directories. Every icon is stored as a PNG pre-scaled for a window
+ * scale of 1 and of 2, so loading is a single decode with no resize.
+ *
+ * The pack starts with a magic and a random serial, followed by the blobs.
+ * The index is a separate GVariant file, sorted by key and scale, which is
+ * mapped and binary-searched in place. Blobs added since the last flush are
+ * only referenced from the pending table until the index is rewritten.
+ *
+ * Replaced blobs are left in the pack as dead space; the pack is compacted
+ * when it grows over the size cap or is mostly dead, dropping the oldest
+ * icons first.
+ *
+ * Other processes may use the same pack, so appends, flushes and compaction
+ * are done holding a lock on a file alongside the pack. With the lock held
+ * the pack is checked for a new serial, meaning it was compacted, or a new
+ * size, meaning icons were appended and maybe flushed to the index. Lookups
+ * do not take the lock, but map the index again when its size or
+ * modification time changes.
+ */
+
+#define GS_ICON_PACK_MAGIC		"GSICNPK1"
+#define GS_ICON_PACK_HEADER_SIZE	16
+#define GS_ICON_PACK_VERSION		1
+#define GS_ICON_PACK_FORMAT		"(uttta(sutu))"
+#define GS_ICON_PACK_ICON_SIZE		64
+#define GS_ICON_PACK_MAX_SIZE		(32 * 1024 * 1024)
+#define GS_ICON_PACK_DEAD_THRESHOLD	(1024 * 1024)
+
+typedef struct {
+	gchar		*key;
+	guint32		 scale;
+	guint64		 offset;
+	guint32		 length;
+} GsIconPackEntry;
+
+struct _GsIconPack
+{
+	GObject			 parent_instance;
+
+	GMutex			 mutex;
+	gchar			*filename;
+	gchar			*index_fn;
+	guint64			 max_size;
+	guint64			 serial;
+	guint64			 pack_size;	/* including the header */
+	guint64			 live_size;	/* blobs referenced by key */
+	gboolean		 loaded;
+	GMappedFile		*pack_map;
+	GMappedFile		*index_map;
+	guint64			 index_size;	/* when mapped */
+	gint64			 index_mtime;	/* when mapped */
+	GVariant		*index;		/* a(sutu) */
+	GHashTable		*pending;	/* "scale:key" → GsIconPackEntry */
+	GOutputStream		*out;
+	gint			 lock_fd;
+};
+
+G_DEFINE_TYPE (GsIconPack, gs_icon_pack, G_TYPE_OBJECT)
+
+/**
+ * gs_icon_pack_entry_free:
+ **/
+static void
+gs_icon_pack_entry_free (GsIconPackEntry *entry)
+{
+	g_free (entry->key);
+	g_slice_free (GsIconPackEntry, entry);
+}
+
+/**
+ * gs_icon_pack_entry_new:
+ **/
+static GsIconPackEntry *
+gs_icon_pack_entry_new (const gchar *key, guint32 scale,
+			guint64 offset, guint32 length)
+{
+	GsIconPackEntry *entry = g_slice_new0 (GsIconPackEntry);
+	entry->key = g_strdup (key);
+	entry->scale = scale;
+	entry->offset = offset;
+	entry->length = length;
+	return entry;
+}
+
+/**
+ * gs_icon_pack_entry_compare_cb:
+ **/
+static gint
+gs_icon_pack_entry_compare_cb (gconstpointer a, gconstpointer b)
+{
+	GsIconPackEntry *entry1 = *((GsIconPackEntry **) a);
+	GsIconPackEntry *entry2 = *((GsIconPackEntry **) b);
+	gint rc = g_strcmp0 (entry1->key, entry2->key);
+	if (rc != 0)
+		return rc;
+	return (gint) entry1->scale - (gint) entry2->scale;
+}
+
+/**
+ * gs_icon_pack_entry_age_cb:
+ *
+ * Sorts the newest blobs first.
+ **/
+static gint
+gs_icon_pack_entry_age_cb (gconstpointer a, gconstpointer b)
+{
+	GsIconPackEntry *entry1 = *((GsIconPackEntry **) a);
+	GsIconPackEntry *entry2 = *((GsIconPackEntry **) b);
+	if (entry1->offset > entry2->offset)
+		return -1;
+	if (entry1->offset < entry2->offset)
+		return 1;
+	return 0;
+}
+
+/**
+ * gs_icon_pack_pending_key:
+ **/
+static gchar *
+gs_icon_pack_pending_key (const gchar *key, guint32 scale)
+{
+	return g_strdup_printf ("%u:%s", scale, key);
+}
+
+/**
+ * gs_icon_pack_unload:
+ **/
+static void
+gs_icon_pack_unload (GsIconPack *pack)
+{
+	if (pack->out != NULL) {
+		g_output_stream_close (pack->out, NULL, NULL);
+		g_clear_object (&pack->out);
+	}
+	g_clear_pointer (&pack->index, g_variant_unref);
+	g_clear_pointer (&pack->index_map, g_mapped_file_unref);
+	g_clear_pointer (&pack->pack_map, g_mapped_file_unref);
+	g_hash_table_remove_all (pack->pending);
+}
+
+/**
+ * gs_icon_pack_reset:
+ *
+ * Throws away the pack and starts a new, empty one. The files are only
+ * replaced when the next icon is added, as that is done with the lock held.
+ **/
+static void
+gs_icon_pack_reset (GsIconPack *pack)
+{
+	gs_icon_pack_unload (pack);
+	pack->serial = ((guint64) g_random_int () << 32) | g_random_int ();
+	pack->pack_size = 0;
+	pack->live_size = 0;
+}
+
+/**
+ * gs_icon_pack_load_index:
+ **/
+static gboolean
+gs_icon_pack_load_index (GsIconPack *pack, GError **error)
+{
+	guint32 version;
+	guint64 pack_size;
+	guint64 serial;
+	guint64 live_size;
+	GStatBuf st;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) data = NULL;
+
+	/* a change made after this is picked up the next time */
+	if (g_stat (pack->index_fn, &st) == 0) {
+		pack->index_size = (guint64) st.st_size;
+		pack->index_mtime = (gint64) st.st_mtime;
+	} else {
+		pack->index_size = 0;
+		pack->index_mtime = 0;
+	}
+	pack->index_map = g_mapped_file_new (pack->index_fn, FALSE, error);
+	if (pack->index_map == NULL)
+		return FALSE;
+	bytes = g_mapped_file_get_bytes (pack->index_map);
+	data = g_variant_new_from_bytes (G_VARIANT_TYPE (GS_ICON_PACK_FORMAT),
+					 bytes, FALSE);
+	g_variant_get (data, "(uttt@a(sutu))",
+		       &version, &serial, &pack_size, &live_size, &pack->index);
+	if (version != GS_ICON_PACK_VERSION) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "icon index version %u not supported", version);
+		return FALSE;
+	}
+	pack->serial = serial;
+	pack->pack_size = pack_size;
+	pack->live_size = live_size;
+	return TRUE;
+}
+
+/**
+ * gs_icon_pack_check_header:
+ **/
+static gboolean
+gs_icon_pack_check_header (GsIconPack *pack,
+			   const gchar *data,
+			   gsize len,
+			   GError **error)
+{
+	guint64 serial;
+
+	if (len < GS_ICON_PACK_HEADER_SIZE ||
+	    memcmp (data, GS_ICON_PACK_MAGIC, 8) != 0) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "icon pack header invalid");
+		return FALSE;
+	}
+	memcpy (&serial, data + 8, sizeof (serial));
+	if (GUINT64_FROM_LE (serial) != pack->serial) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "icon pack does not match index");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * gs_icon_pack_load_pack:
+ **/
+static gboolean
+gs_icon_pack_load_pack (GsIconPack *pack, GError **error)
+{
+	const gchar *data;
+	gsize len;
+
+	pack->pack_map = g_mapped_file_new (pack->filename, FALSE, error);
+	if (pack->pack_map == NULL)
+		return FALSE;
+	data = g_mapped_file_get_contents (pack->pack_map);
+	len = g_mapped_file_get_length (pack->pack_map);
+	if (!gs_icon_pack_check_header (pack, data, len, error))
+		return FALSE;
+	if (len < pack->pack_size) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "icon pack is truncated");
+		return FALSE;
+	}
+
+	/* blobs appended but never flushed to the index are dead space */
+	pack->pack_size = len;
+	return TRUE;
+}
+
+/**
+ * gs_icon_pack_ensure_loaded:
+ **/
+static void
+gs_icon_pack_ensure_loaded (GsIconPack *pack)
+{
+	g_autoptr(GError) error = NULL;
+
+	if (pack->loaded)
+		return;
+	pack->loaded = TRUE;
+	if (!gs_icon_pack_load_index (pack, &error) ||
+	    !gs_icon_pack_load_pack (pack, &error)) {
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_warning ("ignoring icon pack %s: %s",
+				   pack->filename, error->message);
+		gs_icon_pack_reset (pack);
+	}
+}
+
+/**
+ * gs_icon_pack_find_index:
+ **/
+static gboolean
+gs_icon_pack_find_index (GsIconPack *pack, const gchar *key, guint32 scale,
+			 guint64 *offset, guint32 *length)
+{
+	gsize lo = 0;
+	gsize hi;
+
+	if (pack->index == NULL)
+		return FALSE;
+
+	/* binary search the mapped index */
+	hi = g_variant_n_children (pack->index);
+	while (lo < hi) {
+		const gchar *tmp;
+		gint rc;
+		gsize mid = lo + (hi - lo) / 2;
+		guint32 scale_tmp;
+		g_autoptr(GVariant) child = NULL;
+
+		child = g_variant_get_child_value (pack->index, mid);
+		g_variant_get (child, "(&sutu)", &tmp, &scale_tmp, offset, length);
+		rc = g_strcmp0 (key, tmp);
+		if (rc == 0)
+			rc = (gint) scale - (gint) scale_tmp;
+		if (rc == 0)
+			return TRUE;
+		if (rc < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return FALSE;
+}
+
+/**
+ * gs_icon_pack_find:
+ **/
+static gboolean
+gs_icon_pack_find (GsIconPack *pack, const gchar *key, guint32 scale,
+		   guint64 *offset, guint32 *length)
+{
+	GsIconPackEntry *entry;
+	g_autofree gchar *pending_key = NULL;
+
+	/* added since the last flush */
+	pending_key = gs_icon_pack_pending_key (key, scale);
+	entry = g_hash_table_lookup (pack->pending, pending_key);
+	if (entry != NULL) {
+		*offset = entry->offset;
+		*length = entry->length;
+		return TRUE;
+	}
+	return gs_icon_pack_find_index (pack, key, scale, offset, length);
+}
+
+/**
+ * gs_icon_pack_reload_index:
+ *
+ * Maps the index again, keeping the icons added since the last flush.
+ *
+ * Returns: %FALSE if the index is missing or belongs to a different pack
+ **/
+static gboolean
+gs_icon_pack_reload_index (GsIconPack *pack)
+{
+	GHashTableIter iter;
+	gboolean ret = TRUE;
+	gpointer value;
+	guint32 length;
+	guint64 offset;
+	guint64 pack_size = pack->pack_size;
+	guint64 serial = pack->serial;
+	g_autoptr(GError) error = NULL;
+
+	g_clear_pointer (&pack->index, g_variant_unref);
+	g_clear_pointer (&pack->index_map, g_mapped_file_unref);
+	if (!gs_icon_pack_load_index (pack, &error) || pack->serial != serial) {
+		g_clear_pointer (&pack->index, g_variant_unref);
+		g_clear_pointer (&pack->index_map, g_mapped_file_unref);
+		pack->serial = serial;
+		pack->live_size = 0;
+		ret = FALSE;
+	}
+	pack->pack_size = MAX (pack_size, pack->pack_size);
+
+	/* a pending icon replaces any entry in the index */
+	g_hash_table_iter_init (&iter, pack->pending);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		GsIconPackEntry *entry = value;
+		if (gs_icon_pack_find_index (pack, entry->key, entry->scale,
+					     &offset, &length))
+			pack->live_size -= MIN (pack->live_size, length);
+		pack->live_size += entry->length;
+	}
+	return ret;
+}
+
+/**
+ * gs_icon_pack_check_index:
+ *
+ * Picks up an index written by another process since it was mapped,
+ * which does not need the lock as the index is replaced atomically.
+ **/
+static void
+gs_icon_pack_check_index (GsIconPack *pack)
+{
+	GStatBuf st;
+
+	if (g_stat (pack->index_fn, &st) != 0) {
+		if (pack->index == NULL)
+			return;
+	} else if ((guint64) st.st_size == pack->index_size &&
+		   (gint64) st.st_mtime == pack->index_mtime) {
+		return;
+	}
+
+	/* compacted, so the pack has to be mapped again too */
+	if (!gs_icon_pack_reload_index (pack)) {
+		gs_icon_pack_unload (pack);
+		pack->loaded = FALSE;
+		gs_icon_pack_ensure_loaded (pack);
+	}
+}
+
+/**
+ * gs_icon_pack_refresh:
+ *
+ * Picks up the changes other processes made to the pack, and must be
+ * called with the lock held.
+ **/
+static void
+gs_icon_pack_refresh (GsIconPack *pack)
+{
+	GStatBuf st;
+	gchar header[GS_ICON_PACK_HEADER_SIZE];
+	gint fd;
+	gssize len;
+
+	gs_icon_pack_ensure_loaded (pack);
+	fd = g_open (pack->filename, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		if (pack->pack_size > 0)
+			gs_icon_pack_reset (pack);
+		return;
+	}
+	len = read (fd, header, sizeof (header));
+	if (fstat (fd, &st) != 0)
+		len = -1;
+	close (fd);
+
+	/* compacted or replaced */
+	if (len < 0 ||
+	    !gs_icon_pack_check_header (pack, header, (gsize) len, NULL)) {
+		gs_icon_pack_unload (pack);
+		pack->loaded = FALSE;
+		gs_icon_pack_ensure_loaded (pack);
+		return;
+	}
+
+	/* nothing was appended */
+	if ((guint64) st.st_size == pack->pack_size)
+		return;
+
+	/* reload the index, which is only valid if it matches this pack */
+	gs_icon_pack_reload_index (pack);
+	pack->pack_size = (guint64) st.st_size;
+}
+
+/**
+ * gs_icon_pack_lock:
+ *
+ * Takes the lock shared with other processes using the pack, waiting for
+ * it if required, and then refreshes the pack.
+ **/
+static gboolean
+gs_icon_pack_lock (GsIconPack *pack, GError **error)
+{
+	struct flock lock = { 0 };
+
+	if (pack->lock_fd < 0) {
+		g_autofree gchar *lock_fn = g_strdup_printf ("%s.lock", pack->filename);
+		if (!gs_mkdir_parent (lock_fn, error))
+			return FALSE;
+		pack->lock_fd = g_open (lock_fn, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (pack->lock_fd < 0) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     g_io_error_from_errno (errno),
+				     "failed to open %s: %s",
+				     lock_fn, g_strerror (errno));
+			return FALSE;
+		}
+	}
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	while (fcntl (pack->lock_fd, F_SETLKW, &lock) != 0) {
+		if (errno == EINTR)
+			continue;
+		g_set_error (error,
+			     G_IO_ERROR,
+			     g_io_error_from_errno (errno),
+			     "failed to lock %s: %s",
+			     pack->filename, g_strerror (errno));
+		return FALSE;
+	}
+	gs_icon_pack_refresh (pack);
+	return TRUE;
+}
+
+/**
+ * gs_icon_pack_unlock:
+ **/
+static void
+gs_icon_pack_unlock (GsIconPack *pack)
+{
+	struct flock lock = { 0 };
+
+	lock.l_type = F_UNLCK;
+	lock.l_whence = SEEK_SET;
+	fcntl (pack->lock_fd, F_SETLK, &lock);
+}
+
+/**
+ * gs_icon_pack_ensure_output:
+ **/
+static gboolean
+gs_icon_pack_ensure_output (GsIconPack *pack, GError **error)
+{
+	guint64 serial;
+	g_autoptr(GFile) file = NULL;
+
+	if (pack->out != NULL)
+		return TRUE;
+
+	file = g_file_new_for_path (pack->filename);
+	if (pack->pack_size > 0) {
+		pack->out = G_OUTPUT_STREAM (g_file_append_to (file,
+							       G_FILE_CREATE_NONE,
+							       NULL, error));
+		return pack->out != NULL;
+	}
+
+	/* new pack, written in place so the blobs can be mapped before the
+	 * stream is closed */
+	if (!gs_mkdir_parent (pack->filename, error))
+		return FALSE;
+	g_unlink (pack->index_fn);
+	g_unlink (pack->filename);
+	pack->out = G_OUTPUT_STREAM (g_file_create (file,
+						    G_FILE_CREATE_NONE,
+						    NULL, error));
+	if (pack->out == NULL)
+		return FALSE;
+	serial = GUINT64_TO_LE (pack->serial);
+	if (!g_output_stream_write_all (pack->out, GS_ICON_PACK_MAGIC, 8,
+					NULL, NULL, error))
+		return FALSE;
+	if (!g_output_stream_write_all (pack->out, &serial, sizeof (serial),
+					NULL, NULL, error))
+		return FALSE;
+	pack->pack_size = GS_ICON_PACK_HEADER_SIZE;
+	return TRUE;
+}
+
+/**
+ * gs_icon_pack_get_blob:
+ **/
+static GBytes *
+gs_icon_pack_get_blob (GsIconPack *pack, guint64 offset, guint32 length)
+{
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* blobs appended since the pack was mapped */
+	if (pack->pack_map == NULL ||
+	    offset + length > g_mapped_file_get_length (pack->pack_map)) {
+		if (pack->out != NULL)
+			g_output_stream_flush (pack->out, NULL, NULL);
+		g_clear_pointer (&pack->pack_map, g_mapped_file_unref);
+		pack->pack_map = g_mapped_file_new (pack->filename, FALSE, &error);
+		if (pack->pack_map == NULL) {
+			g_warning ("failed to map %s: %s",
+				   pack->filename, error->message);
+			return NULL;
+		}
+
+		/* compacted by another process */
+		if (!gs_icon_pack_check_header (pack,
+						g_mapped_file_get_contents (pack->pack_map),
+						g_mapped_file_get_length (pack->pack_map),
+						&error)) {
+			g_debug ("not using %s: %s", pack->filename, error->message);
+			g_clear_pointer (&pack->pack_map, g_mapped_file_unref);
+			return NULL;
+		}
+		if (offset + length > g_mapped_file_get_length (pack->pack_map))
+			return NULL;
+	}
+	bytes = g_mapped_file_get_bytes (pack->pack_map);
+	return g_bytes_new_from_bytes (bytes, offset, length);
+}
+
+/**
+ * gs_icon_pack_get_entries:
+ *
+ * Returns all the live entries, both flushed and pending, sorted by key.
+ **/
+static GPtrArray *
+gs_icon_pack_get_entries (GsIconPack *pack)
+{
+	GHashTableIter iter;
+	GPtrArray *entries;
+	gpointer value;
+	gsize i;
+
+	entries = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_icon_pack_entry_free);
+	for (i = 0; pack->index != NULL && i < g_variant_n_children (pack->index); i++) {
+		const gchar *key;
+		guint32 scale;
+		guint64 offset;
+		guint32 length;
+		g_autofree gchar *pending_key = NULL;
+		g_autoptr(GVariant) child = NULL;
+
+		child = g_variant_get_child_value (pack->index, i);
+		g_variant_get (child, "(&sutu)", &key, &scale, &offset, &length);
+		pending_key = gs_icon_pack_pending_key (key, scale);
+		if (g_hash_table_contains (pack->pending, pending_key))
+			continue;
+		g_ptr_array_add (entries, gs_icon_pack_entry_new (key, scale, offset, length));
+	}
+	g_hash_table_iter_init (&iter, pack->pending);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		GsIconPackEntry *entry = value;
+		g_ptr_array_add (entries, gs_icon_pack_entry_new (entry->key,
+								  entry->scale,
+								  entry->offset,
+								  entry->length));
+	}
+	g_ptr_array_sort (entries, gs_icon_pack_entry_compare_cb);
+	return entries;
+}
+
+/**
+ * gs_icon_pack_write_index:
+ **/
+static gboolean
+gs_icon_pack_write_index (GsIconPack *pack, GPtrArray *entries, GError **error)
+{
+	GVariantBuilder builder;
+	guint i;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GVariant) data = NULL;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sutu)"));
+	for (i = 0; i < entries->len; i++) {
+		GsIconPackEntry *entry = g_ptr_array_index (entries, i);
+		g_variant_builder_add (&builder, "(sutu)",
+				       entry->key, entry->scale,
+				       entry->offset, entry->length);
+	}
+	data = g_variant_new (GS_ICON_PACK_FORMAT,
+			      (guint32) GS_ICON_PACK_VERSION,
+			      pack->serial,
+			      pack->pack_size,
+			      pack->live_size,
+			      &builder);
+	g_variant_ref_sink (data);
+	if (!g_file_set_contents (pack->index_fn,
+				  g_variant_get_data (data),
+				  (gssize) g_variant_get_size (data),
+				  error))
+		return FALSE;
+
+	/* map the new index */
+	g_clear_pointer (&pack->index, g_variant_unref);
+	g_clear_pointer (&pack->index_map, g_mapped_file_unref);
+	g_hash_table_remove_all (pack->pending);
+	if (!gs_icon_pack_load_index (pack, &error_local)) {
+		g_warning ("failed to reload icon index: %s",
+			   error_local->message);
+		gs_icon_pack_reset (pack);
+	}
+	return TRUE;
+}
+
+/**
+ * gs_icon_pack_compact:
+ *
+ * Rewrites the pack with only the live blobs, dropping the oldest icons
+ * until it fits in three quarters of the size cap. The newest icon is
+ * always kept.
+ **/
+static gboolean
+gs_icon_pack_compact (GsIconPack *pack, GError **error)
+{
+	GsIconPackEntry *entry;
+	gboolean ret = FALSE;
+	guint64 budget = pack->max_size / 4 * 3;
+	guint64 offset;
+	guint64 serial;
+	guint64 serial_le;
+	guint64 total = 0;
+	guint i;
+	g_autoptr(GCancellable) cancellable = NULL;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GHashTable) keep = NULL;
+	g_autoptr(GOutputStream) out = NULL;
+	g_autoptr(GPtrArray) entries = NULL;
+	g_autoptr(GPtrArray) kept = NULL;
+
+	/* pick the newest icons that fit, keeping every scale of a key */
+	entries = gs_icon_pack_get_entries (pack);
+	g_ptr_array_sort (entries, gs_icon_pack_entry_age_cb);
+	keep = g_hash_table_new (g_str_hash, g_str_equal);
+	kept = g_ptr_array_new ();
+	for (i = 0; i < entries->len; i++) {
+		gpointer decision;
+		entry = g_ptr_array_index (entries, i);
+		if (!g_hash_table_lookup_extended (keep, entry->key, NULL, &decision)) {
+			decision = GINT_TO_POINTER (kept->len == 0 ||
+						    total + entry->length <= budget);
+			g_hash_table_insert (keep, entry->key, decision);
+		}
+		if (!GPOINTER_TO_INT (decision))
+			continue;
+		total += entry->length;
+		g_ptr_array_add (kept, entry);
+	}
+
+	/* write the survivors oldest first, so age order is preserved; the
+	 * replaced file is only renamed over the pack if the stream is closed
+	 * without the cancellable being cancelled */
+	serial = ((guint64) g_random_int () << 32) | g_random_int ();
+	file = g_file_new_for_path (pack->filename);
+	cancellable = g_cancellable_new ();
+	out = G_OUTPUT_STREAM (g_file_replace (file, NULL, FALSE,
+					       G_FILE_CREATE_NONE,
+					       cancellable, error));
+	if (out == NULL)
+		goto out;
+	serial_le = GUINT64_TO_LE (serial);
+	if (!g_output_stream_write_all (out, GS_ICON_PACK_MAGIC, 8,
+					NULL, NULL, error))
+		goto out;
+	if (!g_output_stream_write_all (out, &serial_le, sizeof (serial_le),
+					NULL, NULL, error))
+		goto out;
+	offset = GS_ICON_PACK_HEADER_SIZE;
+	for (i = kept->len; i > 0; i--) {
+		g_autoptr(GBytes) blob = NULL;
+		entry = g_ptr_array_index (kept, i - 1);
+		blob = gs_icon_pack_get_blob (pack, entry->offset, entry->length);
+		if (blob == NULL) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "icon %s is missing from the pack",
+				     entry->key);
+			goto out;
+		}
+		if (!g_output_stream_write_all (out,
+						g_bytes_get_data (blob, NULL),
+						entry->length,
+						NULL, NULL, error))
+			goto out;
+		entry->offset = offset;
+		offset += entry->length;
+	}
+
+	/* the old pack is replaced when the stream is closed */
+	gs_icon_pack_unload (pack);
+	if (!g_output_stream_close (out, NULL, error)) {
+		gs_icon_pack_reset (pack);
+		goto out;
+	}
+	pack->serial = serial;
+	pack->pack_size = offset;
+	pack->live_size = total;
+	g_debug ("compacted icon pack to %" G_GUINT64_FORMAT " bytes", offset);
+
+	/* write an index matching the new pack */
+	g_ptr_array_sort (kept, gs_icon_pack_entry_compare_cb);
+	if (!gs_icon_pack_write_index (pack, kept, error)) {
+		gs_icon_pack_reset (pack);
+		goto out;
+	}
+	ret = TRUE;
+out:
+	/* do not leave a partial pack in place of the old one */
+	if (!ret && out != NULL && !g_output_stream_is_closed (out)) {
+		g_cancellable_cancel (cancellable);
+		g_output_stream_close (out, cancellable, NULL);
+	}
+	return ret;
+}
+
+/**
+ * gs_icon_pack_save:
+ **/
+static gboolean
+gs_icon_pack_save (GsIconPack *pack, GError **error)
+{
+	guint64 dead;
+	g_autoptr(GPtrArray) entries = NULL;
+
+	/* too big, or mostly replaced blobs */
+	dead = pack->pack_size - MIN (pack->pack_size,
+				      GS_ICON_PACK_HEADER_SIZE + pack->live_size);
+	if (pack->pack_size > pack->max_size ||
+	    (dead > pack->live_size && dead > GS_ICON_PACK_DEAD_THRESHOLD))
+		return gs_icon_pack_compact (pack, error);
+
+	/* nothing to do */
+	if (g_hash_table_size (pack->pending) == 0)
+		return TRUE;
+
+	/* the blobs have to be on disk before the index points at them */
+	if (pack->out != NULL &&
+	    !g_output_stream_flush (pack->out, NULL, error))
+		return FALSE;
+	entries = gs_icon_pack_get_entries (pack);
+	return gs_icon_pack_write_index (pack, entries, error);
+}
+
+/**
+ * gs_icon_pack_lookup:
+ * @pack: A #GsIconPack
+ * @key: The icon key, typically the remote URL
+ * @scale: The window scale factor
+ *
+ * Loads an icon from the pack, already sized for @scale.
+ *
+ * Returns: (transfer full): a #GdkPixbuf, or %NULL if the icon is not known
+ **/
+GdkPixbuf *
+gs_icon_pack_lookup (GsIconPack *pack, const gchar *key, gint scale)
+{
+	guint32 length;
+	guint64 offset;
+	GdkPixbuf *pixbuf;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+
+	g_return_val_if_fail (GS_IS_ICON_PACK (pack), NULL);
+	g_return_val_if_fail (key != NULL, NULL);
+
+	g_mutex_lock (&pack->mutex);
+	gs_icon_pack_ensure_loaded (pack);
+	gs_icon_pack_check_index (pack);
+	if (gs_icon_pack_find (pack, key, scale > 1 ? 2 : 1, &offset, &length))
+		blob = gs_icon_pack_get_blob (pack, offset, length);
+	g_mutex_unlock (&pack->mutex);
+	if (blob == NULL)
+		return NULL;
+
+	/* decode outside the lock, the blob keeps the mapping alive */
+	stream = g_memory_input_stream_new_from_bytes (blob);
+	pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, &error);
+	if (pixbuf == NULL) {
+		g_warning ("failed to decode packed icon %s: %s",
+			   key, error->message);
+		return NULL;
+	}
+	return pixbuf;
+}
+
+/**
+ * gs_icon_pack_contains:
+ * @pack: A #GsIconPack
+ * @key: The icon key, typically the remote URL
+ * @scale: The window scale factor
+ *
+ * Checks the index for an icon without decoding it.
+ *
+ * Returns: %TRUE if gs_icon_pack_lookup() would find the icon
+ **/
+gboolean
+gs_icon_pack_contains (GsIconPack *pack, const gchar *key, gint scale)
+{
+	gboolean ret;
+	guint32 length;
+	guint64 offset;
+
+	g_return_val_if_fail (GS_IS_ICON_PACK (pack), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	g_mutex_lock (&pack->mutex);
+	gs_icon_pack_ensure_loaded (pack);
+	gs_icon_pack_check_index (pack);
+	ret = gs_icon_pack_find (pack, key, scale > 1 ? 2 : 1, &offset, &length);
+	g_mutex_unlock (&pack->mutex);
+	return ret;
+}
+
+/**
+ * gs_icon_pack_add:
+ * @pack: A #GsIconPack
+ * @key: The icon key, typically the remote URL
+ * @pixbuf: A #GdkPixbuf of any size
+ * @error: A #GError, or %NULL
+ *
+ * Appends an icon to the pack, scaled for a window scale of 1 and 2. Any
+ * existing icon with the same key is replaced. The icon can be looked up
+ * straight away, but is only saved in the index by gs_icon_pack_flush().
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_icon_pack_add (GsIconPack *pack,
+		  const gchar *key,
+		  GdkPixbuf *pixbuf,
+		  GError **error)
+{
+	gboolean ret = FALSE;
+	gsize len[2];
+	guint32 length;
+	guint64 offset;
+	guint i;
+	gchar *data[2] = { NULL, NULL };
+
+	g_return_val_if_fail (GS_IS_ICON_PACK (pack), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), FALSE);
+
+	/* encode outside the lock */
+	for (i = 0; i < 2; i++) {
+		gint size = GS_ICON_PACK_ICON_SIZE * (gint) (i + 1);
+		g_autoptr(GdkPixbuf) pixbuf_scaled = NULL;
+		if (gdk_pixbuf_get_width (pixbuf) == size &&
+		    gdk_pixbuf_get_height (pixbuf) == size) {
+			pixbuf_scaled = g_object_ref (pixbuf);
+		} else {
+			pixbuf_scaled = gdk_pixbuf_scale_simple (pixbuf, size, size,
+								 GDK_INTERP_BILINEAR);
+		}
+		if (!gdk_pixbuf_save_to_buffer (pixbuf_scaled, &data[i], &len[i],
+						"png", error, NULL))
+			goto out_free;
+	}
+
+	g_mutex_lock (&pack->mutex);
+	if (!gs_icon_pack_lock (pack, error))
+		goto out;
+	if (!gs_icon_pack_ensure_output (pack, error))
+		goto out_unlock;
+	for (i = 0; i < 2; i++) {
+		if (!g_output_stream_write_all (pack->out, data[i], len[i],
+						NULL, NULL, error)) {
+			/* the pack offsets are now unknown */
+			gs_icon_pack_reset (pack);
+			goto out_unlock;
+		}
+		if (gs_icon_pack_find (pack, key, i + 1, &offset, &length))
+			pack->live_size -= MIN (pack->live_size, length);
+		g_hash_table_insert (pack->pending,
+				     gs_icon_pack_pending_key (key, i + 1),
+				     gs_icon_pack_entry_new (key, i + 1,
+							     pack->pack_size,
+							     (guint32) len[i]));
+		pack->pack_size += len[i];
+		pack->live_size += len[i];
+	}
+
+	/* over the cap */
+	if (pack->pack_size > pack->max_size &&
+	    !gs_icon_pack_save (pack, error))
+		goto out_unlock;
+	ret = TRUE;
+out_unlock:
+	gs_icon_pack_unlock (pack);
+out:
+	g_mutex_unlock (&pack->mutex);
+out_free:
+	g_free (data[0]);
+	g_free (data[1]);
+	return ret;
+}
+
+/**
+ * gs_icon_pack_flush:
+ * @pack: A #GsIconPack
+ * @error: A #GError, or %NULL
+ *
+ * Writes the index for any icons added since the last flush, compacting
+ * the pack if required.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_icon_pack_flush (GsIconPack *pack, GError **error)
+{
+	gboolean ret;
+
+	g_return_val_if_fail (GS_IS_ICON_PACK (pack), FALSE);
+
+	g_mutex_lock (&pack->mutex);
+	ret = gs_icon_pack_lock (pack, error);
+	if (ret) {
+		ret = gs_icon_pack_save (pack, error);
+		gs_icon_pack_unlock (pack);
+	}
+	g_mutex_unlock (&pack->mutex);
+	return ret;
+}
+
+/**
+ * gs_icon_pack_get_size:
+ * @pack: A #GsIconPack
+ *
+ * Returns: the size of the pack file in bytes
+ **/
+guint64
+gs_icon_pack_get_size (GsIconPack *pack)
+{
+	guint64 size;
+
+	g_return_val_if_fail (GS_IS_ICON_PACK (pack), 0);
+
+	g_mutex_lock (&pack->mutex);
+	gs_icon_pack_ensure_loaded (pack);
+	size = pack->pack_size;
+	g_mutex_unlock (&pack->mutex);
+	return size;
+}
+
+/**
+ * gs_icon_pack_finalize:
+ **/
+static void
+gs_icon_pack_finalize (GObject *object)
+{
+	GsIconPack *pack = GS_ICON_PACK (object);
+
+	gs_icon_pack_unload (pack);
+	if (pack->lock_fd >= 0)
+		close (pack->lock_fd);
+	g_hash_table_unref (pack->pending);
+	g_mutex_clear (&pack->mutex);
+	g_free (pack->filename);
+	g_free (pack->index_fn);
+
+	G_OBJECT_CLASS (gs_icon_pack_parent_class)->finalize (object);
+}
+
+/**
+ * gs_icon_pack_class_init:
+ **/
+static void
+gs_icon_pack_class_init (GsIconPackClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = gs_icon_pack_finalize;
+}
+
+/**
+ * gs_icon_pack_init:
+ **/
+static void
+gs_icon_pack_init (GsIconPack *pack)
+{
+	g_mutex_init (&pack->mutex);
+	pack->lock_fd = -1;
+	pack->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free,
+					       (GDestroyNotify) gs_icon_pack_entry_free);
+}
+
+/**
+ * gs_icon_pack_new:
+ * @filename: The pack filename; the index is saved alongside
+ * @max_size: The size in bytes the pack is compacted at
+ *
+ * Returns: a new #GsIconPack
+ **/
+GsIconPack *
+gs_icon_pack_new (const gchar *filename, guint64 max_size)
+{
+	GsIconPack *pack;
+	pack = g_object_new (GS_TYPE_ICON_PACK, NULL);
+	pack->filename = g_strdup (filename);
+	pack->index_fn = g_strdup_printf ("%s.idx", filename);
+	pack->max_size = max_size;
+	return pack;
+}
+
+/**
+ * gs_icon_pack_get_default:
+ *
+ * Gets the icon pack shared by all plugins, which lives for the
+ * lifetime of the process.
+ *
+ * Returns: (transfer none): a #GsIconPack
+ **/
+GsIconPack *
+gs_icon_pack_get_default (void)
+{
+	static gsize initialized = 0;
+	static GsIconPack *pack = NULL;
+
+	if (g_once_init_enter (&initialized)) {
+		g_autofree gchar *fn = NULL;
+		fn = g_build_filename (g_get_user_data_dir (),
+				       "gnome-software",
+				       "icons.pack",
+				       NULL);
+		pack = gs_icon_pack_new (fn, GS_ICON_PACK_MAX_SIZE);
+		g_once_init_leave (&initialized, 1);
+	}
+	return pack;
+}
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GS_ICON_PACK_H
+#define __GS_ICON_PACK_H
+
+#include <glib-object.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+#define GS_TYPE_ICON_PACK (gs_icon_pack_get_type ())
+
+G_DECLARE_FINAL_TYPE (GsIconPack, gs_icon_pack, GS, ICON_PACK, GObject)
+
+GsIconPack	*gs_icon_pack_new			(const gchar		*filename,
+							 guint64		 max_size);
+GsIconPack	*gs_icon_pack_get_default		(void);
+
+GdkPixbuf	*gs_icon_pack_lookup			(GsIconPack		*pack,
+							 const gchar		*key,
+							 gint			 scale);
+gboolean	 gs_icon_pack_contains			(GsIconPack		*pack,
+							 const gchar		*key,
+							 gint			 scale);
+gboolean	 gs_icon_pack_add			(GsIconPack		*pack,
+							 const gchar		*key,
+							 GdkPixbuf		*pixbuf,
+							 GError			**error);
+gboolean	 gs_icon_pack_flush			(GsIconPack		*pack,
+							 GError			**error);
+guint64		 gs_icon_pack_get_size			(GsIconPack		*pack);
+
+G_END_DECLS
+
+#endif /* __GS_ICON_PACK_H */
+
+/* vim: set noexpandtab: */
@@ -29,9 +29,14 @@
 
 #define GS_PLUGIN_LOADER_UPDATES_CHANGED_DELAY	3	/* s */
 
+/* flags that change what is returned, rather than add data to the app */
+#define GS_PLUGIN_LOADER_REFINE_FLAGS_MODIFIERS	(GS_PLUGIN_REFINE_FLAGS_USE_HISTORY | \
+						 GS_PLUGIN_REFINE_FLAGS_ALLOW_PACKAGES)
+
 typedef struct
 {
 	GPtrArray		*plugins;
+	GPtrArray		*plugins_vfunc[GS_PLUGIN_VFUNC_LAST];
 	gchar			*location;
 	GsPluginStatus		 status_last;
 	AsProfile		*profile;
@@ -41,13 +46,19 @@ typedef struct
 
 	GMutex			 app_cache_mutex;
 	GHashTable		*app_cache;
+	gint			 app_cache_generation;
+
+	GMutex			 refine_plans_mutex;
+	GHashTable		*refine_plans;
 	GSettings		*settings;
 
 	gchar			**compatible_projects;
 	gint			 scale;
 
 	guint			 updates_changed_id;
+	guint			 setup_progress;
 	gboolean		 online; 
+	gboolean		 parallel;
 } GsPluginLoaderPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GsPluginLoader, gs_plugin_loader, G_TYPE_OBJECT)
@@ -56,6 +67,7 @@ enum {
 	SIGNAL_STATUS_CHANGED,
 	SIGNAL_PENDING_APPS_CHANGED,
 	SIGNAL_UPDATES_CHANGED,
+	SIGNAL_SETUP_PROGRESS,
 	SIGNAL_LAST
 };
 
@@ -63,7 +75,7 @@ static guint signals [SIGNAL_LAST] = { 0 };
 
 /* async state */
 typedef struct {
-	const gchar			*function_name;
+	GsPluginVfunc			 vfunc;
 	GList				*list;
 	GsPluginRefineFlags		 flags;
 	gchar				*value;
@@ -186,19 +198,11 @@ gs_plugin_loader_run_refine_plugin (GsPluginLoader *plugin_loader,
 				    GError **error)
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
-	GsPluginRefineFunc plugin_func = NULL;
+	GsPluginRefineFunc plugin_func = plugin->vfuncs[GS_PLUGIN_VFUNC_REFINE];
 	g_autoptr(AsProfileTask) ptask = NULL;
-	const gchar *function_name = "gs_plugin_refine";
-	gboolean exists;
+	const gchar *function_name = gs_plugin_vfunc_to_string (GS_PLUGIN_VFUNC_REFINE);
 	gboolean ret = TRUE;
 
-	/* load the symbol */
-	exists = g_module_symbol (plugin->module,
-				  function_name,
-				  (gpointer *) &plugin_func);
-	if (!exists)
-		goto out;
-
 	/* profile the plugin runtime */
 	if (function_name_parent == NULL) {
 		ptask = as_profile_start (priv->profile,
@@ -239,6 +243,165 @@ out:
 	return ret;
 }
 
+/* the refine plugins that need to run for a set of flags */
+typedef struct {
+	GPtrArray		*plugins;
+} GsPluginLoaderRefinePlan;
+
+/**
+ * gs_plugin_loader_refine_plan_free:
+ **/
+static void
+gs_plugin_loader_refine_plan_free (GsPluginLoaderRefinePlan *plan)
+{
+	g_ptr_array_unref (plan->plugins);
+	g_slice_free (GsPluginLoaderRefinePlan, plan);
+}
+
+/**
+ * gs_plugin_loader_refine_plugin_is_wanted:
+ **/
+static gboolean
+gs_plugin_loader_refine_plugin_is_wanted (GsPlugin *plugin, guint64 flags)
+{
+	if (!plugin->enabled)
+		return FALSE;
+	if (plugin->refine_flags == 0)
+		return TRUE;
+	return (plugin->refine_flags & flags) > 0;
+}
+
+/**
+ * gs_plugin_loader_refine_plan_add:
+ *
+ * Adds @plugin to the plan after the wanted plugins that provide the
+ * data it reads.
+ **/
+static void
+gs_plugin_loader_refine_plan_add (GsPluginLoaderRefinePlan *plan,
+				  GPtrArray *wanted,
+				  GHashTable *added,
+				  GsPlugin *plugin)
+{
+	GsPlugin *dep;
+	guint i;
+
+	if (!g_hash_table_add (added, plugin))
+		return;
+	for (i = 0; i < wanted->len; i++) {
+		dep = g_ptr_array_index (wanted, i);
+		if (dep == plugin)
+			continue;
+		if ((dep->refine_flags & plugin->refine_flags_requires) == 0)
+			continue;
+		gs_plugin_loader_refine_plan_add (plan, wanted, added, dep);
+	}
+	g_ptr_array_add (plan->plugins, plugin);
+}
+
+/**
+ * gs_plugin_loader_get_refine_flags_plan:
+ *
+ * Adds the flags needed by the plugins that run for @flags, apart from
+ * the ones every application in the list has already been refined with.
+ *
+ * Returns: the flags to build the plan for
+ **/
+static guint64
+gs_plugin_loader_get_refine_flags_plan (GsPluginLoader *plugin_loader,
+					guint64 flags,
+					guint64 refined)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_REFINE];
+	GsPlugin *plugin;
+	gboolean changes;
+	guint64 tmp;
+	guint i;
+
+	do {
+		changes = FALSE;
+		for (i = 0; i < plugins->len; i++) {
+			plugin = g_ptr_array_index (plugins, i);
+			if (!gs_plugin_loader_refine_plugin_is_wanted (plugin, flags))
+				continue;
+			tmp = plugin->refine_flags_requires & ~refined & ~flags;
+			if (tmp == 0)
+				continue;
+			flags |= tmp;
+			changes = TRUE;
+		}
+	} while (changes);
+	return flags;
+}
+
+/**
+ * gs_plugin_loader_get_refine_plan:
+ *
+ * Gets the refine plugins that can provide any of @flags. Each plugin
+ * runs after the plugins providing its refine_flags_requires, and is
+ * otherwise kept in priority order. The plan is cached for next time.
+ *
+ * Returns: (transfer container): the plugins to run
+ **/
+static GPtrArray *
+gs_plugin_loader_get_refine_plan (GsPluginLoader *plugin_loader,
+				  guint64 flags)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_REFINE];
+	GsPlugin *plugin;
+	GsPluginLoaderRefinePlan *plan;
+	guint i;
+	g_autoptr(GHashTable) added = NULL;
+	g_autoptr(GPtrArray) wanted = NULL;
+
+	g_mutex_lock (&priv->refine_plans_mutex);
+	plan = g_hash_table_lookup (priv->refine_plans, &flags);
+	if (plan != NULL)
+		goto out;
+
+	/* the plugins are already sorted by deps */
+	wanted = g_ptr_array_new ();
+	for (i = 0; i < plugins->len; i++) {
+		plugin = g_ptr_array_index (plugins, i);
+		if (!gs_plugin_loader_refine_plugin_is_wanted (plugin, flags))
+			continue;
+		g_ptr_array_add (wanted, plugin);
+	}
+
+	/* move the plugins providing data before the ones reading it */
+	plan = g_slice_new0 (GsPluginLoaderRefinePlan);
+	plan->plugins = g_ptr_array_new ();
+	added = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (i = 0; i < wanted->len; i++) {
+		plugin = g_ptr_array_index (wanted, i);
+		gs_plugin_loader_refine_plan_add (plan, wanted, added, plugin);
+	}
+	for (i = 0; i < plan->plugins->len; i++) {
+		plugin = g_ptr_array_index (plan->plugins, i);
+		g_debug ("refine plan for 0x%" G_GINT64_MODIFIER "x includes %s",
+			 flags, plugin->name);
+	}
+	g_hash_table_insert (priv->refine_plans, g_memdup (&flags, sizeof (flags)), plan);
+out:
+	plugins = g_ptr_array_ref (plan->plugins);
+	g_mutex_unlock (&priv->refine_plans_mutex);
+	return plugins;
+}
+
+/**
+ * gs_plugin_loader_invalidate_refine_plans:
+ **/
+static void
+gs_plugin_loader_invalidate_refine_plans (GsPluginLoader *plugin_loader)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	g_mutex_lock (&priv->refine_plans_mutex);
+	g_hash_table_remove_all (priv->refine_plans);
+	g_mutex_unlock (&priv->refine_plans_mutex);
+}
+
 /**
  * gs_plugin_loader_run_refine:
  **/
@@ -257,25 +420,59 @@ gs_plugin_loader_run_refine (GsPluginLoader *plugin_loader,
 	GsApp *app;
 	GsPlugin *plugin;
 	gboolean ret = TRUE;
+	guint64 flags_plan;
+	guint64 refined_all = G_MAXUINT64;
+	guint64 refined_missing = 0;
+	guint64 refined_wanted;
+	guint generation;
 	guint i;
+	guint serial;
+	g_autoptr(GHashTable) serials = NULL;
+	g_autoptr(GPtrArray) plugins = NULL;
 	g_autoptr(GsAppList) addons_list = NULL;
-	g_autoptr(GsAppList) freeze_list = NULL;
+	g_autoptr(GsAppList) refine_list = NULL;
 	g_autoptr(GsAppList) related_list = NULL;
 
+	/* only refine the apps that are missing some of the data, and
+	 * remember if the flags of each were cleared while refining */
+	generation = (guint) g_atomic_int_get (&priv->app_cache_generation);
+	refined_wanted = (flags & ~GS_PLUGIN_LOADER_REFINE_FLAGS_MODIFIERS) |
+			 GS_PLUGIN_REFINED_DEFAULT;
+	serials = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (l = *list; l != NULL; l = l->next) {
+		guint64 tmp;
+		app = GS_APP (l->data);
+		tmp = gs_app_get_refined_flags (app, generation, &serial);
+		if ((refined_wanted & ~tmp) == 0)
+			continue;
+		refined_missing |= refined_wanted & ~tmp;
+		refined_all &= tmp;
+		g_hash_table_insert (serials, app, GUINT_TO_POINTER (serial));
+		gs_plugin_add_app (&refine_list, app);
+	}
+	if (refine_list == NULL) {
+		gs_plugin_loader_list_dedupe (plugin_loader, *list);
+		return TRUE;
+	}
+	refine_list = g_list_reverse (refine_list);
+	flags_plan = gs_plugin_loader_get_refine_flags_plan (plugin_loader,
+							     refined_missing,
+							     refined_all);
+	flags = (flags_plan & ~GS_PLUGIN_REFINED_DEFAULT) |
+		(flags & GS_PLUGIN_LOADER_REFINE_FLAGS_MODIFIERS);
+
 	/* freeze all apps */
-	freeze_list = gs_plugin_list_copy (*list);
-	for (l = freeze_list; l != NULL; l = l->next)
+	for (l = refine_list; l != NULL; l = l->next)
 		g_object_freeze_notify (G_OBJECT (l->data));
 
-	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
-		plugin = g_ptr_array_index (priv->plugins, i);
-		if (!plugin->enabled)
-			continue;
+	/* run each plugin that has something to do */
+	plugins = gs_plugin_loader_get_refine_plan (plugin_loader, flags_plan);
+	for (i = 0; i < plugins->len; i++) {
+		plugin = g_ptr_array_index (plugins, i);
 		ret = gs_plugin_loader_run_refine_plugin (plugin_loader,
 							  plugin,
 							  function_name_parent,
-							  list,
+							  &refine_list,
 							  flags,
 							  cancellable,
 							  error);
@@ -286,7 +483,7 @@ gs_plugin_loader_run_refine (GsPluginLoader *plugin_loader,
 	/* refine addons one layer deep */
 	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS) > 0) {
 		flags &= ~GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS;
-		for (l = *list; l != NULL; l = l->next) {
+		for (l = refine_list; l != NULL; l = l->next) {
 			app = GS_APP (l->data);
 			addons = gs_app_get_addons (app);
 			for (i = 0; i < addons->len; i++) {
@@ -312,7 +509,7 @@ gs_plugin_loader_run_refine (GsPluginLoader *plugin_loader,
 	/* also do related packages one layer deep */
 	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_RELATED) > 0) {
 		flags &= ~GS_PLUGIN_REFINE_FLAGS_REQUIRE_RELATED;
-		for (l = *list; l != NULL; l = l->next) {
+		for (l = refine_list; l != NULL; l = l->next) {
 			app = GS_APP (l->data);
 			related = gs_app_get_related (app);
 			for (i = 0; i < related->len; i++) {
@@ -335,11 +532,28 @@ gs_plugin_loader_run_refine (GsPluginLoader *plugin_loader,
 		}
 	}
 
+	/* don't refine these again until the cache is invalidated, apart
+	 * from the data a plugin reported it failed to add */
+	for (l = refine_list; l != NULL; l = l->next) {
+		serial = GPOINTER_TO_UINT (g_hash_table_lookup (serials, l->data));
+		gs_app_add_refined_flags (GS_APP (l->data), refined_wanted,
+					  generation, serial);
+	}
+
 	/* dedupe applications we already know about */
 	gs_plugin_loader_list_dedupe (plugin_loader, *list);
 out:
+	/* record nothing, but drop the failures reported by this refine */
+	if (!ret) {
+		for (l = refine_list; l != NULL; l = l->next) {
+			serial = GPOINTER_TO_UINT (g_hash_table_lookup (serials, l->data));
+			gs_app_add_refined_flags (GS_APP (l->data), 0,
+						  generation, serial);
+		}
+	}
+
 	/* now emit all the changed signals */
-	for (l = freeze_list; l != NULL; l = l->next)
+	for (l = refine_list; l != NULL; l = l->next)
 		g_object_thaw_notify (G_OBJECT (l->data));
 
 	return ret;
@@ -351,30 +565,54 @@ out:
 static gboolean
 gs_plugin_loader_run_results_plugin (GsPluginLoader *plugin_loader,
 				     GsPlugin *plugin,
-				     const gchar *function_name,
+				     GsPluginVfunc vfunc,
 				     GList **list,
 				     GCancellable *cancellable,
 				     GError **error)
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
-	GsPluginResultsFunc plugin_func = NULL;
-	gboolean exists;
+	GsPluginResultsFunc plugin_func = plugin->vfuncs[vfunc];
 	gboolean ret = TRUE;
 	g_autoptr(AsProfileTask) ptask = NULL;
 
-	/* get symbol */
-	exists = g_module_symbol (plugin->module,
-				  function_name,
-				  (gpointer *) &plugin_func);
-	if (!exists)
+	/* run function */
+	ptask = as_profile_start (priv->profile,
+				  "GsPlugin::%s(%s)",
+				  plugin->name,
+				  gs_plugin_vfunc_to_string (vfunc));
+	g_assert (error == NULL || *error == NULL);
+	ret = plugin_func (plugin, list, cancellable, error);
+	if (!ret)
 		goto out;
+out:
+	gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+	return ret;
+}
+
+/**
+ * gs_plugin_loader_run_search_plugin:
+ **/
+static gboolean
+gs_plugin_loader_run_search_plugin (GsPluginLoader *plugin_loader,
+				    GsPlugin *plugin,
+				    GsPluginVfunc vfunc,
+				    gchar **values,
+				    GList **list,
+				    GCancellable *cancellable,
+				    GError **error)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GsPluginSearchFunc plugin_func = plugin->vfuncs[vfunc];
+	gboolean ret = TRUE;
+	g_autoptr(AsProfileTask) ptask = NULL;
 
 	/* run function */
 	ptask = as_profile_start (priv->profile,
 				  "GsPlugin::%s(%s)",
-				  plugin->name, function_name);
+				  plugin->name,
+				  gs_plugin_vfunc_to_string (vfunc));
 	g_assert (error == NULL || *error == NULL);
-	ret = plugin_func (plugin, list, cancellable, error);
+	ret = plugin_func (plugin, values, list, cancellable, error);
 	if (!ret)
 		goto out;
 out:
@@ -382,25 +620,185 @@ out:
 	return ret;
 }
 
+/* one plugin add_* call when running in parallel */
+typedef struct {
+	GsPluginLoader		*plugin_loader;
+	GsPlugin		*plugin;
+	GsPluginVfunc		 vfunc;
+	gchar			**values;
+	GList			*list;
+	GCancellable		*cancellable;
+	GError			*error;
+	gboolean		 ret;
+} GsPluginLoaderJob;
+
+/**
+ * gs_plugin_loader_job_free:
+ **/
+static void
+gs_plugin_loader_job_free (GsPluginLoaderJob *job)
+{
+	if (job->error != NULL)
+		g_error_free (job->error);
+	gs_plugin_list_free (job->list);
+	g_slice_free (GsPluginLoaderJob, job);
+}
+
+/**
+ * gs_plugin_loader_job_run:
+ **/
+static void
+gs_plugin_loader_job_run (GsPluginLoaderJob *job)
+{
+	/* don't start anything new if the request was cancelled */
+	if (g_cancellable_set_error_if_cancelled (job->cancellable, &job->error)) {
+		job->ret = FALSE;
+		return;
+	}
+	if (job->values != NULL) {
+		job->ret = gs_plugin_loader_run_search_plugin (job->plugin_loader,
+							       job->plugin,
+							       job->vfunc,
+							       job->values,
+							       &job->list,
+							       job->cancellable,
+							       &job->error);
+	} else {
+		job->ret = gs_plugin_loader_run_results_plugin (job->plugin_loader,
+								job->plugin,
+								job->vfunc,
+								&job->list,
+								job->cancellable,
+								&job->error);
+	}
+}
+
+/**
+ * gs_plugin_loader_job_thread_cb:
+ **/
+static void
+gs_plugin_loader_job_thread_cb (gpointer data, gpointer user_data)
+{
+	gs_plugin_loader_job_run ((GsPluginLoaderJob *) data);
+}
+
+/**
+ * gs_plugin_loader_run_add:
+ *
+ * Runs the add_* @vfunc on every enabled plugin, using
+ * @values as the search terms if set. When running in parallel each plugin
+ * gets its own list and a worker thread, and the lists are then joined in
+ * plugin priority order so the result is the same as running serially.
+ **/
+static gboolean
+gs_plugin_loader_run_add (GsPluginLoader *plugin_loader,
+			  GsPluginVfunc vfunc,
+			  gchar **values,
+			  GList **list,
+			  GCancellable *cancellable,
+			  GError **error)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GPtrArray *plugins = priv->plugins_vfunc[vfunc];
+	GThreadPool *pool;
+	GsPlugin *plugin;
+	GsPluginLoaderJob *job;
+	gboolean ret;
+	guint i;
+	g_autoptr(GPtrArray) jobs = NULL;
+
+	/* run each plugin in turn */
+	if (!priv->parallel) {
+		for (i = 0; i < plugins->len; i++) {
+			plugin = g_ptr_array_index (plugins, i);
+			if (!plugin->enabled)
+				continue;
+			if (g_cancellable_set_error_if_cancelled (cancellable, error))
+				return FALSE;
+			if (values != NULL) {
+				ret = gs_plugin_loader_run_search_plugin (plugin_loader,
+									  plugin,
+									  vfunc,
+									  values,
+									  list,
+									  cancellable,
+									  error);
+			} else {
+				ret = gs_plugin_loader_run_results_plugin (plugin_loader,
+									   plugin,
+									   vfunc,
+									   list,
+									   cancellable,
+									   error);
+			}
+			if (!ret)
+				return FALSE;
+		}
+		return TRUE;
+	}
+
+	/* one job for each plugin */
+	jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_plugin_loader_job_free);
+	for (i = 0; i < plugins->len; i++) {
+		plugin = g_ptr_array_index (plugins, i);
+		if (!plugin->enabled)
+			continue;
+		job = g_slice_new0 (GsPluginLoaderJob);
+		job->plugin_loader = plugin_loader;
+		job->plugin = plugin;
+		job->vfunc = vfunc;
+		job->values = values;
+		job->cancellable = cancellable;
+		g_ptr_array_add (jobs, job);
+	}
+
+	/* no need for any threads */
+	if (jobs->len == 1) {
+		gs_plugin_loader_job_run (g_ptr_array_index (jobs, 0));
+	} else if (jobs->len > 1) {
+		pool = g_thread_pool_new (gs_plugin_loader_job_thread_cb,
+					  NULL, jobs->len, FALSE, error);
+		if (pool == NULL)
+			return FALSE;
+		for (i = 0; i < jobs->len; i++)
+			g_thread_pool_push (pool, g_ptr_array_index (jobs, i), NULL);
+
+		/* wait for all the plugins to finish */
+		g_thread_pool_free (pool, FALSE, TRUE);
+	}
+
+	/* merge in priority order, reporting the first plugin to fail */
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		if (!job->ret) {
+			g_propagate_error (error, job->error);
+			job->error = NULL;
+			return FALSE;
+		}
+		*list = g_list_concat (job->list, *list);
+		job->list = NULL;
+	}
+	return TRUE;
+}
+
 /**
  * gs_plugin_loader_run_results:
  **/
 static GList *
 gs_plugin_loader_run_results (GsPluginLoader *plugin_loader,
-			      const gchar *function_name,
+			      GsPluginVfunc vfunc,
 			      GsPluginRefineFlags flags,
 			      GCancellable *cancellable,
 			      GError **error)
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	const gchar *function_name = gs_plugin_vfunc_to_string (vfunc);
 	gboolean ret = TRUE;
 	GList *list = NULL;
-	GsPlugin *plugin;
-	guint i;
 	g_autoptr(AsProfileTask) ptask = NULL;
 
 	g_return_val_if_fail (GS_IS_PLUGIN_LOADER (plugin_loader), NULL);
-	g_return_val_if_fail (function_name != NULL, NULL);
+	g_return_val_if_fail (vfunc < GS_PLUGIN_VFUNC_LAST, NULL);
 	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
 
@@ -408,24 +806,14 @@ gs_plugin_loader_run_results (GsPluginLoader *plugin_loader,
 	ptask = as_profile_start (priv->profile, "GsPlugin::*(%s)", function_name);
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
-		plugin = g_ptr_array_index (priv->plugins, i);
-		if (!plugin->enabled)
-			continue;
-		ret = g_cancellable_set_error_if_cancelled (cancellable, error);
-		if (ret) {
-			ret = FALSE;
-			goto out;
-		}
-		ret = gs_plugin_loader_run_results_plugin (plugin_loader,
-							   plugin,
-							   function_name,
-							   &list,
-							   cancellable,
-							   error);
-		if (!ret)
-			goto out;
-	}
+	ret = gs_plugin_loader_run_add (plugin_loader,
+					vfunc,
+					NULL,
+					&list,
+					cancellable,
+					error);
+	if (!ret)
+		goto out;
 
 	/* dedupe applications we already know about */
 	gs_plugin_loader_list_dedupe (plugin_loader, list);
@@ -545,6 +933,7 @@ gs_plugin_loader_app_is_valid (GsApp *app, gpointer user_data)
 		return FALSE;
 	}
 	if (gs_app_get_kind (app) == GS_APP_KIND_NORMAL &&
+	    !gs_app_get_icon_deferred (app) &&
 	    gs_app_get_pixbuf (app) == NULL) {
 		g_debug ("app invalid as no pixbuf %s",
 			 gs_plugin_loader_get_app_str (app));
@@ -641,26 +1030,20 @@ static gboolean
 gs_plugin_loader_run_action_plugin (GsPluginLoader *plugin_loader,
 				    GsPlugin *plugin,
 				    GsApp *app,
-				    const gchar *function_name,
+				    GsPluginVfunc vfunc,
 				    GCancellable *cancellable,
 				    GError **error)
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
 	GError *error_local = NULL;
-	GsPluginActionFunc plugin_func = NULL;
-	gboolean exists;
+	GsPluginActionFunc plugin_func = plugin->vfuncs[vfunc];
 	gboolean ret = TRUE;
 	g_autoptr(AsProfileTask) ptask = NULL;
 
-	exists = g_module_symbol (plugin->module,
-				  function_name,
-				  (gpointer *) &plugin_func);
-	if (!exists)
-		goto out;
 	ptask = as_profile_start (priv->profile,
 				  "GsPlugin::%s(%s)",
 				  plugin->name,
-				  function_name);
+				  gs_plugin_vfunc_to_string (vfunc));
 	ret = plugin_func (plugin, app, cancellable, &error_local);
 	if (!ret) {
 		if (g_error_matches (error_local,
@@ -687,19 +1070,20 @@ out:
 static gboolean
 gs_plugin_loader_run_action (GsPluginLoader *plugin_loader,
 			     GsApp *app,
-			     const gchar *function_name,
+			     GsPluginVfunc vfunc,
 			     GCancellable *cancellable,
 			     GError **error)
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GPtrArray *plugins = priv->plugins_vfunc[vfunc];
 	gboolean ret;
 	gboolean anything_ran = FALSE;
 	GsPlugin *plugin;
 	guint i;
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
-		plugin = g_ptr_array_index (priv->plugins, i);
+	for (i = 0; i < plugins->len; i++) {
+		plugin = g_ptr_array_index (plugins, i);
 		if (!plugin->enabled)
 			continue;
 		if (g_cancellable_set_error_if_cancelled (cancellable, error))
@@ -707,7 +1091,7 @@ gs_plugin_loader_run_action (GsPluginLoader *plugin_loader,
 		ret = gs_plugin_loader_run_action_plugin (plugin_loader,
 							  plugin,
 							  app,
-							  function_name,
+							  vfunc,
 							  cancellable,
 							  error);
 		if (!ret)
@@ -721,7 +1105,7 @@ gs_plugin_loader_run_action (GsPluginLoader *plugin_loader,
 			     GS_PLUGIN_LOADER_ERROR,
 			     GS_PLUGIN_LOADER_ERROR_FAILED,
 			     "no plugin could handle %s",
-			     function_name);
+			     gs_plugin_vfunc_to_string (vfunc));
 		return FALSE;
 	}
 	return TRUE;
@@ -804,17 +1188,17 @@ gs_plugin_loader_get_updates_thread_cb (GTask *task,
 					gpointer task_data,
 					GCancellable *cancellable)
 {
-	const gchar *method_name = "gs_plugin_add_updates";
+	GsPluginVfunc vfunc = GS_PLUGIN_VFUNC_ADD_UPDATES;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (object);
 	GError *error = NULL;
 
 	/* do things that would block */
 	if ((state->flags & GS_PLUGIN_REFINE_FLAGS_USE_HISTORY) > 0)
-		method_name = "gs_plugin_add_updates_historical";
+		vfunc = GS_PLUGIN_VFUNC_ADD_UPDATES_HISTORICAL;
 
 	state->list = gs_plugin_loader_run_results (plugin_loader,
-						    method_name,
+						    vfunc,
 						    state->flags,
 						    cancellable,
 						    &error);
@@ -927,7 +1311,7 @@ gs_plugin_loader_get_distro_upgrades_thread_cb (GTask *task,
 	GError *error = NULL;
 
 	state->list = gs_plugin_loader_run_results (plugin_loader,
-						    "gs_plugin_add_distro_upgrades",
+						    GS_PLUGIN_VFUNC_ADD_DISTRO_UPGRADES,
 						    state->flags,
 						    cancellable,
 						    &error);
@@ -1010,7 +1394,7 @@ gs_plugin_loader_get_sources_thread_cb (GTask *task,
 	GError *error = NULL;
 
 	state->list = gs_plugin_loader_run_results (plugin_loader,
-						    "gs_plugin_add_sources",
+						    GS_PLUGIN_VFUNC_ADD_SOURCES,
 						    state->flags,
 						    cancellable,
 						    &error);
@@ -1106,7 +1490,7 @@ gs_plugin_loader_get_installed_thread_cb (GTask *task,
 
 	/* do things that would block */
 	state->list = gs_plugin_loader_run_results (plugin_loader,
-						    "gs_plugin_add_installed",
+						    GS_PLUGIN_VFUNC_ADD_INSTALLED,
 						    state->flags,
 						    cancellable,
 						    &error);
@@ -1208,7 +1592,7 @@ gs_plugin_loader_get_popular_thread_cb (GTask *task,
 
 	/* do things that would block */
 	state->list = gs_plugin_loader_run_results (plugin_loader,
-						    "gs_plugin_add_popular",
+						    GS_PLUGIN_VFUNC_ADD_POPULAR,
 						    state->flags,
 						    cancellable,
 						    &error);
@@ -1307,7 +1691,7 @@ gs_plugin_loader_get_featured_thread_cb (GTask *task,
 
 	/* do things that would block */
 	state->list = gs_plugin_loader_run_results (plugin_loader,
-						    "gs_plugin_add_featured",
+						    GS_PLUGIN_VFUNC_ADD_FEATURED,
 						    state->flags,
 						    cancellable,
 						    &error);
@@ -1473,14 +1857,10 @@ gs_plugin_loader_search_thread_cb (GTask *task,
 				   GCancellable *cancellable)
 {
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (object);
-	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
-	const gchar *function_name = "gs_plugin_add_search";
+	GsPluginVfunc vfunc = GS_PLUGIN_VFUNC_ADD_SEARCH;
 	gboolean ret = TRUE;
 	GError *error = NULL;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
-	GsPlugin *plugin;
-	GsPluginSearchFunc plugin_func = NULL;
-	guint i;
 	g_auto(GStrv) values = NULL;
 
 	/* run each plugin */
@@ -1492,29 +1872,15 @@ gs_plugin_loader_search_thread_cb (GTask *task,
 					 "no valid search terms");
 		return;
 	}
-	for (i = 0; i < priv->plugins->len; i++) {
-		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
-		if (!plugin->enabled)
-			continue;
-		ret = g_task_return_error_if_cancelled (task);
-		if (ret)
-			return;
-		ret = g_module_symbol (plugin->module,
-				       function_name,
-				       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
-		ptask = as_profile_start (priv->profile,
-					  "GsPlugin::%s(%s)",
-					  plugin->name,
-					  function_name);
-		ret = plugin_func (plugin, values, &state->list, cancellable, &error);
-		if (!ret) {
-			g_task_return_error (task, error);
-			return;
-		}
-		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+	ret = gs_plugin_loader_run_add (plugin_loader,
+					vfunc,
+					values,
+					&state->list,
+					cancellable,
+					&error);
+	if (!ret) {
+		g_task_return_error (task, error);
+		return;
 	}
 
 	/* dedupe applications we already know about */
@@ -1522,7 +1888,7 @@ gs_plugin_loader_search_thread_cb (GTask *task,
 
 	/* run refine() on each one */
 	ret = gs_plugin_loader_run_refine (plugin_loader,
-					   function_name,
+					   gs_plugin_vfunc_to_string (vfunc),
 					   &state->list,
 					   state->flags,
 					   cancellable,
@@ -1636,43 +2002,25 @@ gs_plugin_loader_search_files_thread_cb (GTask *task,
                                          GCancellable *cancellable)
 {
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (object);
-	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
-	const gchar *function_name = "gs_plugin_add_search_files";
+	GsPluginVfunc vfunc = GS_PLUGIN_VFUNC_ADD_SEARCH_FILES;
 	gboolean ret = TRUE;
 	GError *error = NULL;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
-	GsPlugin *plugin;
-	GsPluginSearchFunc plugin_func = NULL;
-	guint i;
 	g_auto(GStrv) values = NULL;
 
 	values = g_new0 (gchar *, 2);
 	values[0] = g_strdup (state->value);
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
-		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
-		if (!plugin->enabled)
-			continue;
-		ret = g_task_return_error_if_cancelled (task);
-		if (ret)
-			return;
-		ret = g_module_symbol (plugin->module,
-				       function_name,
-				       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
-		ptask = as_profile_start (priv->profile,
-					  "GsPlugin::%s(%s)",
-					  plugin->name,
-					  function_name);
-		ret = plugin_func (plugin, values, &state->list, cancellable, &error);
-		if (!ret) {
-			g_task_return_error (task, error);
-			return;
-		}
-		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+	ret = gs_plugin_loader_run_add (plugin_loader,
+					vfunc,
+					values,
+					&state->list,
+					cancellable,
+					&error);
+	if (!ret) {
+		g_task_return_error (task, error);
+		return;
 	}
 
 	/* dedupe applications we already know about */
@@ -1680,7 +2028,7 @@ gs_plugin_loader_search_files_thread_cb (GTask *task,
 
 	/* run refine() on each one */
 	ret = gs_plugin_loader_run_refine (plugin_loader,
-					   function_name,
+					   gs_plugin_vfunc_to_string (vfunc),
 					   &state->list,
 					   state->flags,
 					   cancellable,
@@ -1795,43 +2143,25 @@ gs_plugin_loader_search_what_provides_thread_cb (GTask *task,
                                                  GCancellable *cancellable)
 {
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (object);
-	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
-	const gchar *function_name = "gs_plugin_add_search_what_provides";
+	GsPluginVfunc vfunc = GS_PLUGIN_VFUNC_ADD_SEARCH_WHAT_PROVIDES;
 	gboolean ret = TRUE;
 	GError *error = NULL;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
-	GsPlugin *plugin;
-	GsPluginSearchFunc plugin_func = NULL;
-	guint i;
 	g_auto(GStrv) values = NULL;
 
 	values = g_new0 (gchar *, 2);
 	values[0] = g_strdup (state->value);
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
-		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
-		if (!plugin->enabled)
-			continue;
-		ret = g_task_return_error_if_cancelled (task);
-		if (ret)
-			return;
-		ret = g_module_symbol (plugin->module,
-				       function_name,
-				       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
-		ptask = as_profile_start (priv->profile,
-					  "GsPlugin::%s(%s)",
-					  plugin->name,
-					  function_name);
-		ret = plugin_func (plugin, values, &state->list, cancellable, &error);
-		if (!ret) {
-			g_task_return_error (task, error);
-			return;
-		}
-		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+	ret = gs_plugin_loader_run_add (plugin_loader,
+					vfunc,
+					values,
+					&state->list,
+					cancellable,
+					&error);
+	if (!ret) {
+		g_task_return_error (task, error);
+		return;
 	}
 
 	/* dedupe applications we already know about */
@@ -1839,7 +2169,7 @@ gs_plugin_loader_search_what_provides_thread_cb (GTask *task,
 
 	/* run refine() on each one */
 	ret = gs_plugin_loader_run_refine (plugin_loader,
-					   function_name,
+					   gs_plugin_vfunc_to_string (vfunc),
 					   &state->list,
 					   state->flags,
 					   cancellable,
@@ -1969,25 +2299,22 @@ gs_plugin_loader_get_categories_thread_cb (GTask *task,
 	gboolean ret = TRUE;
 	GError *error = NULL;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_ADD_CATEGORIES];
 	GsPlugin *plugin;
 	GsPluginResultsFunc plugin_func = NULL;
 	GList *l;
 	guint i;
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
+	for (i = 0; i < plugins->len; i++) {
 		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
+		plugin = g_ptr_array_index (plugins, i);
 		if (!plugin->enabled)
 			continue;
 		ret = g_task_return_error_if_cancelled (task);
 		if (ret)
 			return;
-		ret = g_module_symbol (plugin->module,
-				       function_name,
-				       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
+		plugin_func = plugin->vfuncs[GS_PLUGIN_VFUNC_ADD_CATEGORIES];
 		ptask = as_profile_start (priv->profile,
 					  "GsPlugin::%s(%s)",
 					  plugin->name,
@@ -2083,24 +2410,21 @@ gs_plugin_loader_get_category_apps_thread_cb (GTask *task,
 	gboolean ret = TRUE;
 	GError *error = NULL;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_ADD_CATEGORY_APPS];
 	GsPlugin *plugin;
 	GsPluginCategoryFunc plugin_func = NULL;
 	guint i;
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
+	for (i = 0; i < plugins->len; i++) {
 		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
+		plugin = g_ptr_array_index (plugins, i);
 		if (!plugin->enabled)
 			continue;
 		ret = g_task_return_error_if_cancelled (task);
 		if (ret)
 			return;
-		ret = g_module_symbol (plugin->module,
-				       function_name,
-				       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
+		plugin_func = plugin->vfuncs[GS_PLUGIN_VFUNC_ADD_CATEGORY_APPS];
 		ptask = as_profile_start (priv->profile,
 					  "GsPlugin::%s(%s)",
 					  plugin->name,
@@ -2338,7 +2662,7 @@ gs_plugin_loader_app_action_thread_cb (GTask *task,
 	/* perform action */
 	ret = gs_plugin_loader_run_action (plugin_loader,
 					   state->app,
-					   state->function_name,
+					   state->vfunc,
 					   cancellable,
 					   &error);
 	if (ret) {
@@ -2355,9 +2679,10 @@ gs_plugin_loader_app_action_thread_cb (GTask *task,
 		}
 
 		/* refine again to make sure we pick up new source id */
+		gs_app_clear_refined_flags (state->app);
 		gs_plugin_add_app (&list, state->app);
 		ret = gs_plugin_loader_run_refine (plugin_loader,
-						   state->function_name,
+						   gs_plugin_vfunc_to_string (state->vfunc),
 						   &list,
 						   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN,
 						   cancellable,
@@ -2588,27 +2913,27 @@ gs_plugin_loader_app_action_async (GsPluginLoader *plugin_loader,
 
 	switch (action) {
 	case GS_PLUGIN_LOADER_ACTION_INSTALL:
-		state->function_name = "gs_plugin_app_install";
+		state->vfunc = GS_PLUGIN_VFUNC_APP_INSTALL;
 		state->state_success = AS_APP_STATE_INSTALLED;
 		state->state_failure = AS_APP_STATE_AVAILABLE;
 		break;
 	case GS_PLUGIN_LOADER_ACTION_REMOVE:
-		state->function_name = "gs_plugin_app_remove";
+		state->vfunc = GS_PLUGIN_VFUNC_APP_REMOVE;
 		state->state_success = AS_APP_STATE_AVAILABLE;
 		state->state_failure = AS_APP_STATE_INSTALLED;
 		break;
 	case GS_PLUGIN_LOADER_ACTION_SET_RATING:
-		state->function_name = "gs_plugin_app_set_rating";
+		state->vfunc = GS_PLUGIN_VFUNC_APP_SET_RATING;
 		state->state_success = AS_APP_STATE_UNKNOWN;
 		state->state_failure = AS_APP_STATE_UNKNOWN;
 		break;
 	case GS_PLUGIN_LOADER_ACTION_UPGRADE_DOWNLOAD:
-		state->function_name = "gs_plugin_app_upgrade_download";
+		state->vfunc = GS_PLUGIN_VFUNC_APP_UPGRADE_DOWNLOAD;
 		state->state_success = AS_APP_STATE_UNKNOWN;
 		state->state_failure = AS_APP_STATE_UNKNOWN;
 		break;
 	case GS_PLUGIN_LOADER_ACTION_UPGRADE_TRIGGER:
-		state->function_name = "gs_plugin_app_upgrade_trigger";
+		state->vfunc = GS_PLUGIN_VFUNC_APP_UPGRADE_TRIGGER;
 		state->state_success = AS_APP_STATE_UNKNOWN;
 		state->state_failure = AS_APP_STATE_UNKNOWN;
 		break;
@@ -2694,32 +3019,89 @@ gs_plugin_loader_get_pending (GsPluginLoader *plugin_loader)
  * gs_plugin_loader_run:
  **/
 static void
-gs_plugin_loader_run (GsPluginLoader *plugin_loader, const gchar *function_name)
+gs_plugin_loader_run (GsPluginLoader *plugin_loader, GsPluginVfunc vfunc)
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
-	gboolean ret;
+	GPtrArray *plugins = priv->plugins_vfunc[vfunc];
 	GsPluginFunc plugin_func = NULL;
 	GsPlugin *plugin;
 	guint i;
 
-	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
+	/* run each plugin, even the disabled ones */
+	for (i = 0; i < plugins->len; i++) {
 		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
-		ret = g_module_symbol (plugin->module,
-				       function_name,
-				       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
+		plugin = g_ptr_array_index (plugins, i);
+		plugin_func = plugin->vfuncs[vfunc];
 		ptask = as_profile_start (priv->profile,
 					  "GsPlugin::%s(%s)",
 					  plugin->name,
-					  function_name);
+					  gs_plugin_vfunc_to_string (vfunc));
 		plugin_func (plugin);
 		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
 	}
 }
 
+/**
+ * gs_plugin_loader_setup_thread_cb:
+ **/
+static void
+gs_plugin_loader_setup_thread_cb (GTask *task,
+				  gpointer object,
+				  gpointer task_data,
+				  GCancellable *cancellable)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (object);
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_SETUP];
+	GsPluginSetupFunc plugin_func = NULL;
+	GsPlugin *plugin;
+	guint i;
+
+	/* run each plugin, which blocks any request that needs the same
+	 * data until the plugin has finished loading it */
+	for (i = 0; i < plugins->len; i++) {
+		g_autoptr(AsProfileTask) ptask = NULL;
+		g_autoptr(GError) error_local = NULL;
+		plugin = g_ptr_array_index (plugins, i);
+		if (!plugin->enabled) {
+			gs_plugin_setup_progress (plugin, 100);
+			continue;
+		}
+		plugin_func = plugin->vfuncs[GS_PLUGIN_VFUNC_SETUP];
+		ptask = as_profile_start (priv->profile,
+					  "GsPlugin::%s(%s)",
+					  plugin->name,
+					  gs_plugin_vfunc_to_string (GS_PLUGIN_VFUNC_SETUP));
+		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_SETUP);
+		if (!plugin_func (plugin, cancellable, &error_local)) {
+			g_warning ("failed to setup %s: %s",
+				   plugin->name, error_local->message);
+		}
+		gs_plugin_setup_progress (plugin, 100);
+		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+	}
+	g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * gs_plugin_loader_setup_plugins:
+ *
+ * Starts loading the data the plugins need in a thread, so that it is
+ * hopefully ready before the first request that needs it.
+ **/
+static void
+gs_plugin_loader_setup_plugins (GsPluginLoader *plugin_loader)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	g_autoptr(GTask) task = NULL;
+
+	if (priv->plugins_vfunc[GS_PLUGIN_VFUNC_SETUP]->len == 0)
+		return;
+	priv->setup_progress = 0;
+	task = g_task_new (plugin_loader, NULL, NULL, NULL);
+	g_task_run_in_thread (task, gs_plugin_loader_setup_thread_cb);
+}
+
 /**
  * gs_plugin_loader_set_enabled:
  */
@@ -2736,7 +3118,7 @@ gs_plugin_loader_set_enabled (GsPluginLoader *plugin_loader,
 	for (i = 0; i < priv->plugins->len; i++) {
 		plugin = g_ptr_array_index (priv->plugins, i);
 		if (g_strcmp0 (plugin->name, plugin_name) == 0) {
-			plugin->enabled = enabled;
+			gs_plugin_set_enabled (plugin, enabled);
 			ret = TRUE;
 			break;
 		}
@@ -2770,6 +3152,61 @@ gs_plugin_loader_status_update_cb (GsPlugin *plugin,
 		       0, app, status);
 }
 
+/**
+ * gs_plugin_loader_enabled_changed_cb:
+ */
+static void
+gs_plugin_loader_enabled_changed_cb (GsPlugin *plugin, gpointer user_data)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (user_data);
+	gs_plugin_loader_invalidate_refine_plans (plugin_loader);
+}
+
+/**
+ * gs_plugin_loader_setup_progress_cb:
+ *
+ * Each plugin with a gs_plugin_setup() gets an equal share of the
+ * overall progress, in the order they are set up.
+ */
+static void
+gs_plugin_loader_setup_progress_cb (GsPlugin *plugin,
+				    guint percentage,
+				    gpointer user_data)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (user_data);
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_SETUP];
+	guint i;
+	guint progress;
+
+	for (i = 0; i < plugins->len; i++) {
+		if (g_ptr_array_index (plugins, i) == plugin)
+			break;
+	}
+	if (i == plugins->len)
+		return;
+	progress = (i * 100 + percentage) / plugins->len;
+	if (progress == priv->setup_progress)
+		return;
+	priv->setup_progress = progress;
+	g_signal_emit (plugin_loader,
+		       signals[SIGNAL_SETUP_PROGRESS],
+		       0, progress);
+}
+
+/**
+ * gs_plugin_loader_get_setup_progress:
+ *
+ * Gets how much of the data the plugins load before answering requests
+ * is ready, where 100 means that requests will not have to wait for it.
+ */
+guint
+gs_plugin_loader_get_setup_progress (GsPluginLoader *plugin_loader)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	return priv->setup_progress;
+}
+
 /**
  * gs_plugin_loader_updates_changed_delay_cb:
  */
@@ -2800,6 +3237,7 @@ gs_plugin_loader_updates_changed_delay_cb (gpointer user_data)
 
 	/* not valid anymore */
 	g_hash_table_remove_all (priv->app_cache);
+	g_atomic_int_inc (&priv->app_cache_generation);
 	g_mutex_unlock (&priv->app_cache_mutex);
 
 	/* notify shells */
@@ -2825,6 +3263,52 @@ gs_plugin_loader_updates_changed_cb (GsPlugin *plugin, gpointer user_data)
 				       plugin_loader);
 }
 
+/**
+ * gs_plugin_loader_apps_changed_cb:
+ *
+ * Only the applications in @ids are out of date, so keep the rest of the
+ * cache. These are dropped from it, as some may have been removed, and
+ * any copies still shown are refined again next time.
+ */
+static void
+gs_plugin_loader_apps_changed_cb (GsPlugin *plugin,
+				  gchar **ids,
+				  gpointer user_data)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (user_data);
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GsApp *app;
+	guint i;
+
+	/* a full reload is already pending */
+	if (priv->updates_changed_id != 0)
+		return;
+
+	g_mutex_lock (&priv->app_cache_mutex);
+	for (i = 0; ids[i] != NULL; i++) {
+		app = g_hash_table_lookup (priv->app_cache, ids[i]);
+		if (app == NULL)
+			continue;
+		g_debug ("invalidating %s from %s", ids[i], plugin->name);
+		switch (gs_app_get_state (app)) {
+		case AS_APP_STATE_INSTALLED:
+		case AS_APP_STATE_UPDATABLE:
+		case AS_APP_STATE_AVAILABLE:
+			gs_app_set_state (app, AS_APP_STATE_UNKNOWN);
+			break;
+		default:
+			break;
+		}
+		gs_app_clear_refined_flags (app);
+		g_hash_table_remove (priv->app_cache, ids[i]);
+	}
+	g_mutex_unlock (&priv->app_cache_mutex);
+
+	/* notify shells */
+	g_debug ("updates-changed for %u apps", g_strv_length (ids));
+	g_signal_emit (plugin_loader, signals[SIGNAL_UPDATES_CHANGED], 0);
+}
+
 /**
  * gs_plugin_loader_open_plugin:
  */
@@ -2838,6 +3322,7 @@ gs_plugin_loader_open_plugin (GsPluginLoader *plugin_loader,
 	GsPluginGetNameFunc plugin_name = NULL;
 	GsPluginGetDepsFunc plugin_deps = NULL;
 	GsPlugin *plugin = NULL;
+	guint i;
 
 	module = g_module_open (filename, 0);
 	if (module == NULL) {
@@ -2865,6 +3350,8 @@ gs_plugin_loader_open_plugin (GsPluginLoader *plugin_loader,
 	plugin = g_slice_new0 (GsPlugin);
 	plugin->enabled = TRUE;
 	plugin->module = module;
+	g_mutex_init (&plugin->idle_mutex);
+	plugin->idle_sources = g_ptr_array_new_with_free_func ((GDestroyNotify) g_source_unref);
 	plugin->pixbuf_size = 64;
 	plugin->priority = 0.f;
 	plugin->deps = plugin_deps != NULL ? plugin_deps (plugin) : NULL;
@@ -2873,8 +3360,21 @@ gs_plugin_loader_open_plugin (GsPluginLoader *plugin_loader,
 	plugin->status_update_user_data = plugin_loader;
 	plugin->updates_changed_fn = gs_plugin_loader_updates_changed_cb;
 	plugin->updates_changed_user_data = plugin_loader;
+	plugin->apps_changed_fn = gs_plugin_loader_apps_changed_cb;
+	plugin->apps_changed_user_data = plugin_loader;
+	plugin->setup_progress_fn = gs_plugin_loader_setup_progress_cb;
+	plugin->setup_progress_user_data = plugin_loader;
+	plugin->enabled_changed_fn = gs_plugin_loader_enabled_changed_cb;
+	plugin->enabled_changed_user_data = plugin_loader;
 	plugin->profile = g_object_ref (priv->profile);
 	plugin->scale = gs_plugin_loader_get_scale (plugin_loader);
+
+	/* resolve each vfunc once, rather than on every request */
+	for (i = 0; i < GS_PLUGIN_VFUNC_LAST; i++) {
+		(void) g_module_symbol (module,
+					gs_plugin_vfunc_to_string (i),
+					&plugin->vfuncs[i]);
+	}
 	g_debug ("opened plugin %s: %s", filename, plugin->name);
 
 	/* add to array */
@@ -2910,6 +3410,20 @@ gs_plugin_loader_get_scale (GsPluginLoader *plugin_loader)
 	return priv->scale;
 }
 
+/**
+ * gs_plugin_loader_set_parallel:
+ *
+ * Sets if the plugins should be run at the same time when getting results.
+ * The add_* vfuncs are independent, so this is only turned off when
+ * debugging a misbehaving plugin.
+ */
+void
+gs_plugin_loader_set_parallel (GsPluginLoader *plugin_loader, gboolean parallel)
+{
+	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	priv->parallel = parallel;
+}
+
 /**
  * gs_plugin_loader_set_location:
  */
@@ -3050,12 +3564,26 @@ gs_plugin_loader_setup (GsPluginLoader *plugin_loader, GError **error)
 	g_ptr_array_sort (priv->plugins,
 			  gs_plugin_loader_plugin_sort_fn);
 
+	/* get the plugins that implement each vfunc, in priority order */
+	for (i = 0; i < GS_PLUGIN_VFUNC_LAST; i++) {
+		g_ptr_array_set_size (priv->plugins_vfunc[i], 0);
+		for (j = 0; j < priv->plugins->len; j++) {
+			plugin = g_ptr_array_index (priv->plugins, j);
+			if (plugin->vfuncs[i] == NULL)
+				continue;
+			g_ptr_array_add (priv->plugins_vfunc[i], plugin);
+		}
+	}
+
 	/* run the plugins */
-	gs_plugin_loader_run (plugin_loader, "gs_plugin_initialize");
+	gs_plugin_loader_run (plugin_loader, GS_PLUGIN_VFUNC_INITIALIZE);
 
 	/* now we can load the install-queue */
 	if (!load_install_queue (plugin_loader, error))
 		return FALSE;
+
+	/* load any slow data before it is needed */
+	gs_plugin_loader_setup_plugins (plugin_loader);
 	return TRUE;
 }
 
@@ -3085,6 +3613,10 @@ gs_plugin_loader_dump_state (GsPluginLoader *plugin_loader)
 static void
 gs_plugin_loader_plugin_free (GsPlugin *plugin)
 {
+	/* any status callback still queued would use the freed plugin */
+	gs_plugin_remove_idle_sources (plugin);
+	g_ptr_array_unref (plugin->idle_sources);
+	g_mutex_clear (&plugin->idle_mutex);
 	g_free (plugin->priv);
 	g_free (plugin->name);
 	g_object_unref (plugin->profile);
@@ -3101,9 +3633,12 @@ gs_plugin_loader_dispose (GObject *object)
 {
 	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (object);
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	guint i;
 
 	if (priv->plugins != NULL) {
-		gs_plugin_loader_run (plugin_loader, "gs_plugin_destroy");
+		gs_plugin_loader_run (plugin_loader, GS_PLUGIN_VFUNC_DESTROY);
+		for (i = 0; i < GS_PLUGIN_VFUNC_LAST; i++)
+			g_clear_pointer (&priv->plugins_vfunc[i], g_ptr_array_unref);
 		g_clear_pointer (&priv->plugins, g_ptr_array_unref);
 	}
 	if (priv->updates_changed_id != 0) {
@@ -3113,6 +3648,7 @@ gs_plugin_loader_dispose (GObject *object)
 	g_clear_object (&priv->profile);
 	g_clear_object (&priv->settings);
 	g_clear_pointer (&priv->app_cache, g_hash_table_unref);
+	g_clear_pointer (&priv->refine_plans, g_hash_table_unref);
 	g_clear_pointer (&priv->pending_apps, g_ptr_array_unref);
 
 	G_OBJECT_CLASS (gs_plugin_loader_parent_class)->dispose (object);
@@ -3133,6 +3669,7 @@ gs_plugin_loader_finalize (GObject *object)
 
 	g_mutex_clear (&priv->pending_apps_mutex);
 	g_mutex_clear (&priv->app_cache_mutex);
+	g_mutex_clear (&priv->refine_plans_mutex);
 
 	G_OBJECT_CLASS (gs_plugin_loader_parent_class)->finalize (object);
 }
@@ -3167,6 +3704,12 @@ gs_plugin_loader_class_init (GsPluginLoaderClass *klass)
 			      G_STRUCT_OFFSET (GsPluginLoaderClass, updates_changed),
 			      NULL, NULL, g_cclosure_marshal_VOID__VOID,
 			      G_TYPE_NONE, 0);
+	signals [SIGNAL_SETUP_PROGRESS] =
+		g_signal_new ("setup-progress",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (GsPluginLoaderClass, setup_progress),
+			      NULL, NULL, g_cclosure_marshal_VOID__UINT,
+			      G_TYPE_NONE, 1, G_TYPE_UINT);
 }
 
 /**
@@ -3181,7 +3724,11 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 	guint i;
 
 	priv->scale = 1;
+	priv->setup_progress = 100;
+	priv->parallel = g_getenv ("GNOME_SOFTWARE_SERIAL_PLUGINS") == NULL;
 	priv->plugins = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_plugin_loader_plugin_free);
+	for (i = 0; i < GS_PLUGIN_VFUNC_LAST; i++)
+		priv->plugins_vfunc[i] = g_ptr_array_new ();
 	priv->status_last = GS_PLUGIN_STATUS_LAST;
 	priv->pending_apps = g_ptr_array_new_with_free_func ((GFreeFunc) g_object_unref);
 	priv->profile = as_profile_new ();
@@ -3191,8 +3738,14 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 								g_free,
 								(GFreeFunc) g_object_unref);
 
+	priv->refine_plans = g_hash_table_new_full (g_int64_hash,
+						    g_int64_equal,
+						    g_free,
+						    (GDestroyNotify) gs_plugin_loader_refine_plan_free);
+
 	g_mutex_init (&priv->pending_apps_mutex);
 	g_mutex_init (&priv->app_cache_mutex);
+	g_mutex_init (&priv->refine_plans_mutex);
 
 	/* by default we only show project-less apps or compatible projects */
 	tmp = g_getenv ("GNOME_SOFTWARE_COMPATIBLE_PROJECTS");
@@ -3299,17 +3852,11 @@ gs_plugin_loader_run_refresh_plugin (GsPluginLoader *plugin_loader,
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
 	const gchar *function_name = "gs_plugin_refresh";
-	gboolean exists;
 	gboolean ret = TRUE;
 	GError *error_local = NULL;
-	GsPluginRefreshFunc plugin_func = NULL;
+	GsPluginRefreshFunc plugin_func = plugin->vfuncs[GS_PLUGIN_VFUNC_REFRESH];
 	g_autoptr(AsProfileTask) ptask = NULL;
 
-	exists = g_module_symbol (plugin->module,
-				  function_name,
-				  (gpointer *) &plugin_func);
-	if (!exists)
-		goto out;
 	ptask = as_profile_start (priv->profile,
 				  "GsPlugin::%s(%s)",
 				  plugin->name,
@@ -3345,14 +3892,15 @@ gs_plugin_loader_run_refresh (GsPluginLoader *plugin_loader,
 			      GError **error)
 {
 	GsPluginLoaderPrivate *priv = gs_plugin_loader_get_instance_private (plugin_loader);
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_REFRESH];
 	gboolean anything_ran = FALSE;
 	gboolean ret;
 	GsPlugin *plugin;
 	guint i;
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
-		plugin = g_ptr_array_index (priv->plugins, i);
+	for (i = 0; i < plugins->len; i++) {
+		plugin = g_ptr_array_index (plugins, i);
 		if (!plugin->enabled)
 			continue;
 		if (g_cancellable_set_error_if_cancelled (cancellable, error))
@@ -3474,24 +4022,21 @@ gs_plugin_loader_filename_to_app_thread_cb (GTask *task,
 	gboolean ret = TRUE;
 	GError *error = NULL;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_FILENAME_TO_APP];
 	GsPlugin *plugin;
 	GsPluginFilenameToAppFunc plugin_func = NULL;
 	guint i;
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
+	for (i = 0; i < plugins->len; i++) {
 		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
+		plugin = g_ptr_array_index (plugins, i);
 		if (!plugin->enabled)
 			continue;
 		ret = g_task_return_error_if_cancelled (task);
 		if (ret)
 			return;
-		ret = g_module_symbol (plugin->module,
-				       function_name,
-				       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
+		plugin_func = plugin->vfuncs[GS_PLUGIN_VFUNC_FILENAME_TO_APP];
 		ptask = as_profile_start (priv->profile,
 					  "GsPlugin::%s(%s)",
 					  plugin->name,
@@ -3614,24 +4159,21 @@ gs_plugin_loader_offline_update_thread_cb (GTask *task,
 	gboolean ret = TRUE;
 	GError *error = NULL;
 	GsPluginLoaderAsyncState *state = (GsPluginLoaderAsyncState *) task_data;
+	GPtrArray *plugins = priv->plugins_vfunc[GS_PLUGIN_VFUNC_OFFLINE_UPDATE];
 	GsPlugin *plugin;
 	GsPluginOfflineUpdateFunc plugin_func = NULL;
 	guint i;
 
 	/* run each plugin */
-	for (i = 0; i < priv->plugins->len; i++) {
+	for (i = 0; i < plugins->len; i++) {
 		g_autoptr(AsProfileTask) ptask = NULL;
-		plugin = g_ptr_array_index (priv->plugins, i);
+		plugin = g_ptr_array_index (plugins, i);
 		if (!plugin->enabled)
 			continue;
 		ret = g_task_return_error_if_cancelled (task);
 		if (ret)
 			return;
-		ret = g_module_symbol (plugin->module,
-		                       function_name,
-		                       (gpointer *) &plugin_func);
-		if (!ret)
-			continue;
+		plugin_func = plugin->vfuncs[GS_PLUGIN_VFUNC_OFFLINE_UPDATE];
 		ptask = as_profile_start (priv->profile,
 					  "GsPlugin::%s(%s)",
 					  plugin->name,
@@ -43,6 +43,8 @@ struct _GsPluginLoaderClass
 							 GsPluginStatus	 status);
 	void			(*pending_apps_changed)	(GsPluginLoader	*plugin_loader);
 	void			(*updates_changed)	(GsPluginLoader	*plugin_loader);
+	void			(*setup_progress)	(GsPluginLoader	*plugin_loader,
+							 guint		 percentage);
 };
 
 typedef enum
@@ -185,9 +187,12 @@ gboolean	 gs_plugin_loader_set_enabled		(GsPluginLoader	*plugin_loader,
 							 gboolean	 enabled);
 void		 gs_plugin_loader_set_location		(GsPluginLoader	*plugin_loader,
 							 const gchar	*location);
+guint		 gs_plugin_loader_get_setup_progress	(GsPluginLoader	*plugin_loader);
 gint		 gs_plugin_loader_get_scale		(GsPluginLoader	*plugin_loader);
 void		 gs_plugin_loader_set_scale		(GsPluginLoader	*plugin_loader,
 							 gint		 scale);
+void		 gs_plugin_loader_set_parallel		(GsPluginLoader	*plugin_loader,
+							 gboolean	 parallel);
 void		 gs_plugin_loader_app_refine_async	(GsPluginLoader	*plugin_loader,
 							 GsApp		*app,
 							 GsPluginRefineFlags flags,
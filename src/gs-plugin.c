@@ -50,13 +50,76 @@ gs_plugin_status_to_string (GsPluginStatus status)
 	return "unknown";
 }
 
+/**
+ * gs_plugin_vfunc_to_string:
+ *
+ * Returns the symbol name the plugin exports for @vfunc.
+ */
+const gchar *
+gs_plugin_vfunc_to_string (GsPluginVfunc vfunc)
+{
+	if (vfunc == GS_PLUGIN_VFUNC_INITIALIZE)
+		return "gs_plugin_initialize";
+	if (vfunc == GS_PLUGIN_VFUNC_DESTROY)
+		return "gs_plugin_destroy";
+	if (vfunc == GS_PLUGIN_VFUNC_SETUP)
+		return "gs_plugin_setup";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_SEARCH)
+		return "gs_plugin_add_search";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_SEARCH_FILES)
+		return "gs_plugin_add_search_files";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_SEARCH_WHAT_PROVIDES)
+		return "gs_plugin_add_search_what_provides";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_INSTALLED)
+		return "gs_plugin_add_installed";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_UPDATES)
+		return "gs_plugin_add_updates";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_UPDATES_HISTORICAL)
+		return "gs_plugin_add_updates_historical";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_DISTRO_UPGRADES)
+		return "gs_plugin_add_distro_upgrades";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_SOURCES)
+		return "gs_plugin_add_sources";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_POPULAR)
+		return "gs_plugin_add_popular";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_FEATURED)
+		return "gs_plugin_add_featured";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_CATEGORIES)
+		return "gs_plugin_add_categories";
+	if (vfunc == GS_PLUGIN_VFUNC_ADD_CATEGORY_APPS)
+		return "gs_plugin_add_category_apps";
+	if (vfunc == GS_PLUGIN_VFUNC_REFINE)
+		return "gs_plugin_refine";
+	if (vfunc == GS_PLUGIN_VFUNC_APP_INSTALL)
+		return "gs_plugin_app_install";
+	if (vfunc == GS_PLUGIN_VFUNC_APP_REMOVE)
+		return "gs_plugin_app_remove";
+	if (vfunc == GS_PLUGIN_VFUNC_APP_SET_RATING)
+		return "gs_plugin_app_set_rating";
+	if (vfunc == GS_PLUGIN_VFUNC_APP_UPGRADE_DOWNLOAD)
+		return "gs_plugin_app_upgrade_download";
+	if (vfunc == GS_PLUGIN_VFUNC_APP_UPGRADE_TRIGGER)
+		return "gs_plugin_app_upgrade_trigger";
+	if (vfunc == GS_PLUGIN_VFUNC_REFRESH)
+		return "gs_plugin_refresh";
+	if (vfunc == GS_PLUGIN_VFUNC_FILENAME_TO_APP)
+		return "gs_plugin_filename_to_app";
+	if (vfunc == GS_PLUGIN_VFUNC_OFFLINE_UPDATE)
+		return "gs_plugin_offline_update";
+	return NULL;
+}
+
 /**
  * gs_plugin_set_enabled:
  **/
 void
 gs_plugin_set_enabled (GsPlugin *plugin, gboolean enabled)
 {
+	if (plugin->enabled == enabled)
+		return;
 	plugin->enabled = enabled;
+	if (plugin->enabled_changed_fn != NULL)
+		plugin->enabled_changed_fn (plugin, plugin->enabled_changed_user_data);
 }
 
 /**
@@ -229,6 +292,65 @@ gs_plugin_list_copy (GList *list)
 	return g_list_copy_deep (list, (GCopyFunc) g_object_ref, NULL);
 }
 
+/**
+ * gs_plugin_idle_add:
+ *
+ * Calls @func in the main context, unless the plugin is freed first.
+ * The loader has to run gs_plugin_remove_idle_sources() before that.
+ **/
+static void
+gs_plugin_idle_add (GsPlugin *plugin,
+		    GSourceFunc func,
+		    gpointer data,
+		    GDestroyNotify destroy)
+{
+	GSource *source;
+
+	source = g_idle_source_new ();
+	g_source_set_callback (source, func, data, destroy);
+	g_mutex_lock (&plugin->idle_mutex);
+	g_ptr_array_add (plugin->idle_sources, source);
+	g_source_attach (source, NULL);
+	g_mutex_unlock (&plugin->idle_mutex);
+}
+
+/**
+ * gs_plugin_idle_done:
+ *
+ * Forgets the idle source that is being dispatched.
+ **/
+static void
+gs_plugin_idle_done (GsPlugin *plugin)
+{
+	g_mutex_lock (&plugin->idle_mutex);
+	g_ptr_array_remove_fast (plugin->idle_sources, g_main_current_source ());
+	g_mutex_unlock (&plugin->idle_mutex);
+}
+
+/**
+ * gs_plugin_remove_idle_sources:
+ * @plugin: A #GsPlugin
+ *
+ * Removes the callbacks into the loader that have not run yet, which
+ * must be done in the main thread before the plugin is freed.
+ **/
+void
+gs_plugin_remove_idle_sources (GsPlugin *plugin)
+{
+	GSource *source;
+	g_autoptr(GPtrArray) sources = NULL;
+	guint i;
+
+	g_mutex_lock (&plugin->idle_mutex);
+	sources = plugin->idle_sources;
+	plugin->idle_sources = g_ptr_array_new_with_free_func ((GDestroyNotify) g_source_unref);
+	g_mutex_unlock (&plugin->idle_mutex);
+	for (i = 0; i < sources->len; i++) {
+		source = g_ptr_array_index (sources, i);
+		g_source_destroy (source);
+	}
+}
+
 typedef struct {
 	GsPlugin	*plugin;
 	GsApp		*app;
@@ -236,6 +358,17 @@ typedef struct {
 	guint		 percentage;
 } GsPluginStatusHelper;
 
+/**
+ * gs_plugin_status_helper_free:
+ **/
+static void
+gs_plugin_status_helper_free (GsPluginStatusHelper *helper)
+{
+	if (helper->app != NULL)
+		g_object_unref (helper->app);
+	g_slice_free (GsPluginStatusHelper, helper);
+}
+
 /**
  * gs_plugin_status_update_cb:
  **/
@@ -245,13 +378,11 @@ gs_plugin_status_update_cb (gpointer user_data)
 	GsPluginStatusHelper *helper = (GsPluginStatusHelper *) user_data;
 
 	/* call back into the loader */
+	gs_plugin_idle_done (helper->plugin);
 	helper->plugin->status_update_fn (helper->plugin,
 					  helper->app,
 					  helper->status,
 					  helper->plugin->status_update_user_data);
-	if (helper->app != NULL)
-		g_object_unref (helper->app);
-	g_slice_free (GsPluginStatusHelper, helper);
 	return FALSE;
 }
 
@@ -268,7 +399,8 @@ gs_plugin_status_update (GsPlugin *plugin, GsApp *app, GsPluginStatus status)
 	helper->status = status;
 	if (app != NULL)
 		helper->app = g_object_ref (app);
-	g_idle_add (gs_plugin_status_update_cb, helper);
+	gs_plugin_idle_add (plugin, gs_plugin_status_update_cb, helper,
+			    (GDestroyNotify) gs_plugin_status_helper_free);
 }
 
 /**
@@ -279,9 +411,8 @@ gs_plugin_progress_update_cb (gpointer user_data)
 {
 	GsPluginStatusHelper *helper = (GsPluginStatusHelper *) user_data;
 
+	gs_plugin_idle_done (helper->plugin);
 	gs_app_set_progress (helper->app, helper->percentage);
-	g_object_unref (helper->app);
-	g_slice_free (GsPluginStatusHelper, helper);
 	return FALSE;
 }
 
@@ -300,7 +431,46 @@ gs_plugin_progress_update (GsPlugin *plugin, GsApp *app, guint percentage)
 	helper->plugin = plugin;
 	helper->percentage = percentage;
 	helper->app = g_object_ref (app);
-	g_idle_add (gs_plugin_progress_update_cb, helper);
+	gs_plugin_idle_add (plugin, gs_plugin_progress_update_cb, helper,
+			    (GDestroyNotify) gs_plugin_status_helper_free);
+}
+
+/**
+ * gs_plugin_setup_progress_cb:
+ **/
+static gboolean
+gs_plugin_setup_progress_cb (gpointer user_data)
+{
+	GsPluginStatusHelper *helper = (GsPluginStatusHelper *) user_data;
+
+	/* call back into the loader */
+	gs_plugin_idle_done (helper->plugin);
+	helper->plugin->setup_progress_fn (helper->plugin,
+					   helper->percentage,
+					   helper->plugin->setup_progress_user_data);
+	return FALSE;
+}
+
+/**
+ * gs_plugin_setup_progress:
+ * @plugin: A #GsPlugin
+ * @percentage: How much of the data has been loaded, from 0 to 100
+ *
+ * Tells the plugin loader how far the plugin has got loading the data
+ * it needs before it can answer any request.
+ *
+ * This can be called from a thread.
+ **/
+void
+gs_plugin_setup_progress (GsPlugin *plugin, guint percentage)
+{
+	GsPluginStatusHelper *helper;
+
+	helper = g_slice_new0 (GsPluginStatusHelper);
+	helper->plugin = plugin;
+	helper->percentage = MIN (percentage, 100);
+	gs_plugin_idle_add (plugin, gs_plugin_setup_progress_cb, helper,
+			    (GDestroyNotify) gs_plugin_status_helper_free);
 }
 
 /**
@@ -310,6 +480,7 @@ static gboolean
 gs_plugin_updates_changed_cb (gpointer user_data)
 {
 	GsPlugin *plugin = GS_PLUGIN (user_data);
+	gs_plugin_idle_done (plugin);
 	plugin->updates_changed_fn (plugin, plugin->updates_changed_user_data);
 	return FALSE;
 }
@@ -320,7 +491,62 @@ gs_plugin_updates_changed_cb (gpointer user_data)
 void
 gs_plugin_updates_changed (GsPlugin *plugin)
 {
-	g_idle_add (gs_plugin_updates_changed_cb, plugin);
+	gs_plugin_idle_add (plugin, gs_plugin_updates_changed_cb, plugin, NULL);
+}
+
+typedef struct {
+	GsPlugin	*plugin;
+	gchar		**ids;
+} GsPluginAppsChangedHelper;
+
+/**
+ * gs_plugin_apps_changed_helper_free:
+ **/
+static void
+gs_plugin_apps_changed_helper_free (GsPluginAppsChangedHelper *helper)
+{
+	g_strfreev (helper->ids);
+	g_slice_free (GsPluginAppsChangedHelper, helper);
+}
+
+/**
+ * gs_plugin_apps_changed_cb:
+ **/
+static gboolean
+gs_plugin_apps_changed_cb (gpointer user_data)
+{
+	GsPluginAppsChangedHelper *helper = (GsPluginAppsChangedHelper *) user_data;
+	GsPlugin *plugin = helper->plugin;
+	gs_plugin_idle_done (plugin);
+	plugin->apps_changed_fn (plugin, helper->ids,
+				 plugin->apps_changed_user_data);
+	return FALSE;
+}
+
+/**
+ * gs_plugin_apps_changed:
+ * @plugin: A #GsPlugin
+ * @ids: The application IDs that were added, removed or modified
+ *
+ * Tells the plugin loader that only some of the applications it knows
+ * about are out of date, rather than invalidating everything like
+ * gs_plugin_updates_changed() does.
+ *
+ * This can be called from a thread.
+ **/
+void
+gs_plugin_apps_changed (GsPlugin *plugin, gchar **ids)
+{
+	GsPluginAppsChangedHelper *helper;
+
+	if (ids == NULL || ids[0] == NULL)
+		return;
+
+	helper = g_slice_new0 (GsPluginAppsChangedHelper);
+	helper->plugin = plugin;
+	helper->ids = g_strdupv (ids);
+	gs_plugin_idle_add (plugin, gs_plugin_apps_changed_cb, helper,
+			    (GDestroyNotify) gs_plugin_apps_changed_helper_free);
 }
 
 /* vim: set noexpandtab: */
@@ -56,10 +56,46 @@ typedef void (*GsPluginStatusUpdate)	(GsPlugin	*plugin,
 					 gpointer	 user_data);
 typedef void (*GsPluginUpdatesChanged)	(GsPlugin	*plugin,
 					 gpointer	 user_data);
+typedef void (*GsPluginAppsChanged)	(GsPlugin	*plugin,
+					 gchar		**ids,
+					 gpointer	 user_data);
+typedef void (*GsPluginSetupProgress)	(GsPlugin	*plugin,
+					 guint		 percentage,
+					 gpointer	 user_data);
+typedef void (*GsPluginEnabledChanged)	(GsPlugin	*plugin,
+					 gpointer	 user_data);
 
 typedef gboolean (*GsPluginListFilter)	(GsApp		*app,
 					 gpointer	 user_data);
 
+typedef enum {
+	GS_PLUGIN_VFUNC_INITIALIZE,
+	GS_PLUGIN_VFUNC_DESTROY,
+	GS_PLUGIN_VFUNC_SETUP,
+	GS_PLUGIN_VFUNC_ADD_SEARCH,
+	GS_PLUGIN_VFUNC_ADD_SEARCH_FILES,
+	GS_PLUGIN_VFUNC_ADD_SEARCH_WHAT_PROVIDES,
+	GS_PLUGIN_VFUNC_ADD_INSTALLED,
+	GS_PLUGIN_VFUNC_ADD_UPDATES,
+	GS_PLUGIN_VFUNC_ADD_UPDATES_HISTORICAL,
+	GS_PLUGIN_VFUNC_ADD_DISTRO_UPGRADES,
+	GS_PLUGIN_VFUNC_ADD_SOURCES,
+	GS_PLUGIN_VFUNC_ADD_POPULAR,
+	GS_PLUGIN_VFUNC_ADD_FEATURED,
+	GS_PLUGIN_VFUNC_ADD_CATEGORIES,
+	GS_PLUGIN_VFUNC_ADD_CATEGORY_APPS,
+	GS_PLUGIN_VFUNC_REFINE,
+	GS_PLUGIN_VFUNC_APP_INSTALL,
+	GS_PLUGIN_VFUNC_APP_REMOVE,
+	GS_PLUGIN_VFUNC_APP_SET_RATING,
+	GS_PLUGIN_VFUNC_APP_UPGRADE_DOWNLOAD,
+	GS_PLUGIN_VFUNC_APP_UPGRADE_TRIGGER,
+	GS_PLUGIN_VFUNC_REFRESH,
+	GS_PLUGIN_VFUNC_FILENAME_TO_APP,
+	GS_PLUGIN_VFUNC_OFFLINE_UPDATE,
+	GS_PLUGIN_VFUNC_LAST
+} GsPluginVfunc;
+
 struct GsPlugin {
 	GModule			*module;
 	gdouble			 priority;	/* largest number gets run first */
@@ -74,7 +110,18 @@ struct GsPlugin {
 	gpointer		 status_update_user_data;
 	GsPluginUpdatesChanged	 updates_changed_fn;
 	gpointer		 updates_changed_user_data;
+	GsPluginAppsChanged	 apps_changed_fn;
+	gpointer		 apps_changed_user_data;
+	GsPluginSetupProgress	 setup_progress_fn;
+	gpointer		 setup_progress_user_data;
+	GsPluginEnabledChanged	 enabled_changed_fn;
+	gpointer		 enabled_changed_user_data;
 	AsProfile		*profile;
+	gpointer		 vfuncs[GS_PLUGIN_VFUNC_LAST];	/* allow-none */
+	guint64			 refine_flags;		/* 0 to always refine */
+	guint64			 refine_flags_requires;	/* read from other plugins */
+	GMutex			 idle_mutex;
+	GPtrArray		*idle_sources;	/* of GSource, not yet dispatched */
 };
 
 typedef enum {
@@ -110,6 +157,9 @@ typedef enum {
 	GS_PLUGIN_REFRESH_FLAGS_LAST
 } GsPluginRefreshFlags;
 
+/* the data every refine adds, such as the icon, whatever flags are used */
+#define	GS_PLUGIN_REFINED_DEFAULT			(G_GUINT64_CONSTANT (1) << 63)
+
 /* helpers */
 #define	GS_PLUGIN_ERROR					1
 #define	GS_PLUGIN_GET_PRIVATE(x)			g_new0 (x,1)
@@ -118,6 +168,9 @@ typedef enum {
 typedef const gchar	*(*GsPluginGetNameFunc)		(void);
 typedef const gchar	**(*GsPluginGetDepsFunc)	(GsPlugin	*plugin);
 typedef void		 (*GsPluginFunc)		(GsPlugin	*plugin);
+typedef gboolean	 (*GsPluginSetupFunc)		(GsPlugin	*plugin,
+							 GCancellable	*cancellable,
+							 GError		**error);
 typedef gboolean	 (*GsPluginSearchFunc)		(GsPlugin	*plugin,
 							 gchar		**value,
 							 GList		**list,
@@ -159,6 +212,9 @@ typedef gboolean	 (*GsPluginOfflineUpdateFunc)	(GsPlugin	*plugin,
 const gchar	*gs_plugin_get_name			(void);
 void		 gs_plugin_initialize			(GsPlugin	*plugin);
 void		 gs_plugin_destroy			(GsPlugin	*plugin);
+gboolean	 gs_plugin_setup			(GsPlugin	*plugin,
+							 GCancellable	*cancellable,
+							 GError		**error);
 void		 gs_plugin_set_enabled			(GsPlugin	*plugin,
 							 gboolean	 enabled);
 gboolean	 gs_plugin_check_distro_id		(GsPlugin	*plugin,
@@ -179,8 +235,14 @@ void		 gs_plugin_status_update		(GsPlugin	*plugin,
 void		 gs_plugin_progress_update		(GsPlugin	*plugin,
 							 GsApp		*app,
 							 guint		 percentage);
+void		 gs_plugin_setup_progress		(GsPlugin	*plugin,
+							 guint		 percentage);
 void		 gs_plugin_updates_changed		(GsPlugin	*plugin);
+void		 gs_plugin_apps_changed			(GsPlugin	*plugin,
+							 gchar		**ids);
+void		 gs_plugin_remove_idle_sources		(GsPlugin	*plugin);
 const gchar	*gs_plugin_status_to_string		(GsPluginStatus	 status);
+const gchar	*gs_plugin_vfunc_to_string		(GsPluginVfunc	 vfunc);
 gboolean	 gs_plugin_add_search			(GsPlugin	*plugin,
 							 gchar		**values,
 							 GList		**list,
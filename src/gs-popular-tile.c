@@ -38,6 +38,7 @@ struct _GsPopularTile
 	GtkWidget	*eventbox;
 	GtkWidget	*stack;
 	GtkWidget	*stars;
+	GCancellable	*icon_cancellable;
 };
 
 G_DEFINE_TYPE (GsPopularTile, gs_popular_tile, GTK_TYPE_BUTTON)
@@ -99,6 +100,36 @@ app_state_changed (GsApp *app, GParamSpec *pspec, GsPopularTile *tile)
 	g_idle_add (app_state_changed_idle, g_object_ref (tile));
 }
 
+static void
+gs_popular_tile_load_icon_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GsApp *app = GS_APP (source);
+	g_autoptr(GsPopularTile) tile = GS_POPULAR_TILE (user_data);
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+
+	ret = gs_app_load_icon_finish (app, res, &error);
+
+	/* cancelled, or superseded by a load for another app */
+	if (tile->icon_cancellable != g_task_get_cancellable (G_TASK (res)))
+		return;
+	g_clear_object (&tile->icon_cancellable);
+	if (!ret) {
+		g_warning ("failed to load icon: %s", error->message);
+		return;
+	}
+	gs_image_set_from_pixbuf (GTK_IMAGE (tile->image), gs_app_get_pixbuf (app));
+}
+
+static void
+gs_popular_tile_cancel_icon (GsPopularTile *tile)
+{
+	if (tile->icon_cancellable == NULL)
+		return;
+	g_cancellable_cancel (tile->icon_cancellable);
+	g_clear_object (&tile->icon_cancellable);
+}
+
 void
 gs_popular_tile_set_app (GsPopularTile *tile, GsApp *app)
 {
@@ -107,6 +138,7 @@ gs_popular_tile_set_app (GsPopularTile *tile, GsApp *app)
 
 	if (tile->app)
 		g_signal_handlers_disconnect_by_func (tile->app, app_state_changed, tile);
+	gs_popular_tile_cancel_icon (tile);
 
 	g_set_object (&tile->app, app);
 	if (!app)
@@ -127,7 +159,20 @@ gs_popular_tile_set_app (GsPopularTile *tile, GsApp *app)
 		 	  G_CALLBACK (app_state_changed), tile);
 	app_state_changed (tile->app, NULL, tile);
 
-	gs_image_set_from_pixbuf (GTK_IMAGE (tile->image), gs_app_get_pixbuf (tile->app));
+	/* show a placeholder until the icon is decoded */
+	if (gs_app_get_icon_deferred (tile->app)) {
+		gtk_image_set_from_icon_name (GTK_IMAGE (tile->image),
+					      "application-x-executable",
+					      GTK_ICON_SIZE_DIALOG);
+		gtk_image_set_pixel_size (GTK_IMAGE (tile->image), 64);
+		tile->icon_cancellable = g_cancellable_new ();
+		gs_app_load_icon_async (tile->app,
+					tile->icon_cancellable,
+					gs_popular_tile_load_icon_cb,
+					g_object_ref (tile));
+	} else {
+		gs_image_set_from_pixbuf (GTK_IMAGE (tile->image), gs_app_get_pixbuf (tile->app));
+	}
 
 	gtk_label_set_label (GTK_LABEL (tile->label), gs_app_get_name (app));
 }
@@ -141,6 +186,7 @@ gs_popular_tile_destroy (GtkWidget *widget)
 		g_signal_handlers_disconnect_by_func (tile->app, app_state_changed, tile);
 
 	g_clear_object (&tile->app);
+	gs_popular_tile_cancel_icon (tile);
 
 	GTK_WIDGET_CLASS (gs_popular_tile_parent_class)->destroy (widget);
 }
@@ -0,0 +1,141 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "gs-self-test-server.h"
+
+struct GsSelfTestServer {
+	GMainContext		*context;
+	GMainLoop		*loop;
+	GThread			*thread;
+	SoupServer		*server;
+	SoupServerCallback	 callback;
+	gpointer		 user_data;
+	guint			 port;
+	gint			 requests;
+};
+
+/**
+ * gs_self_test_server_cb:
+ **/
+static void
+gs_self_test_server_cb (SoupServer *server,
+			SoupMessage *msg,
+			const char *path,
+			GHashTable *query,
+			SoupClientContext *client,
+			gpointer user_data)
+{
+	GsSelfTestServer *helper = (GsSelfTestServer *) user_data;
+	g_atomic_int_inc (&helper->requests);
+	helper->callback (server, msg, path, query, client, helper->user_data);
+}
+
+/**
+ * gs_self_test_server_thread_cb:
+ **/
+static gpointer
+gs_self_test_server_thread_cb (gpointer user_data)
+{
+	GsSelfTestServer *helper = (GsSelfTestServer *) user_data;
+	g_main_context_push_thread_default (helper->context);
+	g_main_loop_run (helper->loop);
+	g_main_context_pop_thread_default (helper->context);
+	return NULL;
+}
+
+/**
+ * gs_self_test_server_new:
+ * @callback: The handler for every request
+ * @user_data: Data to pass to @callback
+ *
+ * Starts a local stand-in HTTP server in its own thread, so that the
+ * tests can use blocking requests against it. @callback is run in that
+ * thread.
+ *
+ * Returns: A new #GsSelfTestServer, free with gs_self_test_server_free()
+ **/
+GsSelfTestServer *
+gs_self_test_server_new (SoupServerCallback callback, gpointer user_data)
+{
+	GsSelfTestServer *helper;
+	GSList *uris;
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+
+	helper = g_new0 (GsSelfTestServer, 1);
+	helper->callback = callback;
+	helper->user_data = user_data;
+	helper->context = g_main_context_new ();
+	helper->loop = g_main_loop_new (helper->context, FALSE);
+	g_main_context_push_thread_default (helper->context);
+	helper->server = soup_server_new (NULL, NULL);
+	soup_server_add_handler (helper->server, NULL,
+				 gs_self_test_server_cb, helper, NULL);
+	ret = soup_server_listen_local (helper->server, 0,
+					SOUP_SERVER_LISTEN_IPV4_ONLY,
+					&error);
+	g_main_context_pop_thread_default (helper->context);
+	g_assert_no_error (error);
+	g_assert (ret);
+	uris = soup_server_get_uris (helper->server);
+	helper->port = soup_uri_get_port (uris->data);
+	g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+	helper->thread = g_thread_new ("gs-self-test-server",
+				       gs_self_test_server_thread_cb,
+				       helper);
+	return helper;
+}
+
+/**
+ * gs_self_test_server_free:
+ **/
+void
+gs_self_test_server_free (GsSelfTestServer *helper)
+{
+	g_main_loop_quit (helper->loop);
+	g_thread_join (helper->thread);
+	g_object_unref (helper->server);
+	g_main_loop_unref (helper->loop);
+	g_main_context_unref (helper->context);
+	g_free (helper);
+}
+
+/**
+ * gs_self_test_server_get_port:
+ **/
+guint
+gs_self_test_server_get_port (GsSelfTestServer *helper)
+{
+	return helper->port;
+}
+
+/**
+ * gs_self_test_server_get_requests:
+ *
+ * Returns: How many requests the server has been sent so far
+ **/
+guint
+gs_self_test_server_get_requests (GsSelfTestServer *helper)
+{
+	return (guint) g_atomic_int_get (&helper->requests);
+}
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GS_SELF_TEST_SERVER_H
+#define __GS_SELF_TEST_SERVER_H
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+typedef struct GsSelfTestServer	GsSelfTestServer;
+
+GsSelfTestServer	*gs_self_test_server_new	(SoupServerCallback	 callback,
+							 gpointer		 user_data);
+void			 gs_self_test_server_free	(GsSelfTestServer	*server);
+guint			 gs_self_test_server_get_port	(GsSelfTestServer	*server);
+guint			 gs_self_test_server_get_requests (GsSelfTestServer	*server);
+
+G_END_DECLS
+
+#endif /* __GS_SELF_TEST_SERVER_H */
+
+/* vim: set noexpandtab: */
@@ -25,12 +25,17 @@
 #include <glib-object.h>
 #include <gtk/gtk.h>
 #include <glib/gstdio.h>
+#include <utime.h>
+#include <libsoup/soup.h>
+#include <packagekit-glib2/packagekit.h>
 
 #include "gs-app.h"
+#include "gs-icon-pack.h"
 #include "gs-markdown.h"
 #include "gs-plugin.h"
 #include "gs-plugin-loader.h"
 #include "gs-plugin-loader-sync.h"
+#include "gs-self-test-server.h"
 #include "gs-utils.h"
 
 static void
@@ -230,6 +235,12 @@ gs_plugin_func (void)
 	GList *list_dup;
 	GList *list_remove = NULL;
 	GsApp *app;
+	guint i;
+
+	/* every vfunc has a symbol name */
+	for (i = 0; i < GS_PLUGIN_VFUNC_LAST; i++)
+		g_assert (gs_plugin_vfunc_to_string (i) != NULL);
+	g_assert_cmpstr (gs_plugin_vfunc_to_string (GS_PLUGIN_VFUNC_REFINE), ==, "gs_plugin_refine");
 
 	/* add a couple of duplicate IDs */
 	app = gs_app_new ("a");
@@ -285,9 +296,207 @@ gs_app_subsume_func (void)
 	g_assert_cmpstr (gs_app_get_metadata_item (new, "foo"), ==, "bar");
 }
 
+static void
+gs_app_icon_cache_load_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GAsyncResult **result = (GAsyncResult **) user_data;
+	*result = g_object_ref (res);
+}
+
+static void
+gs_app_icon_cache_func (void)
+{
+	gboolean ret;
+	guint hits;
+	guint hits_before;
+	guint misses;
+	guint misses_before;
+	g_autofree gchar *fn = NULL;
+	g_autoptr(AsIcon) icon = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsApp) app1 = NULL;
+	g_autoptr(GsApp) app2 = NULL;
+	g_autoptr(GsApp) app3 = NULL;
+	g_autoptr(GsApp) app4 = NULL;
+	g_autoptr(GAsyncResult) res = NULL;
+	struct utimbuf times;
+
+	/* write an icon to load */
+	fn = g_build_filename (g_get_tmp_dir (), "gs-self-test-icon.png", NULL);
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 64, 64);
+	gdk_pixbuf_fill (pixbuf, 0xff0000ff);
+	ret = gdk_pixbuf_save (pixbuf, fn, "png", &error, NULL);
+	g_assert_no_error (error);
+	g_assert (ret);
+	icon = as_icon_new ();
+	as_icon_set_kind (icon, AS_ICON_KIND_LOCAL);
+	as_icon_set_filename (icon, fn);
+
+	/* only the first app decodes the file */
+	gs_app_get_pixbuf_cache_stats (&hits_before, &misses_before);
+	app1 = gs_app_new ("a.desktop");
+	gs_app_set_icon (app1, icon);
+	ret = gs_app_load_icon (app1, 1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	app2 = gs_app_new ("b.desktop");
+	gs_app_set_icon (app2, icon);
+	ret = gs_app_load_icon (app2, 1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	gs_app_get_pixbuf_cache_stats (&hits, &misses);
+	g_assert_cmpint (hits - hits_before, ==, 1);
+	g_assert_cmpint (misses - misses_before, ==, 1);
+	g_assert (gs_app_get_pixbuf (app1) == gs_app_get_pixbuf (app2));
+
+	/* only decoded when actually needed */
+	gs_app_set_defer_icon_decode (TRUE);
+	app3 = gs_app_new ("c.desktop");
+	gs_app_set_icon (app3, icon);
+	ret = gs_app_load_icon (app3, 2, &error);
+	gs_app_set_defer_icon_decode (FALSE);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (gs_app_get_icon_deferred (app3));
+	g_assert (gs_app_get_pixbuf (app3) == NULL);
+	gs_app_load_icon_async (app3, NULL, gs_app_icon_cache_load_cb, &res);
+	while (res == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	ret = gs_app_load_icon_finish (app3, res, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (gs_app_get_pixbuf (app3) != NULL);
+	g_assert (!gs_app_get_icon_deferred (app3));
+
+	/* a file that has been replaced is decoded again */
+	gdk_pixbuf_fill (pixbuf, 0x00ff00ff);
+	ret = gdk_pixbuf_save (pixbuf, fn, "png", &error, NULL);
+	g_assert_no_error (error);
+	g_assert (ret);
+	times.actime = times.modtime = g_get_real_time () / G_USEC_PER_SEC + 10;
+	g_assert_cmpint (g_utime (fn, &times), ==, 0);
+	gs_app_get_pixbuf_cache_stats (&hits_before, &misses_before);
+	app4 = gs_app_new ("d.desktop");
+	gs_app_set_icon (app4, icon);
+	ret = gs_app_load_icon (app4, 1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	gs_app_get_pixbuf_cache_stats (&hits, &misses);
+	g_assert_cmpint (hits - hits_before, ==, 0);
+	g_assert_cmpint (misses - misses_before, ==, 1);
+	g_assert (gs_app_get_pixbuf (app4) != gs_app_get_pixbuf (app1));
+	g_unlink (fn);
+}
+
+static void
+gs_icon_pack_func (void)
+{
+	gboolean ret;
+	g_autofree gchar *fn = NULL;
+	g_autofree gchar *fn_idx = NULL;
+	g_autofree gchar *fn_lock = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GdkPixbuf) pixbuf1 = NULL;
+	g_autoptr(GdkPixbuf) pixbuf2 = NULL;
+	g_autoptr(GdkPixbuf) pixbuf3 = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsIconPack) pack = NULL;
+	g_autoptr(GsIconPack) pack2 = NULL;
+	g_autoptr(GsIconPack) pack3 = NULL;
+	g_autoptr(GsIconPack) pack4 = NULL;
+
+	fn = g_build_filename (g_get_tmp_dir (), "gs-self-test-icons.pack", NULL);
+	fn_idx = g_strdup_printf ("%s.idx", fn);
+	fn_lock = g_strdup_printf ("%s.lock", fn);
+	g_unlink (fn);
+	g_unlink (fn_idx);
+
+	/* icons are pre-scaled */
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 48, 48);
+	gdk_pixbuf_fill (pixbuf, 0x00ff00ff);
+	pack = gs_icon_pack_new (fn, 1024 * 1024);
+	g_assert (gs_icon_pack_lookup (pack, "http://a/a.png", 1) == NULL);
+	ret = gs_icon_pack_add (pack, "http://a/a.png", pixbuf, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	pixbuf1 = gs_icon_pack_lookup (pack, "http://a/a.png", 1);
+	g_assert (pixbuf1 != NULL);
+	g_assert_cmpint (gdk_pixbuf_get_width (pixbuf1), ==, 64);
+	pixbuf2 = gs_icon_pack_lookup (pack, "http://a/a.png", 2);
+	g_assert (pixbuf2 != NULL);
+	g_assert_cmpint (gdk_pixbuf_get_width (pixbuf2), ==, 128);
+	ret = gs_icon_pack_flush (pack, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* still there when loaded from the index */
+	pack2 = gs_icon_pack_new (fn, 1);
+	pixbuf3 = gs_icon_pack_lookup (pack2, "http://a/a.png", 2);
+	g_assert (pixbuf3 != NULL);
+	g_assert_cmpint (gdk_pixbuf_get_width (pixbuf3), ==, 128);
+
+	/* going over the cap drops the oldest icon */
+	ret = gs_icon_pack_add (pack2, "http://b/b.png", pixbuf, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (gs_icon_pack_lookup (pack2, "http://a/a.png", 1) == NULL);
+	g_clear_object (&pixbuf3);
+	pixbuf3 = gs_icon_pack_lookup (pack2, "http://b/b.png", 1);
+	g_assert (pixbuf3 != NULL);
+	g_assert_cmpint (gs_icon_pack_get_size (pack2), ==, gs_icon_pack_get_size (pack));
+
+	/* icons added by other users of the pack are kept when flushing */
+	pack3 = gs_icon_pack_new (fn, 1024 * 1024);
+	g_clear_object (&pixbuf3);
+	pixbuf3 = gs_icon_pack_lookup (pack3, "http://b/b.png", 1);
+	g_assert (pixbuf3 != NULL);
+	ret = gs_icon_pack_add (pack3, "http://c/c.png", pixbuf, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = gs_icon_pack_add (pack, "http://d/d.png", pixbuf, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = gs_icon_pack_flush (pack, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = gs_icon_pack_flush (pack3, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	pack4 = gs_icon_pack_new (fn, 1024 * 1024);
+	g_clear_object (&pixbuf3);
+	pixbuf3 = gs_icon_pack_lookup (pack4, "http://b/b.png", 1);
+	g_assert (pixbuf3 != NULL);
+	g_clear_object (&pixbuf3);
+	pixbuf3 = gs_icon_pack_lookup (pack4, "http://c/c.png", 1);
+	g_assert (pixbuf3 != NULL);
+	g_clear_object (&pixbuf3);
+	pixbuf3 = gs_icon_pack_lookup (pack4, "http://d/d.png", 1);
+	g_assert (pixbuf3 != NULL);
+
+	/* an index flushed by another user is picked up without adding */
+	g_assert (!gs_icon_pack_contains (pack4, "http://e/e.png", 1));
+	ret = gs_icon_pack_add (pack3, "http://e/e.png", pixbuf, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = gs_icon_pack_flush (pack3, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (gs_icon_pack_contains (pack4, "http://e/e.png", 1));
+	g_clear_object (&pixbuf3);
+	pixbuf3 = gs_icon_pack_lookup (pack4, "http://e/e.png", 2);
+	g_assert (pixbuf3 != NULL);
+	g_assert_cmpint (gdk_pixbuf_get_width (pixbuf3), ==, 128);
+
+	g_unlink (fn);
+	g_unlink (fn_idx);
+	g_unlink (fn_lock);
+}
+
 static void
 gs_app_func (void)
 {
+	guint serial = 0;
 	g_autoptr(GsApp) app = NULL;
 
 	app = gs_app_new ("gnome-software");
@@ -311,6 +520,41 @@ gs_app_func (void)
 	g_assert_cmpstr (gs_app_get_name (app), ==, "dave");
 	gs_app_set_name (app, GS_APP_QUALITY_HIGHEST, "hugh");
 	g_assert_cmpstr (gs_app_get_name (app), ==, "hugh");
+
+	/* check the refine bookkeeping is reset for a new generation */
+	g_assert_cmpint (gs_app_get_refined_flags (app, 1, &serial), ==, 0);
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING, 1, serial);
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE, 1, serial);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 1, NULL), ==,
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING |
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 2, NULL), ==, 0);
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE, 2, serial);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 2, NULL), ==,
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE);
+
+	/* check data a plugin failed to add is not recorded, just once */
+	gs_app_add_refine_failed (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY);
+	gs_app_add_refined_flags (app,
+				  GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY |
+				  GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL, 2, serial);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 2, NULL), ==,
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE |
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL);
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY, 2, serial);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 2, NULL), ==,
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE |
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL |
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY);
+
+	/* check a refine that overlapped a clear does not record anything */
+	gs_app_clear_refined_flags (app);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 2, NULL), ==, 0);
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE, 2, serial);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 2, &serial), ==, 0);
+	gs_app_add_refined_flags (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE, 2, serial);
+	g_assert_cmpint (gs_app_get_refined_flags (app, 2, NULL), ==,
+			 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE);
 }
 
 static guint _status_changed_cnt = 0;
@@ -491,6 +735,49 @@ gs_plugin_loader_func (void)
 	g_object_unref (app);
 }
 
+static void
+gs_plugin_loader_local_ratings_func (void)
+{
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsApp) app = NULL;
+	g_autoptr(GsPluginLoader) loader = NULL;
+
+	/* not avaiable in make distcheck */
+	if (!g_file_test (GS_MODULESETDIR, G_FILE_TEST_EXISTS))
+		return;
+
+	/* set a rating, which is only written to the database later */
+	loader = gs_plugin_loader_new ();
+	gs_plugin_loader_set_location (loader, "./plugins/.libs");
+	ret = gs_plugin_loader_setup (loader, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	gs_plugin_loader_set_enabled (loader, "fedora-tagger-ratings", FALSE);
+	app = gs_app_new ("self-test-local-ratings.desktop");
+	gs_app_set_rating (app, 35);
+	ret = gs_plugin_loader_app_action (loader, app,
+					   GS_PLUGIN_LOADER_ACTION_SET_RATING,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the pending rating is written when the plugin is destroyed */
+	g_clear_object (&loader);
+	loader = gs_plugin_loader_new ();
+	gs_plugin_loader_set_location (loader, "./plugins/.libs");
+	ret = gs_plugin_loader_setup (loader, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	gs_app_set_rating (app, -1);
+	ret = gs_plugin_loader_app_refine (loader, app,
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (gs_app_get_rating (app), ==, 35);
+}
+
 static void
 gs_plugin_loader_refine_func (void)
 {
@@ -534,6 +821,646 @@ gs_plugin_loader_refine_func (void)
 	g_assert_cmpstr (url, ==, "http://www.gimp.org/");
 }
 
+/* a stand-in for the PackageKit daemon, run in its own thread */
+typedef struct {
+	GMainContext	*context;
+	GMainLoop	*loop;
+	GThread		*thread;
+	GDBusConnection	*connection;
+	GDBusNodeInfo	*introspection;
+	GArray		*registrations;
+	guint		 transactions;
+	gint		 get_details;
+	gint		 get_files;
+	gint		 get_repo_list;
+	gint		 get_updates;
+	gint		 get_updates_delay;	/* ms */
+	gint		 resolve;
+	gint		 search_files;
+} GsSelfTestPackagekit;
+
+static const gchar gs_self_test_packagekit_xml[] =
+	"<node>"
+	"  <interface name='org.freedesktop.PackageKit'>"
+	"    <method name='CreateTransaction'>"
+	"      <arg type='o' name='object_path' direction='out'/>"
+	"    </method>"
+	"  </interface>"
+	"  <interface name='org.freedesktop.PackageKit.Transaction'>"
+	"    <method name='SetHints'>"
+	"      <arg type='as' name='hints' direction='in'/>"
+	"    </method>"
+	"    <method name='Resolve'>"
+	"      <arg type='t' name='filter' direction='in'/>"
+	"      <arg type='as' name='packages' direction='in'/>"
+	"    </method>"
+	"    <method name='SearchFiles'>"
+	"      <arg type='t' name='filter' direction='in'/>"
+	"      <arg type='as' name='values' direction='in'/>"
+	"    </method>"
+	"    <method name='GetDetails'>"
+	"      <arg type='as' name='package_ids' direction='in'/>"
+	"    </method>"
+	"    <method name='GetFiles'>"
+	"      <arg type='as' name='package_ids' direction='in'/>"
+	"    </method>"
+	"    <method name='GetRepoList'>"
+	"      <arg type='t' name='filter' direction='in'/>"
+	"    </method>"
+	"    <method name='GetUpdates'>"
+	"      <arg type='t' name='filter' direction='in'/>"
+	"    </method>"
+	"  </interface>"
+	"</node>";
+
+#define GS_SELF_TEST_PACKAGEKIT_APP_ID		"gs-self-test-app;1.2.3-1;x86_64;installed:gs-self-test-repo"
+#define GS_SELF_TEST_PACKAGEKIT_FOUND_ID	"gs-self-test-found;2.0-1;noarch;installed:gs-self-test-repo"
+#define GS_SELF_TEST_PACKAGEKIT_DESKTOP		"/usr/share/applications/gs-self-test-found.desktop"
+#define GS_SELF_TEST_PACKAGEKIT_OTHER_ID	"gs-self-test-other;3.0-1;noarch;installed:gs-self-test-repo"
+#define GS_SELF_TEST_PACKAGEKIT_OTHER_DESKTOP	"/usr/share/applications/gs-self-test-other.desktop"
+
+static void
+gs_self_test_packagekit_emit (GDBusConnection *connection,
+			      const gchar *object_path,
+			      const gchar *signal_name,
+			      GVariant *parameters)
+{
+	g_dbus_connection_emit_signal (connection, NULL, object_path,
+				       "org.freedesktop.PackageKit.Transaction",
+				       signal_name, parameters, NULL);
+}
+
+static void
+gs_self_test_packagekit_transaction_cb (GDBusConnection *connection,
+					const gchar *sender,
+					const gchar *object_path,
+					const gchar *interface_name,
+					const gchar *method_name,
+					GVariant *parameters,
+					GDBusMethodInvocation *invocation,
+					gpointer user_data)
+{
+	GsSelfTestPackagekit *helper = (GsSelfTestPackagekit *) user_data;
+	GVariantBuilder builder;
+	PkExitEnum exit_enum = PK_EXIT_ENUM_SUCCESS;
+	guint i;
+	g_autofree const gchar **values = NULL;
+
+	/* the results are signals sent after the method returns */
+	g_dbus_method_invocation_return_value (invocation, NULL);
+	if (g_strcmp0 (method_name, "SetHints") == 0)
+		return;
+
+	if (g_strcmp0 (method_name, "GetRepoList") == 0) {
+		g_atomic_int_inc (&helper->get_repo_list);
+		gs_self_test_packagekit_emit (connection, object_path, "RepoDetail",
+					      g_variant_new ("(ssb)",
+							     "gs-self-test-repo",
+							     "GNOME Software Self Test",
+							     TRUE));
+	} else if (g_strcmp0 (method_name, "GetUpdates") == 0) {
+		g_atomic_int_inc (&helper->get_updates);
+		g_usleep ((gulong) g_atomic_int_get (&helper->get_updates_delay) * 1000);
+	} else if (g_strcmp0 (method_name, "Resolve") == 0) {
+		g_atomic_int_inc (&helper->resolve);
+		g_variant_get (parameters, "(t^a&s)", NULL, &values);
+		for (i = 0; values[i] != NULL; i++) {
+			if (g_strcmp0 (values[i], "gs-self-test-error") == 0) {
+				gs_self_test_packagekit_emit (connection, object_path, "ErrorCode",
+							      g_variant_new ("(us)",
+									     PK_ERROR_ENUM_INTERNAL_ERROR,
+									     "self test failure"));
+				exit_enum = PK_EXIT_ENUM_FAILED;
+				break;
+			}
+			if (g_strcmp0 (values[i], "gs-self-test-app") != 0)
+				continue;
+			gs_self_test_packagekit_emit (connection, object_path, "Package",
+						      g_variant_new ("(uss)",
+								     PK_INFO_ENUM_INSTALLED,
+								     GS_SELF_TEST_PACKAGEKIT_APP_ID,
+								     "Self test application"));
+		}
+	} else if (g_strcmp0 (method_name, "SearchFiles") == 0) {
+		g_atomic_int_inc (&helper->search_files);
+		g_variant_get (parameters, "(t^a&s)", NULL, &values);
+		for (i = 0; values[i] != NULL; i++) {
+			if (g_strcmp0 (values[i], GS_SELF_TEST_PACKAGEKIT_DESKTOP) == 0) {
+				gs_self_test_packagekit_emit (connection, object_path, "Package",
+							      g_variant_new ("(uss)",
+									     PK_INFO_ENUM_INSTALLED,
+									     GS_SELF_TEST_PACKAGEKIT_FOUND_ID,
+									     "Self test found application"));
+			} else if (g_strcmp0 (values[i], GS_SELF_TEST_PACKAGEKIT_OTHER_DESKTOP) == 0) {
+				gs_self_test_packagekit_emit (connection, object_path, "Package",
+							      g_variant_new ("(uss)",
+									     PK_INFO_ENUM_INSTALLED,
+									     GS_SELF_TEST_PACKAGEKIT_OTHER_ID,
+									     "Self test other application"));
+			}
+		}
+	} else if (g_strcmp0 (method_name, "GetFiles") == 0) {
+		g_atomic_int_inc (&helper->get_files);
+		g_variant_get (parameters, "(^a&s)", &values);
+		for (i = 0; values[i] != NULL; i++) {
+			const gchar *files[] = { "/usr/bin/gs-self-test", NULL, NULL };
+			if (g_strcmp0 (values[i], GS_SELF_TEST_PACKAGEKIT_FOUND_ID) == 0)
+				files[1] = GS_SELF_TEST_PACKAGEKIT_DESKTOP;
+			else if (g_strcmp0 (values[i], GS_SELF_TEST_PACKAGEKIT_OTHER_ID) == 0)
+				files[1] = GS_SELF_TEST_PACKAGEKIT_OTHER_DESKTOP;
+			gs_self_test_packagekit_emit (connection, object_path, "Files",
+						      g_variant_new ("(s^as)", values[i], files));
+		}
+	} else if (g_strcmp0 (method_name, "GetDetails") == 0) {
+		g_atomic_int_inc (&helper->get_details);
+		g_variant_get (parameters, "(^a&s)", &values);
+		for (i = 0; values[i] != NULL; i++) {
+			g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+			g_variant_builder_add (&builder, "{sv}", "package-id",
+					       g_variant_new_string (values[i]));
+			g_variant_builder_add (&builder, "{sv}", "license",
+					       g_variant_new_string ("GPL-2.0+"));
+			g_variant_builder_add (&builder, "{sv}", "url",
+					       g_variant_new_string ("https://example.com/"));
+			g_variant_builder_add (&builder, "{sv}", "summary",
+					       g_variant_new_string ("Self test application"));
+			g_variant_builder_add (&builder, "{sv}", "description",
+					       g_variant_new_string ("Used by the self tests."));
+			g_variant_builder_add (&builder, "{sv}", "group",
+					       g_variant_new_uint32 (PK_GROUP_ENUM_SYSTEM));
+			g_variant_builder_add (&builder, "{sv}", "size",
+					       g_variant_new_uint64 (1024));
+			gs_self_test_packagekit_emit (connection, object_path, "Details",
+						      g_variant_new ("(a{sv})", &builder));
+		}
+	}
+
+	gs_self_test_packagekit_emit (connection, object_path, "Finished",
+				      g_variant_new ("(uu)", exit_enum, 0));
+}
+
+static const GDBusInterfaceVTable gs_self_test_packagekit_transaction_vtable = {
+	gs_self_test_packagekit_transaction_cb,
+	NULL,
+	NULL
+};
+
+static void
+gs_self_test_packagekit_method_cb (GDBusConnection *connection,
+				   const gchar *sender,
+				   const gchar *object_path,
+				   const gchar *interface_name,
+				   const gchar *method_name,
+				   GVariant *parameters,
+				   GDBusMethodInvocation *invocation,
+				   gpointer user_data)
+{
+	GsSelfTestPackagekit *helper = (GsSelfTestPackagekit *) user_data;
+	GError *error = NULL;
+	guint id;
+	g_autofree gchar *tid = NULL;
+
+	/* only CreateTransaction is in the introspection data */
+	tid = g_strdup_printf ("/gs_self_test/%u", ++helper->transactions);
+	id = g_dbus_connection_register_object (connection, tid,
+					       g_dbus_node_info_lookup_interface (helper->introspection,
+										  "org.freedesktop.PackageKit.Transaction"),
+					       &gs_self_test_packagekit_transaction_vtable,
+					       helper, NULL, &error);
+	if (id == 0) {
+		g_dbus_method_invocation_take_error (invocation, error);
+		return;
+	}
+	g_array_append_val (helper->registrations, id);
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_new ("(o)", tid));
+}
+
+static const GDBusInterfaceVTable gs_self_test_packagekit_vtable = {
+	gs_self_test_packagekit_method_cb,
+	NULL,
+	NULL
+};
+
+static gpointer
+gs_self_test_packagekit_thread_cb (gpointer user_data)
+{
+	GsSelfTestPackagekit *helper = (GsSelfTestPackagekit *) user_data;
+	g_main_context_push_thread_default (helper->context);
+	g_main_loop_run (helper->loop);
+	g_main_context_pop_thread_default (helper->context);
+	return NULL;
+}
+
+static void
+gs_self_test_packagekit_start (GsSelfTestPackagekit *helper, const gchar *address)
+{
+	guint id;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) reply = NULL;
+
+	helper->introspection = g_dbus_node_info_new_for_xml (gs_self_test_packagekit_xml,
+							      &error);
+	g_assert_no_error (error);
+	helper->registrations = g_array_new (FALSE, FALSE, sizeof (guint));
+	helper->context = g_main_context_new ();
+	helper->loop = g_main_loop_new (helper->context, FALSE);
+
+	/* the methods are dispatched in the context of the thread */
+	g_main_context_push_thread_default (helper->context);
+	helper->connection = g_dbus_connection_new_for_address_sync (address,
+								     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+								     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+								     NULL, NULL, &error);
+	g_assert_no_error (error);
+	id = g_dbus_connection_register_object (helper->connection,
+						"/org/freedesktop/PackageKit",
+						g_dbus_node_info_lookup_interface (helper->introspection,
+										   "org.freedesktop.PackageKit"),
+						&gs_self_test_packagekit_vtable,
+						helper, NULL, &error);
+	g_assert_no_error (error);
+	g_array_append_val (helper->registrations, id);
+	g_main_context_pop_thread_default (helper->context);
+
+	/* own the name before any client asks for it */
+	reply = g_dbus_connection_call_sync (helper->connection,
+					     "org.freedesktop.DBus",
+					     "/org/freedesktop/DBus",
+					     "org.freedesktop.DBus",
+					     "RequestName",
+					     g_variant_new ("(su)",
+							    "org.freedesktop.PackageKit",
+							    G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE),
+					     G_VARIANT_TYPE ("(u)"),
+					     G_DBUS_CALL_FLAGS_NONE,
+					     -1, NULL, &error);
+	g_assert_no_error (error);
+	helper->thread = g_thread_new ("gs-self-test-packagekit",
+				       gs_self_test_packagekit_thread_cb,
+				       helper);
+}
+
+static void
+gs_self_test_packagekit_stop (GsSelfTestPackagekit *helper)
+{
+	guint i;
+
+	g_main_loop_quit (helper->loop);
+	g_thread_join (helper->thread);
+	for (i = 0; i < helper->registrations->len; i++) {
+		g_dbus_connection_unregister_object (helper->connection,
+						     g_array_index (helper->registrations, guint, i));
+	}
+	g_dbus_connection_close_sync (helper->connection, NULL, NULL);
+	g_object_unref (helper->connection);
+	g_array_unref (helper->registrations);
+	g_dbus_node_info_unref (helper->introspection);
+	g_main_loop_unref (helper->loop);
+	g_main_context_unref (helper->context);
+}
+
+static void
+gs_self_test_rmtree (const gchar *directory)
+{
+	const gchar *filename;
+	g_autoptr(GDir) dir = NULL;
+
+	dir = g_dir_open (directory, 0, NULL);
+	if (dir == NULL)
+		return;
+	while ((filename = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *path = g_build_filename (directory, filename, NULL);
+		if (g_file_test (path, G_FILE_TEST_IS_DIR) &&
+		    !g_file_test (path, G_FILE_TEST_IS_SYMLINK)) {
+			gs_self_test_rmtree (path);
+		} else {
+			g_unlink (path);
+		}
+	}
+	g_rmdir (directory);
+}
+
+static void
+gs_plugin_loader_packagekit_refine_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GAsyncResult **result = (GAsyncResult **) user_data;
+	*result = g_object_ref (res);
+}
+
+static void
+gs_plugin_loader_packagekit_refine_func (void)
+{
+	GsSelfTestPackagekit helper = { NULL };
+	gboolean ret;
+	gint get_updates;
+	g_autoptr(GAsyncResult) res1 = NULL;
+	g_autoptr(GAsyncResult) res2 = NULL;
+	g_autoptr(GDBusConnection) system_bus = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GTestDBus) bus = NULL;
+	g_autoptr(GsApp) app1 = NULL;
+	g_autoptr(GsApp) app2 = NULL;
+	g_autoptr(GsApp) app3 = NULL;
+	g_autoptr(GsApp) app4 = NULL;
+	g_autoptr(GsApp) app5 = NULL;
+	g_autoptr(GsApp) app6 = NULL;
+	g_autoptr(GsApp) app7 = NULL;
+	g_autoptr(GsApp) addon1 = NULL;
+	g_autoptr(GsApp) addon2 = NULL;
+	g_autoptr(GsPluginLoader) loader = NULL;
+
+	/* not avaiable in make distcheck */
+	if (!g_file_test (GS_MODULESETDIR, G_FILE_TEST_EXISTS))
+		return;
+
+	/* the system bus cannot be changed once it is connected, so use a
+	 * new process with its own cache directory */
+	if (!g_test_subprocess ()) {
+		g_autofree gchar *cache_dir = NULL;
+		g_autofree gchar *cache_dir_old = NULL;
+
+		cache_dir = g_dir_make_tmp ("gs-self-test-XXXXXX", &error);
+		g_assert_no_error (error);
+		cache_dir_old = g_strdup (g_getenv ("XDG_CACHE_HOME"));
+		g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+		g_test_trap_subprocess (NULL, 0, G_TEST_SUBPROCESS_INHERIT_STDERR);
+		if (cache_dir_old != NULL)
+			g_setenv ("XDG_CACHE_HOME", cache_dir_old, TRUE);
+		else
+			g_unsetenv ("XDG_CACHE_HOME");
+		gs_self_test_rmtree (cache_dir);
+		g_test_trap_assert_passed ();
+		return;
+	}
+
+	/* use a private bus as the system bus */
+	bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_test_dbus_up (bus);
+	g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address (bus), TRUE);
+	system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	g_assert_no_error (error);
+	g_dbus_connection_set_exit_on_close (system_bus, FALSE);
+	gs_self_test_packagekit_start (&helper, g_test_dbus_get_bus_address (bus));
+
+	/* load the plugins */
+	loader = gs_plugin_loader_new ();
+	gs_plugin_loader_set_location (loader, "./plugins/.libs");
+	ret = gs_plugin_loader_setup (loader, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = gs_plugin_loader_set_enabled (loader, "packagekit-refine", TRUE);
+	g_assert (ret);
+
+	/* the repo list and resolve are in the first round, then details */
+	app1 = gs_app_new ("gs-self-test-app");
+	gs_app_add_source (app1, "gs-self-test-app");
+	ret = gs_plugin_loader_app_refine (loader, app1,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENCE |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (gs_app_get_source_id_default (app1), ==, GS_SELF_TEST_PACKAGEKIT_APP_ID);
+	g_assert_cmpint (gs_app_get_state (app1), ==, AS_APP_STATE_INSTALLED);
+	g_assert_cmpstr (gs_app_get_version (app1), ==, "1.2.3-1");
+	g_assert_cmpstr (gs_app_get_origin (app1), ==, "GNOME Software Self Test");
+	g_assert (g_strstr_len (gs_app_get_licence (app1), -1, "GPL-2.0+") != NULL);
+	g_assert_cmpstr (gs_app_get_url (app1, AS_URL_KIND_HOMEPAGE), ==, "https://example.com/");
+	g_assert_cmpint (g_atomic_int_get (&helper.get_repo_list), ==, 1);
+	g_assert_cmpint (g_atomic_int_get (&helper.resolve), ==, 1);
+	g_assert_cmpint (g_atomic_int_get (&helper.get_details), ==, 1);
+	g_assert_cmpint (g_atomic_int_get (&helper.search_files), ==, 0);
+
+	/* opening the details page again does not ask PackageKit */
+	ret = gs_plugin_loader_app_refine (loader, app1,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENCE |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (g_atomic_int_get (&helper.get_repo_list), ==, 1);
+	g_assert_cmpint (g_atomic_int_get (&helper.resolve), ==, 1);
+	g_assert_cmpint (g_atomic_int_get (&helper.get_details), ==, 1);
+
+	/* nothing resolved, so the desktop file is searched for */
+	app2 = gs_app_new ("gs-self-test-found.desktop");
+	gs_app_add_source (app2, "gs-self-test-missing");
+	gs_app_set_metadata (app2, "DataDir::desktop-filename", GS_SELF_TEST_PACKAGEKIT_DESKTOP);
+	ret = gs_plugin_loader_app_refine (loader, app2,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (gs_app_get_source_id_default (app2), ==, GS_SELF_TEST_PACKAGEKIT_FOUND_ID);
+	g_assert_cmpint (g_atomic_int_get (&helper.resolve), ==, 2);
+	g_assert_cmpint (g_atomic_int_get (&helper.search_files), ==, 1);
+
+	/* a failure in the first round while another stage is in flight */
+	app3 = gs_app_new ("gs-self-test-error");
+	gs_app_add_source (app3, "gs-self-test-error");
+	ret = gs_plugin_loader_app_refine (loader, app3,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY,
+					   NULL, &error);
+	g_assert (error != NULL);
+	g_assert (!ret);
+	g_clear_error (&error);
+	g_assert_cmpint (g_atomic_int_get (&helper.resolve), ==, 3);
+	g_assert_cmpint (g_atomic_int_get (&helper.get_updates), ==, 1);
+
+	/* nothing was recorded for the failed refine, so it is retried */
+	ret = gs_plugin_loader_app_refine (loader, app3,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY,
+					   NULL, &error);
+	g_assert (error != NULL);
+	g_assert (!ret);
+	g_clear_error (&error);
+	g_assert_cmpint (g_atomic_int_get (&helper.resolve), ==, 4);
+
+	/* the contexts were popped, so the next refine still works */
+	app4 = gs_app_new ("gs-self-test-app2");
+	gs_app_add_source (app4, "gs-self-test-app");
+	ret = gs_plugin_loader_app_refine (loader, app4,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (gs_app_get_version (app4), ==, "1.2.3-1");
+
+	/* the addons are refined together, so the packages found for both
+	 * desktop files are mapped back with one GetFiles */
+	app5 = gs_app_new ("gs-self-test-parent");
+	addon1 = gs_app_new ("gs-self-test-addon.desktop");
+	gs_app_set_metadata (addon1, "DataDir::desktop-filename", GS_SELF_TEST_PACKAGEKIT_DESKTOP);
+	gs_app_add_addon (app5, addon1);
+	addon2 = gs_app_new ("gs-self-test-other.desktop");
+	gs_app_set_metadata (addon2, "DataDir::desktop-filename", GS_SELF_TEST_PACKAGEKIT_OTHER_DESKTOP);
+	gs_app_add_addon (app5, addon2);
+	ret = gs_plugin_loader_app_refine (loader, app5,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (gs_app_get_source_id_default (addon1), ==, GS_SELF_TEST_PACKAGEKIT_FOUND_ID);
+	g_assert_cmpstr (gs_app_get_source_id_default (addon2), ==, GS_SELF_TEST_PACKAGEKIT_OTHER_ID);
+	g_assert_cmpint (g_atomic_int_get (&helper.search_files), ==, 2);
+	g_assert_cmpint (g_atomic_int_get (&helper.get_files), ==, 1);
+
+	/* two refines in flight at once share one GetUpdates, which is slow
+	 * enough that the second starts before the first has the list */
+	get_updates = g_atomic_int_get (&helper.get_updates);
+	g_atomic_int_set (&helper.get_updates_delay, 200);
+	app6 = gs_app_new ("gs-self-test-updates1");
+	app7 = gs_app_new ("gs-self-test-updates2");
+	gs_plugin_loader_app_refine_async (loader, app6,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY,
+					   NULL, gs_plugin_loader_packagekit_refine_cb, &res1);
+	gs_plugin_loader_app_refine_async (loader, app7,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT |
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY,
+					   NULL, gs_plugin_loader_packagekit_refine_cb, &res2);
+	while (res1 == NULL || res2 == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	g_atomic_int_set (&helper.get_updates_delay, 0);
+	ret = gs_plugin_loader_app_refine_finish (loader, res1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = gs_plugin_loader_app_refine_finish (loader, res2, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (g_atomic_int_get (&helper.get_updates) - get_updates, ==, 1);
+
+	g_clear_object (&loader);
+	gs_self_test_packagekit_stop (&helper);
+	g_clear_object (&system_bus);
+	g_test_dbus_down (bus);
+}
+
+static void
+gs_self_test_icon_cb (SoupServer *server,
+		      SoupMessage *msg,
+		      const char *path,
+		      GHashTable *query,
+		      SoupClientContext *client,
+		      gpointer user_data)
+{
+	gchar *data = NULL;
+	gsize len = 0;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 64, 64);
+	gdk_pixbuf_fill (pixbuf, 0x0000ffff);
+	if (!gdk_pixbuf_save_to_buffer (pixbuf, &data, &len, "png", NULL, NULL)) {
+		soup_message_set_status (msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	soup_message_set_response (msg, "image/png", SOUP_MEMORY_TAKE, data, len);
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+}
+
+static void
+gs_plugin_loader_icons_func (void)
+{
+	GsSelfTestServer *server;
+	gboolean ret;
+	guint i;
+	g_autofree gchar *url = NULL;
+	g_autofree gchar *url_shared = NULL;
+	g_autoptr(AsIcon) icon = NULL;
+	g_autoptr(AsIcon) icon_shared = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsApp) app1 = NULL;
+	g_autoptr(GsApp) app2 = NULL;
+	g_autoptr(GsApp) parent = NULL;
+	g_autoptr(GsPluginLoader) loader = NULL;
+
+	/* not avaiable in make distcheck */
+	if (!g_file_test (GS_MODULESETDIR, G_FILE_TEST_EXISTS))
+		return;
+
+	/* serve icons from a local stand-in server in its own thread */
+	server = gs_self_test_server_new (gs_self_test_icon_cb, NULL);
+
+	/* load the plugins */
+	loader = gs_plugin_loader_new ();
+	gs_plugin_loader_set_location (loader, "./plugins/.libs");
+	ret = gs_plugin_loader_setup (loader, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the icon is downloaded */
+	url = g_strdup_printf ("http://127.0.0.1:%u/%" G_GINT64_FORMAT ".png",
+			       gs_self_test_server_get_port (server),
+			       g_get_real_time ());
+	icon = as_icon_new ();
+	as_icon_set_kind (icon, AS_ICON_KIND_REMOTE);
+	as_icon_set_url (icon, url);
+	app1 = gs_app_new ("self-test-remote1.desktop");
+	gs_app_set_icon (app1, icon);
+	ret = gs_plugin_loader_app_refine (loader, app1,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (gs_app_get_pixbuf (app1) != NULL);
+	g_assert_cmpint (gs_self_test_server_get_requests (server), ==, 1);
+
+	/* and then found in the icon pack */
+	app2 = gs_app_new ("self-test-remote2.desktop");
+	gs_app_set_icon (app2, icon);
+	ret = gs_plugin_loader_app_refine (loader, app2,
+					   GS_PLUGIN_REFINE_FLAGS_DEFAULT,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (gs_app_get_pixbuf (app2) != NULL);
+	g_assert_cmpint (gs_self_test_server_get_requests (server), ==, 1);
+
+	/* the addons are refined as one list, and all share one new icon
+	 * which should only be downloaded once */
+	url_shared = g_strdup_printf ("http://127.0.0.1:%u/shared-%" G_GINT64_FORMAT ".png",
+				      gs_self_test_server_get_port (server),
+				      g_get_real_time ());
+	icon_shared = as_icon_new ();
+	as_icon_set_kind (icon_shared, AS_ICON_KIND_REMOTE);
+	as_icon_set_url (icon_shared, url_shared);
+	parent = gs_app_new ("self-test-remote-parent.desktop");
+	for (i = 0; i < 3; i++) {
+		g_autofree gchar *id = NULL;
+		g_autoptr(GsApp) addon = NULL;
+		id = g_strdup_printf ("self-test-remote-addon%u.desktop", i);
+		addon = gs_app_new (id);
+		gs_app_set_icon (addon, icon_shared);
+		gs_app_add_addon (parent, addon);
+	}
+	ret = gs_plugin_loader_app_refine (loader, parent,
+					   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS,
+					   NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (i = 0; i < 3; i++) {
+		GsApp *addon = g_ptr_array_index (gs_app_get_addons (parent), i);
+		g_assert (gs_app_get_pixbuf (addon) != NULL);
+	}
+	g_assert_cmpint (gs_self_test_server_get_requests (server), ==, 2);
+
+	g_clear_object (&loader);
+	gs_self_test_server_free (server);
+}
+
 static void
 gs_plugin_loader_empty_func (void)
 {
@@ -681,6 +1608,16 @@ gs_plugin_loader_webapps_func (void)
 int
 main (int argc, char **argv)
 {
+	gint retval;
+	g_autofree gchar *data_dir = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* keep the icon pack and any AppStream files out of the real home,
+	 * which has to be set before anything looks up the directory */
+	data_dir = g_dir_make_tmp ("gs-self-test-XXXXXX", &error);
+	g_assert_no_error (error);
+	g_setenv ("XDG_DATA_HOME", data_dir, TRUE);
+
 	gtk_init (&argc, &argv);
 	g_test_init (&argc, &argv, NULL);
 	g_setenv ("G_MESSAGES_DEBUG", "all", TRUE);
@@ -692,16 +1629,23 @@ main (int argc, char **argv)
 	/* tests go here */
 	g_test_add_func ("/gnome-software/markdown", gs_markdown_func);
 	g_test_add_func ("/gnome-software/plugin-loader{refine}", gs_plugin_loader_refine_func);
+	g_test_add_func ("/gnome-software/plugin-loader{packagekit-refine}", gs_plugin_loader_packagekit_refine_func);
+	g_test_add_func ("/gnome-software/plugin-loader{icons}", gs_plugin_loader_icons_func);
+	g_test_add_func ("/gnome-software/plugin-loader{local-ratings}", gs_plugin_loader_local_ratings_func);
 	g_test_add_func ("/gnome-software/plugin", gs_plugin_func);
 	g_test_add_func ("/gnome-software/app", gs_app_func);
 	g_test_add_func ("/gnome-software/app{subsume}", gs_app_subsume_func);
+	g_test_add_func ("/gnome-software/app{icon-cache}", gs_app_icon_cache_func);
+	g_test_add_func ("/gnome-software/icon-pack", gs_icon_pack_func);
 	if (g_getenv ("HAS_APPSTREAM") != NULL)
 		g_test_add_func ("/gnome-software/plugin-loader{empty}", gs_plugin_loader_empty_func);
 	g_test_add_func ("/gnome-software/plugin-loader{dedupe}", gs_plugin_loader_dedupe_func);
 	if(0)g_test_add_func ("/gnome-software/plugin-loader", gs_plugin_loader_func);
 	if(0)g_test_add_func ("/gnome-software/plugin-loader{webapps}", gs_plugin_loader_webapps_func);
 
-	return g_test_run ();
+	retval = g_test_run ();
+	gs_self_test_rmtree (data_dir);
+	return retval;
 }
 
 /* vim: set noexpandtab: */
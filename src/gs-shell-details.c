@@ -543,6 +543,32 @@ gs_shell_details_set_description (GsShellDetails *self, const gchar *tmp)
 	}
 }
 
+/**
+ * gs_shell_details_load_icon_cb:
+ **/
+static void
+gs_shell_details_load_icon_cb (GObject *source,
+			       GAsyncResult *res,
+			       gpointer user_data)
+{
+	GsApp *app = GS_APP (source);
+	GsShellDetails *self = GS_SHELL_DETAILS (user_data);
+	g_autoptr(GError) error = NULL;
+
+	if (!gs_app_load_icon_finish (app, res, &error)) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("failed to load icon: %s", error->message);
+		return;
+	}
+
+	/* the user moved on to another application */
+	if (app != self->app)
+		return;
+	gs_image_set_from_pixbuf (GTK_IMAGE (self->application_details_icon),
+				  gs_app_get_pixbuf (app));
+	gtk_widget_set_visible (self->application_details_icon, TRUE);
+}
+
 /**
  * gs_shell_details_refresh_all:
  **/
@@ -600,6 +626,12 @@ gs_shell_details_refresh_all (GsShellDetails *self)
 	if (pixbuf != NULL) {
 		gs_image_set_from_pixbuf (GTK_IMAGE (self->application_details_icon), pixbuf);
 		gtk_widget_set_visible (self->application_details_icon, TRUE);
+	} else if (gs_app_get_icon_deferred (self->app)) {
+		gtk_widget_set_visible (self->application_details_icon, FALSE);
+		gs_app_load_icon_async (self->app,
+					self->cancellable,
+					gs_shell_details_load_icon_cb,
+					self);
 	} else {
 		gtk_widget_set_visible (self->application_details_icon, FALSE);
 	}
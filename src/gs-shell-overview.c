@@ -58,6 +58,7 @@ typedef struct
 	GtkWidget		*flowbox_categories;
 	GtkWidget		*popular_heading;
 	GtkWidget		*popular_rotating_heading;
+	GtkWidget		*progressbar_overview;
 	GtkWidget		*scrolledwindow_overview;
 	GtkWidget		*stack_overview;
 } GsShellOverviewPrivate;
@@ -355,6 +356,7 @@ gs_shell_overview_load (GsShellOverview *self)
 {
 	GsShellOverviewPrivate *priv = gs_shell_overview_get_instance_private (self);
 	const gchar *category_of_day;
+	guint setup_progress;
 	g_autoptr(GDateTime) date = NULL;
 
 	priv->empty = TRUE;
@@ -388,6 +390,14 @@ gs_shell_overview_load (GsShellOverview *self)
 	g_free (priv->category_of_day);
 	priv->category_of_day = g_strdup (category_of_day);
 
+	/* the requests wait for the plugins to finish loading their data */
+	setup_progress = gs_plugin_loader_get_setup_progress (priv->plugin_loader);
+	if (setup_progress < 100) {
+		gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (priv->progressbar_overview),
+					       (gdouble) setup_progress / 100);
+		gtk_stack_set_visible_child_name (GTK_STACK (priv->stack_overview), "loading");
+	}
+
 	if (!priv->loading_featured) {
 		priv->loading_featured = TRUE;
 		gs_plugin_loader_get_featured_async (priv->plugin_loader,
@@ -486,6 +496,19 @@ gs_shell_overview_switch_to (GsShellOverview *self, gboolean scroll_up)
 	gs_shell_overview_load (self);
 }
 
+/**
+ * gs_shell_overview_setup_progress_cb:
+ **/
+static void
+gs_shell_overview_setup_progress_cb (GsPluginLoader *plugin_loader,
+				     guint percentage,
+				     GsShellOverview *self)
+{
+	GsShellOverviewPrivate *priv = gs_shell_overview_get_instance_private (self);
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (priv->progressbar_overview),
+				       (gdouble) percentage / 100);
+}
+
 void
 gs_shell_overview_setup (GsShellOverview *self,
 			 GsShell *shell,
@@ -507,6 +530,11 @@ gs_shell_overview_setup (GsShellOverview *self,
 	/* avoid a ref cycle */
 	priv->shell = shell;
 
+	/* the refreshed handler switches away from the loading page */
+	g_signal_connect_object (priv->plugin_loader, "setup-progress",
+				 G_CALLBACK (gs_shell_overview_setup_progress_cb),
+				 self, 0);
+
 	adj = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (priv->scrolledwindow_overview));
 	gtk_container_set_focus_vadjustment (GTK_CONTAINER (priv->box_overview), adj);
 
@@ -590,6 +618,7 @@ gs_shell_overview_class_init (GsShellOverviewClass *klass)
 	gtk_widget_class_bind_template_child_private (widget_class, GsShellOverview, flowbox_categories);
 	gtk_widget_class_bind_template_child_private (widget_class, GsShellOverview, popular_heading);
 	gtk_widget_class_bind_template_child_private (widget_class, GsShellOverview, popular_rotating_heading);
+	gtk_widget_class_bind_template_child_private (widget_class, GsShellOverview, progressbar_overview);
 	gtk_widget_class_bind_template_child_private (widget_class, GsShellOverview, scrolledwindow_overview);
 	gtk_widget_class_bind_template_child_private (widget_class, GsShellOverview, stack_overview);
 }
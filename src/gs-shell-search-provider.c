@@ -37,6 +37,13 @@ typedef struct {
 	GDBusMethodInvocation *invocation;
 } PendingSearch;
 
+typedef struct {
+	GsShellSearchProvider *provider;
+	GDBusMethodInvocation *invocation;
+	gchar **results;
+	guint pending;
+} PendingMetas;
+
 struct _GsShellSearchProvider {
 	GObject parent;
 
@@ -168,6 +175,75 @@ handle_get_subsearch_result_set (GsShellSearchProvider2	*skeleton,
 	return TRUE;
 }
 
+static void
+pending_metas_free (PendingMetas *metas)
+{
+	g_object_unref (metas->invocation);
+	g_strfreev (metas->results);
+	g_slice_free (PendingMetas, metas);
+}
+
+static void
+add_result_meta (GsShellSearchProvider *self, GsApp *app)
+{
+	GVariantBuilder meta;
+	GVariant *meta_variant;
+	GdkPixbuf *pixbuf;
+
+	g_variant_builder_init (&meta, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&meta, "{sv}", "id", g_variant_new_string (gs_app_get_id (app)));
+	g_variant_builder_add (&meta, "{sv}", "name", g_variant_new_string (gs_app_get_name (app)));
+	pixbuf = gs_app_get_pixbuf (app);
+	if (pixbuf != NULL)
+		g_variant_builder_add (&meta, "{sv}", "icon", g_icon_serialize (G_ICON (pixbuf)));
+	g_variant_builder_add (&meta, "{sv}", "description", g_variant_new_string (gs_app_get_summary (app)));
+	meta_variant = g_variant_builder_end (&meta);
+	g_hash_table_insert (self->metas_cache, g_strdup (gs_app_get_id (app)), g_variant_ref_sink (meta_variant));
+}
+
+static void
+pending_metas_done (PendingMetas *metas)
+{
+	GsShellSearchProvider *self = metas->provider;
+	GVariant *meta_variant;
+	GVariantBuilder builder;
+	guint i;
+
+	/* still decoding icons */
+	if (--metas->pending > 0)
+		return;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+	for (i = 0; metas->results[i]; i++) {
+		meta_variant = (GVariant*)g_hash_table_lookup (self->metas_cache, metas->results[i]);
+		if (meta_variant == NULL)
+			continue;
+		g_variant_builder_add_value (&builder, meta_variant);
+	}
+
+	g_dbus_method_invocation_return_value (metas->invocation, g_variant_new ("(aa{sv})", &builder));
+
+	pending_metas_free (metas);
+	g_application_release (g_application_get_default ());
+}
+
+static void
+load_icon_cb (GObject *source,
+	      GAsyncResult *res,
+	      gpointer user_data)
+{
+	GsApp *app = GS_APP (source);
+	PendingMetas *metas = user_data;
+	g_autoptr(GError) error = NULL;
+
+	/* use the result without an icon if it cannot be decoded */
+	if (!gs_app_load_icon_finish (app, res, &error))
+		g_warning ("failed to load icon for %s: %s",
+			   gs_app_get_id (app), error->message);
+	add_result_meta (metas->provider, app);
+	pending_metas_done (metas);
+}
+
 static gboolean
 handle_get_result_metas (GsShellSearchProvider2	*skeleton,
 			 GDBusMethodInvocation	 *invocation,
@@ -175,15 +251,19 @@ handle_get_result_metas (GsShellSearchProvider2	*skeleton,
 			 gpointer		       user_data)
 {
 	GsShellSearchProvider *self = user_data;
-	GVariantBuilder meta;
-	GVariant *meta_variant;
-	GdkPixbuf *pixbuf;
+	PendingMetas *metas;
 	gint i;
-	GVariantBuilder builder;
 	GError *error = NULL;
 
 	g_debug ("****** GetResultMetas");
 
+	metas = g_slice_new0 (PendingMetas);
+	metas->provider = self;
+	metas->invocation = g_object_ref (invocation);
+	metas->results = g_strdupv (results);
+	metas->pending = 1;
+	g_application_hold (g_application_get_default ());
+
 	for (i = 0; results[i]; i++) {
 		g_autoptr(GsApp) app = NULL;
 
@@ -204,27 +284,15 @@ handle_get_result_metas (GsShellSearchProvider2	*skeleton,
 			continue;
 		}
 
-		g_variant_builder_init (&meta, G_VARIANT_TYPE ("a{sv}"));
-		g_variant_builder_add (&meta, "{sv}", "id", g_variant_new_string (gs_app_get_id (app)));
-		g_variant_builder_add (&meta, "{sv}", "name", g_variant_new_string (gs_app_get_name (app)));
-		pixbuf = gs_app_get_pixbuf (app);
-		if (pixbuf != NULL)
-			g_variant_builder_add (&meta, "{sv}", "icon", g_icon_serialize (G_ICON (pixbuf)));
-		g_variant_builder_add (&meta, "{sv}", "description", g_variant_new_string (gs_app_get_summary (app)));
-		meta_variant = g_variant_builder_end (&meta);
-		g_hash_table_insert (self->metas_cache, g_strdup (gs_app_get_id (app)), g_variant_ref_sink (meta_variant));
-
-	}
-
-	g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
-	for (i = 0; results[i]; i++) {
-		meta_variant = (GVariant*)g_hash_table_lookup (self->metas_cache, results[i]);
-		if (meta_variant == NULL)
+		/* decode the icon in a thread before replying */
+		if (gs_app_get_icon_deferred (app)) {
+			metas->pending++;
+			gs_app_load_icon_async (app, NULL, load_icon_cb, metas);
 			continue;
-		g_variant_builder_add_value (&builder, meta_variant);
+		}
+		add_result_meta (self, app);
 	}
-
-	g_dbus_method_invocation_return_value (invocation, g_variant_new ("(aa{sv})", &builder));
+	pending_metas_done (metas);
 
 	return TRUE;
 }
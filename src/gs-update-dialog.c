@@ -89,6 +89,26 @@ back_entry_free (BackEntry *entry)
 	g_slice_free (BackEntry, entry);
 }
 
+static void
+load_icon_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GsApp *app = GS_APP (source);
+	GsUpdateDialog *dialog = GS_UPDATE_DIALOG (user_data);
+	g_autoptr(GError) error = NULL;
+
+	if (!gs_app_load_icon_finish (app, res, &error)) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("failed to load icon: %s", error->message);
+		return;
+	}
+
+	/* the dialog shows another update now */
+	if (g_object_get_data (G_OBJECT (dialog->image_icon), "app") != app)
+		return;
+	gs_image_set_from_pixbuf (GTK_IMAGE (dialog->image_icon),
+				  gs_app_get_pixbuf (app));
+}
+
 static void
 set_updates_description_ui (GsUpdateDialog *dialog, GsApp *app)
 {
@@ -132,9 +152,17 @@ set_updates_description_ui (GsUpdateDialog *dialog, GsApp *app)
 	gtk_label_set_label (GTK_LABEL (dialog->label_name), gs_app_get_name (app));
 	gtk_label_set_label (GTK_LABEL (dialog->label_summary), gs_app_get_summary (app));
 
+	g_object_set_data_full (G_OBJECT (dialog->image_icon), "app",
+				g_object_ref (app), g_object_unref);
 	pixbuf = gs_app_get_pixbuf (app);
-	if (pixbuf != NULL)
+	if (pixbuf != NULL) {
 		gs_image_set_from_pixbuf (GTK_IMAGE (dialog->image_icon), pixbuf);
+	} else if (gs_app_get_icon_deferred (app)) {
+		gs_app_load_icon_async (app,
+					dialog->cancellable,
+					load_icon_cb,
+					dialog);
+	}
 
 	/* show the back button if needed */
 	gtk_widget_set_visible (dialog->button_back, !g_queue_is_empty (dialog->back_entry_stack));
@@ -0,0 +1,955 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "gs-appstream-cache.h"
+
+/*
+ * The cache is a single GVariant of the loaded store, written after the
+ * XML, AppData and desktop files have been parsed and merged. Loading it
+ * still creates every AsApp, but skips the XML parsing and the merging, and
+ * is only done when the key (locale and load flags) and the mtime, size and
+ * inode of every source file still match.
+ *
+ * Only the parts of AsApp that the plugins and the UI read are saved, and
+ * localized values that are only looked up by locale are saved for the
+ * locales of the current key. Stores that contain data that cannot be
+ * saved are not cached at all, and are loaded from the XML every time.
+ */
+
+#define GS_APPSTREAM_CACHE_VERSION	2
+#define GS_APPSTREAM_CACHE_FORMAT	"(usa(sttt)aa{sv})"
+
+typedef const gchar *(*GsAppstreamCacheLocalizedFunc)	(gpointer	 obj,
+							 const gchar	*locale);
+
+/**
+ * gs_appstream_cache_stamp_compare_cb:
+ **/
+static gint
+gs_appstream_cache_stamp_compare_cb (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*((const gchar **) a), *((const gchar **) b));
+}
+
+/**
+ * gs_appstream_cache_add_stamp:
+ **/
+static void
+gs_appstream_cache_add_stamp (GVariantBuilder *builder, const gchar *filename)
+{
+	GStatBuf buf;
+
+	if (g_stat (filename, &buf) != 0) {
+		g_variant_builder_add (builder, "(sttt)", filename,
+				       (guint64) 0, (guint64) 0, (guint64) 0);
+		return;
+	}
+
+	/* a file rewritten within the same second keeps st_mtime, and a
+	 * file replaced by a rename keeps neither the inode nor the mtime */
+	g_variant_builder_add (builder, "(sttt)", filename,
+			       (guint64) buf.st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000) +
+			       (guint64) buf.st_mtim.tv_nsec,
+			       (guint64) buf.st_size,
+			       (guint64) buf.st_ino);
+}
+
+/**
+ * gs_appstream_cache_get_stamps:
+ * @paths: The directories the store is loaded from
+ *
+ * Gets the modification time in nanoseconds, the size and the inode of each
+ * directory and of every file directly inside it. Directories that do not exist are included so that
+ * creating them later invalidates the cache.
+ *
+ * Returns: (transfer full): a #GVariant of type a(sttt)
+ **/
+GVariant *
+gs_appstream_cache_get_stamps (gchar **paths)
+{
+	GVariantBuilder builder;
+	const gchar *tmp;
+	guint i;
+	guint j;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sttt)"));
+	for (i = 0; paths[i] != NULL; i++) {
+		g_autoptr(GDir) dir = NULL;
+		g_autoptr(GPtrArray) names = NULL;
+
+		gs_appstream_cache_add_stamp (&builder, paths[i]);
+		dir = g_dir_open (paths[i], 0, NULL);
+		if (dir == NULL)
+			continue;
+
+		/* the order of g_dir_read_name() is not defined */
+		names = g_ptr_array_new_with_free_func (g_free);
+		while ((tmp = g_dir_read_name (dir)) != NULL)
+			g_ptr_array_add (names, g_build_filename (paths[i], tmp, NULL));
+		g_ptr_array_sort (names, gs_appstream_cache_stamp_compare_cb);
+		for (j = 0; j < names->len; j++)
+			gs_appstream_cache_add_stamp (&builder, g_ptr_array_index (names, j));
+	}
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * gs_appstream_cache_get_changed:
+ * @stamps_old: The value of gs_appstream_cache_get_stamps() at load time
+ * @stamps_new: The current value of gs_appstream_cache_get_stamps()
+ *
+ * Compares two sets of stamps to find the paths that were added, removed
+ * or modified since the store was loaded.
+ *
+ * Returns: (transfer container) (element-type utf8): the sorted paths
+ **/
+GPtrArray *
+gs_appstream_cache_get_changed (GVariant *stamps_old, GVariant *stamps_new)
+{
+	GHashTableIter hash_iter;
+	GPtrArray *changed;
+	GVariantIter iter;
+	const gchar *path;
+	gpointer key;
+	guint64 inode;
+	guint64 mtime;
+	guint64 size;
+	g_autoptr(GHashTable) old = NULL;
+
+	/* path -> "mtime:size:inode" */
+	old = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_variant_iter_init (&iter, stamps_old);
+	while (g_variant_iter_next (&iter, "(&sttt)", &path, &mtime, &size, &inode)) {
+		g_hash_table_insert (old, g_strdup (path),
+				     g_strdup_printf ("%" G_GUINT64_FORMAT ":%"
+						      G_GUINT64_FORMAT ":%"
+						      G_GUINT64_FORMAT,
+						      mtime, size, inode));
+	}
+
+	/* added or modified */
+	changed = g_ptr_array_new_with_free_func (g_free);
+	g_variant_iter_init (&iter, stamps_new);
+	while (g_variant_iter_next (&iter, "(&sttt)", &path, &mtime, &size, &inode)) {
+		const gchar *tmp;
+		g_autofree gchar *stamp = NULL;
+		stamp = g_strdup_printf ("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT
+					 ":%" G_GUINT64_FORMAT,
+					 mtime, size, inode);
+		tmp = g_hash_table_lookup (old, path);
+		if (g_strcmp0 (tmp, stamp) != 0)
+			g_ptr_array_add (changed, g_strdup (path));
+		g_hash_table_remove (old, path);
+	}
+
+	/* removed */
+	g_hash_table_iter_init (&hash_iter, old);
+	while (g_hash_table_iter_next (&hash_iter, &key, NULL))
+		g_ptr_array_add (changed, g_strdup (key));
+	g_ptr_array_sort (changed, gs_appstream_cache_stamp_compare_cb);
+	return changed;
+}
+
+/**
+ * gs_appstream_cache_add_string:
+ **/
+static void
+gs_appstream_cache_add_string (GVariantBuilder *builder,
+			       const gchar *key,
+			       const gchar *value)
+{
+	if (value == NULL)
+		return;
+	g_variant_builder_add (builder, "{sv}", key, g_variant_new_string (value));
+}
+
+/**
+ * gs_appstream_cache_add_strv:
+ **/
+static void
+gs_appstream_cache_add_strv (GVariantBuilder *builder,
+			     const gchar *key,
+			     GPtrArray *array)
+{
+	GVariantBuilder sub;
+	guint i;
+
+	if (array == NULL || array->len == 0)
+		return;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE_STRING_ARRAY);
+	for (i = 0; i < array->len; i++)
+		g_variant_builder_add (&sub, "s", g_ptr_array_index (array, i));
+	g_variant_builder_add (builder, "{sv}", key, g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_add_hash:
+ **/
+static void
+gs_appstream_cache_add_hash (GVariantBuilder *builder,
+			     const gchar *key,
+			     GHashTable *hash)
+{
+	GHashTableIter iter;
+	GVariantBuilder sub;
+	gpointer hash_key;
+	gpointer hash_value;
+
+	if (hash == NULL || g_hash_table_size (hash) == 0)
+		return;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a{ss}"));
+	g_hash_table_iter_init (&iter, hash);
+	while (g_hash_table_iter_next (&iter, &hash_key, &hash_value))
+		g_variant_builder_add (&sub, "{ss}", hash_key, hash_value);
+	g_variant_builder_add (builder, "{sv}", key, g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_localized_to_variant:
+ *
+ * Gets the values of a string that can only be looked up by locale, for
+ * each of the locales that can be seen from the current one.
+ **/
+static GVariant *
+gs_appstream_cache_localized_to_variant (gpointer obj,
+					 GsAppstreamCacheLocalizedFunc func)
+{
+	GVariantBuilder sub;
+	const gchar * const *locales;
+	const gchar *tmp;
+	guint i;
+
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a{ss}"));
+	locales = (const gchar * const *) g_get_language_names ();
+	for (i = 0; locales[i] != NULL; i++) {
+		tmp = func (obj, locales[i]);
+		if (tmp == NULL)
+			continue;
+		g_variant_builder_add (&sub, "{ss}", locales[i], tmp);
+	}
+	return g_variant_builder_end (&sub);
+}
+
+/**
+ * gs_appstream_cache_add_keywords:
+ **/
+static void
+gs_appstream_cache_add_keywords (GVariantBuilder *builder, AsApp *app)
+{
+	GPtrArray *keywords;
+	GVariantBuilder sub;
+	const gchar * const *locales;
+	guint i;
+	guint j;
+	gboolean found = FALSE;
+
+	/* keywords can only be looked up by locale, so save the ones that
+	 * can be seen from the current locale, which is part of the key */
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a{sas}"));
+	locales = (const gchar * const *) g_get_language_names ();
+	for (i = 0; locales[i] != NULL; i++) {
+		GVariantBuilder strv;
+		keywords = as_app_get_keywords (app, locales[i]);
+		if (keywords == NULL || keywords->len == 0)
+			continue;
+		g_variant_builder_init (&strv, G_VARIANT_TYPE_STRING_ARRAY);
+		for (j = 0; j < keywords->len; j++)
+			g_variant_builder_add (&strv, "s", g_ptr_array_index (keywords, j));
+		g_variant_builder_add (&sub, "{sas}", locales[i], &strv);
+		found = TRUE;
+	}
+	if (!found) {
+		g_variant_builder_clear (&sub);
+		return;
+	}
+	g_variant_builder_add (builder, "{sv}", "keywords", g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_add_languages:
+ **/
+static void
+gs_appstream_cache_add_languages (GVariantBuilder *builder, AsApp *app)
+{
+	GList *l;
+	GVariantBuilder sub;
+	g_autoptr(GList) languages = NULL;
+
+	languages = as_app_get_languages (app);
+	if (languages == NULL)
+		return;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a{si}"));
+	for (l = languages; l != NULL; l = l->next) {
+		g_variant_builder_add (&sub, "{si}", l->data,
+				       as_app_get_language (app, l->data));
+	}
+	g_variant_builder_add (builder, "{sv}", "languages", g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_get_icon_data:
+ *
+ * Embedded icons only exist as a pixbuf, so save them as PNG data.
+ **/
+static GVariant *
+gs_appstream_cache_get_icon_data (AsApp *app, AsIcon *icon, GError **error)
+{
+	GdkPixbuf *pixbuf;
+	gsize len = 0;
+	g_autofree gchar *data = NULL;
+
+	if (as_icon_get_kind (icon) != AS_ICON_KIND_EMBEDDED)
+		return g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, NULL, 0, 1);
+	pixbuf = as_icon_get_pixbuf (icon);
+	if (pixbuf == NULL) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_NOT_SUPPORTED,
+			     "embedded icon of %s has no pixbuf",
+			     as_app_get_id (app));
+		return NULL;
+	}
+	if (!gdk_pixbuf_save_to_buffer (pixbuf, &data, &len, "png", error, NULL))
+		return NULL;
+	return g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, data, len, 1);
+}
+
+/**
+ * gs_appstream_cache_add_icons:
+ **/
+static gboolean
+gs_appstream_cache_add_icons (GVariantBuilder *builder, AsApp *app, GError **error)
+{
+	AsIcon *icon;
+	GPtrArray *icons;
+	GVariant *data;
+	GVariantBuilder sub;
+	guint i;
+
+	icons = as_app_get_icons (app);
+	if (icons->len == 0)
+		return TRUE;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a(ussssuuay)"));
+	for (i = 0; i < icons->len; i++) {
+		icon = g_ptr_array_index (icons, i);
+		data = gs_appstream_cache_get_icon_data (app, icon, error);
+		if (data == NULL) {
+			g_variant_builder_clear (&sub);
+			return FALSE;
+		}
+		g_variant_builder_add (&sub, "(ussssuu@ay)",
+				       as_icon_get_kind (icon),
+				       as_icon_get_name (icon) != NULL ? as_icon_get_name (icon) : "",
+				       as_icon_get_prefix (icon) != NULL ? as_icon_get_prefix (icon) : "",
+				       as_icon_get_filename (icon) != NULL ? as_icon_get_filename (icon) : "",
+				       as_icon_get_url (icon) != NULL ? as_icon_get_url (icon) : "",
+				       as_icon_get_width (icon),
+				       as_icon_get_height (icon),
+				       data);
+	}
+	g_variant_builder_add (builder, "{sv}", "icons", g_variant_builder_end (&sub));
+	return TRUE;
+}
+
+/**
+ * gs_appstream_cache_add_screenshots:
+ **/
+static void
+gs_appstream_cache_add_screenshots (GVariantBuilder *builder, AsApp *app)
+{
+	AsImage *image;
+	AsScreenshot *ss;
+	GPtrArray *images;
+	GPtrArray *screenshots;
+	GVariantBuilder sub;
+	guint i;
+	guint j;
+
+	screenshots = as_app_get_screenshots (app);
+	if (screenshots->len == 0)
+		return;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a(ua{ss}a(suuu))"));
+	for (i = 0; i < screenshots->len; i++) {
+		GVariantBuilder sub_images;
+		ss = g_ptr_array_index (screenshots, i);
+		g_variant_builder_init (&sub_images, G_VARIANT_TYPE ("a(suuu)"));
+		images = as_screenshot_get_images (ss);
+		for (j = 0; j < images->len; j++) {
+			image = g_ptr_array_index (images, j);
+			g_variant_builder_add (&sub_images, "(suuu)",
+					       as_image_get_url (image) != NULL ? as_image_get_url (image) : "",
+					       as_image_get_width (image),
+					       as_image_get_height (image),
+					       as_image_get_kind (image));
+		}
+		g_variant_builder_add (&sub, "(u@a{ss}a(suuu))",
+				       as_screenshot_get_kind (ss),
+				       gs_appstream_cache_localized_to_variant (ss,
+						(GsAppstreamCacheLocalizedFunc) as_screenshot_get_caption),
+				       &sub_images);
+	}
+	g_variant_builder_add (builder, "{sv}", "screenshots", g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_add_releases:
+ **/
+static void
+gs_appstream_cache_add_releases (GVariantBuilder *builder, AsApp *app)
+{
+	AsRelease *release;
+	GPtrArray *releases;
+	GVariantBuilder sub;
+	guint i;
+
+	releases = as_app_get_releases (app);
+	if (releases->len == 0)
+		return;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a(sta{ss})"));
+	for (i = 0; i < releases->len; i++) {
+		release = g_ptr_array_index (releases, i);
+		g_variant_builder_add (&sub, "(st@a{ss})",
+				       as_release_get_version (release) != NULL ? as_release_get_version (release) : "",
+				       as_release_get_timestamp (release),
+				       gs_appstream_cache_localized_to_variant (release,
+						(GsAppstreamCacheLocalizedFunc) as_release_get_description));
+	}
+	g_variant_builder_add (builder, "{sv}", "releases", g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_add_bundles:
+ **/
+static void
+gs_appstream_cache_add_bundles (GVariantBuilder *builder, AsApp *app)
+{
+	AsBundle *bundle;
+	GPtrArray *bundles;
+	GVariantBuilder sub;
+	guint i;
+
+	bundles = as_app_get_bundles (app);
+	if (bundles->len == 0)
+		return;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a(us)"));
+	for (i = 0; i < bundles->len; i++) {
+		bundle = g_ptr_array_index (bundles, i);
+		g_variant_builder_add (&sub, "(us)",
+				       as_bundle_get_kind (bundle),
+				       as_bundle_get_id (bundle) != NULL ? as_bundle_get_id (bundle) : "");
+	}
+	g_variant_builder_add (builder, "{sv}", "bundles", g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_add_provides:
+ **/
+static void
+gs_appstream_cache_add_provides (GVariantBuilder *builder, AsApp *app)
+{
+	AsProvide *provide;
+	GPtrArray *provides;
+	GVariantBuilder sub;
+	guint i;
+
+	provides = as_app_get_provides (app);
+	if (provides->len == 0)
+		return;
+	g_variant_builder_init (&sub, G_VARIANT_TYPE ("a(us)"));
+	for (i = 0; i < provides->len; i++) {
+		provide = g_ptr_array_index (provides, i);
+		g_variant_builder_add (&sub, "(us)",
+				       as_provide_get_kind (provide),
+				       as_provide_get_value (provide) != NULL ? as_provide_get_value (provide) : "");
+	}
+	g_variant_builder_add (builder, "{sv}", "provides", g_variant_builder_end (&sub));
+}
+
+/**
+ * gs_appstream_cache_app_to_variant:
+ **/
+static GVariant *
+gs_appstream_cache_app_to_variant (AsApp *app, GError **error)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+	gs_appstream_cache_add_string (&builder, "id", as_app_get_id (app));
+	g_variant_builder_add (&builder, "{sv}", "id-kind",
+			       g_variant_new_uint32 (as_app_get_id_kind (app)));
+	g_variant_builder_add (&builder, "{sv}", "source-kind",
+			       g_variant_new_uint32 (as_app_get_source_kind (app)));
+	g_variant_builder_add (&builder, "{sv}", "state",
+			       g_variant_new_uint32 (as_app_get_state (app)));
+	g_variant_builder_add (&builder, "{sv}", "priority",
+			       g_variant_new_int32 (as_app_get_priority (app)));
+	gs_appstream_cache_add_string (&builder, "source-file", as_app_get_source_file (app));
+	gs_appstream_cache_add_string (&builder, "origin", as_app_get_origin (app));
+	gs_appstream_cache_add_string (&builder, "project-group", as_app_get_project_group (app));
+	gs_appstream_cache_add_string (&builder, "project-license", as_app_get_project_license (app));
+	gs_appstream_cache_add_hash (&builder, "names", as_app_get_names (app));
+	gs_appstream_cache_add_hash (&builder, "comments", as_app_get_comments (app));
+	gs_appstream_cache_add_hash (&builder, "descriptions", as_app_get_descriptions (app));
+	gs_appstream_cache_add_hash (&builder, "developer-names", as_app_get_developer_names (app));
+	gs_appstream_cache_add_hash (&builder, "urls", as_app_get_urls (app));
+	gs_appstream_cache_add_hash (&builder, "metadata", as_app_get_metadata (app));
+	gs_appstream_cache_add_strv (&builder, "categories", as_app_get_categories (app));
+	gs_appstream_cache_add_strv (&builder, "pkgnames", as_app_get_pkgnames (app));
+	gs_appstream_cache_add_strv (&builder, "mimetypes", as_app_get_mimetypes (app));
+	gs_appstream_cache_add_strv (&builder, "kudos", as_app_get_kudos (app));
+	gs_appstream_cache_add_strv (&builder, "extends", as_app_get_extends (app));
+	gs_appstream_cache_add_strv (&builder, "compulsory-for-desktops",
+				     as_app_get_compulsory_for_desktops (app));
+	gs_appstream_cache_add_keywords (&builder, app);
+	gs_appstream_cache_add_languages (&builder, app);
+	if (!gs_appstream_cache_add_icons (&builder, app, error)) {
+		g_variant_builder_clear (&builder);
+		return NULL;
+	}
+	gs_appstream_cache_add_screenshots (&builder, app);
+	gs_appstream_cache_add_releases (&builder, app);
+	gs_appstream_cache_add_bundles (&builder, app);
+	gs_appstream_cache_add_provides (&builder, app);
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * gs_appstream_cache_save:
+ * @store: A #AsStore
+ * @filename: The cache filename
+ * @key: A string that has to match when loading, e.g. the locale
+ * @stamps: The value of gs_appstream_cache_get_stamps() before @store was loaded
+ * @error: A #GError or %NULL
+ *
+ * Saves the applications in @store to a binary cache file. If any
+ * application has data the cache cannot represent, any existing cache file
+ * is removed and the store has to be loaded from the XML next time.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_appstream_cache_save (AsStore *store,
+			 const gchar *filename,
+			 const gchar *key,
+			 GVariant *stamps,
+			 GError **error)
+{
+	AsApp *app;
+	GPtrArray *apps;
+	GVariant *dict;
+	GVariantBuilder builder;
+	guint i;
+	g_autoptr(GVariant) data = NULL;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+	apps = as_store_get_apps (store);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+		dict = gs_appstream_cache_app_to_variant (app, error);
+		if (dict == NULL) {
+			/* do not leave an older cache behind */
+			g_variant_builder_clear (&builder);
+			g_unlink (filename);
+			return FALSE;
+		}
+		g_variant_builder_add_value (&builder, dict);
+	}
+	data = g_variant_new (GS_APPSTREAM_CACHE_FORMAT,
+			      GS_APPSTREAM_CACHE_VERSION,
+			      key,
+			      stamps,
+			      &builder);
+	g_variant_ref_sink (data);
+	return g_file_set_contents (filename,
+				    g_variant_get_data (data),
+				    g_variant_get_size (data),
+				    error);
+}
+
+/**
+ * gs_appstream_cache_app_from_variant:
+ **/
+static AsApp *
+gs_appstream_cache_app_from_variant (GVariant *dict)
+{
+	AsApp *app;
+	const gchar *key;
+	const gchar *value;
+	gint32 priority;
+	guint32 tmp;
+
+	app = as_app_new ();
+	if (g_variant_lookup (dict, "id", "&s", &value))
+		as_app_set_id (app, value);
+	if (g_variant_lookup (dict, "id-kind", "u", &tmp))
+		as_app_set_id_kind (app, tmp);
+	if (g_variant_lookup (dict, "source-kind", "u", &tmp))
+		as_app_set_source_kind (app, tmp);
+	if (g_variant_lookup (dict, "state", "u", &tmp))
+		as_app_set_state (app, tmp);
+	if (g_variant_lookup (dict, "priority", "i", &priority))
+		as_app_set_priority (app, priority);
+	if (g_variant_lookup (dict, "source-file", "&s", &value))
+		as_app_set_source_file (app, value);
+	if (g_variant_lookup (dict, "origin", "&s", &value))
+		as_app_set_origin (app, value);
+	if (g_variant_lookup (dict, "project-group", "&s", &value))
+		as_app_set_project_group (app, value);
+	if (g_variant_lookup (dict, "project-license", "&s", &value))
+		as_app_set_project_license (app, value);
+
+	/* localized strings */
+	{
+		g_autoptr(GVariantIter) names = NULL;
+		if (g_variant_lookup (dict, "names", "a{ss}", &names)) {
+			while (g_variant_iter_next (names, "{&s&s}", &key, &value))
+				as_app_set_name (app, key, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) comments = NULL;
+		if (g_variant_lookup (dict, "comments", "a{ss}", &comments)) {
+			while (g_variant_iter_next (comments, "{&s&s}", &key, &value))
+				as_app_set_comment (app, key, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) descriptions = NULL;
+		if (g_variant_lookup (dict, "descriptions", "a{ss}", &descriptions)) {
+			while (g_variant_iter_next (descriptions, "{&s&s}", &key, &value))
+				as_app_set_description (app, key, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) developer_names = NULL;
+		if (g_variant_lookup (dict, "developer-names", "a{ss}", &developer_names)) {
+			while (g_variant_iter_next (developer_names, "{&s&s}", &key, &value))
+				as_app_set_developer_name (app, key, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) urls = NULL;
+		if (g_variant_lookup (dict, "urls", "a{ss}", &urls)) {
+			while (g_variant_iter_next (urls, "{&s&s}", &key, &value))
+				as_app_add_url (app, as_url_kind_from_string (key), value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) metadata = NULL;
+		if (g_variant_lookup (dict, "metadata", "a{ss}", &metadata)) {
+			while (g_variant_iter_next (metadata, "{&s&s}", &key, &value))
+				as_app_add_metadata (app, key, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) keywords = NULL;
+		g_autoptr(GVariantIter) strv = NULL;
+		if (g_variant_lookup (dict, "keywords", "a{sas}", &keywords)) {
+			while (g_variant_iter_next (keywords, "{&sas}", &key, &strv)) {
+				while (g_variant_iter_next (strv, "&s", &value))
+					as_app_add_keyword (app, key, value);
+				g_clear_pointer (&strv, g_variant_iter_free);
+			}
+		}
+	}
+	{
+		g_autoptr(GVariantIter) languages = NULL;
+		gint32 percentage;
+		if (g_variant_lookup (dict, "languages", "a{si}", &languages)) {
+			while (g_variant_iter_next (languages, "{&si}", &key, &percentage))
+				as_app_add_language (app, percentage, key);
+		}
+	}
+
+	/* string lists */
+	{
+		g_autoptr(GVariantIter) strv = NULL;
+		if (g_variant_lookup (dict, "categories", "as", &strv)) {
+			while (g_variant_iter_next (strv, "&s", &value))
+				as_app_add_category (app, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) strv = NULL;
+		if (g_variant_lookup (dict, "pkgnames", "as", &strv)) {
+			while (g_variant_iter_next (strv, "&s", &value))
+				as_app_add_pkgname (app, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) strv = NULL;
+		if (g_variant_lookup (dict, "mimetypes", "as", &strv)) {
+			while (g_variant_iter_next (strv, "&s", &value))
+				as_app_add_mimetype (app, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) strv = NULL;
+		if (g_variant_lookup (dict, "kudos", "as", &strv)) {
+			while (g_variant_iter_next (strv, "&s", &value))
+				as_app_add_kudo (app, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) strv = NULL;
+		if (g_variant_lookup (dict, "extends", "as", &strv)) {
+			while (g_variant_iter_next (strv, "&s", &value))
+				as_app_add_extends (app, value);
+		}
+	}
+	{
+		g_autoptr(GVariantIter) strv = NULL;
+		if (g_variant_lookup (dict, "compulsory-for-desktops", "as", &strv)) {
+			while (g_variant_iter_next (strv, "&s", &value))
+				as_app_add_compulsory_for_desktop (app, value);
+		}
+	}
+
+	/* objects */
+	{
+		g_autoptr(GVariantIter) icons = NULL;
+		const gchar *name;
+		const gchar *prefix;
+		const gchar *filename;
+		const gchar *url;
+		guint32 width;
+		guint32 height;
+		if (g_variant_lookup (dict, "icons", "a(ussssuuay)", &icons)) {
+			while (TRUE) {
+				g_autoptr(AsIcon) icon = NULL;
+				g_autoptr(GVariant) data = NULL;
+				if (!g_variant_iter_next (icons, "(u&s&s&s&suu@ay)",
+							  &tmp, &name, &prefix,
+							  &filename, &url,
+							  &width, &height, &data))
+					break;
+				icon = as_icon_new ();
+				as_icon_set_kind (icon, tmp);
+				if (name[0] != '\0')
+					as_icon_set_name (icon, name);
+				if (prefix[0] != '\0')
+					as_icon_set_prefix (icon, prefix);
+				if (filename[0] != '\0')
+					as_icon_set_filename (icon, filename);
+				if (url[0] != '\0')
+					as_icon_set_url (icon, url);
+				as_icon_set_width (icon, width);
+				as_icon_set_height (icon, height);
+				if (g_variant_get_size (data) > 0) {
+					g_autoptr(GBytes) bytes = NULL;
+					g_autoptr(GdkPixbuf) pixbuf = NULL;
+					g_autoptr(GInputStream) stream = NULL;
+					bytes = g_variant_get_data_as_bytes (data);
+					stream = g_memory_input_stream_new_from_bytes (bytes);
+					pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
+					if (pixbuf != NULL)
+						as_icon_set_pixbuf (icon, pixbuf);
+				}
+				as_app_add_icon (app, icon);
+			}
+		}
+	}
+	{
+		g_autoptr(GVariantIter) screenshots = NULL;
+		g_autoptr(GVariantIter) captions = NULL;
+		g_autoptr(GVariantIter) images = NULL;
+		const gchar *url;
+		guint32 width;
+		guint32 height;
+		guint32 image_kind;
+		if (g_variant_lookup (dict, "screenshots", "a(ua{ss}a(suuu))", &screenshots)) {
+			while (g_variant_iter_next (screenshots, "(ua{ss}a(suuu))",
+						    &tmp, &captions, &images)) {
+				g_autoptr(AsScreenshot) ss = as_screenshot_new ();
+				as_screenshot_set_kind (ss, tmp);
+				while (g_variant_iter_next (captions, "{&s&s}", &key, &value))
+					as_screenshot_set_caption (ss, key, value);
+				g_clear_pointer (&captions, g_variant_iter_free);
+				while (g_variant_iter_next (images, "(&suuu)",
+							    &url, &width,
+							    &height, &image_kind)) {
+					g_autoptr(AsImage) image = as_image_new ();
+					as_image_set_url (image, url);
+					as_image_set_width (image, width);
+					as_image_set_height (image, height);
+					as_image_set_kind (image, image_kind);
+					as_screenshot_add_image (ss, image);
+				}
+				g_clear_pointer (&images, g_variant_iter_free);
+				as_app_add_screenshot (app, ss);
+			}
+		}
+	}
+	{
+		g_autoptr(GVariantIter) releases = NULL;
+		g_autoptr(GVariantIter) descriptions = NULL;
+		const gchar *version;
+		guint64 timestamp;
+		if (g_variant_lookup (dict, "releases", "a(sta{ss})", &releases)) {
+			while (g_variant_iter_next (releases, "(&sta{ss})",
+						    &version, &timestamp,
+						    &descriptions)) {
+				g_autoptr(AsRelease) release = as_release_new ();
+				if (version[0] != '\0')
+					as_release_set_version (release, version);
+				as_release_set_timestamp (release, timestamp);
+				while (g_variant_iter_next (descriptions, "{&s&s}", &key, &value))
+					as_release_set_description (release, key, value);
+				g_clear_pointer (&descriptions, g_variant_iter_free);
+				as_app_add_release (app, release);
+			}
+		}
+	}
+	{
+		g_autoptr(GVariantIter) bundles = NULL;
+		if (g_variant_lookup (dict, "bundles", "a(us)", &bundles)) {
+			while (g_variant_iter_next (bundles, "(u&s)", &tmp, &value)) {
+				g_autoptr(AsBundle) bundle = as_bundle_new ();
+				as_bundle_set_kind (bundle, tmp);
+				if (value[0] != '\0')
+					as_bundle_set_id (bundle, value);
+				as_app_add_bundle (app, bundle);
+			}
+		}
+	}
+	{
+		g_autoptr(GVariantIter) provides = NULL;
+		if (g_variant_lookup (dict, "provides", "a(us)", &provides)) {
+			while (g_variant_iter_next (provides, "(u&s)", &tmp, &value)) {
+				g_autoptr(AsProvide) provide = as_provide_new ();
+				as_provide_set_kind (provide, tmp);
+				if (value[0] != '\0')
+					as_provide_set_value (provide, value);
+				as_app_add_provide (app, provide);
+			}
+		}
+	}
+	return app;
+}
+
+/**
+ * gs_appstream_cache_load:
+ * @store: A #AsStore
+ * @filename: The cache filename
+ * @key: A string that has to match the one used when saving
+ * @stamps: The current value of gs_appstream_cache_get_stamps()
+ * @error: A #GError or %NULL
+ *
+ * Adds the applications from a binary cache file to @store, failing if the
+ * cache does not exist or any of the source files have changed since it
+ * was written.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_appstream_cache_load (AsStore *store,
+			 const gchar *filename,
+			 const gchar *key,
+			 GVariant *stamps,
+			 GError **error)
+{
+	AsApp *app;
+	AsApp *parent;
+	GPtrArray *apps;
+	GPtrArray *extends;
+	GVariantIter iter;
+	const gchar *key_cache;
+	guint32 version;
+	guint i;
+	guint j;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GVariant) apps_cache = NULL;
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GVariant) stamps_cache = NULL;
+
+	/* map the file rather than reading it into memory */
+	mapped_file = g_mapped_file_new (filename, FALSE, error);
+	if (mapped_file == NULL)
+		return FALSE;
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_variant_new_from_bytes (G_VARIANT_TYPE (GS_APPSTREAM_CACHE_FORMAT),
+					 bytes, FALSE);
+	g_variant_ref_sink (data);
+
+	/* check this is the same data */
+	g_variant_get (data, "(u&s@a(sttt)@aa{sv})",
+		       &version, &key_cache, &stamps_cache, &apps_cache);
+	if (version != GS_APPSTREAM_CACHE_VERSION) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "cache version %u is not supported", version);
+		return FALSE;
+	}
+	if (g_strcmp0 (key_cache, key) != 0) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "cache was created for %s, not %s",
+			     key_cache, key);
+		return FALSE;
+	}
+	if (!g_variant_equal (stamps_cache, stamps)) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_FAILED,
+				     "cache is out of date");
+		return FALSE;
+	}
+
+	/* add each app */
+	g_variant_iter_init (&iter, apps_cache);
+	while (TRUE) {
+		g_autoptr(GVariant) dict = NULL;
+		g_autoptr(AsApp) app_tmp = NULL;
+		dict = g_variant_iter_next_value (&iter);
+		if (dict == NULL)
+			break;
+		app_tmp = gs_appstream_cache_app_from_variant (dict);
+		as_store_add_app (store, app_tmp);
+	}
+
+	/* link the addons to the apps they extend */
+	apps = as_store_get_apps (store);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+		if (as_app_get_id_kind (app) != AS_ID_KIND_ADDON)
+			continue;
+		extends = as_app_get_extends (app);
+		for (j = 0; j < extends->len; j++) {
+			parent = as_store_get_app_by_id (store,
+							 g_ptr_array_index (extends, j));
+			if (parent == NULL)
+				continue;
+			as_app_add_addon (parent, app);
+		}
+	}
+	return TRUE;
+}
+
+/* vim: set noexpandtab: */
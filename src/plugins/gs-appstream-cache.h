@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GS_APPSTREAM_CACHE_H
+#define __GS_APPSTREAM_CACHE_H
+
+#include <glib.h>
+#include <appstream-glib.h>
+
+G_BEGIN_DECLS
+
+GVariant	*gs_appstream_cache_get_stamps		(gchar			**paths);
+GPtrArray	*gs_appstream_cache_get_changed		(GVariant		*stamps_old,
+							 GVariant		*stamps_new);
+gboolean	 gs_appstream_cache_load		(AsStore		*store,
+							 const gchar		*filename,
+							 const gchar		*key,
+							 GVariant		*stamps,
+							 GError			**error);
+gboolean	 gs_appstream_cache_save		(AsStore		*store,
+							 const gchar		*filename,
+							 const gchar		*key,
+							 GVariant		*stamps,
+							 GError			**error);
+
+G_END_DECLS
+
+#endif /* __GS_APPSTREAM_CACHE_H */
+
+/* vim: set noexpandtab: */
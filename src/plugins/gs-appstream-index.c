@@ -0,0 +1,785 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "gs-appstream-index.h"
+
+/*
+ * The index maps every three-byte sequence of the casefolded searchable
+ * text to a sorted posting list of the apps that contain it. Each posting
+ * packs the app index in the store snapshot with the fields that contained
+ * the trigram, so a search term can only match an app when all of its
+ * trigrams were found in the same field.
+ *
+ * This never misses an app that as_app_search_matches() would accept, but
+ * may return a few extra candidates that the caller then scores normally.
+ *
+ * Categories use the same sorted posting lists, keyed by the category ID.
+ * The 'Other' categories and the number of apps shown in each category are
+ * worked out when the index is built, rather than when they are first
+ * asked for.
+ *
+ * Searching, getting the apps in a category and getting the size of a
+ * category only read the index, so can be done from several threads at
+ * once. Building the index and adding the rules for the 'Other' categories
+ * need the index to itself.
+ */
+
+#define GS_APPSTREAM_INDEX_POSTING(idx,fields)	(((guint32) (idx) << 8) | (fields))
+#define GS_APPSTREAM_INDEX_POSTING_IDX(p)	((p) >> 8)
+#define GS_APPSTREAM_INDEX_POSTING_FIELDS(p)	((p) & 0xff)
+
+struct _GsAppstreamIndex
+{
+	GObject			 parent_instance;
+
+	GPtrArray		*apps;		/* of AsApp, in store order */
+	GHashTable		*trigrams;	/* trigram:GArray of guint32 */
+	GHashTable		*categories;	/* id:GArray of guint32 */
+	GHashTable		*category_sizes; /* key:guint */
+	GPtrArray		*others;	/* of GsAppstreamIndexOther */
+};
+
+typedef struct {
+	gchar			*parent_id;
+	gchar			**child_ids;
+	gchar			*other_id;
+} GsAppstreamIndexOther;
+
+G_DEFINE_TYPE (GsAppstreamIndex, gs_appstream_index, G_TYPE_OBJECT)
+
+static void gs_appstream_index_build_other (GsAppstreamIndex *app_index, GsAppstreamIndexOther *other);
+static void gs_appstream_index_build_sizes (GsAppstreamIndex *app_index);
+
+/**
+ * gs_appstream_index_other_free:
+ **/
+static void
+gs_appstream_index_other_free (GsAppstreamIndexOther *other)
+{
+	g_free (other->parent_id);
+	g_strfreev (other->child_ids);
+	g_free (other->other_id);
+	g_slice_free (GsAppstreamIndexOther, other);
+}
+
+/**
+ * gs_appstream_index_trigram:
+ **/
+static guint32
+gs_appstream_index_trigram (const gchar *str)
+{
+	return ((guint32) (guint8) str[0] << 16) |
+	       ((guint32) (guint8) str[1] << 8) |
+	       (guint32) (guint8) str[2];
+}
+
+/**
+ * gs_appstream_index_add_text:
+ **/
+static void
+gs_appstream_index_add_text (GsAppstreamIndex *app_index,
+			     guint idx,
+			     GsAppstreamIndexField field,
+			     const gchar *text)
+{
+	GArray *postings;
+	gpointer key;
+	gsize i;
+	gsize len;
+	guint32 posting;
+	guint32 *last;
+	g_autofree gchar *folded = NULL;
+
+	if (text == NULL)
+		return;
+	folded = g_utf8_casefold (text, -1);
+	len = strlen (folded);
+	for (i = 0; i + 2 < len; i++) {
+		key = GUINT_TO_POINTER (gs_appstream_index_trigram (folded + i));
+		postings = g_hash_table_lookup (app_index->trigrams, key);
+		if (postings == NULL) {
+			postings = g_array_new (FALSE, FALSE, sizeof (guint32));
+			g_hash_table_insert (app_index->trigrams, key, postings);
+		}
+
+		/* apps are added in order, so only the last posting can be
+		 * for this app */
+		if (postings->len > 0) {
+			last = &g_array_index (postings, guint32, postings->len - 1);
+			if (GS_APPSTREAM_INDEX_POSTING_IDX (*last) == idx) {
+				*last |= field;
+				continue;
+			}
+		}
+		posting = GS_APPSTREAM_INDEX_POSTING (idx, field);
+		g_array_append_val (postings, posting);
+	}
+}
+
+/**
+ * gs_appstream_index_add_text_array:
+ **/
+static void
+gs_appstream_index_add_text_array (GsAppstreamIndex *app_index,
+				   guint idx,
+				   GsAppstreamIndexField field,
+				   GPtrArray *array)
+{
+	guint i;
+
+	if (array == NULL)
+		return;
+	for (i = 0; i < array->len; i++) {
+		gs_appstream_index_add_text (app_index, idx, field,
+					     g_ptr_array_index (array, i));
+	}
+}
+
+/**
+ * gs_appstream_index_add_text_hash:
+ **/
+static void
+gs_appstream_index_add_text_hash (GsAppstreamIndex *app_index,
+				  guint idx,
+				  GsAppstreamIndexField field,
+				  GHashTable *hash)
+{
+	GList *l;
+	g_autoptr(GList) values = NULL;
+
+	if (hash == NULL)
+		return;
+	values = g_hash_table_get_values (hash);
+	for (l = values; l != NULL; l = l->next)
+		gs_appstream_index_add_text (app_index, idx, field, l->data);
+}
+
+/**
+ * gs_appstream_index_add_category:
+ **/
+static void
+gs_appstream_index_add_category (GsAppstreamIndex *app_index,
+				 guint idx,
+				 const gchar *id)
+{
+	GArray *postings;
+	guint32 posting;
+
+	postings = g_hash_table_lookup (app_index->categories, id);
+	if (postings == NULL) {
+		postings = g_array_new (FALSE, FALSE, sizeof (guint32));
+		g_hash_table_insert (app_index->categories, g_strdup (id), postings);
+	}
+
+	/* the same category may be listed twice */
+	if (postings->len > 0 &&
+	    GS_APPSTREAM_INDEX_POSTING_IDX (g_array_index (postings, guint32, postings->len - 1)) == idx)
+		return;
+	posting = GS_APPSTREAM_INDEX_POSTING (idx, 1);
+	g_array_append_val (postings, posting);
+}
+
+/**
+ * gs_appstream_index_add_app:
+ **/
+static void
+gs_appstream_index_add_app (GsAppstreamIndex *app_index, guint idx, AsApp *app)
+{
+	GPtrArray *categories;
+	const gchar * const *locales;
+	guint i;
+
+	/* as_app_search_matches() otherwise builds the token cache of the
+	 * app the first time it is scored, which is a write */
+	(void) as_app_search_matches (app, "");
+
+	gs_appstream_index_add_text (app_index, idx,
+				     GS_APPSTREAM_INDEX_FIELD_ID,
+				     as_app_get_id (app));
+	gs_appstream_index_add_text_hash (app_index, idx,
+					  GS_APPSTREAM_INDEX_FIELD_NAME,
+					  as_app_get_names (app));
+	gs_appstream_index_add_text_hash (app_index, idx,
+					  GS_APPSTREAM_INDEX_FIELD_SUMMARY,
+					  as_app_get_comments (app));
+	gs_appstream_index_add_text_hash (app_index, idx,
+					  GS_APPSTREAM_INDEX_FIELD_DESCRIPTION,
+					  as_app_get_descriptions (app));
+	gs_appstream_index_add_text_array (app_index, idx,
+					   GS_APPSTREAM_INDEX_FIELD_PKGNAME,
+					   as_app_get_pkgnames (app));
+	gs_appstream_index_add_text_array (app_index, idx,
+					   GS_APPSTREAM_INDEX_FIELD_MIMETYPE,
+					   as_app_get_mimetypes (app));
+
+	/* keywords are only available per-locale, and the origin keywords
+	 * added at startup are in the "C" locale */
+	locales = (const gchar * const *) g_get_language_names ();
+	for (i = 0; locales[i] != NULL; i++) {
+		gs_appstream_index_add_text_array (app_index, idx,
+						   GS_APPSTREAM_INDEX_FIELD_KEYWORD,
+						   as_app_get_keywords (app, locales[i]));
+	}
+
+	/* apps without an ID are never shown in a category */
+	if (as_app_get_id (app) == NULL)
+		return;
+	categories = as_app_get_categories (app);
+	for (i = 0; i < categories->len; i++)
+		gs_appstream_index_add_category (app_index, idx,
+						 g_ptr_array_index (categories, i));
+}
+
+/**
+ * gs_appstream_index_build:
+ * @app_index: A #GsAppstreamIndex
+ * @apps: An array of #AsApp, typically from as_store_get_apps()
+ *
+ * Rebuilds the index from a snapshot of @apps, dropping any existing data.
+ * This also builds the search token cache of each app, so that the apps
+ * can then be scored with as_app_search_matches_all() from several
+ * threads at once, and counts the apps in each category.
+ **/
+void
+gs_appstream_index_build (GsAppstreamIndex *app_index, GPtrArray *apps)
+{
+	AsApp *app;
+	guint i;
+
+	g_return_if_fail (GS_IS_APPSTREAM_INDEX (app_index));
+
+	g_hash_table_remove_all (app_index->trigrams);
+	g_hash_table_remove_all (app_index->categories);
+	g_hash_table_remove_all (app_index->category_sizes);
+	g_ptr_array_set_size (app_index->apps, 0);
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+		g_ptr_array_add (app_index->apps, g_object_ref (app));
+		gs_appstream_index_add_app (app_index, i, app);
+	}
+	for (i = 0; i < app_index->others->len; i++)
+		gs_appstream_index_build_other (app_index, g_ptr_array_index (app_index->others, i));
+	gs_appstream_index_build_sizes (app_index);
+	g_debug ("indexed %u apps using %u trigrams",
+		 app_index->apps->len, g_hash_table_size (app_index->trigrams));
+}
+
+/**
+ * gs_appstream_index_get_size:
+ **/
+guint
+gs_appstream_index_get_size (GsAppstreamIndex *app_index)
+{
+	g_return_val_if_fail (GS_IS_APPSTREAM_INDEX (app_index), 0);
+	return app_index->apps->len;
+}
+
+/**
+ * gs_appstream_index_intersect:
+ *
+ * Returns the postings found in both sorted lists, optionally requiring the
+ * postings to share at least one field.
+ **/
+static GArray *
+gs_appstream_index_intersect (GArray *a, GArray *b, gboolean same_field)
+{
+	GArray *result;
+	guint i = 0;
+	guint j = 0;
+	guint32 pa;
+	guint32 pb;
+	guint32 fields;
+
+	result = g_array_new (FALSE, FALSE, sizeof (guint32));
+	while (i < a->len && j < b->len) {
+		pa = g_array_index (a, guint32, i);
+		pb = g_array_index (b, guint32, j);
+		if (GS_APPSTREAM_INDEX_POSTING_IDX (pa) < GS_APPSTREAM_INDEX_POSTING_IDX (pb)) {
+			i++;
+			continue;
+		}
+		if (GS_APPSTREAM_INDEX_POSTING_IDX (pa) > GS_APPSTREAM_INDEX_POSTING_IDX (pb)) {
+			j++;
+			continue;
+		}
+		fields = GS_APPSTREAM_INDEX_POSTING_FIELDS (pa);
+		if (same_field)
+			fields &= GS_APPSTREAM_INDEX_POSTING_FIELDS (pb);
+		if (fields != 0) {
+			pa = GS_APPSTREAM_INDEX_POSTING (GS_APPSTREAM_INDEX_POSTING_IDX (pa), fields);
+			g_array_append_val (result, pa);
+		}
+		i++;
+		j++;
+	}
+	return result;
+}
+
+/**
+ * gs_appstream_index_postings_to_apps:
+ **/
+static GPtrArray *
+gs_appstream_index_postings_to_apps (GsAppstreamIndex *app_index,
+				     GArray *postings)
+{
+	AsApp *app;
+	GPtrArray *results;
+	guint i;
+	guint32 posting;
+
+	results = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	for (i = 0; i < postings->len; i++) {
+		posting = g_array_index (postings, guint32, i);
+		app = g_ptr_array_index (app_index->apps,
+					 GS_APPSTREAM_INDEX_POSTING_IDX (posting));
+		g_ptr_array_add (results, g_object_ref (app));
+	}
+	return results;
+}
+
+/**
+ * gs_appstream_index_search_term:
+ *
+ * Returns the postings of the apps that contain every trigram of @term in
+ * the same field, or %NULL if the term is too short to be looked up.
+ **/
+static GArray *
+gs_appstream_index_search_term (GsAppstreamIndex *app_index, const gchar *term)
+{
+	GArray *postings;
+	GArray *matches = NULL;
+	GArray *tmp;
+	gpointer key;
+	gsize i;
+	gsize len;
+	g_autofree gchar *folded = NULL;
+
+	folded = g_utf8_casefold (term, -1);
+	len = strlen (folded);
+	if (len < 3)
+		return NULL;
+	for (i = 0; i + 2 < len; i++) {
+		key = GUINT_TO_POINTER (gs_appstream_index_trigram (folded + i));
+		postings = g_hash_table_lookup (app_index->trigrams, key);
+		if (postings == NULL) {
+			if (matches != NULL)
+				g_array_unref (matches);
+			return g_array_new (FALSE, FALSE, sizeof (guint32));
+		}
+		if (matches == NULL) {
+			matches = g_array_sized_new (FALSE, FALSE,
+						     sizeof (guint32),
+						     postings->len);
+			g_array_append_vals (matches, postings->data, postings->len);
+			continue;
+		}
+		tmp = gs_appstream_index_intersect (matches, postings, TRUE);
+		g_array_unref (matches);
+		matches = tmp;
+		if (matches->len == 0)
+			break;
+	}
+	return matches;
+}
+
+/**
+ * gs_appstream_index_search:
+ * @app_index: A #GsAppstreamIndex
+ * @values: The search terms, as passed to as_app_search_matches_all()
+ *
+ * Finds the apps that may match all of the search terms. The results are a
+ * superset of the apps as_app_search_matches_all() would accept and are in
+ * the same order as the array passed to gs_appstream_index_build().
+ *
+ * Returns: (transfer container): An array of #AsApp
+ **/
+GPtrArray *
+gs_appstream_index_search (GsAppstreamIndex *app_index, gchar **values)
+{
+	AsApp *app;
+	GArray *matches = NULL;
+	GArray *tmp;
+	GPtrArray *results;
+	guint i;
+
+	g_return_val_if_fail (GS_IS_APPSTREAM_INDEX (app_index), NULL);
+
+	/* intersect the candidates for each search term */
+	for (i = 0; values[i] != NULL; i++) {
+		g_autoptr(GArray) term = NULL;
+		term = gs_appstream_index_search_term (app_index, values[i]);
+		if (term == NULL)
+			continue;
+		if (matches == NULL) {
+			matches = g_array_ref (term);
+		} else {
+			tmp = gs_appstream_index_intersect (matches, term, FALSE);
+			g_array_unref (matches);
+			matches = tmp;
+		}
+		if (matches->len == 0)
+			break;
+	}
+
+	/* no terms could be looked up, so everything is a candidate */
+	if (matches == NULL) {
+		results = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+		for (i = 0; i < app_index->apps->len; i++) {
+			app = g_ptr_array_index (app_index->apps, i);
+			g_ptr_array_add (results, g_object_ref (app));
+		}
+		return results;
+	}
+	results = gs_appstream_index_postings_to_apps (app_index, matches);
+	g_array_unref (matches);
+	return results;
+}
+
+/**
+ * gs_appstream_index_get_category_postings:
+ *
+ * Returns the postings of the apps in @id, and also in @parent_id if set.
+ **/
+static GArray *
+gs_appstream_index_get_category_postings (GsAppstreamIndex *app_index,
+					  const gchar *id,
+					  const gchar *parent_id)
+{
+	GArray *postings;
+	GArray *postings_parent;
+
+	postings = g_hash_table_lookup (app_index->categories, id);
+	if (postings == NULL)
+		return g_array_new (FALSE, FALSE, sizeof (guint32));
+	if (parent_id == NULL)
+		return g_array_ref (postings);
+	postings_parent = g_hash_table_lookup (app_index->categories, parent_id);
+	if (postings_parent == NULL)
+		return g_array_new (FALSE, FALSE, sizeof (guint32));
+	return gs_appstream_index_intersect (postings, postings_parent, FALSE);
+}
+
+/**
+ * gs_appstream_index_get_category_apps:
+ * @app_index: A #GsAppstreamIndex
+ * @id: A category ID
+ * @parent_id: (allow-none): A parent category ID the apps also have to be in
+ *
+ * Finds the apps with an ID that are in the category.
+ *
+ * Returns: (transfer container): An array of #AsApp
+ **/
+GPtrArray *
+gs_appstream_index_get_category_apps (GsAppstreamIndex *app_index,
+				      const gchar *id,
+				      const gchar *parent_id)
+{
+	g_autoptr(GArray) postings = NULL;
+
+	g_return_val_if_fail (GS_IS_APPSTREAM_INDEX (app_index), NULL);
+
+	postings = gs_appstream_index_get_category_postings (app_index, id, parent_id);
+	return gs_appstream_index_postings_to_apps (app_index, postings);
+}
+
+/**
+ * gs_appstream_index_count_category:
+ *
+ * Counts the apps that would be shown in the category overview, which does
+ * not include apps with a negative priority.
+ **/
+static guint
+gs_appstream_index_count_category (GsAppstreamIndex *app_index,
+				   const gchar *id,
+				   const gchar *parent_id)
+{
+	AsApp *app;
+	guint i;
+	guint size = 0;
+	guint32 posting;
+	g_autoptr(GArray) postings = NULL;
+
+	postings = gs_appstream_index_get_category_postings (app_index, id, parent_id);
+	for (i = 0; i < postings->len; i++) {
+		posting = g_array_index (postings, guint32, i);
+		app = g_ptr_array_index (app_index->apps,
+					 GS_APPSTREAM_INDEX_POSTING_IDX (posting));
+		if (as_app_get_priority (app) < 0)
+			continue;
+		size++;
+	}
+	return size;
+}
+
+/**
+ * gs_appstream_index_size_key:
+ **/
+static gchar *
+gs_appstream_index_size_key (const gchar *id, const gchar *parent_id)
+{
+	return g_strdup_printf ("%s/%s", parent_id != NULL ? parent_id : "", id);
+}
+
+/**
+ * gs_appstream_index_add_size:
+ **/
+static void
+gs_appstream_index_add_size (GsAppstreamIndex *app_index,
+			     const gchar *id,
+			     const gchar *parent_id)
+{
+	guint size;
+
+	size = gs_appstream_index_count_category (app_index, id, parent_id);
+	g_hash_table_insert (app_index->category_sizes,
+			     gs_appstream_index_size_key (id, parent_id),
+			     GUINT_TO_POINTER (size));
+}
+
+/**
+ * gs_appstream_index_build_sizes:
+ *
+ * Counts the apps in every category, and in each subcategory and 'Other'
+ * category of the parents that have a rule.
+ **/
+static void
+gs_appstream_index_build_sizes (GsAppstreamIndex *app_index)
+{
+	GsAppstreamIndexOther *other;
+	GHashTableIter iter;
+	gpointer key;
+	guint i;
+	guint j;
+	g_autoptr(GPtrArray) ids = NULL;
+
+	/* the sizes are added to the hash table being iterated */
+	ids = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, app_index->categories);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (ids, key);
+	for (i = 0; i < ids->len; i++)
+		gs_appstream_index_add_size (app_index, g_ptr_array_index (ids, i), NULL);
+
+	for (i = 0; i < app_index->others->len; i++) {
+		other = g_ptr_array_index (app_index->others, i);
+		for (j = 0; other->child_ids[j] != NULL; j++) {
+			gs_appstream_index_add_size (app_index,
+						     other->child_ids[j],
+						     other->parent_id);
+		}
+		gs_appstream_index_add_size (app_index,
+					     other->other_id,
+					     other->parent_id);
+	}
+}
+
+/**
+ * gs_appstream_index_get_category_size:
+ * @app_index: A #GsAppstreamIndex
+ * @id: A category ID
+ * @parent_id: (allow-none): A parent category ID the apps also have to be in
+ *
+ * Gets the number of apps that would be shown in the category overview,
+ * which does not include apps with a negative priority. The sizes are
+ * counted when the index is built, and any other combination is counted
+ * without being saved.
+ *
+ * Returns: the number of apps
+ **/
+guint
+gs_appstream_index_get_category_size (GsAppstreamIndex *app_index,
+				      const gchar *id,
+				      const gchar *parent_id)
+{
+	gpointer value;
+	g_autofree gchar *key = NULL;
+
+	g_return_val_if_fail (GS_IS_APPSTREAM_INDEX (app_index), 0);
+
+	key = gs_appstream_index_size_key (id, parent_id);
+	if (g_hash_table_lookup_extended (app_index->category_sizes,
+					  key, NULL, &value))
+		return GPOINTER_TO_UINT (value);
+	return gs_appstream_index_count_category (app_index, id, parent_id);
+}
+
+/**
+ * gs_appstream_index_insert_posting:
+ **/
+static void
+gs_appstream_index_insert_posting (GArray *postings, guint32 posting)
+{
+	guint lo = 0;
+	guint hi = postings->len;
+	guint mid;
+	guint32 tmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		tmp = g_array_index (postings, guint32, mid);
+		if (GS_APPSTREAM_INDEX_POSTING_IDX (tmp) == GS_APPSTREAM_INDEX_POSTING_IDX (posting))
+			return;
+		if (GS_APPSTREAM_INDEX_POSTING_IDX (tmp) < GS_APPSTREAM_INDEX_POSTING_IDX (posting))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	g_array_insert_val (postings, lo, posting);
+}
+
+/**
+ * gs_appstream_index_build_other:
+ *
+ * Adds the apps in the parent category that would be shown in the
+ * category overview but are not in any of the subcategories to the
+ * postings of the 'Other' category. The #AsApp objects are not changed.
+ **/
+static void
+gs_appstream_index_build_other (GsAppstreamIndex *app_index,
+				GsAppstreamIndexOther *other)
+{
+	AsApp *app;
+	GArray *postings;
+	GArray *postings_other;
+	guint i;
+	guint j;
+	guint32 posting;
+
+	postings = g_hash_table_lookup (app_index->categories, other->parent_id);
+	for (i = 0; postings != NULL && i < postings->len; i++) {
+		posting = g_array_index (postings, guint32, i);
+		app = g_ptr_array_index (app_index->apps,
+					 GS_APPSTREAM_INDEX_POSTING_IDX (posting));
+		if (as_app_get_priority (app) < 0)
+			continue;
+		for (j = 0; other->child_ids[j] != NULL; j++) {
+			if (as_app_has_category (app, other->child_ids[j]))
+				break;
+		}
+		if (other->child_ids[j] != NULL)
+			continue;
+
+		/* the postings are kept sorted as the same app may be
+		 * added by more than one parent */
+		postings_other = g_hash_table_lookup (app_index->categories,
+						      other->other_id);
+		if (postings_other == NULL) {
+			postings_other = g_array_new (FALSE, FALSE, sizeof (guint32));
+			g_hash_table_insert (app_index->categories,
+					     g_strdup (other->other_id),
+					     postings_other);
+		}
+		gs_appstream_index_insert_posting (postings_other, posting);
+	}
+}
+
+/**
+ * gs_appstream_index_add_category_other:
+ * @app_index: A #GsAppstreamIndex
+ * @parent_id: A category ID
+ * @child_ids: The IDs of all the subcategories of @parent_id
+ * @other_id: The ID to use for apps that are in none of the subcategories
+ *
+ * Makes each following gs_appstream_index_build() put the apps in
+ * @parent_id that would be shown in the category overview but are not in
+ * any of the subcategories into @other_id, and count them.
+ **/
+void
+gs_appstream_index_add_category_other (GsAppstreamIndex *app_index,
+				       const gchar *parent_id,
+				       gchar **child_ids,
+				       const gchar *other_id)
+{
+	GsAppstreamIndexOther *other;
+
+	g_return_if_fail (GS_IS_APPSTREAM_INDEX (app_index));
+
+	other = g_slice_new0 (GsAppstreamIndexOther);
+	other->parent_id = g_strdup (parent_id);
+	other->child_ids = g_strdupv (child_ids);
+	other->other_id = g_strdup (other_id);
+	g_ptr_array_add (app_index->others, other);
+}
+
+/**
+ * gs_appstream_index_finalize:
+ **/
+static void
+gs_appstream_index_finalize (GObject *object)
+{
+	GsAppstreamIndex *app_index = GS_APPSTREAM_INDEX (object);
+
+	g_ptr_array_unref (app_index->apps);
+	g_hash_table_unref (app_index->trigrams);
+	g_hash_table_unref (app_index->categories);
+	g_hash_table_unref (app_index->category_sizes);
+	g_ptr_array_unref (app_index->others);
+
+	G_OBJECT_CLASS (gs_appstream_index_parent_class)->finalize (object);
+}
+
+/**
+ * gs_appstream_index_class_init:
+ **/
+static void
+gs_appstream_index_class_init (GsAppstreamIndexClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = gs_appstream_index_finalize;
+}
+
+/**
+ * gs_appstream_index_init:
+ **/
+static void
+gs_appstream_index_init (GsAppstreamIndex *app_index)
+{
+	app_index->apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	app_index->trigrams = g_hash_table_new_full (g_direct_hash,
+						     g_direct_equal,
+						     NULL,
+						     (GDestroyNotify) g_array_unref);
+	app_index->categories = g_hash_table_new_full (g_str_hash,
+						       g_str_equal,
+						       g_free,
+						       (GDestroyNotify) g_array_unref);
+	app_index->category_sizes = g_hash_table_new_full (g_str_hash,
+							   g_str_equal,
+							   g_free,
+							   NULL);
+	app_index->others = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_appstream_index_other_free);
+}
+
+/**
+ * gs_appstream_index_new:
+ **/
+GsAppstreamIndex *
+gs_appstream_index_new (void)
+{
+	GsAppstreamIndex *app_index;
+	app_index = g_object_new (GS_TYPE_APPSTREAM_INDEX, NULL);
+	return GS_APPSTREAM_INDEX (app_index);
+}
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,65 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GS_APPSTREAM_INDEX_H
+#define __GS_APPSTREAM_INDEX_H
+
+#include <glib-object.h>
+#include <appstream-glib.h>
+
+G_BEGIN_DECLS
+
+#define GS_TYPE_APPSTREAM_INDEX (gs_appstream_index_get_type ())
+
+G_DECLARE_FINAL_TYPE (GsAppstreamIndex, gs_appstream_index, GS, APPSTREAM_INDEX, GObject)
+
+typedef enum {
+	GS_APPSTREAM_INDEX_FIELD_ID		= 1 << 0,
+	GS_APPSTREAM_INDEX_FIELD_NAME		= 1 << 1,
+	GS_APPSTREAM_INDEX_FIELD_SUMMARY	= 1 << 2,
+	GS_APPSTREAM_INDEX_FIELD_KEYWORD	= 1 << 3,
+	GS_APPSTREAM_INDEX_FIELD_PKGNAME	= 1 << 4,
+	GS_APPSTREAM_INDEX_FIELD_MIMETYPE	= 1 << 5,
+	GS_APPSTREAM_INDEX_FIELD_DESCRIPTION	= 1 << 6,
+	GS_APPSTREAM_INDEX_FIELD_LAST
+} GsAppstreamIndexField;
+
+GsAppstreamIndex *gs_appstream_index_new		(void);
+
+void		 gs_appstream_index_build		(GsAppstreamIndex	*app_index,
+							 GPtrArray		*apps);
+guint		 gs_appstream_index_get_size		(GsAppstreamIndex	*app_index);
+GPtrArray	*gs_appstream_index_search		(GsAppstreamIndex	*app_index,
+							 gchar			**values);
+GPtrArray	*gs_appstream_index_get_category_apps	(GsAppstreamIndex	*app_index,
+							 const gchar		*id,
+							 const gchar		*parent_id);
+guint		 gs_appstream_index_get_category_size	(GsAppstreamIndex	*app_index,
+							 const gchar		*id,
+							 const gchar		*parent_id);
+void		 gs_appstream_index_add_category_other	(GsAppstreamIndex	*app_index,
+							 const gchar		*parent_id,
+							 gchar			**child_ids,
+							 const gchar		*other_id);
+
+G_END_DECLS
+
+#endif /* __GS_APPSTREAM_INDEX_H */
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,230 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include "gs-fedora-tagger-import.h"
+
+/*
+ * The dump is one 'pkgname\trating\tvote_count\tuser_count' line per
+ * package. It is parsed a line at a time as it arrives and every row goes
+ * through the same prepared statement, all inside one transaction so
+ * there is only one sync at the end.
+ *
+ * The confidence of a package depends on the average vote count of the
+ * whole dump, so it is set with one UPDATE once the vote counts have all
+ * been summed.
+ */
+
+/**
+ * gs_fedora_tagger_import_exec:
+ */
+static gboolean
+gs_fedora_tagger_import_exec (sqlite3 *db, const gchar *statement, GError **error)
+{
+	gchar *error_msg = NULL;
+	gint rc;
+
+	rc = sqlite3_exec (db, statement, NULL, NULL, &error_msg);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", error_msg);
+		sqlite3_free (error_msg);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * gs_fedora_tagger_import_line:
+ *
+ * Splits @line in place and adds it using @stmt.
+ */
+static gboolean
+gs_fedora_tagger_import_line (sqlite3 *db,
+			      sqlite3_stmt *stmt,
+			      gchar *line,
+			      gdouble *vote_count,
+			      GError **error)
+{
+	gchar *fields[4];
+	guint i;
+	guint tabs = 0;
+
+	for (i = 0; line[i] != '\0'; i++) {
+		if (line[i] == '\t')
+			tabs++;
+	}
+	if (tabs != 3) {
+		g_warning ("unexpected data from fedora-tagger, expected: "
+			   "'pkgname\trating\tvote_count\tuser_count' and got '%s'",
+			   line);
+		*vote_count = -1;
+		return TRUE;
+	}
+	fields[0] = line;
+	for (i = 1; i < 4; i++) {
+		fields[i] = strchr (fields[i - 1], '\t');
+		*fields[i]++ = '\0';
+	}
+	*vote_count = g_strtod (fields[2], NULL);
+
+	sqlite3_reset (stmt);
+	sqlite3_bind_text (stmt, 1, fields[0], -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64 (stmt, 2, (sqlite3_int64) (g_strtod (fields[1], NULL) + 0.5));
+	sqlite3_bind_int64 (stmt, 3, (sqlite3_int64) (*vote_count + 0.5));
+	sqlite3_bind_int64 (stmt, 4, (sqlite3_int64) (g_strtod (fields[3], NULL) + 0.5));
+	if (sqlite3_step (stmt) != SQLITE_DONE) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (db));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * gs_fedora_tagger_import:
+ * @db: a database with a ratings table
+ * @stream: the fedora-tagger rating dump
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: a #GError, or %NULL
+ *
+ * Adds or replaces the ratings of every package in @stream. Nothing is
+ * changed if the dump cannot be read or has no votes in it.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_fedora_tagger_import (sqlite3 *db,
+			 GInputStream *stream,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	gboolean ret = FALSE;
+	gchar *line;
+	gdouble count_sum = 0;
+	gdouble vote_count;
+	gint rc;
+	guint count = 0;
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *stmt_confidence = NULL;
+	g_autoptr(GDataInputStream) data = NULL;
+
+	if (!gs_fedora_tagger_import_exec (db, "BEGIN TRANSACTION;", error))
+		return FALSE;
+	rc = sqlite3_prepare_v2 (db,
+				 "INSERT OR REPLACE INTO ratings (pkgname, rating, "
+				 "vote_count, user_count, confidence) "
+				 "VALUES (?1, ?2, ?3, ?4, 0);",
+				 -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (db));
+		goto out;
+	}
+
+	/* process the tab-delimited data as it arrives */
+	data = g_data_input_stream_new (stream);
+	while (TRUE) {
+		g_autoptr(GError) error_local = NULL;
+		line = g_data_input_stream_read_line (data, NULL,
+						      cancellable,
+						      &error_local);
+		if (line == NULL) {
+			if (error_local != NULL) {
+				g_propagate_error (error, g_steal_pointer (&error_local));
+				goto out;
+			}
+			break;
+		}
+		if (line[0] == '\0' || line[0] == '#') {
+			g_free (line);
+			continue;
+		}
+		if (!gs_fedora_tagger_import_line (db, stmt, line, &vote_count, error)) {
+			g_free (line);
+			goto out;
+		}
+		g_free (line);
+		if (vote_count < 0)
+			continue;
+		count_sum += vote_count;
+		count++;
+	}
+
+	/* no suitable data? */
+	if (count == 0) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "Failed to get data from fedora-tagger");
+		goto out;
+	}
+	if (count_sum == 0) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "Failed to get vote count in fedora-tagger");
+		goto out;
+	}
+
+	/* calculate confidence */
+	count_sum /= (gdouble) count;
+	g_debug ("fedora-tagger vote_count average of %u packages is %.2f",
+		 count, count_sum);
+	rc = sqlite3_prepare_v2 (db,
+				 "UPDATE ratings SET confidence = "
+				 "MAX(ROUND(100.0 * vote_count / ?1), 100);",
+				 -1, &stmt_confidence, NULL);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_double (stmt_confidence, 1, count_sum);
+		rc = sqlite3_step (stmt_confidence);
+	}
+	if (rc != SQLITE_DONE) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (db));
+		goto out;
+	}
+	if (!gs_fedora_tagger_import_exec (db, "COMMIT;", error))
+		goto out;
+
+	/* success */
+	ret = TRUE;
+out:
+	if (stmt != NULL)
+		sqlite3_finalize (stmt);
+	if (stmt_confidence != NULL)
+		sqlite3_finalize (stmt_confidence);
+	if (!ret)
+		sqlite3_exec (db, "ROLLBACK;", NULL, NULL, NULL);
+	return ret;
+}
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,116 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include "gs-http-validators.h"
+
+/*
+ * The ETag and Last-Modified headers of the last full response are kept
+ * in a small key file next to the downloaded data. Sending them back
+ * lets the server reply with 304 Not Modified and no body when nothing
+ * has changed.
+ */
+
+#define GS_HTTP_VALIDATORS_GROUP	"validators"
+
+/**
+ * gs_http_validators_add:
+ * @msg: a #SoupMessage that has not been sent yet
+ * @filename: the file the validators were saved to
+ *
+ * Makes @msg conditional on the resource having changed since the saved
+ * response. Nothing is added if there is no saved response, or if it was
+ * for a different URI.
+ **/
+void
+gs_http_validators_add (SoupMessage *msg, const gchar *filename)
+{
+	g_autofree gchar *etag = NULL;
+	g_autofree gchar *last_modified = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autofree gchar *uri_msg = NULL;
+	g_autoptr(GKeyFile) kf = NULL;
+
+	kf = g_key_file_new ();
+	if (!g_key_file_load_from_file (kf, filename, G_KEY_FILE_NONE, NULL))
+		return;
+	uri = g_key_file_get_string (kf, GS_HTTP_VALIDATORS_GROUP, "URI", NULL);
+	uri_msg = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
+	if (g_strcmp0 (uri, uri_msg) != 0)
+		return;
+	etag = g_key_file_get_string (kf, GS_HTTP_VALIDATORS_GROUP, "ETag", NULL);
+	if (etag != NULL) {
+		soup_message_headers_replace (msg->request_headers,
+					      "If-None-Match", etag);
+	}
+	last_modified = g_key_file_get_string (kf, GS_HTTP_VALIDATORS_GROUP,
+					       "Last-Modified", NULL);
+	if (last_modified != NULL) {
+		soup_message_headers_replace (msg->request_headers,
+					      "If-Modified-Since", last_modified);
+	}
+}
+
+/**
+ * gs_http_validators_save:
+ * @msg: a #SoupMessage with a successful response
+ * @filename: the file to save the validators to
+ * @error: a #GError, or %NULL
+ *
+ * Saves the validators of the response to @msg, or removes @filename if
+ * the server did not send any.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_http_validators_save (SoupMessage *msg, const gchar *filename, GError **error)
+{
+	const gchar *etag;
+	const gchar *last_modified;
+	gsize len;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(GKeyFile) kf = NULL;
+
+	etag = soup_message_headers_get_one (msg->response_headers, "ETag");
+	last_modified = soup_message_headers_get_one (msg->response_headers,
+						      "Last-Modified");
+	if (etag == NULL && last_modified == NULL) {
+		g_unlink (filename);
+		return TRUE;
+	}
+
+	kf = g_key_file_new ();
+	uri = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
+	g_key_file_set_string (kf, GS_HTTP_VALIDATORS_GROUP, "URI", uri);
+	if (etag != NULL)
+		g_key_file_set_string (kf, GS_HTTP_VALIDATORS_GROUP, "ETag", etag);
+	if (last_modified != NULL) {
+		g_key_file_set_string (kf, GS_HTTP_VALIDATORS_GROUP,
+				       "Last-Modified", last_modified);
+	}
+	data = g_key_file_to_data (kf, &len, NULL);
+	return g_file_set_contents (filename, data, (gssize) len, error);
+}
+
+/* vim: set noexpandtab: */
@@ -26,14 +26,31 @@
 
 #include <gs-plugin.h>
 #include <gs-plugin-loader.h>
+#include <gs-utils.h>
+
+#include "gs-appstream-cache.h"
+#include "gs-appstream-index.h"
+#include "menu-spec-common.h"
 
 #define	GS_PLUGIN_APPSTREAM_MAX_SCREENSHOTS	5
+#define	GS_PLUGIN_APPSTREAM_RELOAD_DELAY	1	/* s */
 
 struct GsPluginPrivate {
 	AsStore			*store;
-	GMutex			 store_mutex;
+	GsAppstreamIndex	*index;
+	GPtrArray		*monitors;
+	GRWLock			 store_lock;
 	gchar			*locale;
+	gchar			*cache_fn;
+	gchar			*cache_key;
+	GVariant		*stamps;
+	guint			 reload_id;
+	GCancellable		*reload_cancellable;
+	GMutex			 reload_mutex;
+	GCond			 reload_cond;
+	gboolean		 reload_running;
 	gsize			 done_init;
+	GError			*startup_error;
 };
 
 static gboolean gs_plugin_refine_item (GsPlugin *plugin, GsApp *app, AsApp *item, GError **error);
@@ -66,18 +83,108 @@ as_app_has_compulsory_for_desktop (AsApp *app, const gchar *compulsory_for_deskt
 	return FALSE;
 }
 
+static void gs_plugin_appstream_reload (GsPlugin *plugin, GCancellable *cancellable);
+
+/**
+ * gs_plugin_appstream_reload_thread_cb:
+ */
+static void
+gs_plugin_appstream_reload_thread_cb (GTask *task,
+				      gpointer source_object,
+				      gpointer task_data,
+				      GCancellable *cancellable)
+{
+	GsPlugin *plugin = GS_PLUGIN (task_data);
+
+	if (!g_cancellable_is_cancelled (cancellable))
+		gs_plugin_appstream_reload (plugin, cancellable);
+
+	/* gs_plugin_destroy() waits for this */
+	g_mutex_lock (&plugin->priv->reload_mutex);
+	plugin->priv->reload_running = FALSE;
+	g_cond_broadcast (&plugin->priv->reload_cond);
+	g_mutex_unlock (&plugin->priv->reload_mutex);
+}
+
+/**
+ * gs_plugin_appstream_reload_cb:
+ */
+static gboolean
+gs_plugin_appstream_reload_cb (gpointer user_data)
+{
+	GsPlugin *plugin = GS_PLUGIN (user_data);
+	g_autoptr(GTask) task = NULL;
+
+	/* try again when the running reload is done */
+	g_mutex_lock (&plugin->priv->reload_mutex);
+	if (plugin->priv->reload_running) {
+		g_mutex_unlock (&plugin->priv->reload_mutex);
+		return TRUE;
+	}
+	plugin->priv->reload_running = TRUE;
+	g_mutex_unlock (&plugin->priv->reload_mutex);
+
+	plugin->priv->reload_id = 0;
+	task = g_task_new (NULL, plugin->priv->reload_cancellable, NULL, NULL);
+	g_task_set_task_data (task, plugin, NULL);
+	g_task_run_in_thread (task, gs_plugin_appstream_reload_thread_cb);
+	return FALSE;
+}
+
 /**
  * gs_plugin_appstream_store_changed_cb:
  */
 static void
 gs_plugin_appstream_store_changed_cb (AsStore *store, GsPlugin *plugin)
 {
-	g_debug ("AppStream metadata changed, reloading cache");
-	plugin->priv->done_init = FALSE;
+	/* wait for any other files from the same transaction */
+	if (plugin->priv->reload_id != 0)
+		return;
+	g_debug ("AppStream metadata changed, reloading soon");
+	plugin->priv->reload_id =
+		g_timeout_add_seconds (GS_PLUGIN_APPSTREAM_RELOAD_DELAY,
+				       gs_plugin_appstream_reload_cb,
+				       plugin);
+}
+
+/**
+ * gs_plugin_appstream_add_category_others:
+ *
+ * The menu-spec parents are the categories that get an 'Other'
+ * subcategory, which is worked out each time the index is built.
+ */
+static void
+gs_plugin_appstream_add_category_others (GsPlugin *plugin)
+{
+	const MenuSpecData *msdata;
+	const gchar *parent_id = NULL;
+	guint i;
+	g_autoptr(GPtrArray) child_ids = NULL;
+
+	child_ids = g_ptr_array_new ();
+	msdata = menu_spec_get_data ();
+	for (i = 0; ; i++) {
+		const gchar *tmp = NULL;
+		if (msdata[i].path != NULL)
+			tmp = g_strstr_len (msdata[i].path, -1, "::");
+		if (tmp != NULL) {
+			g_ptr_array_add (child_ids, (gpointer) (tmp + 2));
+			continue;
+		}
 
-	/* this is not strictly true, but it causes all the UI to be reloaded
-	 * which is what we really want */
-	gs_plugin_updates_changed (plugin);
+		/* a new parent, or the end of the data */
+		if (parent_id != NULL) {
+			g_ptr_array_add (child_ids, NULL);
+			gs_appstream_index_add_category_other (plugin->priv->index,
+							       parent_id,
+							       (gchar **) child_ids->pdata,
+							       "other");
+			g_ptr_array_set_size (child_ids, 0);
+		}
+		if (msdata[i].path == NULL)
+			break;
+		parent_id = msdata[i].path;
+	}
 }
 
 /**
@@ -87,11 +194,21 @@ void
 gs_plugin_initialize (GsPlugin *plugin)
 {
 	plugin->priv = GS_PLUGIN_GET_PRIVATE (GsPluginPrivate);
-	g_mutex_init (&plugin->priv->store_mutex);
+	g_rw_lock_init (&plugin->priv->store_lock);
+	g_mutex_init (&plugin->priv->reload_mutex);
+	g_cond_init (&plugin->priv->reload_cond);
+	plugin->priv->reload_cancellable = g_cancellable_new ();
 	plugin->priv->store = as_store_new ();
+	plugin->priv->index = gs_appstream_index_new ();
+	gs_plugin_appstream_add_category_others (plugin);
+	plugin->priv->monitors = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	plugin->refine_flags = GS_PLUGIN_REFINED_DEFAULT;
 	as_store_set_watch_flags (plugin->priv->store,
 				  AS_STORE_WATCH_FLAG_ADDED |
 				  AS_STORE_WATCH_FLAG_REMOVED);
+	g_signal_connect (plugin->priv->store, "changed",
+			  G_CALLBACK (gs_plugin_appstream_store_changed_cb),
+			  plugin);
 
 	/* AppInstall does not ever give us a long description */
 	if (gs_plugin_check_distro_id (plugin, "debian") ||
@@ -118,9 +235,29 @@ gs_plugin_get_deps (GsPlugin *plugin)
 void
 gs_plugin_destroy (GsPlugin *plugin)
 {
+	g_signal_handlers_disconnect_by_data (plugin->priv->store, plugin);
+	if (plugin->priv->reload_id != 0)
+		g_source_remove (plugin->priv->reload_id);
+
+	/* the reload thread uses the store and the plugin */
+	g_cancellable_cancel (plugin->priv->reload_cancellable);
+	g_mutex_lock (&plugin->priv->reload_mutex);
+	while (plugin->priv->reload_running)
+		g_cond_wait (&plugin->priv->reload_cond, &plugin->priv->reload_mutex);
+	g_mutex_unlock (&plugin->priv->reload_mutex);
+	g_object_unref (plugin->priv->reload_cancellable);
+	if (plugin->priv->stamps != NULL)
+		g_variant_unref (plugin->priv->stamps);
 	g_free (plugin->priv->locale);
+	g_free (plugin->priv->cache_fn);
+	g_free (plugin->priv->cache_key);
+	g_clear_error (&plugin->priv->startup_error);
 	g_object_unref (plugin->priv->store);
-	g_mutex_clear (&plugin->priv->store_mutex);
+	g_object_unref (plugin->priv->index);
+	g_ptr_array_unref (plugin->priv->monitors);
+	g_rw_lock_clear (&plugin->priv->store_lock);
+	g_mutex_clear (&plugin->priv->reload_mutex);
+	g_cond_clear (&plugin->priv->reload_cond);
 }
 
 /**
@@ -170,6 +307,276 @@ gs_plugin_appstream_get_origins_hash (GPtrArray *array)
 	return origins;
 }
 
+/**
+ * gs_plugin_appstream_get_source_dirs:
+ *
+ * Returns: The directories as_store_load() reads AppStream data from.
+ */
+static gchar **
+gs_plugin_appstream_get_source_dirs (void)
+{
+	GPtrArray *dirs;
+	const gchar * const *data_dirs;
+	guint i;
+
+	dirs = g_ptr_array_new ();
+	data_dirs = g_get_system_data_dirs ();
+	for (i = 0; data_dirs[i] != NULL; i++) {
+		g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "app-info", "xmls", NULL));
+		g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "app-info", "yaml", NULL));
+		g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "appdata", NULL));
+		g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "metainfo", NULL));
+		g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "applications", NULL));
+		g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "app-install", "desktop", NULL));
+	}
+	g_ptr_array_add (dirs, g_build_filename (LOCALSTATEDIR, "cache", "app-info", "xmls", NULL));
+	g_ptr_array_add (dirs, g_build_filename (LOCALSTATEDIR, "lib", "app-info", "xmls", NULL));
+	g_ptr_array_add (dirs, g_build_filename (g_get_user_data_dir (), "app-info", "xmls", NULL));
+	g_ptr_array_add (dirs, NULL);
+	return (gchar **) g_ptr_array_free (dirs, FALSE);
+}
+
+/**
+ * gs_plugin_appstream_monitor_changed_cb:
+ */
+static void
+gs_plugin_appstream_monitor_changed_cb (GFileMonitor *monitor,
+					GFile *file,
+					GFile *other_file,
+					GFileMonitorEvent event_type,
+					GsPlugin *plugin)
+{
+	/* wait for the write to complete */
+	if (event_type == G_FILE_MONITOR_EVENT_CHANGED ||
+	    event_type == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+		return;
+	gs_plugin_appstream_store_changed_cb (plugin->priv->store, plugin);
+}
+
+/**
+ * gs_plugin_appstream_watch_dirs:
+ *
+ * The store only watches the directories it loaded itself, so do the same
+ * for the data that came from the cache or was parsed in other threads.
+ */
+static void
+gs_plugin_appstream_watch_dirs (GsPlugin *plugin, gchar **dirs)
+{
+	GFileMonitor *monitor;
+	guint i;
+
+	for (i = 0; dirs[i] != NULL; i++) {
+		g_autoptr(GError) error = NULL;
+		g_autoptr(GFile) file = NULL;
+		if (!g_file_test (dirs[i], G_FILE_TEST_IS_DIR))
+			continue;
+		file = g_file_new_for_path (dirs[i]);
+		monitor = g_file_monitor_directory (file,
+						    G_FILE_MONITOR_NONE,
+						    NULL,
+						    &error);
+		if (monitor == NULL) {
+			g_warning ("failed to watch %s: %s",
+				   dirs[i], error->message);
+			continue;
+		}
+		g_signal_connect (monitor, "changed",
+				  G_CALLBACK (gs_plugin_appstream_monitor_changed_cb),
+				  plugin);
+		g_ptr_array_add (plugin->priv->monitors, monitor);
+	}
+}
+
+typedef struct {
+	gchar			*filename;
+	gchar			*icon_root;
+	AsStoreAddFlags		 add_flags;
+	AsStore			*store;
+	GError			*error;
+} GsPluginAppstreamParseJob;
+
+typedef struct {
+	GsPlugin		*plugin;
+	gint			 parsed;
+	guint			 total;
+} GsPluginAppstreamParseHelper;
+
+/* the share of the setup progress used by parsing the catalogs */
+#define GS_PLUGIN_APPSTREAM_PARSE_PERCENTAGE	70
+
+/**
+ * gs_plugin_appstream_parse_job_free:
+ */
+static void
+gs_plugin_appstream_parse_job_free (GsPluginAppstreamParseJob *job)
+{
+	g_free (job->filename);
+	g_free (job->icon_root);
+	if (job->store != NULL)
+		g_object_unref (job->store);
+	if (job->error != NULL)
+		g_error_free (job->error);
+	g_slice_free (GsPluginAppstreamParseJob, job);
+}
+
+/**
+ * gs_plugin_appstream_parse_thread_cb:
+ */
+static void
+gs_plugin_appstream_parse_thread_cb (gpointer data, gpointer user_data)
+{
+	GsPluginAppstreamParseJob *job = (GsPluginAppstreamParseJob *) data;
+	GsPluginAppstreamParseHelper *helper = (GsPluginAppstreamParseHelper *) user_data;
+	guint parsed;
+	g_autoptr(GFile) file = NULL;
+
+	file = g_file_new_for_path (job->filename);
+	job->store = as_store_new ();
+	as_store_set_add_flags (job->store, job->add_flags);
+	if (!as_store_from_file (job->store, file, job->icon_root,
+				 NULL, &job->error))
+		g_clear_object (&job->store);
+
+	/* the catalogs are most of the work of loading */
+	parsed = (guint) g_atomic_int_add (&helper->parsed, 1) + 1;
+	gs_plugin_setup_progress (helper->plugin,
+				  GS_PLUGIN_APPSTREAM_PARSE_PERCENTAGE * parsed / helper->total);
+}
+
+/**
+ * gs_plugin_appstream_filename_compare_cb:
+ */
+static gint
+gs_plugin_appstream_filename_compare_cb (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*((const gchar **) a), *((const gchar **) b));
+}
+
+/**
+ * gs_plugin_appstream_add_parse_jobs:
+ *
+ * Adds a job for each AppStream catalog in @path, sorted by filename so
+ * the merge order does not depend on the filesystem.
+ */
+static void
+gs_plugin_appstream_add_parse_jobs (GPtrArray *jobs,
+				    const gchar *path,
+				    AsStoreAddFlags add_flags)
+{
+	GsPluginAppstreamParseJob *job;
+	const gchar *tmp;
+	guint i;
+	g_autofree gchar *icon_root = NULL;
+	g_autofree gchar *parent = NULL;
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GPtrArray) filenames = NULL;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir == NULL)
+		return;
+	filenames = g_ptr_array_new_with_free_func (g_free);
+	while ((tmp = g_dir_read_name (dir)) != NULL) {
+		switch (as_app_guess_source_kind (tmp)) {
+		case AS_APP_SOURCE_KIND_APPSTREAM:
+		case AS_APP_SOURCE_KIND_DEP11:
+			break;
+		default:
+			g_debug ("ignoring %s in %s", tmp, path);
+			continue;
+		}
+		g_ptr_array_add (filenames, g_build_filename (path, tmp, NULL));
+	}
+	g_ptr_array_sort (filenames, gs_plugin_appstream_filename_compare_cb);
+
+	/* the icons are in app-info/icons, next to the xmls directory */
+	parent = g_path_get_dirname (path);
+	icon_root = g_build_filename (parent, "icons", NULL);
+	for (i = 0; i < filenames->len; i++) {
+		job = g_slice_new0 (GsPluginAppstreamParseJob);
+		job->filename = g_strdup (g_ptr_array_index (filenames, i));
+		job->icon_root = g_strdup (icon_root);
+		job->add_flags = add_flags;
+		g_ptr_array_add (jobs, job);
+	}
+}
+
+/**
+ * gs_plugin_appstream_load:
+ *
+ * Loads the same sources as as_store_load(), but parses each AppStream
+ * or DEP-11 catalog in its own store on a worker thread. The catalogs are then
+ * merged in the order of @dirs and then filename using as_store_add_app()
+ * so that the result, including %AS_STORE_ADD_FLAG_PREFER_LOCAL handling,
+ * does not depend on which thread finished first. The installed AppData
+ * and desktop files are then loaded as normal.
+ */
+static gboolean
+gs_plugin_appstream_load (GsPlugin *plugin, gchar **dirs, GError **error)
+{
+	AsStoreAddFlags add_flags;
+	GPtrArray *apps;
+	GThreadPool *pool;
+	GsPluginAppstreamParseHelper helper;
+	GsPluginAppstreamParseJob *job;
+	guint i;
+	guint j;
+	g_autoptr(GPtrArray) jobs = NULL;
+
+	/* one job for each catalog */
+	add_flags = as_store_get_add_flags (plugin->priv->store);
+	jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_plugin_appstream_parse_job_free);
+	for (i = 0; dirs[i] != NULL; i++) {
+		g_autofree gchar *basename = g_path_get_basename (dirs[i]);
+		if (g_strcmp0 (basename, "xmls") != 0 &&
+		    g_strcmp0 (basename, "yaml") != 0)
+			continue;
+		gs_plugin_appstream_add_parse_jobs (jobs, dirs[i], add_flags);
+	}
+	if (jobs->len > 0) {
+		helper.plugin = plugin;
+		helper.parsed = 0;
+		helper.total = jobs->len;
+		pool = g_thread_pool_new (gs_plugin_appstream_parse_thread_cb,
+					  &helper,
+					  (gint) MIN (jobs->len, g_get_num_processors ()),
+					  FALSE,
+					  error);
+		if (pool == NULL)
+			return FALSE;
+		for (i = 0; i < jobs->len; i++)
+			g_thread_pool_push (pool, g_ptr_array_index (jobs, i), NULL);
+
+		/* wait for all the catalogs to be parsed */
+		g_thread_pool_free (pool, FALSE, TRUE);
+	}
+
+	/* merge in a fixed order, reporting the first file to fail */
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		if (job->store == NULL) {
+			g_propagate_prefixed_error (error, job->error,
+						    "failed to parse %s: ",
+						    job->filename);
+			job->error = NULL;
+			return FALSE;
+		}
+		apps = as_store_get_apps (job->store);
+		for (j = 0; j < apps->len; j++)
+			as_store_add_app (plugin->priv->store, g_ptr_array_index (apps, j));
+	}
+	g_debug ("merged %u catalogs into %u apps", jobs->len,
+		 as_store_get_size (plugin->priv->store));
+	gs_plugin_setup_progress (plugin, GS_PLUGIN_APPSTREAM_PARSE_PERCENTAGE + 5);
+
+	/* the installed files are merged into what is already there */
+	return as_store_load (plugin->priv->store,
+			      AS_STORE_LOAD_FLAG_APPDATA |
+			      AS_STORE_LOAD_FLAG_DESKTOP |
+			      AS_STORE_LOAD_FLAG_APP_INSTALL,
+			      NULL,
+			      error);
+}
+
 /**
  * gs_plugin_startup:
  */
@@ -178,41 +585,73 @@ gs_plugin_startup (GsPlugin *plugin, GError **error)
 {
 	AsApp *app;
 	GPtrArray *items;
-	gboolean ret;
+	gboolean from_cache;
+	gboolean prefer_local;
+	gboolean ret = TRUE;
 	const gchar *origin;
 	gchar *tmp;
 	guint *perc;
 	guint i;
+	g_auto(GStrv) dirs = NULL;
+	g_autoptr(GError) error_cache = NULL;
 	g_autoptr(GHashTable) origins = NULL;
+	g_autoptr(GVariant) stamps = NULL;
 	g_autoptr(AsProfileTask) ptask = NULL;
 
 	ptask = as_profile_start_literal (plugin->profile, "appstream::startup");
-	g_mutex_lock (&plugin->priv->store_mutex);
+	g_rw_lock_writer_lock (&plugin->priv->store_lock);
 
 	/* clear all existing applications if the store was invalidated */
 	as_store_remove_all (plugin->priv->store);
+	g_ptr_array_set_size (plugin->priv->monitors, 0);
+	g_clear_pointer (&plugin->priv->stamps, g_variant_unref);
 
 	/* get the locale without the UTF-8 suffix */
+	g_free (plugin->priv->locale);
 	plugin->priv->locale = g_strdup (setlocale (LC_MESSAGES, NULL));
 	tmp = g_strstr_len (plugin->priv->locale, -1, ".UTF-8");
 	if (tmp != NULL)
 		*tmp = '\0';
 
+	/* use the cache if none of the source files have changed */
+	prefer_local = g_getenv ("GNOME_SOFTWARE_PREFER_LOCAL") != NULL;
+	dirs = gs_plugin_appstream_get_source_dirs ();
+	stamps = gs_appstream_cache_get_stamps (dirs);
+	g_free (plugin->priv->cache_fn);
+	plugin->priv->cache_fn = g_build_filename (g_get_user_cache_dir (),
+						   "gnome-software",
+						   "appstream.cache",
+						   NULL);
+	g_free (plugin->priv->cache_key);
+	plugin->priv->cache_key = g_strdup_printf ("%s:%s:%s", PACKAGE_VERSION,
+						   plugin->priv->locale,
+						   prefer_local ? "prefer-local" : "default");
+	from_cache = gs_appstream_cache_load (plugin->priv->store,
+					      plugin->priv->cache_fn,
+					      plugin->priv->cache_key,
+					      stamps,
+					      &error_cache);
+	if (from_cache) {
+		g_debug ("loaded AppStream data from %s", plugin->priv->cache_fn);
+		gs_plugin_setup_progress (plugin, GS_PLUGIN_APPSTREAM_PARSE_PERCENTAGE);
+	} else {
+		g_debug ("not using AppStream cache: %s", error_cache->message);
+	}
+
 	/* Parse the XML */
-	if (g_getenv ("GNOME_SOFTWARE_PREFER_LOCAL") != NULL) {
+	if (prefer_local) {
 		as_store_set_add_flags (plugin->priv->store,
 					AS_STORE_ADD_FLAG_PREFER_LOCAL);
 	}
-	ret = as_store_load (plugin->priv->store,
-			     AS_STORE_LOAD_FLAG_APP_INFO_SYSTEM |
-			     AS_STORE_LOAD_FLAG_APP_INFO_USER |
-			     AS_STORE_LOAD_FLAG_APPDATA |
-			     AS_STORE_LOAD_FLAG_DESKTOP |
-			     AS_STORE_LOAD_FLAG_APP_INSTALL,
-			     NULL,
-			     error);
-	if (!ret)
-		goto out;
+	if (!from_cache) {
+		ret = gs_plugin_appstream_load (plugin, dirs, error);
+		if (!ret)
+			goto out;
+		gs_plugin_setup_progress (plugin, GS_PLUGIN_APPSTREAM_PARSE_PERCENTAGE + 15);
+	}
+
+	/* the store does not watch the files it did not load itself */
+	gs_plugin_appstream_watch_dirs (plugin, dirs);
 	items = as_store_get_apps (plugin->priv->store);
 	if (items->len == 0) {
 		g_warning ("No AppStream data, try 'make install-sample-data' in data/");
@@ -224,28 +663,274 @@ gs_plugin_startup (GsPlugin *plugin, GError **error)
 		goto out;
 	}
 
-	/* watch for changes */
-	g_signal_connect (plugin->priv->store, "changed",
-			  G_CALLBACK (gs_plugin_appstream_store_changed_cb),
-			  plugin);
-
 	/* add search terms for apps not in the main source */
-	origins = gs_plugin_appstream_get_origins_hash (items);
+	if (!from_cache) {
+		g_autoptr(GError) error_save = NULL;
+		origins = gs_plugin_appstream_get_origins_hash (items);
+		for (i = 0; i < items->len; i++) {
+			app = g_ptr_array_index (items, i);
+			origin = as_app_get_origin (app);
+			if (origin == NULL)
+				continue;
+			perc = g_hash_table_lookup (origins, origin);
+			if (*perc < 10) {
+				g_debug ("Adding keyword '%s' to %s",
+					 origin, as_app_get_id (app));
+				as_app_add_keyword (app, NULL, origin);
+			}
+		}
+
+		/* save for next time, including the keywords */
+		if (!gs_mkdir_parent (plugin->priv->cache_fn, &error_save) ||
+		    !gs_appstream_cache_save (plugin->priv->store,
+					      plugin->priv->cache_fn,
+					      plugin->priv->cache_key,
+					      stamps,
+					      &error_save)) {
+			g_warning ("failed to save AppStream cache: %s",
+				   error_save->message);
+		}
+	}
+
+	/* index the search terms now all the keywords have been added */
+	gs_plugin_setup_progress (plugin, GS_PLUGIN_APPSTREAM_PARSE_PERCENTAGE + 20);
+	gs_appstream_index_build (plugin->priv->index, items);
+
+	/* only reparse the files that change after this */
+	plugin->priv->stamps = g_variant_ref (stamps);
+out:
+	g_rw_lock_writer_unlock (&plugin->priv->store_lock);
+	return ret;
+}
+
+/**
+ * gs_plugin_appstream_is_installed_file:
+ *
+ * Returns: %TRUE if @filename is in one of the directories of AppData and
+ * desktop files for installed applications, rather than a catalog.
+ */
+static gboolean
+gs_plugin_appstream_is_installed_file (const gchar *filename)
+{
+	g_autofree gchar *dirname = g_path_get_dirname (filename);
+	g_autofree gchar *basename = g_path_get_basename (dirname);
+
+	return g_strcmp0 (basename, "applications") == 0 ||
+	       g_strcmp0 (basename, "appdata") == 0 ||
+	       g_strcmp0 (basename, "metainfo") == 0;
+}
+
+/**
+ * gs_plugin_appstream_reload_file:
+ *
+ * Updates the store for one installed file that was added, removed or
+ * modified, adding the IDs of the applications it affected to @ids.
+ */
+static void
+gs_plugin_appstream_reload_file (GsPlugin *plugin,
+				 const gchar *filename,
+				 GHashTable *ids)
+{
+	AsApp *item;
+	GPtrArray *items;
+	guint i;
+	g_autoptr(AsApp) app = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) stale = NULL;
+
+	/* the store never loads things like mimeinfo.cache */
+	switch (as_app_guess_source_kind (filename)) {
+	case AS_APP_SOURCE_KIND_APPDATA:
+	case AS_APP_SOURCE_KIND_DESKTOP:
+	case AS_APP_SOURCE_KIND_METAINFO:
+		break;
+	default:
+		return;
+	}
+
+	/* remove anything that was loaded from the old version */
+	stale = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	items = as_store_get_apps (plugin->priv->store);
 	for (i = 0; i < items->len; i++) {
-		app = g_ptr_array_index (items, i);
-		origin = as_app_get_origin (app);
-		if (origin == NULL)
+		item = g_ptr_array_index (items, i);
+		if (g_strcmp0 (as_app_get_source_file (item), filename) == 0)
+			g_ptr_array_add (stale, g_object_ref (item));
+	}
+	for (i = 0; i < stale->len; i++) {
+		item = g_ptr_array_index (stale, i);
+		g_hash_table_add (ids, g_strdup (as_app_get_id (item)));
+		as_store_remove_app (plugin->priv->store, item);
+	}
+
+	/* a desktop file that was merged into an AppStream entry */
+	if (!g_file_test (filename, G_FILE_TEST_EXISTS)) {
+		g_autofree gchar *id = g_path_get_basename (filename);
+		item = as_store_get_app_by_id (plugin->priv->store, id);
+		if (item != NULL &&
+		    (as_app_get_source_kind (item) == AS_APP_SOURCE_KIND_APPSTREAM ||
+		     as_app_get_source_kind (item) == AS_APP_SOURCE_KIND_DEP11) &&
+		    as_app_get_state (item) == AS_APP_STATE_INSTALLED) {
+			as_app_set_state (item, AS_APP_STATE_AVAILABLE);
+			g_hash_table_add (ids, g_strdup (id));
+		}
+		return;
+	}
+
+	/* let the store merge it with any AppStream entry, which also
+	 * honours AS_STORE_ADD_FLAG_PREFER_LOCAL */
+	app = as_app_new ();
+	if (!as_app_parse_file (app, filename,
+				AS_APP_PARSE_FLAG_USE_HEURISTICS, &error)) {
+		g_debug ("not loading %s: %s", filename, error->message);
+		return;
+	}
+	as_app_set_source_file (app, filename);
+	as_app_set_state (app, AS_APP_STATE_INSTALLED);
+	as_store_add_app (plugin->priv->store, app);
+	g_hash_table_add (ids, g_strdup (as_app_get_id (app)));
+}
+
+/**
+ * gs_plugin_appstream_reload:
+ *
+ * Reparses only the installed files that changed since the store was
+ * loaded, and tells the plugin loader which applications were affected.
+ * A change to any AppStream catalog still reloads everything.
+ */
+static void
+gs_plugin_appstream_reload (GsPlugin *plugin, GCancellable *cancellable)
+{
+	const gchar *fn;
+	gboolean full_reload = FALSE;
+	guint i;
+	g_auto(GStrv) dirs = NULL;
+	g_autofree gchar **ids = NULL;
+	g_autoptr(AsProfileTask) ptask = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) ids_hash = NULL;
+	g_autoptr(GPtrArray) changed = NULL;
+	g_autoptr(GVariant) stamps = NULL;
+
+	g_rw_lock_writer_lock (&plugin->priv->store_lock);
+
+	/* not loaded yet, or about to be loaded from scratch */
+	if (plugin->priv->stamps == NULL)
+		goto out;
+
+	/* the store changed the files itself, or the data was the same */
+	dirs = gs_plugin_appstream_get_source_dirs ();
+	stamps = gs_appstream_cache_get_stamps (dirs);
+	changed = gs_appstream_cache_get_changed (plugin->priv->stamps, stamps);
+	for (i = 0; i < changed->len; i++) {
+		fn = g_ptr_array_index (changed, i);
+		if (g_strv_contains ((const gchar * const *) dirs, fn))
 			continue;
-		perc = g_hash_table_lookup (origins, origin);
-		if (*perc < 10) {
-			g_debug ("Adding keyword '%s' to %s",
-				 origin, as_app_get_id (app));
-			as_app_add_keyword (app, NULL, origin);
+		if (!gs_plugin_appstream_is_installed_file (fn)) {
+			g_debug ("%s changed, reloading all AppStream data", fn);
+			full_reload = TRUE;
+			goto out;
 		}
 	}
+
+	/* only parse the files that changed */
+	ptask = as_profile_start_literal (plugin->profile, "appstream::reload");
+	ids_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < changed->len; i++) {
+		fn = g_ptr_array_index (changed, i);
+		if (g_strv_contains ((const gchar * const *) dirs, fn))
+			continue;
+		g_debug ("reloading %s", fn);
+		gs_plugin_appstream_reload_file (plugin, fn, ids_hash);
+	}
+	g_clear_pointer (&plugin->priv->stamps, g_variant_unref);
+	plugin->priv->stamps = g_variant_ref (stamps);
+	if (g_hash_table_size (ids_hash) == 0)
+		goto out;
+
+	/* searches and categories have to see the new data */
+	gs_appstream_index_build (plugin->priv->index,
+				  as_store_get_apps (plugin->priv->store));
+	if (!gs_appstream_cache_save (plugin->priv->store,
+				      plugin->priv->cache_fn,
+				      plugin->priv->cache_key,
+				      stamps,
+				      &error)) {
+		g_warning ("failed to save AppStream cache: %s",
+			   error->message);
+	}
+	ids = (gchar **) g_hash_table_get_keys_as_array (ids_hash, NULL);
 out:
-	g_mutex_unlock (&plugin->priv->store_mutex);
-	return ret;
+	if (full_reload) {
+		g_clear_pointer (&plugin->priv->stamps, g_variant_unref);
+		g_clear_error (&plugin->priv->startup_error);
+		plugin->priv->done_init = FALSE;
+	}
+	g_rw_lock_writer_unlock (&plugin->priv->store_lock);
+
+	/* the plugin is being destroyed */
+	if (g_cancellable_is_cancelled (cancellable))
+		return;
+
+	/* this is not strictly true, but it causes all the UI to be reloaded
+	 * which is what we really want */
+	if (full_reload)
+		gs_plugin_updates_changed (plugin);
+	else if (ids != NULL)
+		gs_plugin_apps_changed (plugin, ids);
+}
+
+/**
+ * gs_plugin_appstream_ensure_loaded:
+ *
+ * Loads the XML files once, or waits for the thread that got there first.
+ * A failure is kept so that every request reports it, not just the first.
+ */
+static gboolean
+gs_plugin_appstream_ensure_loaded (GsPlugin *plugin, GError **error)
+{
+	if (g_once_init_enter (&plugin->priv->done_init)) {
+		gs_plugin_startup (plugin, &plugin->priv->startup_error);
+		g_once_init_leave (&plugin->priv->done_init, TRUE);
+	}
+	if (plugin->priv->startup_error != NULL) {
+		g_propagate_error (error, g_error_copy (plugin->priv->startup_error));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * gs_plugin_setup:
+ */
+gboolean
+gs_plugin_setup (GsPlugin *plugin, GCancellable *cancellable, GError **error)
+{
+	/* load XML files, or wait for the request that got there first */
+	return gs_plugin_appstream_ensure_loaded (plugin, error);
+}
+
+/**
+ * gs_plugin_appstream_icon_copy:
+ *
+ * Other threads can be refining from the same #AsApp, so the icons in the
+ * store are copied before they are changed or loaded.
+ */
+static AsIcon *
+gs_plugin_appstream_icon_copy (AsIcon *icon)
+{
+	AsIcon *copy;
+
+	if (icon == NULL)
+		return NULL;
+	copy = as_icon_new ();
+	as_icon_set_kind (copy, as_icon_get_kind (icon));
+	as_icon_set_name (copy, as_icon_get_name (icon));
+	as_icon_set_prefix (copy, as_icon_get_prefix (icon));
+	as_icon_set_filename (copy, as_icon_get_filename (icon));
+	as_icon_set_url (copy, as_icon_get_url (icon));
+	as_icon_set_width (copy, as_icon_get_width (icon));
+	as_icon_set_height (copy, as_icon_get_height (icon));
+	return copy;
 }
 
 /**
@@ -254,35 +939,22 @@ out:
 static void
 gs_plugin_refine_item_pixbuf (GsPlugin *plugin, GsApp *app, AsApp *item)
 {
-	AsIcon *icon;
+	AsIcon *icon_item;
 	gboolean ret;
+	g_autoptr(AsIcon) icon = NULL;
 	g_autoptr(GError) error = NULL;
-	g_autofree gchar *fn = NULL;
-	g_autofree gchar *path = NULL;
 
-	icon = as_app_get_icon_default (item);
+	icon = gs_plugin_appstream_icon_copy (as_app_get_icon_default (item));
 	switch (as_icon_get_kind (icon)) {
 	case AS_ICON_KIND_REMOTE:
 		gs_app_set_icon (app, icon);
-		if (as_icon_get_filename (icon) == NULL) {
-			path = g_build_filename (g_get_user_data_dir (),
-						 "gnome-software",
-						 "icons",
-						 NULL);
-			fn = g_build_filename (path, as_icon_get_name (icon), NULL);
-			as_icon_set_filename (icon, fn);
-			as_icon_set_prefix (icon, path);
-		}
-		if (g_file_test (fn, G_FILE_TEST_EXISTS)) {
-			as_icon_set_kind (icon, AS_ICON_KIND_LOCAL);
-			ret = gs_app_load_icon (app, plugin->scale, &error);
-			if (!ret) {
-				g_warning ("failed to load icon %s: %s",
-					   as_icon_get_name (icon),
-					   error->message);
-				return;
-			}
-		}
+
+		/* downloaded into the icon pack by the icons plugin, and
+		 * decoded from there when shown */
+		if (as_icon_get_url (icon) == NULL)
+			break;
+		if (!gs_app_load_icon (app, plugin->scale, &error))
+			g_debug ("%s", error->message);
 		break;
 	case AS_ICON_KIND_STOCK:
 	case AS_ICON_KIND_LOCAL:
@@ -296,6 +968,7 @@ gs_plugin_refine_item_pixbuf (GsPlugin *plugin, GsApp *app, AsApp *item)
 		/* load */
 		ret = gs_app_load_icon (app, plugin->scale, &error);
 		if (!ret) {
+			gs_app_add_refine_failed (app, GS_PLUGIN_REFINED_DEFAULT);
 			g_warning ("failed to load %s icon %s: %s",
 				   as_icon_kind_to_string (as_icon_get_kind (icon)),
 				   as_icon_get_name (icon),
@@ -304,21 +977,26 @@ gs_plugin_refine_item_pixbuf (GsPlugin *plugin, GsApp *app, AsApp *item)
 		}
 		break;
 	case AS_ICON_KIND_CACHED:
+		icon_item = NULL;
 		if (plugin->scale == 2)
-			icon = as_app_get_icon_for_size (item, 128, 128);
-		if (icon == NULL)
-			icon = as_app_get_icon_for_size (item, 64, 64);
-		if (icon == NULL) {
+			icon_item = as_app_get_icon_for_size (item, 128, 128);
+		if (icon_item == NULL)
+			icon_item = as_app_get_icon_for_size (item, 64, 64);
+		if (icon_item == NULL) {
+			gs_app_add_refine_failed (app, GS_PLUGIN_REFINED_DEFAULT);
 			g_warning ("failed to find cached icon %s",
 				   as_icon_get_name (icon));
 			return;
 		}
-		if (!as_icon_load (icon, AS_ICON_LOAD_FLAG_SEARCH_SIZE, &error)) {
+		g_object_unref (icon);
+		icon = gs_plugin_appstream_icon_copy (icon_item);
+		gs_app_set_icon (app, icon);
+		if (!gs_app_load_icon (app, plugin->scale, &error)) {
+			gs_app_add_refine_failed (app, GS_PLUGIN_REFINED_DEFAULT);
 			g_warning ("failed to load cached icon %s: %s",
 				   as_icon_get_name (icon), error->message);
 				return;
 		}
-		gs_app_set_pixbuf (app, as_icon_get_pixbuf (icon));
 		break;
 	default:
 		g_warning ("icon kind unknown for %s", as_app_get_id (item));
@@ -591,7 +1269,9 @@ gs_plugin_refine_item (GsPlugin *plugin,
 	}
 
 	/* set icon */
-	if (as_app_get_icon_default (item) != NULL && gs_app_get_pixbuf (app) == NULL)
+	if (as_app_get_icon_default (item) != NULL &&
+	    !gs_app_get_icon_deferred (app) &&
+	    gs_app_get_pixbuf (app) == NULL)
 		gs_plugin_refine_item_pixbuf (plugin, app, item);
 
 	/* set categories */
@@ -692,7 +1372,7 @@ gs_plugin_refine_from_id (GsPlugin *plugin,
 	gboolean ret = TRUE;
 	AsApp *item = NULL;
 
-	g_mutex_lock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_lock (&plugin->priv->store_lock);
 
 	/* find anything that matches the ID */
 	id = gs_app_get_id (app);
@@ -707,7 +1387,7 @@ gs_plugin_refine_from_id (GsPlugin *plugin,
 	if (!ret)
 		goto out;
 out:
-	g_mutex_unlock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_unlock (&plugin->priv->store_lock);
 	*found = (item != NULL);
 	return ret;
 }
@@ -726,7 +1406,7 @@ gs_plugin_refine_from_pkgname (GsPlugin *plugin,
 	const gchar *pkgname;
 	guint i;
 
-	g_mutex_lock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_lock (&plugin->priv->store_lock);
 
 	/* find anything that matches the ID */
 	sources = gs_app_get_sources (app);
@@ -745,7 +1425,7 @@ gs_plugin_refine_from_pkgname (GsPlugin *plugin,
 	/* set new properties */
 	ret = gs_plugin_refine_item (plugin, app, item, error);
 out:
-	g_mutex_unlock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_unlock (&plugin->priv->store_lock);
 	return ret;
 }
 
@@ -764,15 +1444,11 @@ gs_plugin_add_distro_upgrades (GsPlugin *plugin,
 	guint i;
 
 	/* load XML files */
-	if (g_once_init_enter (&plugin->priv->done_init)) {
-		ret = gs_plugin_startup (plugin, error);
-		g_once_init_leave (&plugin->priv->done_init, TRUE);
-		if (!ret)
-			return FALSE;
-	}
+	if (!gs_plugin_appstream_ensure_loaded (plugin, error))
+		return FALSE;
 
 	/* find any upgrades */
-	g_mutex_lock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_lock (&plugin->priv->store_lock);
 	array = as_store_get_apps (plugin->priv->store);
 	for (i = 0; i < array->len; i++) {
 		g_autoptr(GsApp) app = NULL;
@@ -794,7 +1470,7 @@ gs_plugin_add_distro_upgrades (GsPlugin *plugin,
 		gs_plugin_add_app (list, app);
 	}
 out:
-	g_mutex_unlock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_unlock (&plugin->priv->store_lock);
 	return ret;
 }
 
@@ -808,19 +1484,14 @@ gs_plugin_refine (GsPlugin *plugin,
 		  GCancellable *cancellable,
 		  GError **error)
 {
-	gboolean ret;
 	gboolean found;
 	GList *l;
 	GsApp *app;
 	g_autoptr(AsProfileTask) ptask = NULL;
 
 	/* load XML files */
-	if (g_once_init_enter (&plugin->priv->done_init)) {
-		ret = gs_plugin_startup (plugin, error);
-		g_once_init_leave (&plugin->priv->done_init, TRUE);
-		if (!ret)
-			return FALSE;
-	}
+	if (!gs_plugin_appstream_ensure_loaded (plugin, error))
+		return FALSE;
 
 	ptask = as_profile_start_literal (plugin->profile, "appstream::refine");
 	for (l = *list; l != NULL; l = l->next) {
@@ -852,21 +1523,17 @@ gs_plugin_add_category_apps (GsPlugin *plugin,
 	gboolean ret = TRUE;
 	AsApp *item;
 	GsCategory *parent;
-	GPtrArray *array;
 	guint i;
 	g_autoptr(AsProfileTask) ptask = NULL;
+	g_autoptr(GPtrArray) array = NULL;
 
 	/* load XML files */
-	if (g_once_init_enter (&plugin->priv->done_init)) {
-		ret = gs_plugin_startup (plugin, error);
-		g_once_init_leave (&plugin->priv->done_init, TRUE);
-		if (!ret)
-			return FALSE;
-	}
+	if (!gs_plugin_appstream_ensure_loaded (plugin, error))
+		return FALSE;
 
 	/* get the two search terms */
 	ptask = as_profile_start_literal (plugin->profile, "appstream::add-category-apps");
-	g_mutex_lock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_lock (&plugin->priv->store_lock);
 	search_id1 = gs_category_get_id (category);
 	parent = gs_category_get_parent (category);
 	if (parent != NULL)
@@ -878,17 +1545,17 @@ gs_plugin_add_category_apps (GsPlugin *plugin,
 		search_id2 = NULL;
 	}
 
-	/* just look at each app in turn */
-	array = as_store_get_apps (plugin->priv->store);
+	/* nothing to match */
+	if (search_id1 == NULL)
+		goto out;
+
+	/* just look at the apps in both categories */
+	array = gs_appstream_index_get_category_apps (plugin->priv->index,
+						      search_id1,
+						      search_id2);
 	for (i = 0; i < array->len; i++) {
 		g_autoptr(GsApp) app = NULL;
 		item = g_ptr_array_index (array, i);
-		if (as_app_get_id (item) == NULL)
-			continue;
-		if (!as_app_has_category (item, search_id1))
-			continue;
-		if (search_id2 != NULL && !as_app_has_category (item, search_id2))
-			continue;
 
 		/* got a search match, so add all the data we can */
 		app = gs_app_new (as_app_get_id (item));
@@ -898,7 +1565,7 @@ gs_plugin_add_category_apps (GsPlugin *plugin,
 		gs_plugin_add_app (list, app);
 	}
 out:
-	g_mutex_unlock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_unlock (&plugin->priv->store_lock);
 	return ret;
 }
 
@@ -939,7 +1606,8 @@ gs_plugin_add_search_item (GsPlugin *plugin,
 	guint i;
 	guint match_value;
 
-	/* no match */
+	/* no match; the token cache was built with the index, so this only
+	 * reads the app */
 	match_value = as_app_search_matches_all (app, values);
 	if (match_value == 0)
 		goto out;
@@ -987,23 +1655,19 @@ gs_plugin_add_search (GsPlugin *plugin,
 		      GError **error)
 {
 	AsApp *item;
-	GPtrArray *array;
 	gboolean ret = TRUE;
 	guint i;
 	g_autoptr(AsProfileTask) ptask = NULL;
+	g_autoptr(GPtrArray) array = NULL;
 
 	/* load XML files */
-	if (g_once_init_enter (&plugin->priv->done_init)) {
-		ret = gs_plugin_startup (plugin, error);
-		g_once_init_leave (&plugin->priv->done_init, TRUE);
-		if (!ret)
-			return FALSE;
-	}
+	if (!gs_plugin_appstream_ensure_loaded (plugin, error))
+		return FALSE;
 
-	/* search categories for the search term */
+	/* only score the apps the index says could match */
 	ptask = as_profile_start_literal (plugin->profile, "appstream::search");
-	g_mutex_lock (&plugin->priv->store_mutex);
-	array = as_store_get_apps (plugin->priv->store);
+	g_rw_lock_reader_lock (&plugin->priv->store_lock);
+	array = gs_appstream_index_search (plugin->priv->index, values);
 	for (i = 0; i < array->len; i++) {
 		if (g_cancellable_set_error_if_cancelled (cancellable, error))
 			goto out;
@@ -1014,7 +1678,7 @@ gs_plugin_add_search (GsPlugin *plugin,
 			goto out;
 	}
 out:
-	g_mutex_unlock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_unlock (&plugin->priv->store_lock);
 	return ret;
 }
 
@@ -1034,16 +1698,12 @@ gs_plugin_add_installed (GsPlugin *plugin,
 	g_autoptr(AsProfileTask) ptask = NULL;
 
 	/* load XML files */
-	if (g_once_init_enter (&plugin->priv->done_init)) {
-		ret = gs_plugin_startup (plugin, error);
-		g_once_init_leave (&plugin->priv->done_init, TRUE);
-		if (!ret)
-			return FALSE;
-	}
+	if (!gs_plugin_appstream_ensure_loaded (plugin, error))
+		return FALSE;
 
 	/* search categories for the search term */
 	ptask = as_profile_start_literal (plugin->profile, "appstream::add_installed");
-	g_mutex_lock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_lock (&plugin->priv->store_lock);
 	array = as_store_get_apps (plugin->priv->store);
 	for (i = 0; i < array->len; i++) {
 		item = g_ptr_array_index (array, i);
@@ -1058,54 +1718,58 @@ gs_plugin_add_installed (GsPlugin *plugin,
 		}
 	}
 out:
-	g_mutex_unlock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_unlock (&plugin->priv->store_lock);
 	return ret;
 }
 
 /**
- * gs_plugin_add_categories_for_app:
+ * gs_plugin_add_categories_for_parent:
  */
 static void
-gs_plugin_add_categories_for_app (GList *list, AsApp *app)
+gs_plugin_add_categories_for_parent (GsPlugin *plugin, GsCategory *parent)
 {
 	GList *l;
-	GList *l2;
 	GsCategory *category;
-	GsCategory *parent;
-	gboolean found_subcat;
+	const gchar *id;
+	const gchar *parent_id;
+	guint size;
+	g_autoptr(GList) children = NULL;
 
-	/* does it match the main category */
-	for (l = list; l != NULL; l = l->next) {
-		g_autoptr(GList) children = NULL;
-		parent = GS_CATEGORY (l->data);
-		if (!as_app_has_category (app, gs_category_get_id (parent)))
+	/* does anything match the main category */
+	parent_id = gs_category_get_id (parent);
+	if (parent_id == NULL)
+		return;
+	size = gs_appstream_index_get_category_size (plugin->priv->index,
+						     parent_id, NULL);
+	if (size == 0)
+		return;
+	gs_category_set_size (parent, gs_category_get_size (parent) + size);
+
+	/* does anything match the sub-categories */
+	children = gs_category_get_subcategories (parent);
+	for (l = children; l != NULL; l = l->next) {
+		category = GS_CATEGORY (l->data);
+		id = gs_category_get_id (category);
+		if (id == NULL || g_strcmp0 (id, "other") == 0)
 			continue;
-		gs_category_increment_size (parent);
-
-		/* does it match any sub-categories */
-		found_subcat = FALSE;
-		children = gs_category_get_subcategories (parent);
-		for (l2 = children; l2 != NULL; l2 = l2->next) {
-			category = GS_CATEGORY (l2->data);
-			if (!as_app_has_category (app, gs_category_get_id (category)))
-				continue;
-			gs_category_increment_size (category);
-			found_subcat = TRUE;
-		}
+		size = gs_appstream_index_get_category_size (plugin->priv->index,
+							     id, parent_id);
+		gs_category_set_size (category, gs_category_get_size (category) + size);
+	}
 
-		/* matching the main category but no subcategories means we have
-		 * to create a new 'Other' subcategory manually */
-		if (!found_subcat) {
-			category = gs_category_find_child (parent, "other");
-			if (category == NULL) {
-				category = gs_category_new (parent, "other", NULL);
-				gs_category_add_subcategory (parent, category);
-				g_object_unref (category);
-			}
-			as_app_add_category (app, gs_category_get_id (category));
-			gs_category_increment_size (category);
-		}
+	/* matching the main category but no subcategories means we have
+	 * to create a new 'Other' subcategory manually */
+	size = gs_appstream_index_get_category_size (plugin->priv->index,
+						     "other", parent_id);
+	if (size == 0)
+		return;
+	category = gs_category_find_child (parent, "other");
+	if (category == NULL) {
+		category = gs_category_new (parent, "other", NULL);
+		gs_category_add_subcategory (parent, category);
+		g_object_unref (category);
 	}
+	gs_category_set_size (category, gs_category_get_size (category) + size);
 }
 
 /**
@@ -1117,32 +1781,20 @@ gs_plugin_add_categories (GsPlugin *plugin,
 			  GCancellable *cancellable,
 			  GError **error)
 {
-	AsApp *app;
-	GPtrArray *array;
+	GList *l;
 	gboolean ret = TRUE;
-	guint i;
 	g_autoptr(AsProfileTask) ptask = NULL;
 
 	/* load XML files */
-	if (g_once_init_enter (&plugin->priv->done_init)) {
-		ret = gs_plugin_startup (plugin, error);
-		g_once_init_leave (&plugin->priv->done_init, TRUE);
-		if (!ret)
-			return FALSE;
-	}
+	if (!gs_plugin_appstream_ensure_loaded (plugin, error))
+		return FALSE;
 
-	/* find out how many packages are in each category */
+	/* find out how many packages are in each category; the sizes and
+	 * the 'Other' categories were worked out when the index was built */
 	ptask = as_profile_start_literal (plugin->profile, "appstream::add-categories");
-	g_mutex_lock (&plugin->priv->store_mutex);
-	array = as_store_get_apps (plugin->priv->store);
-	for (i = 0; i < array->len; i++) {
-		app = g_ptr_array_index (array, i);
-		if (as_app_get_id (app) == NULL)
-			continue;
-		if (as_app_get_priority (app) < 0)
-			continue;
-		gs_plugin_add_categories_for_app (*list, app);
-	}
-	g_mutex_unlock (&plugin->priv->store_mutex);
+	g_rw_lock_reader_lock (&plugin->priv->store_lock);
+	for (l = *list; l != NULL; l = l->next)
+		gs_plugin_add_categories_for_parent (plugin, GS_CATEGORY (l->data));
+	g_rw_lock_reader_unlock (&plugin->priv->store_lock);
 	return ret;
 }
@@ -111,12 +111,30 @@ gs_plugin_app_install (GsPlugin *plugin, GsApp *app,
 
 	/* symlink icon */
 	epi_icon = g_build_filename (epi_dir, "app-icon.png", NULL);
-	symlink_icon = g_file_new_for_path (epi_icon);
 	icon = gs_app_get_icon (app);
-	ret = g_file_make_symbolic_link (symlink_icon,
-					 as_icon_get_filename (icon),
-					 NULL,
-					 &error_local);
+	if (as_icon_get_filename (icon) == NULL) {
+		g_autoptr(GdkPixbuf) pixbuf = NULL;
+
+		/* remote icons are only kept in the icon pack, and may not
+		 * have been decoded yet */
+		pixbuf = gs_app_get_icon_pixbuf (app, plugin->scale, NULL);
+		if (pixbuf == NULL) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "No icon for %s",
+				     gs_app_get_id (app));
+			return FALSE;
+		}
+		if (!gdk_pixbuf_save (pixbuf, epi_icon, "png", error, NULL))
+			return FALSE;
+	} else {
+		symlink_icon = g_file_new_for_path (epi_icon);
+		ret = g_file_make_symbolic_link (symlink_icon,
+						 as_icon_get_filename (icon),
+						 NULL,
+						 &error_local);
+	}
 	if (!ret) {
 		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
 			g_debug ("ignoring icon symlink failure: %s",
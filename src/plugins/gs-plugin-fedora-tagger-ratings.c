@@ -24,16 +24,21 @@
 #include <libsoup/soup.h>
 #include <string.h>
 #include <sqlite3.h>
-#include <stdlib.h>
 
 #include <gs-plugin.h>
 #include <gs-utils.h>
 
+#include "gs-fedora-tagger-import.h"
+#include "gs-http-validators.h"
+
 struct GsPluginPrivate {
 	SoupSession		*session;
 	gchar			*db_path;
+	gchar			*validators_fn;
 	gsize			 loaded;
 	sqlite3			*db;
+	GMutex			 ratings_mutex;
+	GHashTable		*ratings;	/* pkgname → packed rating */
 };
 
 /**
@@ -50,6 +55,13 @@ gs_plugin_get_name (void)
 /* 3 months */
 #define GS_PLUGIN_FEDORA_TAGGER_AGE_MAX		(60 * 60 * 24 * 7 * 4 * 3)
 
+/* the rating and confidence share one pointer-sized hash table value,
+ * with the top bit set so that it is never NULL */
+#define GS_PLUGIN_FEDORA_TAGGER_PACK(rating,confidence)	\
+	GUINT_TO_POINTER (0x80000000u | ((guint) (rating) << 24) | (guint) (confidence))
+#define GS_PLUGIN_FEDORA_TAGGER_RATING(value)		((gint) ((GPOINTER_TO_UINT (value) >> 24) & 0x7f))
+#define GS_PLUGIN_FEDORA_TAGGER_CONFIDENCE(value)	((gint) (GPOINTER_TO_UINT (value) & 0xffffff))
+
 /**
  * gs_plugin_initialize:
  */
@@ -61,6 +73,13 @@ gs_plugin_initialize (GsPlugin *plugin)
 						  "gnome-software",
 						  "fedora-tagger.db",
 						  NULL);
+	plugin->priv->validators_fn = g_build_filename (g_get_user_data_dir (),
+							"gnome-software",
+							"fedora-tagger.validators",
+							NULL);
+	g_mutex_init (&plugin->priv->ratings_mutex);
+	plugin->refine_flags = GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING;
+	plugin->refine_flags_requires = GS_PLUGIN_REFINED_DEFAULT;
 
 	/* check that we are running on Fedora */
 	if (!gs_plugin_check_distro_id (plugin, "fedora")) {
@@ -90,6 +109,10 @@ void
 gs_plugin_destroy (GsPlugin *plugin)
 {
 	g_free (plugin->priv->db_path);
+	g_free (plugin->priv->validators_fn);
+	if (plugin->priv->ratings != NULL)
+		g_hash_table_unref (plugin->priv->ratings);
+	g_mutex_clear (&plugin->priv->ratings_mutex);
 	if (plugin->priv->db != NULL)
 		sqlite3_close (plugin->priv->db);
 	if (plugin->priv->session != NULL)
@@ -262,56 +285,6 @@ gs_plugin_fedora_tagger_timestamp_cb (void *data, gint argc,
 	return 0;
 }
 
-typedef struct {
-	gchar		*pkgname;
-	gdouble		 rating;
-	gdouble		 vote_count;
-	gdouble		 user_count;
-	gdouble		 confidence;
-} FedoraTaggerItem;
-
-/**
- * fedora_tagger_item_free:
- */
-static void
-fedora_tagger_item_free (FedoraTaggerItem *item)
-{
-	g_free (item->pkgname);
-	g_slice_free (FedoraTaggerItem, item);
-}
-
-/**
- * gs_plugin_fedora_tagger_add:
- */
-static gboolean
-gs_plugin_fedora_tagger_add (GsPlugin *plugin,
-			     FedoraTaggerItem *item,
-			     GError **error)
-{
-	char *error_msg = NULL;
-	gint rc;
-	g_autofree gchar *statement = NULL;
-
-	/* insert the entry */
-	statement = g_strdup_printf ("INSERT OR REPLACE INTO ratings (pkgname, rating, "
-				     "vote_count, user_count, confidence) "
-				     "VALUES ('%s', '%.0f', '%.0f', '%.0f', '%.0f');",
-				     item->pkgname, item->rating,
-				     item->vote_count, item->user_count,
-				     item->confidence);
-	rc = sqlite3_exec (plugin->priv->db, statement, NULL, NULL, &error_msg);
-	if (rc != SQLITE_OK) {
-		g_set_error (error,
-			     GS_PLUGIN_ERROR,
-			     GS_PLUGIN_ERROR_FAILED,
-			     "SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
-		return FALSE;
-	}
-	return TRUE;
-
-}
-
 /**
  * gs_plugin_fedora_tagger_set_timestamp:
  */
@@ -343,104 +316,125 @@ gs_plugin_fedora_tagger_set_timestamp (GsPlugin *plugin,
 
 /**
  * gs_plugin_fedora_tagger_download:
+ * @conditional: only download the dump if it changed since the last one
  */
 static gboolean
-gs_plugin_fedora_tagger_download (GsPlugin *plugin, GError **error)
+gs_plugin_fedora_tagger_download (GsPlugin *plugin,
+				  gboolean conditional,
+				  GError **error)
 {
-	FedoraTaggerItem *item;
-	gdouble count_sum = 0;
-	guint i;
-	guint status_code;
 	g_autofree gchar *uri = NULL;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GInputStream) stream = NULL;
 	g_autoptr(SoupMessage) msg = NULL;
-	g_autoptr(GPtrArray) items = NULL;
-	g_auto(GStrv) split = NULL;
 
 	/* create the GET data */
 	uri = g_strdup_printf ("%s/api/v1/rating/dump/",
 			       GS_PLUGIN_FEDORA_TAGGER_SERVER);
 	msg = soup_message_new (SOUP_METHOD_GET, uri);
+	if (conditional)
+		gs_http_validators_add (msg, plugin->priv->validators_fn);
 
 	/* ensure networking is set up */
 	if (!gs_plugin_setup_networking (plugin, error))
 		return FALSE;
 
-	/* set sync request */
-	status_code = soup_session_send_message (plugin->priv->session, msg);
-	if (status_code != SOUP_STATUS_OK) {
+	/* set sync request, reading the body as it arrives */
+	stream = soup_session_send (plugin->priv->session, msg, NULL, &error_local);
+	if (stream == NULL) {
 		g_set_error (error,
 			     GS_PLUGIN_ERROR,
 			     GS_PLUGIN_ERROR_FAILED,
 			     "Failed to download fedora-tagger dump: %s",
-			     soup_status_get_phrase (status_code));
+			     error_local->message);
 		return FALSE;
 	}
-
-	/* process the tab-delimited data */
-	items = g_ptr_array_new_with_free_func ((GDestroyNotify) fedora_tagger_item_free);
-	split = g_strsplit (msg->response_body->data, "\n", -1);
-	for (i = 0; split[i] != NULL; i++) {
-		g_auto(GStrv) fields = NULL;
-		if (split[i][0] == '\0' ||
-		    split[i][0] == '#')
-			continue;
-		fields = g_strsplit (split[i], "\t", -1);
-		if (g_strv_length (fields) == 4) {
-			item = g_slice_new0 (FedoraTaggerItem);
-			item->pkgname = g_strdup (fields[0]);
-			item->rating = g_strtod (fields[1], NULL);
-			item->vote_count = g_strtod (fields[2], NULL);
-			item->user_count = g_strtod (fields[3], NULL);
-			g_ptr_array_add (items, item);
-		} else {
-			g_warning ("unexpected data from fedora-tagger, expected: "
-				   "'pkgname\trating\tvote_count\tuser_count' and got '%s'",
-				   split[i]);
-		}
+	if (msg->status_code == SOUP_STATUS_NOT_MODIFIED) {
+		g_debug ("fedora-tagger dump is unchanged");
+		return gs_plugin_fedora_tagger_set_timestamp (plugin, "mtime", error);
 	}
-
-	/* no suitable data? */
-	if (items->len == 0) {
-		g_set_error_literal (error,
-				     GS_PLUGIN_ERROR,
-				     GS_PLUGIN_ERROR_FAILED,
-				     "Failed to get data from fedora-tagger");
+	if (msg->status_code != SOUP_STATUS_OK) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "Failed to download fedora-tagger dump: %s",
+			     soup_status_get_phrase (msg->status_code));
 		return FALSE;
 	}
 
-	/* calculate confidence */
-	for (i = 0; i < items->len; i++) {
-		item = g_ptr_array_index (items, i);
-		count_sum += item->vote_count;
-	}
-	if (count_sum == 0) {
-		g_set_error_literal (error,
-				     GS_PLUGIN_ERROR,
-				     GS_PLUGIN_ERROR_FAILED,
-				     "Failed to get vote count in fedora-tagger");
+	/* add every package in one transaction */
+	if (!gs_fedora_tagger_import (plugin->priv->db, stream, NULL, &error_local)) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "Failed to import fedora-tagger dump: %s",
+			     error_local->message);
 		return FALSE;
 	}
-	count_sum /= (gdouble) items->len;
-	g_debug ("fedora-tagger vote_count average is %.2f", count_sum);
-	for (i = 0; i < items->len; i++) {
-		item = g_ptr_array_index (items, i);
-		item->confidence = MAX (100.0f * item->vote_count / count_sum, 100);
-	}
-
-	/* add each completed item */
-	for (i = 0; i < items->len; i++) {
-		item = g_ptr_array_index (items, i);
-		g_debug ("adding %s: %.1f%% [%.1f] {%.1f%%}",
-			 item->pkgname, item->rating,
-			 item->vote_count, item->confidence);
-		if (!gs_plugin_fedora_tagger_add (plugin, item, error))
-			return FALSE;
+	if (!gs_http_validators_save (msg, plugin->priv->validators_fn, &error_local)) {
+		g_warning ("Failed to save fedora-tagger validators: %s",
+			   error_local->message);
 	}
 
 	/* reset the timestamp */
 	return gs_plugin_fedora_tagger_set_timestamp (plugin, "mtime", error);
 }
 
+/**
+ * gs_plugin_fedora_tagger_load_ratings:
+ *
+ * Reads the whole ratings table into memory, replacing what refine uses
+ * only once it has all been read.
+ */
+static gboolean
+gs_plugin_fedora_tagger_load_ratings (GsPlugin *plugin, GError **error)
+{
+	GHashTable *ratings;
+	gint confidence;
+	gint rating;
+	gint rc;
+	sqlite3_stmt *stmt = NULL;
+
+	rc = sqlite3_prepare_v2 (plugin->priv->db,
+				 "SELECT pkgname, rating, confidence FROM ratings;",
+				 -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "SQL error: %s",
+			     sqlite3_errmsg (plugin->priv->db));
+		return FALSE;
+	}
+	ratings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+		rating = CLAMP (sqlite3_column_int (stmt, 1), 0, 100);
+		confidence = CLAMP (sqlite3_column_int (stmt, 2), 0, 0xffffff);
+		g_hash_table_insert (ratings,
+				     g_strdup ((const gchar *) sqlite3_column_text (stmt, 0)),
+				     GS_PLUGIN_FEDORA_TAGGER_PACK (rating, confidence));
+	}
+	sqlite3_finalize (stmt);
+	if (rc != SQLITE_DONE) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "SQL error: %s",
+			     sqlite3_errmsg (plugin->priv->db));
+		g_hash_table_unref (ratings);
+		return FALSE;
+	}
+	g_debug ("loaded %u fedora-tagger ratings", g_hash_table_size (ratings));
+
+	/* swap in the new ratings */
+	g_mutex_lock (&plugin->priv->ratings_mutex);
+	if (plugin->priv->ratings != NULL)
+		g_hash_table_unref (plugin->priv->ratings);
+	plugin->priv->ratings = ratings;
+	g_mutex_unlock (&plugin->priv->ratings_mutex);
+	return TRUE;
+}
+
 /**
  * gs_plugin_fedora_tagger_load_db:
  */
@@ -515,87 +509,24 @@ gs_plugin_fedora_tagger_load_db (GsPlugin *plugin, GError **error)
 	if (mtime == 0 || rebuild_ratings) {
 		g_debug ("No fedora-tagger data");
 		/* this should not be fatal */
-		if (!gs_plugin_fedora_tagger_download (plugin, &error_local)) {
+		if (!gs_plugin_fedora_tagger_download (plugin, FALSE, &error_local)) {
 			g_warning ("Failed to get fedora-tagger data: %s",
 				   error_local->message);
-			return TRUE;
 		}
 	} else if (now - mtime > GS_PLUGIN_FEDORA_TAGGER_AGE_MAX) {
 		g_debug ("fedora-tagger data was %" G_GINT64_FORMAT
 			 " days old, so regetting",
 			 (now - mtime) / ( 60 * 60 * 24));
-		if (!gs_plugin_fedora_tagger_download (plugin, error))
+		if (!gs_plugin_fedora_tagger_download (plugin, TRUE, error))
 			return FALSE;
 	} else {
 		g_debug ("fedora-tagger data %" G_GINT64_FORMAT
 			 " days old, so no need to redownload",
 			 (now - mtime) / ( 60 * 60 * 24));
 	}
-	return TRUE;
-}
 
-typedef struct {
-	gint		 rating;
-	gint		 confidence;
-} FedoraTaggerHelper;
-
-/**
- * gs_plugin_fedora_tagger_ratings_sqlite_cb:
- **/
-static gint
-gs_plugin_fedora_tagger_ratings_sqlite_cb (void *data,
-					   gint argc,
-					   gchar **argv,
-					   gchar **col_name)
-{
-	FedoraTaggerHelper *helper = (FedoraTaggerHelper *) data;
-	helper->rating = atoi (argv[0]);
-	helper->confidence = atoi (argv[1]);
-	return 0;
-}
-
-/**
- * gs_plugin_resolve_app:
- */
-static gboolean
-gs_plugin_resolve_app (GsPlugin *plugin,
-		       const gchar *pkgname,
-		       gint *rating,
-		       gint *confidence,
-		       GError **error)
-{
-	FedoraTaggerHelper helper;
-	gchar *error_msg = NULL;
-	gint rc;
-	g_autofree gchar *statement = NULL;
-
-	/* default values */
-	helper.rating = -1;
-	helper.confidence = -1;
-
-	/* query, but don't return an error if the package isn't found */
-	statement = g_strdup_printf ("SELECT rating, confidence FROM ratings "
-				     "WHERE pkgname = '%s'", pkgname);
-	rc = sqlite3_exec (plugin->priv->db,
-			   statement,
-			   gs_plugin_fedora_tagger_ratings_sqlite_cb,
-			   &helper,
-			   &error_msg);
-	if (rc != SQLITE_OK) {
-		g_set_error (error,
-			     GS_PLUGIN_ERROR,
-			     GS_PLUGIN_ERROR_FAILED,
-			     "SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
-		return FALSE;
-	}
-
-	/* success */
-	if (rating != NULL)
-		*rating = helper.rating;
-	if (confidence != NULL)
-		*confidence = helper.confidence;
-	return TRUE;
+	/* refine only uses the copy in memory */
+	return gs_plugin_fedora_tagger_load_ratings (plugin, error);
 }
 
 /**
@@ -615,7 +546,9 @@ gs_plugin_refine (GsPlugin *plugin,
 	gboolean ret;
 	gint rating;
 	gint confidence;
+	gpointer value;
 	guint i;
+	g_autoptr(GHashTable) ratings = NULL;
 
 	/* nothing to do here */
 	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING) == 0)
@@ -629,6 +562,14 @@ gs_plugin_refine (GsPlugin *plugin,
 			return FALSE;
 	}
 
+	/* the table is never changed once loaded, only replaced */
+	g_mutex_lock (&plugin->priv->ratings_mutex);
+	if (plugin->priv->ratings != NULL)
+		ratings = g_hash_table_ref (plugin->priv->ratings);
+	g_mutex_unlock (&plugin->priv->ratings_mutex);
+	if (ratings == NULL)
+		return TRUE;
+
 	/* add any missing ratings data */
 	for (l = *list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
@@ -637,14 +578,10 @@ gs_plugin_refine (GsPlugin *plugin,
 		sources = gs_app_get_sources (app);
 		for (i = 0; i < sources->len; i++) {
 			pkgname = g_ptr_array_index (sources, i);
-			ret = gs_plugin_resolve_app (plugin,
-						     pkgname,
-						     &rating,
-						     &confidence,
-						     error);
-			if (!ret)
-				return FALSE;
-			if (rating != -1) {
+			value = g_hash_table_lookup (ratings, pkgname);
+			if (value != NULL) {
+				rating = GS_PLUGIN_FEDORA_TAGGER_RATING (value);
+				confidence = GS_PLUGIN_FEDORA_TAGGER_CONFIDENCE (value);
 				g_debug ("fedora-tagger setting rating on %s to %i%% [%i]",
 					 pkgname, rating, confidence);
 				gs_app_set_rating (app, rating);
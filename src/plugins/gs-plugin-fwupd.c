@@ -32,6 +32,7 @@
 #include <gs-plugin.h>
 
 #include "gs-utils.h"
+#include "gs-http-validators.h"
 
 struct GsPluginPrivate {
 	gsize			 done_init;
@@ -636,6 +637,8 @@ gs_plugin_fwupd_check_lvfs_metadata (GsPlugin *plugin,
 	g_autofree gchar *config_fn = NULL;
 	g_autofree gchar *url_data = NULL;
 	g_autofree gchar *url_sig = NULL;
+	g_autofree gchar *validators_fn_data = NULL;
+	g_autofree gchar *validators_fn_sig = NULL;
 	g_autoptr(GKeyFile) config = NULL;
 	g_autoptr(SoupMessage) msg_data = NULL;
 	g_autoptr(SoupMessage) msg_sig = NULL;
@@ -666,10 +669,18 @@ gs_plugin_fwupd_check_lvfs_metadata (GsPlugin *plugin,
 	if (url_data == NULL)
 		return FALSE;
 
-	/* download the signature first, it's smaller */
+	/* download the signature first, it's smaller, and only if it has
+	 * changed since the one we have */
 	url_sig = g_strdup_printf ("%s.asc", url_data);
+	validators_fn_sig = g_strdup_printf ("%s.validators", plugin->priv->lvfs_sig_fn);
 	msg_sig = soup_message_new (SOUP_METHOD_GET, url_sig);
+	if (plugin->priv->lvfs_sig_hash != NULL)
+		gs_http_validators_add (msg_sig, validators_fn_sig);
 	status_code = soup_session_send_message (plugin->priv->session, msg_sig);
+	if (status_code == SOUP_STATUS_NOT_MODIFIED) {
+		g_debug ("%s is not modified", url_sig);
+		return TRUE;
+	}
 	if (status_code != SOUP_STATUS_OK) {
 		g_warning ("Failed to download %s, ignoring: %s",
 			   url_sig, soup_status_get_phrase (status_code));
@@ -703,29 +714,39 @@ gs_plugin_fwupd_check_lvfs_metadata (GsPlugin *plugin,
 	g_free (plugin->priv->lvfs_sig_hash);
 	plugin->priv->lvfs_sig_hash = g_strdup (checksum);
 
-	/* download the payload */
+	/* download the payload, unless the copy we have is current */
+	basename_data = g_path_get_basename (url_data);
+	cache_fn_data = g_build_filename (plugin->priv->cachedir, basename_data, NULL);
+	validators_fn_data = g_strdup_printf ("%s.validators", cache_fn_data);
 	msg_data = soup_message_new (SOUP_METHOD_GET, url_data);
+	if (g_file_test (cache_fn_data, G_FILE_TEST_EXISTS))
+		gs_http_validators_add (msg_data, validators_fn_data);
 	status_code = soup_session_send_message (plugin->priv->session, msg_data);
-	if (status_code != SOUP_STATUS_OK) {
+	if (status_code == SOUP_STATUS_NOT_MODIFIED) {
+		g_debug ("%s is not modified, using %s", url_data, cache_fn_data);
+	} else if (status_code != SOUP_STATUS_OK) {
 		g_warning ("Failed to download %s, ignoring: %s",
 			   url_data, soup_status_get_phrase (status_code));
 		return TRUE;
-	}
-
-	/* save to a file */
-	basename_data = g_path_get_basename (url_data);
-	cache_fn_data = g_build_filename (plugin->priv->cachedir, basename_data, NULL);
-	g_debug ("saving new LVFS data to %s:", cache_fn_data);
-	if (!g_file_set_contents (cache_fn_data,
-				  msg_data->response_body->data,
-				  msg_data->response_body->length,
-				  &error_local)) {
-		g_set_error (error,
-			     GS_PLUGIN_ERROR,
-			     GS_PLUGIN_ERROR_FAILED,
-			     "Failed to save firmware: %s",
-			     error_local->message);
-		return FALSE;
+	} else {
+		/* save to a file */
+		g_debug ("saving new LVFS data to %s:", cache_fn_data);
+		if (!g_file_set_contents (cache_fn_data,
+					  msg_data->response_body->data,
+					  msg_data->response_body->length,
+					  &error_local)) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "Failed to save firmware: %s",
+				     error_local->message);
+			return FALSE;
+		}
+		if (!gs_http_validators_save (msg_data, validators_fn_data, &error_local)) {
+			g_warning ("Failed to save validators for %s: %s",
+				   url_data, error_local->message);
+			g_clear_error (&error_local);
+		}
 	}
 
 	/* phew, lets send all this to fwupd */
@@ -734,6 +755,11 @@ gs_plugin_fwupd_check_lvfs_metadata (GsPlugin *plugin,
 						   error))
 		return FALSE;
 
+	/* only skip the signature next time once fwupd has the payload */
+	if (!gs_http_validators_save (msg_sig, validators_fn_sig, &error_local)) {
+		g_warning ("Failed to save validators for %s: %s",
+			   url_sig, error_local->message);
+	}
 	return TRUE;
 }
 
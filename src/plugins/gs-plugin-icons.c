@@ -21,17 +21,19 @@
 
 #include <config.h>
 
-#define _GNU_SOURCE
-#include <string.h>
-
 #include <glib/gi18n.h>
 #include <libsoup/soup.h>
 
+#include <gs-icon-pack.h>
 #include <gs-plugin.h>
 #include <gs-utils.h>
 
+/* icons often come from one server, so allow several connections to it */
+#define GS_PLUGIN_ICONS_MAX_DOWNLOADS	6
+
 struct GsPluginPrivate {
 	SoupSession		*session;
+	GMutex			 session_mutex;
 };
 
 /**
@@ -50,6 +52,7 @@ void
 gs_plugin_initialize (GsPlugin *plugin)
 {
 	plugin->priv = GS_PLUGIN_GET_PRIVATE (GsPluginPrivate);
+	g_mutex_init (&plugin->priv->session_mutex);
 }
 
 /**
@@ -73,6 +76,7 @@ gs_plugin_destroy (GsPlugin *plugin)
 {
 	if (plugin->priv->session != NULL)
 		g_object_unref (plugin->priv->session);
+	g_mutex_clear (&plugin->priv->session_mutex);
 }
 
 /**
@@ -81,13 +85,20 @@ gs_plugin_destroy (GsPlugin *plugin)
 static gboolean
 gs_plugin_setup_networking (GsPlugin *plugin, GError **error)
 {
+	gboolean ret = TRUE;
+
 	/* already set up */
+	g_mutex_lock (&plugin->priv->session_mutex);
 	if (plugin->priv->session != NULL)
-		return TRUE;
+		goto out;
 
-	/* set up a session */
+	/* set up a session, shared by all the download threads */
 	plugin->priv->session = soup_session_new_with_options (SOUP_SESSION_USER_AGENT,
 	                                                       "gnome-software",
+	                                                       SOUP_SESSION_MAX_CONNS,
+	                                                       GS_PLUGIN_ICONS_MAX_DOWNLOADS,
+	                                                       SOUP_SESSION_MAX_CONNS_PER_HOST,
+	                                                       GS_PLUGIN_ICONS_MAX_DOWNLOADS,
 	                                                       NULL);
 	if (plugin->priv->session == NULL) {
 		g_set_error (error,
@@ -95,20 +106,20 @@ gs_plugin_setup_networking (GsPlugin *plugin, GError **error)
 			     GS_PLUGIN_ERROR_FAILED,
 			     "%s: failed to setup networking",
 			     plugin->name);
-		return FALSE;
+		ret = FALSE;
 	}
-	return TRUE;
+out:
+	g_mutex_unlock (&plugin->priv->session_mutex);
+	return ret;
 }
 
 /**
  * gs_plugin_icons_download:
  */
-static gboolean
-gs_plugin_icons_download (GsPlugin *plugin, const gchar *uri, const gchar *filename, GError **error)
+static GdkPixbuf *
+gs_plugin_icons_download (GsPlugin *plugin, const gchar *uri, GError **error)
 {
 	guint status_code;
-	g_autoptr(GdkPixbuf) pixbuf_new = NULL;
-	g_autoptr(GdkPixbuf) pixbuf = NULL;
 	g_autoptr(GInputStream) stream = NULL;
 	g_autoptr(SoupMessage) msg = NULL;
 
@@ -119,12 +130,12 @@ gs_plugin_icons_download (GsPlugin *plugin, const gchar *uri, const gchar *filen
 			     GS_PLUGIN_ERROR,
 			     GS_PLUGIN_ERROR_FAILED,
 			     "%s is not a valid URL", uri);
-		return FALSE;
+		return NULL;
 	}
 
 	/* ensure networking is set up */
 	if (!gs_plugin_setup_networking (plugin, error))
-		return FALSE;
+		return NULL;
 
 	/* set sync request */
 	status_code = soup_session_send_message (plugin->priv->session, msg);
@@ -134,62 +145,74 @@ gs_plugin_icons_download (GsPlugin *plugin, const gchar *uri, const gchar *filen
 			     GS_PLUGIN_ERROR_FAILED,
 			     "Failed to download icon %s: %s",
 			     uri, soup_status_get_phrase (status_code));
-		return FALSE;
+		return NULL;
 	}
 
-	/* we're assuming this is a 64x64 png file, resize if not */
+	/* the icon pack resizes as required */
 	stream = g_memory_input_stream_new_from_data (msg->response_body->data,
 						      msg->response_body->length,
 						      NULL);
-	pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, error);
-	if (pixbuf == NULL)
-		return FALSE;
-	if (gdk_pixbuf_get_height (pixbuf) == 64 &&
-	    gdk_pixbuf_get_width (pixbuf) == 64) {
-		pixbuf_new = g_object_ref (pixbuf);
-	} else {
-		pixbuf_new = gdk_pixbuf_scale_simple (pixbuf, 64, 64,
-						      GDK_INTERP_BILINEAR);
-	}
-
-	/* write file */
-	return gdk_pixbuf_save (pixbuf_new, filename, "png", error, NULL);
+	return gdk_pixbuf_new_from_stream (stream, NULL, error);
 }
 
+typedef struct {
+	GsPlugin		*plugin;
+	GCancellable		*cancellable;
+	gchar			*url;
+	GPtrArray		*apps;		/* of GsApp sharing the URL */
+	gboolean		 in_pack;
+	GdkPixbuf		*pixbuf;	/* only if not saved */
+	GError			*error;
+} GsPluginIconsJob;
+
 /**
- * gs_plugin_refine:
+ * gs_plugin_icons_job_free:
  */
-static gboolean
-gs_plugin_refine_app (GsPlugin *plugin, GsApp *app, GError **error)
+static void
+gs_plugin_icons_job_free (GsPluginIconsJob *job)
 {
-	AsIcon *ic;
-	const gchar *fn;
-	gchar *found;
+	g_free (job->url);
+	g_ptr_array_unref (job->apps);
+	if (job->pixbuf != NULL)
+		g_object_unref (job->pixbuf);
+	if (job->error != NULL)
+		g_error_free (job->error);
+	g_slice_free (GsPluginIconsJob, job);
+}
 
-	/* not applicable */
-	ic = gs_app_get_icon (app);
-	if (as_icon_get_url (ic) == NULL)
-		return TRUE;
-	if (as_icon_get_filename (ic) == NULL)
-		return TRUE;
+/**
+ * gs_plugin_icons_download_thread_cb:
+ */
+static void
+gs_plugin_icons_download_thread_cb (gpointer data, gpointer user_data)
+{
+	GsPluginIconsJob *job = (GsPluginIconsJob *) data;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GError) error_local = NULL;
 
-	/* convert filename from jpg to png */
-	fn = as_icon_get_filename (ic);
-	found = g_strstr_len (fn, -1, ".jpg");
-	if (found != NULL)
-		memcpy (found, ".png", 4);
+	if (g_cancellable_set_error_if_cancelled (job->cancellable, &job->error))
+		return;
+	pixbuf = gs_plugin_icons_download (job->plugin, job->url, &job->error);
+	if (pixbuf == NULL)
+		return;
 
-	/* create runtime dir and download */
-	if (!gs_mkdir_parent (fn, error))
-		return FALSE;
-	if (!gs_plugin_icons_download (plugin, as_icon_get_url (ic), fn, error))
-		return FALSE;
-	as_icon_set_kind (ic, AS_ICON_KIND_LOCAL);
-	return gs_app_load_icon (app, plugin->scale, error);
+	/* the pack serializes the appends from each thread */
+	if (!gs_icon_pack_add (gs_icon_pack_get_default (),
+			       job->url, pixbuf, &error_local)) {
+		g_warning ("failed to save icon %s: %s",
+			   job->url, error_local->message);
+		job->pixbuf = g_object_ref (pixbuf);
+		return;
+	}
+	job->in_pack = TRUE;
 }
 
 /**
  * gs_plugin_refine:
+ *
+ * Icons already in the pack are set straight away. The rest are downloaded
+ * concurrently, once for each URL, and the pack index is saved once all
+ * the downloads have finished.
  */
 gboolean
 gs_plugin_refine (GsPlugin *plugin,
@@ -200,18 +223,98 @@ gs_plugin_refine (GsPlugin *plugin,
 {
 	GError *error_local = NULL;
 	GList *l;
+	GThreadPool *pool;
 	GsApp *app;
+	GsIconPack *pack = gs_icon_pack_get_default ();
+	GsPluginIconsJob *job;
+	const gchar *url;
+	guint i;
+	guint j;
+	g_autoptr(GHashTable) hash = NULL;
+	g_autoptr(GPtrArray) jobs = NULL;
 
+	jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_plugin_icons_job_free);
+	hash = g_hash_table_new (g_str_hash, g_str_equal);
 	for (l = *list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
+		if (gs_app_get_icon_deferred (app))
+			continue;
 		if (gs_app_get_pixbuf (app) != NULL)
 			continue;
 		if (gs_app_get_icon (app) == NULL)
 			continue;
-		if (!gs_plugin_refine_app (plugin, app, &error_local)) {
-			g_warning ("ignoring: %s", error_local->message);
-			g_clear_error (&error_local);
+		url = as_icon_get_url (gs_app_get_icon (app));
+		if (url == NULL)
+			continue;
+
+		/* already downloaded, so decode it when shown */
+		if (gs_icon_pack_contains (pack, url, plugin->scale) &&
+		    gs_app_load_icon (app, plugin->scale, NULL))
+			continue;
+
+		/* one download for each URL */
+		job = g_hash_table_lookup (hash, url);
+		if (job == NULL) {
+			job = g_slice_new0 (GsPluginIconsJob);
+			job->plugin = plugin;
+			job->cancellable = cancellable;
+			job->url = g_strdup (url);
+			job->apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+			g_hash_table_insert (hash, job->url, job);
+			g_ptr_array_add (jobs, job);
+		}
+		g_ptr_array_add (job->apps, g_object_ref (app));
+	}
+	if (jobs->len == 0)
+		return TRUE;
+
+	/* one slow server should not hold up the other downloads */
+	if (!gs_plugin_setup_networking (plugin, error))
+		return FALSE;
+	pool = g_thread_pool_new (gs_plugin_icons_download_thread_cb,
+				  NULL,
+				  (gint) MIN (jobs->len, GS_PLUGIN_ICONS_MAX_DOWNLOADS),
+				  FALSE,
+				  error);
+	if (pool == NULL)
+		return FALSE;
+	for (i = 0; i < jobs->len; i++)
+		g_thread_pool_push (pool, g_ptr_array_index (jobs, i), NULL);
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	/* set the icons on every app that asked for them, sharing the
+	 * decoded icons with the rest of the process where possible */
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		if (job->in_pack) {
+			for (j = 0; j < job->apps->len; j++) {
+				app = g_ptr_array_index (job->apps, j);
+				if (gs_app_load_icon (app, plugin->scale, &error_local))
+					continue;
+				g_warning ("ignoring: %s", error_local->message);
+				g_clear_error (&error_local);
+				gs_app_add_refine_failed (app, GS_PLUGIN_REFINED_DEFAULT);
+			}
+			continue;
+		}
+		if (job->pixbuf == NULL) {
+			g_warning ("ignoring: %s", job->error->message);
+			for (j = 0; j < job->apps->len; j++) {
+				app = g_ptr_array_index (job->apps, j);
+				gs_app_add_refine_failed (app, GS_PLUGIN_REFINED_DEFAULT);
+			}
+			continue;
 		}
+		for (j = 0; j < job->apps->len; j++) {
+			app = g_ptr_array_index (job->apps, j);
+			gs_app_set_pixbuf (app, job->pixbuf);
+		}
+	}
+
+	/* save the index for the new icons */
+	if (!gs_icon_pack_flush (pack, &error_local)) {
+		g_warning ("failed to save icon pack: %s", error_local->message);
+		g_clear_error (&error_local);
 	}
 	return TRUE;
 }
@@ -22,17 +22,32 @@
 #include <config.h>
 
 #include <sqlite3.h>
-#include <stdlib.h>
 
 #include <gs-plugin.h>
 #include <gs-utils.h>
 
+/*
+ * All the ratings are read into memory when the database is opened, and
+ * refine only uses that copy. New ratings are also written to memory
+ * straight away, and written to the database together a little later in
+ * a worker thread, so the main loop never waits for the disk.
+ */
+#define GS_PLUGIN_LOCAL_RATINGS_FLUSH_DELAY	2 /* seconds */
+
 struct GsPluginPrivate {
 	gsize                    loaded;
 	gchar			*db_path;
 	sqlite3			*db;
+	sqlite3_stmt		*stmt_insert;
+	GMutex			 mutex;
+	GHashTable		*ratings;	/* app_id → rating */
+	GHashTable		*pending;	/* app_id → rating */
+	guint			 flush_id;
+	GThreadPool		*flush_pool;	/* writes the database */
 };
 
+static void gs_plugin_local_ratings_flush_thread_cb (gpointer data, gpointer user_data);
+
 /**
  * gs_plugin_get_name:
  */
@@ -54,6 +69,14 @@ gs_plugin_initialize (GsPlugin *plugin)
 						  "gnome-software",
 						  "hardcoded-ratings.db",
 						  NULL);
+	plugin->refine_flags = GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING;
+	g_mutex_init (&plugin->priv->mutex);
+	plugin->priv->ratings = g_hash_table_new_full (g_str_hash, g_str_equal,
+						       g_free, NULL);
+	plugin->priv->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+						       g_free, NULL);
+	plugin->priv->flush_pool = g_thread_pool_new (gs_plugin_local_ratings_flush_thread_cb,
+						      plugin, 1, FALSE, NULL);
 }
 
 /**
@@ -68,14 +91,166 @@ gs_plugin_get_deps (GsPlugin *plugin)
 	return deps;
 }
 
+/**
+ * gs_plugin_local_ratings_write:
+ *
+ * Writes @ratings in one transaction.
+ */
+static gboolean
+gs_plugin_local_ratings_write (GsPlugin *plugin, GHashTable *ratings, GError **error)
+{
+	GHashTableIter iter;
+	gchar *error_msg = NULL;
+	gpointer key;
+	gpointer value;
+	gint rc;
+
+	if (plugin->priv->stmt_insert == NULL) {
+		g_set_error_literal (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "database not loaded");
+		return FALSE;
+	}
+	g_debug ("writing %u ratings", g_hash_table_size (ratings));
+	rc = sqlite3_exec (plugin->priv->db, "BEGIN TRANSACTION;",
+			   NULL, NULL, &error_msg);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "SQL error: %s", error_msg);
+		sqlite3_free (error_msg);
+		return FALSE;
+	}
+	g_hash_table_iter_init (&iter, ratings);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		sqlite3_reset (plugin->priv->stmt_insert);
+		sqlite3_bind_text (plugin->priv->stmt_insert, 1,
+				   (const gchar *) key, -1, SQLITE_STATIC);
+		sqlite3_bind_int (plugin->priv->stmt_insert, 2,
+				  GPOINTER_TO_INT (value));
+		if (sqlite3_step (plugin->priv->stmt_insert) != SQLITE_DONE) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "SQL error: %s",
+				     sqlite3_errmsg (plugin->priv->db));
+			sqlite3_reset (plugin->priv->stmt_insert);
+			sqlite3_exec (plugin->priv->db, "ROLLBACK;", NULL, NULL, NULL);
+			return FALSE;
+		}
+	}
+	sqlite3_reset (plugin->priv->stmt_insert);
+	rc = sqlite3_exec (plugin->priv->db, "COMMIT;", NULL, NULL, &error_msg);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "SQL error: %s", error_msg);
+		sqlite3_free (error_msg);
+		sqlite3_exec (plugin->priv->db, "ROLLBACK;", NULL, NULL, NULL);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * gs_plugin_local_ratings_flush:
+ *
+ * Writes the pending ratings. The lock is only held to take them, so that
+ * refine does not have to wait for the database. Only one thread may call
+ * this at a time.
+ */
+static gboolean
+gs_plugin_local_ratings_flush (GsPlugin *plugin, GError **error)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	g_autoptr(GHashTable) ratings = NULL;
+
+	g_mutex_lock (&plugin->priv->mutex);
+	ratings = plugin->priv->pending;
+	plugin->priv->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+						       g_free, NULL);
+	g_mutex_unlock (&plugin->priv->mutex);
+	if (g_hash_table_size (ratings) == 0)
+		return TRUE;
+	if (gs_plugin_local_ratings_write (plugin, ratings, error))
+		return TRUE;
+
+	/* try again next time, unless the rating was set again since */
+	g_mutex_lock (&plugin->priv->mutex);
+	g_hash_table_iter_init (&iter, ratings);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		if (g_hash_table_contains (plugin->priv->pending, key))
+			continue;
+		g_hash_table_insert (plugin->priv->pending, g_strdup (key), value);
+	}
+	g_mutex_unlock (&plugin->priv->mutex);
+	return FALSE;
+}
+
+/**
+ * gs_plugin_local_ratings_flush_thread_cb:
+ */
+static void
+gs_plugin_local_ratings_flush_thread_cb (gpointer data, gpointer user_data)
+{
+	GsPlugin *plugin = (GsPlugin *) user_data;
+	g_autoptr(GError) error = NULL;
+
+	if (!gs_plugin_local_ratings_flush (plugin, &error))
+		g_warning ("failed to save ratings: %s", error->message);
+}
+
+/**
+ * gs_plugin_local_ratings_flush_cb:
+ */
+static gboolean
+gs_plugin_local_ratings_flush_cb (gpointer user_data)
+{
+	GsPlugin *plugin = (GsPlugin *) user_data;
+
+	g_mutex_lock (&plugin->priv->mutex);
+	plugin->priv->flush_id = 0;
+	g_mutex_unlock (&plugin->priv->mutex);
+
+	/* the pool does not accept NULL */
+	g_thread_pool_push (plugin->priv->flush_pool, plugin, NULL);
+	return G_SOURCE_REMOVE;
+}
+
 /**
  * gs_plugin_destroy:
  */
 void
 gs_plugin_destroy (GsPlugin *plugin)
 {
+	g_autoptr(GError) error = NULL;
+
+	/* no new flushes, and wait for any that is running */
+	g_mutex_lock (&plugin->priv->mutex);
+	if (plugin->priv->flush_id != 0) {
+		g_source_remove (plugin->priv->flush_id);
+		plugin->priv->flush_id = 0;
+	}
+	g_mutex_unlock (&plugin->priv->mutex);
+	g_thread_pool_free (plugin->priv->flush_pool, FALSE, TRUE);
+
+	/* write anything still pending */
+	if (plugin->priv->db != NULL &&
+	    !gs_plugin_local_ratings_flush (plugin, &error))
+		g_warning ("failed to save ratings: %s", error->message);
+
 	g_free (plugin->priv->db_path);
+	if (plugin->priv->stmt_insert != NULL)
+		sqlite3_finalize (plugin->priv->stmt_insert);
 	sqlite3_close (plugin->priv->db);
+	g_hash_table_unref (plugin->priv->ratings);
+	g_hash_table_unref (plugin->priv->pending);
+	g_mutex_clear (&plugin->priv->mutex);
 }
 
 /**
@@ -88,6 +263,7 @@ gs_plugin_local_ratings_load_db (GsPlugin *plugin,
 	const gchar *statement;
 	gchar *error_msg = NULL;
 	gint rc;
+	sqlite3_stmt *stmt = NULL;
 
 	g_debug ("trying to open database '%s'", plugin->priv->db_path);
 	if (!gs_mkdir_parent (plugin->priv->db_path, error))
@@ -102,8 +278,9 @@ gs_plugin_local_ratings_load_db (GsPlugin *plugin,
 		return FALSE;
 	}
 
-	/* we don't need to keep doing fsync */
-	sqlite3_exec (plugin->priv->db, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
+	/* writes are batched, so a sync per commit of the log is fine */
+	sqlite3_exec (plugin->priv->db, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+	sqlite3_exec (plugin->priv->db, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL);
 
 	/* create table if required */
 	rc = sqlite3_exec (plugin->priv->db, "SELECT * FROM ratings LIMIT 1", NULL, NULL, &error_msg);
@@ -115,36 +292,55 @@ gs_plugin_local_ratings_load_db (GsPlugin *plugin,
 			    "rating INTEGER DEFAULT 0);";
 		sqlite3_exec (plugin->priv->db, statement, NULL, NULL, NULL);
 	}
-	return TRUE;
-}
 
-/**
- * gs_plugin_local_ratings_sqlite_cb:
- **/
-static gint
-gs_plugin_local_ratings_sqlite_cb (void *data, gint argc, gchar **argv, gchar **col_name)
-{
-	gint *rating = (gint *) data;
-	*rating = atoi (argv[0]);
-	return 0;
-}
+	/* used for every write */
+	rc = sqlite3_prepare_v2 (plugin->priv->db,
+				 "INSERT OR REPLACE INTO ratings (app_id, rating) "
+				 "VALUES (?1, ?2);",
+				 -1, &plugin->priv->stmt_insert, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "SQL error: %s",
+			     sqlite3_errmsg (plugin->priv->db));
+		return FALSE;
+	}
 
-/**
- * gs_plugin_local_find_app:
- */
-static gint
-gs_plugin_local_find_app (GsPlugin *plugin, const gchar *app_id)
-{
-	gint rating = -1;
-	g_autofree gchar *statement = NULL;
-
-	statement = g_strdup_printf ("SELECT rating FROM ratings WHERE app_id = '%s'", app_id);
-	sqlite3_exec (plugin->priv->db,
-		      statement,
-		      gs_plugin_local_ratings_sqlite_cb,
-		      &rating,
-		      NULL);
-	return rating;
+	/* read all the ratings */
+	rc = sqlite3_prepare_v2 (plugin->priv->db,
+				 "SELECT app_id, rating FROM ratings;",
+				 -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "SQL error: %s",
+			     sqlite3_errmsg (plugin->priv->db));
+		return FALSE;
+	}
+	g_mutex_lock (&plugin->priv->mutex);
+	while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+		const gchar *app_id = (const gchar *) sqlite3_column_text (stmt, 0);
+
+		/* a rating set before the load finished is newer */
+		if (g_hash_table_contains (plugin->priv->ratings, app_id))
+			continue;
+		g_hash_table_insert (plugin->priv->ratings,
+				     g_strdup (app_id),
+				     GINT_TO_POINTER (sqlite3_column_int (stmt, 1)));
+	}
+	g_mutex_unlock (&plugin->priv->mutex);
+	sqlite3_finalize (stmt);
+	if (rc != SQLITE_DONE) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "SQL error: %s",
+			     sqlite3_errmsg (plugin->priv->db));
+		return FALSE;
+	}
+	return TRUE;
 }
 
 /**
@@ -156,10 +352,7 @@ gs_plugin_app_set_rating (GsPlugin *plugin,
 			  GCancellable *cancellable,
 			  GError **error)
 {
-	char *error_msg = NULL;
 	gboolean ret;
-	gint rc;
-	g_autofree gchar *statement = NULL;
 
 	/* already loaded */
 	if (g_once_init_enter (&plugin->priv->loaded)) {
@@ -170,22 +363,25 @@ gs_plugin_app_set_rating (GsPlugin *plugin,
 			return FALSE;
 	}
 
-	/* insert the entry */
-	statement = g_strdup_printf ("INSERT OR REPLACE INTO ratings (app_id, rating) "
-				     "VALUES ('%s', '%i');",
-				     gs_app_get_id (app),
-				     gs_app_get_rating (app));
-	rc = sqlite3_exec (plugin->priv->db, statement, NULL, NULL, &error_msg);
-	if (rc != SQLITE_OK) {
-		g_set_error (error,
-			     GS_PLUGIN_ERROR,
-			     GS_PLUGIN_ERROR_FAILED,
-			     "SQL error: %s", error_msg);
-		sqlite3_free (error_msg);
-		return FALSE;
+	if (gs_app_get_id (app) == NULL)
+		return TRUE;
+
+	/* save the entry soon, together with any others set by then */
+	g_mutex_lock (&plugin->priv->mutex);
+	g_hash_table_insert (plugin->priv->ratings,
+			     g_strdup (gs_app_get_id (app)),
+			     GINT_TO_POINTER (gs_app_get_rating (app)));
+	g_hash_table_insert (plugin->priv->pending,
+			     g_strdup (gs_app_get_id (app)),
+			     GINT_TO_POINTER (gs_app_get_rating (app)));
+	if (plugin->priv->flush_id == 0) {
+		plugin->priv->flush_id =
+			g_timeout_add_seconds (GS_PLUGIN_LOCAL_RATINGS_FLUSH_DELAY,
+					       gs_plugin_local_ratings_flush_cb,
+					       plugin);
 	}
+	g_mutex_unlock (&plugin->priv->mutex);
 	return TRUE;
-
 }
 
 /**
@@ -200,6 +396,7 @@ gs_plugin_refine (GsPlugin *plugin,
 {
 	gboolean ret;
 	gint rating;
+	gpointer value;
 	GList *l;
 	GsApp *app;
 
@@ -216,13 +413,18 @@ gs_plugin_refine (GsPlugin *plugin,
 	}
 
 	/* add any missing ratings data */
+	g_mutex_lock (&plugin->priv->mutex);
 	for (l = *list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
 		if (gs_app_get_id (app) == NULL)
 			continue;
 		if (gs_app_get_rating (app) != -1)
 			continue;
-		rating = gs_plugin_local_find_app (plugin, gs_app_get_id (app));
+		if (!g_hash_table_lookup_extended (plugin->priv->ratings,
+						   gs_app_get_id (app),
+						   NULL, &value))
+			continue;
+		rating = GPOINTER_TO_INT (value);
 		if (rating != -1) {
 			gs_app_set_rating (app, rating);
 			gs_app_set_rating_confidence (app, 100);
@@ -231,5 +433,6 @@ gs_plugin_refine (GsPlugin *plugin,
 				gs_app_add_kudo (app, GS_APP_KUDO_POPULAR);
 		}
 	}
+	g_mutex_unlock (&plugin->priv->mutex);
 	return TRUE;
 }
@@ -35,6 +35,16 @@ gs_plugin_get_name (void)
 	return "menu-spec-refine";
 }
 
+/**
+ * gs_plugin_initialize:
+ */
+void
+gs_plugin_initialize (GsPlugin *plugin)
+{
+	plugin->refine_flags = GS_PLUGIN_REFINE_FLAGS_REQUIRE_MENU_PATH;
+	plugin->refine_flags_requires = GS_PLUGIN_REFINED_DEFAULT;
+}
+
 /**
  * gs_plugin_get_deps:
  */
@@ -25,12 +25,20 @@
 #include <packagekit-glib2/packagekit.h>
 
 #include <gs-plugin.h>
+#include <gs-utils.h>
 
-#define GS_PLUGIN_PACKAGEKIT_HISTORY_TIMEOUT	5000 /* ms */
+#include "packagekit-history.h"
+
+#define GS_PLUGIN_PACKAGEKIT_HISTORY_TIMEOUT	5000 /* ms, for all the chunks */
+#define GS_PLUGIN_PACKAGEKIT_HISTORY_CHUNK	100 /* packages */
 
 struct GsPluginPrivate {
 	gsize			 loaded;
 	GDBusConnection		*connection;
+	GMutex			 cache_mutex;
+	GHashTable		*cache;		/* package name → (key, history) */
+	gchar			*cache_fn;
+	gboolean		 cache_dirty;
 };
 
 /**
@@ -49,6 +57,15 @@ void
 gs_plugin_initialize (GsPlugin *plugin)
 {
 	plugin->priv = GS_PLUGIN_GET_PRIVATE (GsPluginPrivate);
+	plugin->refine_flags = GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY;
+	plugin->refine_flags_requires = GS_PLUGIN_REFINED_DEFAULT |
+					GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION;
+	g_mutex_init (&plugin->priv->cache_mutex);
+	plugin->priv->cache = gs_packagekit_history_cache_new ();
+	plugin->priv->cache_fn = g_build_filename (g_get_user_cache_dir (),
+						   "gnome-software",
+						   "packagekit-history.cache",
+						   NULL);
 }
 
 /**
@@ -72,6 +89,9 @@ gs_plugin_destroy (GsPlugin *plugin)
 {
 	if (plugin->priv->connection != NULL)
 		g_object_unref (plugin->priv->connection);
+	g_hash_table_unref (plugin->priv->cache);
+	g_free (plugin->priv->cache_fn);
+	g_mutex_clear (&plugin->priv->cache_mutex);
 }
 
 /**
@@ -127,34 +147,219 @@ gs_plugin_packagekit_refine_add_history (GsApp *app, GVariant *dict)
 	gs_app_set_install_date (app, timestamp);
 }
 
+/**
+ * gs_plugin_packagekit_history_apply:
+ */
+static void
+gs_plugin_packagekit_history_apply (GsApp *app, GVariant *history)
+{
+	GVariantIter iter;
+	GVariant *value;
+
+	/* make up a fake entry as we know this package was at least
+	 * installed at some point in time */
+	if (g_variant_n_children (history) == 0) {
+		if (gs_app_get_state (app) == AS_APP_STATE_INSTALLED) {
+			g_autoptr(GsApp) app_dummy = NULL;
+			app_dummy = gs_app_new (gs_app_get_id (app));
+			gs_app_set_install_date (app_dummy, GS_APP_INSTALL_DATE_UNKNOWN);
+			gs_app_set_kind (app_dummy, GS_APP_KIND_PACKAGE);
+			gs_app_set_state (app_dummy, AS_APP_STATE_INSTALLED);
+			gs_app_set_version (app_dummy, gs_app_get_version (app));
+			gs_app_add_history (app, app_dummy);
+		}
+		gs_app_set_install_date (app, GS_APP_INSTALL_DATE_UNKNOWN);
+		return;
+	}
+
+	/* add history for application */
+	g_variant_iter_init (&iter, history);
+	while ((value = g_variant_iter_next_value (&iter))) {
+		gs_plugin_packagekit_refine_add_history (app, value);
+		g_variant_unref (value);
+	}
+}
+
+/**
+ * gs_plugin_packagekit_history_get_key:
+ *
+ * The history of a package only changes when it is installed, updated or
+ * removed, which changes the package-id or the state of the app.
+ */
+static gchar *
+gs_plugin_packagekit_history_get_key (GsApp *app)
+{
+	const gchar *tmp;
+
+	tmp = gs_app_get_source_id_default (app);
+	if (tmp == NULL)
+		tmp = gs_app_get_version (app);
+	return g_strdup_printf ("%s;%s", tmp != NULL ? tmp : "",
+				as_app_state_to_string (gs_app_get_state (app)));
+}
+
+/**
+ * gs_plugin_packagekit_history_cache_load:
+ */
+static void
+gs_plugin_packagekit_history_cache_load (GsPlugin *plugin)
+{
+	g_autoptr(GError) error = NULL;
+
+	if (!gs_packagekit_history_cache_load (plugin->priv->cache,
+					       plugin->priv->cache_fn,
+					       &error)) {
+		g_debug ("not using history cache: %s", error->message);
+		return;
+	}
+	g_debug ("loaded history for %u packages",
+		 g_hash_table_size (plugin->priv->cache));
+}
+
+/**
+ * gs_plugin_packagekit_history_cache_save:
+ */
+static void
+gs_plugin_packagekit_history_cache_save (GsPlugin *plugin)
+{
+	g_autoptr(GError) error = NULL;
+
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	if (!plugin->priv->cache_dirty)
+		goto out;
+	if (!gs_mkdir_parent (plugin->priv->cache_fn, &error) ||
+	    !gs_packagekit_history_cache_save (plugin->priv->cache,
+					       plugin->priv->cache_fn,
+					       &error)) {
+		g_warning ("failed to save history cache: %s", error->message);
+		goto out;
+	}
+	plugin->priv->cache_dirty = FALSE;
+out:
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+}
+
 /**
  * gs_plugin_load:
  */
 static gboolean
 gs_plugin_load (GsPlugin *plugin, GCancellable *cancellable, GError **error)
 {
+	gs_plugin_packagekit_history_cache_load (plugin);
 	plugin->priv->connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM,
 						   cancellable,
 						   error);
 	return plugin->priv->connection != NULL;
 }
 
+/**
+ * gs_plugin_packagekit_refine_fetch:
+ *
+ * Gets the history of the packages that are not cached and adds it to the
+ * cache. If PackageKit is too old the apps are given an unknown install
+ * date, and if it is too slow the apps that were not reached are left for
+ * the next refine.
+ */
+static gboolean
+gs_plugin_packagekit_refine_fetch (GsPlugin *plugin,
+				   GPtrArray *apps,
+				   GCancellable *cancellable,
+				   GError **error)
+{
+	GError *error_local = NULL;
+	GVariant *history;
+	GsApp *app;
+	gboolean ret;
+	guint i;
+	g_autoptr(GHashTable) results = NULL;
+	g_autoptr(GPtrArray) names = NULL;
+
+	names = g_ptr_array_new ();
+	for (i = 0; i < apps->len; i++) {
+		app = g_ptr_array_index (apps, i);
+		g_ptr_array_add (names, (gpointer) gs_app_get_source_default (app));
+	}
+	results = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 g_free, (GDestroyNotify) g_variant_unref);
+	ret = gs_packagekit_history_fetch (plugin->priv->connection,
+					   names,
+					   results,
+					   GS_PLUGIN_PACKAGEKIT_HISTORY_CHUNK,
+					   GS_PLUGIN_PACKAGEKIT_HISTORY_TIMEOUT,
+					   cancellable,
+					   &error_local);
+
+	/* use whatever was fetched, even if a later chunk failed */
+	for (i = 0; i < apps->len; i++) {
+		g_autofree gchar *key = NULL;
+		app = g_ptr_array_index (apps, i);
+		history = g_hash_table_lookup (results, gs_app_get_source_default (app));
+		if (history == NULL)
+			continue;
+		key = gs_plugin_packagekit_history_get_key (app);
+		g_mutex_lock (&plugin->priv->cache_mutex);
+		gs_packagekit_history_cache_add (plugin->priv->cache,
+						 gs_app_get_source_default (app),
+						 key, history);
+		plugin->priv->cache_dirty = TRUE;
+		g_mutex_unlock (&plugin->priv->cache_mutex);
+		gs_plugin_packagekit_history_apply (app, history);
+	}
+	if (ret)
+		return TRUE;
+
+	if (g_error_matches (error_local,
+			     G_DBUS_ERROR,
+			     G_DBUS_ERROR_UNKNOWN_METHOD)) {
+		g_debug ("No history available as PackageKit is too old: %s",
+			 error_local->message);
+
+		/* just set this to something non-zero so we don't keep
+		 * trying to call GetPackageHistory */
+		for (i = 0; i < apps->len; i++) {
+			app = g_ptr_array_index (apps, i);
+			if (gs_app_get_install_date (app) == 0)
+				gs_app_set_install_date (app, GS_APP_INSTALL_DATE_UNKNOWN);
+		}
+		g_error_free (error_local);
+		return TRUE;
+	}
+	if (g_error_matches (error_local,
+			     G_IO_ERROR,
+			     G_IO_ERROR_TIMED_OUT)) {
+		g_debug ("No history for %u packages as PackageKit took too long: %s",
+			 apps->len - g_hash_table_size (results),
+			 error_local->message);
+
+		/* leave the date unset so it is asked for next time */
+		for (i = 0; i < apps->len; i++) {
+			app = g_ptr_array_index (apps, i);
+			if (g_hash_table_contains (results, gs_app_get_source_default (app)))
+				continue;
+			gs_app_add_refine_failed (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY);
+		}
+		g_error_free (error_local);
+		return TRUE;
+	}
+	g_set_error (error,
+		     GS_PLUGIN_ERROR,
+		     GS_PLUGIN_ERROR_FAILED,
+		     "Failed to get history: %s",
+		     error_local->message);
+	g_error_free (error_local);
+	return FALSE;
+}
+
 static gboolean
 gs_plugin_packagekit_refine (GsPlugin *plugin,
 			     GList *list,
 			     GCancellable *cancellable,
 			     GError **error)
 {
-	gboolean ret;
-	GError *error_local = NULL;
+	gboolean ret = TRUE;
 	GList *l;
 	GsApp *app;
-	guint i = 0;
-	GVariantIter iter;
-	GVariant *value;
-	g_autofree const gchar **package_names = NULL;
-	g_autoptr(GVariant) result = NULL;
-	g_autoptr(GVariant) tuple = NULL;
+	g_autoptr(GPtrArray) missing = NULL;
 
 	/* already loaded */
 	if (g_once_init_enter (&plugin->priv->loaded)) {
@@ -164,88 +369,34 @@ gs_plugin_packagekit_refine (GsPlugin *plugin,
 			return FALSE;
 	}
 
-	/* get an array of package names */
-	package_names = g_new0 (const gchar *, g_list_length (list) + 1);
-	for (l = list; l != NULL; l = l->next) {
-		app = GS_APP (l->data);
-		package_names[i++] = gs_app_get_source_default (app);
-	}
-
-	g_debug ("getting history for %i packages", g_list_length (list));
-	result = g_dbus_connection_call_sync (plugin->priv->connection,
-					      "org.freedesktop.PackageKit",
-					      "/org/freedesktop/PackageKit",
-					      "org.freedesktop.PackageKit",
-					      "GetPackageHistory",
-					      g_variant_new ("(^asu)", package_names, 0),
-					      NULL,
-					      G_DBUS_CALL_FLAGS_NONE,
-					      GS_PLUGIN_PACKAGEKIT_HISTORY_TIMEOUT,
-					      cancellable,
-					      &error_local);
-	if (result == NULL) {
-		if (g_error_matches (error_local,
-				     G_DBUS_ERROR,
-				     G_DBUS_ERROR_UNKNOWN_METHOD)) {
-			g_debug ("No history available as PackageKit is too old: %s",
-				 error_local->message);
-
-			/* just set this to something non-zero so we don't keep
-			 * trying to call GetPackageHistory */
-			for (l = list; l != NULL; l = l->next) {
-				app = GS_APP (l->data);
-				gs_app_set_install_date (app, GS_APP_INSTALL_DATE_UNKNOWN);
-			}
-		} else if (g_error_matches (error_local,
-					    G_IO_ERROR,
-					    G_IO_ERROR_TIMED_OUT)) {
-			g_debug ("No history as PackageKit took too long: %s",
-				 error_local->message);
-			for (l = list; l != NULL; l = l->next) {
-				app = GS_APP (l->data);
-				gs_app_set_install_date (app, GS_APP_INSTALL_DATE_UNKNOWN);
-			}
-		}
-		g_set_error (error,
-			     GS_PLUGIN_ERROR,
-			     GS_PLUGIN_ERROR_FAILED,
-			     "Failed to get history: %s",
-			     error_local->message);
-		return FALSE;
-	}
-
-	/* get any results */
-	tuple = g_variant_get_child_value (result, 0);
+	/* use the cached history of packages which have not changed */
+	missing = g_ptr_array_new ();
 	for (l = list; l != NULL; l = l->next) {
+		g_autofree gchar *key = NULL;
+		g_autoptr(GVariant) history = NULL;
 		app = GS_APP (l->data);
-		ret = g_variant_lookup (tuple,
-					gs_app_get_source_default (app),
-					"@aa{sv}",
-					&value);
-		if (!ret) {
-			/* make up a fake entry as we know this package was at
-			 * least installed at some point in time */
-			if (gs_app_get_state (app) == AS_APP_STATE_INSTALLED) {
-				g_autoptr(GsApp) app_dummy = NULL;
-				app_dummy = gs_app_new (gs_app_get_id (app));
-				gs_app_set_install_date (app_dummy, GS_APP_INSTALL_DATE_UNKNOWN);
-				gs_app_set_kind (app_dummy, GS_APP_KIND_PACKAGE);
-				gs_app_set_state (app_dummy, AS_APP_STATE_INSTALLED);
-				gs_app_set_version (app_dummy, gs_app_get_version (app));
-				gs_app_add_history (app, app_dummy);
-			}
-			gs_app_set_install_date (app, GS_APP_INSTALL_DATE_UNKNOWN);
+		key = gs_plugin_packagekit_history_get_key (app);
+		g_mutex_lock (&plugin->priv->cache_mutex);
+		history = gs_packagekit_history_cache_lookup (plugin->priv->cache,
+							      gs_app_get_source_default (app),
+							      key);
+		g_mutex_unlock (&plugin->priv->cache_mutex);
+		if (history == NULL) {
+			g_ptr_array_add (missing, app);
 			continue;
 		}
-
-		/* add history for application */
-		g_variant_iter_init (&iter, value);
-		while ((value = g_variant_iter_next_value (&iter))) {
-			gs_plugin_packagekit_refine_add_history (app, value);
-			g_variant_unref (value);
-		}
+		gs_plugin_packagekit_history_apply (app, history);
 	}
-	return TRUE;
+	if (missing->len == 0)
+		return TRUE;
+
+	/* ask PackageKit about the rest */
+	g_debug ("history of %u of %u packages not cached",
+		 missing->len, g_list_length (list));
+	ret = gs_plugin_packagekit_refine_fetch (plugin, missing,
+						 cancellable, error);
+	gs_plugin_packagekit_history_cache_save (plugin);
+	return ret;
 }
 
 /**
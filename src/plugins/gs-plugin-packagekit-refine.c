@@ -24,17 +24,50 @@
 #define I_KNOW_THE_PACKAGEKIT_GLIB2_API_IS_SUBJECT_TO_CHANGE
 #include <packagekit-glib2/packagekit.h>
 
+#include <string.h>
+#include <glib/gstdio.h>
+
 #include <gs-plugin.h>
 #include <gs-utils.h>
 #include <glib/gi18n.h>
 
 #include "packagekit-common.h"
+#include "packagekit-resolve-cache.h"
+
+#define GS_PLUGIN_PACKAGEKIT_RESOLVE_CACHE_SAVE_INTERVAL	30 /* s */
+
+/*
+ * Resolve results are kept in a cache of package name to packages, which
+ * is saved between sessions. It is only loaded if the package and repo
+ * databases have not changed since it was saved, and is only written when
+ * a Resolve() returned something new, at most every
+ * %GS_PLUGIN_PACKAGEKIT_RESOLVE_CACHE_SAVE_INTERVAL seconds and once more
+ * when the plugin is destroyed. The repo id to name
+ * table and the list of updates are cached in memory only, and are never
+ * changed once cached so a refine can keep using its reference. Only one
+ * GetUpdates runs at a time, and refines that need the list while it is
+ * running wait for it to be cached.
+ *
+ * All three are dropped when PackageKit says the updates or repos have
+ * changed, which also bumps the cache generation. Results are only added
+ * if the generation did not change while the transaction was running.
+ */
 
 struct GsPluginPrivate {
 	PkControl		*control;
 	PkClient		*client;
-	GHashTable		*sources;
+	GHashTable		*sources;		/* repo id → repo name */
 	AsProfileTask		*ptask;
+	GMutex			 cache_mutex;
+	guint			 cache_generation;
+	PkPackageSack		*updates;
+	gboolean		 updates_running;
+	GCond			 updates_cond;
+	GHashTable		*resolve_cache;		/* name → GPtrArray of PkPackage */
+	gchar			*resolve_cache_fn;
+	gboolean		 resolve_cache_loaded;
+	gboolean		 resolve_cache_dirty;
+	gint64			 resolve_cache_saved;	/* monotonic µs */
 };
 
 /**
@@ -47,11 +80,22 @@ gs_plugin_get_name (void)
 }
 
 /**
- * gs_plugin_initialize:
+ * gs_plugin_packagekit_cache_invalid_cb:
  */
 static void
 gs_plugin_packagekit_cache_invalid_cb (PkControl *control, GsPlugin *plugin)
 {
+	/* anything resolved before now may be stale */
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	plugin->priv->cache_generation++;
+	g_clear_pointer (&plugin->priv->sources, g_hash_table_unref);
+	g_clear_object (&plugin->priv->updates);
+	g_hash_table_remove_all (plugin->priv->resolve_cache);
+	plugin->priv->resolve_cache_loaded = TRUE;
+	plugin->priv->resolve_cache_dirty = FALSE;
+	g_unlink (plugin->priv->resolve_cache_fn);
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+
 	gs_plugin_updates_changed (plugin);
 }
 
@@ -64,6 +108,18 @@ gs_plugin_initialize (GsPlugin *plugin)
 	plugin->priv = GS_PLUGIN_GET_PRIVATE (GsPluginPrivate);
 	plugin->priv->client = pk_client_new ();
 	plugin->priv->control = pk_control_new ();
+	plugin->refine_flags = GS_PLUGIN_REFINED_DEFAULT |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENCE |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_DETAILS |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY |
+			       GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPGRADE_REMOVED;
+	plugin->refine_flags_requires = GS_PLUGIN_REFINED_DEFAULT;
 	g_signal_connect (plugin->priv->control, "updates-changed",
 			  G_CALLBACK (gs_plugin_packagekit_cache_invalid_cb), plugin);
 	g_signal_connect (plugin->priv->control, "repo-list-changed",
@@ -71,10 +127,16 @@ gs_plugin_initialize (GsPlugin *plugin)
 	pk_client_set_background (plugin->priv->client, FALSE);
 	pk_client_set_interactive (plugin->priv->client, FALSE);
 	pk_client_set_cache_age (plugin->priv->client, G_MAXUINT);
-	plugin->priv->sources = g_hash_table_new_full (g_str_hash,
-						       g_str_equal,
-						       g_free,
-						       g_free);
+	g_mutex_init (&plugin->priv->cache_mutex);
+	g_cond_init (&plugin->priv->updates_cond);
+	plugin->priv->resolve_cache = g_hash_table_new_full (g_str_hash,
+							     g_str_equal,
+							     g_free,
+							     (GDestroyNotify) g_ptr_array_unref);
+	plugin->priv->resolve_cache_fn = g_build_filename (g_get_user_cache_dir (),
+							   "gnome-software",
+							   "packagekit-resolve.cache",
+							   NULL);
 }
 
 /**
@@ -90,17 +152,226 @@ gs_plugin_get_deps (GsPlugin *plugin)
 	return deps;
 }
 
+/**
+ * gs_plugin_packagekit_resolve_cache_save:
+ *
+ * Saves the resolve cache if it changed, unless it was already saved in
+ * the last %GS_PLUGIN_PACKAGEKIT_RESOLVE_CACHE_SAVE_INTERVAL seconds and
+ * @force is %FALSE.
+ */
+static void
+gs_plugin_packagekit_resolve_cache_save (GsPlugin *plugin, gboolean force)
+{
+	gint64 now;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) stamps = NULL;
+
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	if (!plugin->priv->resolve_cache_dirty)
+		goto out;
+	now = g_get_monotonic_time ();
+	if (!force && plugin->priv->resolve_cache_saved != 0 &&
+	    now - plugin->priv->resolve_cache_saved <
+	    GS_PLUGIN_PACKAGEKIT_RESOLVE_CACHE_SAVE_INTERVAL * G_USEC_PER_SEC)
+		goto out;
+	stamps = gs_packagekit_get_package_db_stamps ();
+	if (!gs_mkdir_parent (plugin->priv->resolve_cache_fn, &error) ||
+	    !gs_packagekit_resolve_cache_save (plugin->priv->resolve_cache,
+					       plugin->priv->resolve_cache_fn,
+					       stamps, &error)) {
+		g_warning ("failed to save resolve cache: %s", error->message);
+		goto out;
+	}
+	plugin->priv->resolve_cache_dirty = FALSE;
+	plugin->priv->resolve_cache_saved = now;
+out:
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+}
+
 /**
  * gs_plugin_destroy:
  */
 void
 gs_plugin_destroy (GsPlugin *plugin)
 {
-	g_hash_table_unref (plugin->priv->sources);
+	gs_plugin_packagekit_resolve_cache_save (plugin, TRUE);
+	if (plugin->priv->sources != NULL)
+		g_hash_table_unref (plugin->priv->sources);
+	g_hash_table_unref (plugin->priv->resolve_cache);
+	g_free (plugin->priv->resolve_cache_fn);
+	if (plugin->priv->updates != NULL)
+		g_object_unref (plugin->priv->updates);
+	g_cond_clear (&plugin->priv->updates_cond);
+	g_mutex_clear (&plugin->priv->cache_mutex);
 	g_object_unref (plugin->priv->client);
 	g_object_unref (plugin->priv->control);
 }
 
+/**
+ * gs_plugin_packagekit_resolve_cache_load:
+ *
+ * Must be called with the cache lock held.
+ */
+static void
+gs_plugin_packagekit_resolve_cache_load (GsPlugin *plugin)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) stamps = NULL;
+
+	if (plugin->priv->resolve_cache_loaded)
+		return;
+	plugin->priv->resolve_cache_loaded = TRUE;
+	stamps = gs_packagekit_get_package_db_stamps ();
+	if (!gs_packagekit_resolve_cache_load (plugin->priv->resolve_cache,
+					       plugin->priv->resolve_cache_fn,
+					       stamps, &error)) {
+		g_debug ("not using resolve cache: %s", error->message);
+		return;
+	}
+	g_debug ("loaded %u names from the resolve cache",
+		 g_hash_table_size (plugin->priv->resolve_cache));
+}
+
+/**
+ * gs_plugin_packagekit_get_generation:
+ */
+static guint
+gs_plugin_packagekit_get_generation (GsPlugin *plugin)
+{
+	guint generation;
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	generation = plugin->priv->cache_generation;
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+	return generation;
+}
+
+/**
+ * gs_plugin_packagekit_resolve_cache_lookup:
+ *
+ * Adds the cached packages of each app whose package names are all in
+ * the cache to @packages, and returns the apps that need resolving.
+ */
+static GList *
+gs_plugin_packagekit_resolve_cache_lookup (GsPlugin *plugin,
+					   GList *list,
+					   GPtrArray *packages,
+					   GList **hits)
+{
+	GList *l;
+	GList *misses = NULL;
+	GPtrArray *cached;
+	GPtrArray *sources;
+	GsApp *app;
+	guint i;
+	guint j;
+
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	gs_plugin_packagekit_resolve_cache_load (plugin);
+	for (l = list; l != NULL; l = l->next) {
+		app = GS_APP (l->data);
+		sources = gs_app_get_sources (app);
+		for (i = 0; i < sources->len; i++) {
+			if (!g_hash_table_contains (plugin->priv->resolve_cache,
+						    g_ptr_array_index (sources, i)))
+				break;
+		}
+		if (i < sources->len) {
+			misses = g_list_prepend (misses, app);
+			continue;
+		}
+		for (i = 0; i < sources->len; i++) {
+			cached = g_hash_table_lookup (plugin->priv->resolve_cache,
+						      g_ptr_array_index (sources, i));
+			for (j = 0; j < cached->len; j++)
+				g_ptr_array_add (packages, g_object_ref (g_ptr_array_index (cached, j)));
+		}
+		*hits = g_list_prepend (*hits, app);
+	}
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+	return misses;
+}
+
+/**
+ * gs_plugin_packagekit_resolve_cache_equal:
+ */
+static gboolean
+gs_plugin_packagekit_resolve_cache_equal (GPtrArray *packages1, GPtrArray *packages2)
+{
+	PkPackage *package1;
+	PkPackage *package2;
+	guint i;
+
+	if (packages1 == NULL || packages1->len != packages2->len)
+		return FALSE;
+	for (i = 0; i < packages1->len; i++) {
+		package1 = g_ptr_array_index (packages1, i);
+		package2 = g_ptr_array_index (packages2, i);
+		if (g_strcmp0 (pk_package_get_id (package1),
+			       pk_package_get_id (package2)) != 0)
+			return FALSE;
+		if (pk_package_get_info (package1) != pk_package_get_info (package2))
+			return FALSE;
+		if (g_strcmp0 (pk_package_get_summary (package1),
+			       pk_package_get_summary (package2)) != 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * gs_plugin_packagekit_resolve_cache_add:
+ *
+ * Replaces the cached packages of each name in @packages, and marks the
+ * cache as changed if any of them are different.
+ */
+static void
+gs_plugin_packagekit_resolve_cache_add (GsPlugin *plugin,
+					GPtrArray *packages,
+					guint generation)
+{
+	GHashTableIter iter;
+	GPtrArray *cached;
+	PkPackage *package;
+	gpointer key;
+	gpointer value;
+	guint i;
+	g_autoptr(GHashTable) resolved = NULL;
+
+	/* group by name first, so the order of the results does not matter */
+	resolved = g_hash_table_new_full (g_str_hash, g_str_equal,
+					  NULL, (GDestroyNotify) g_ptr_array_unref);
+	for (i = 0; i < packages->len; i++) {
+		package = g_ptr_array_index (packages, i);
+		cached = g_hash_table_lookup (resolved, pk_package_get_name (package));
+		if (cached == NULL) {
+			cached = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+			g_hash_table_insert (resolved,
+					     (gpointer) pk_package_get_name (package),
+					     cached);
+		}
+		g_ptr_array_add (cached, g_object_ref (package));
+	}
+
+	g_mutex_lock (&plugin->priv->cache_mutex);
+
+	/* a signal arrived while the transaction was running */
+	if (generation != plugin->priv->cache_generation)
+		goto out;
+
+	g_hash_table_iter_init (&iter, resolved);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		cached = g_hash_table_lookup (plugin->priv->resolve_cache, key);
+		if (gs_plugin_packagekit_resolve_cache_equal (cached, value))
+			continue;
+		g_hash_table_insert (plugin->priv->resolve_cache,
+				     g_strdup (key),
+				     g_ptr_array_ref (value));
+		plugin->priv->resolve_cache_dirty = TRUE;
+	}
+out:
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+}
+
 
 typedef struct {
 	GsPlugin	*plugin;
@@ -139,16 +410,164 @@ gs_plugin_packagekit_progress_cb (PkProgress *progress,
 		gs_plugin_status_update (plugin, NULL, plugin_status);
 }
 
+/*
+ * The refine stages are started with the async PkClient API so that the
+ * transactions that do not depend on each other are in flight together.
+ * Each stage is added to a join, which runs a private main context until
+ * all of its stages have finished, and the results are then processed
+ * in the same order as when the stages ran one after the other.
+ */
+typedef struct {
+	GMainContext		*context;
+	GMainLoop		*loop;
+	GPtrArray		*stages;
+	guint			 pending;
+} GsPluginPackagekitJoin;
+
+typedef struct {
+	GsPluginPackagekitJoin	*join;
+	GsApp			*app;		/* for per-app stages */
+	ProgressData		 progress;
+	PkResults		*results;
+	GError			*error;
+} GsPluginPackagekitStage;
+
+/**
+ * gs_plugin_packagekit_stage_free:
+ **/
+static void
+gs_plugin_packagekit_stage_free (GsPluginPackagekitStage *stage)
+{
+	if (stage->app != NULL)
+		g_object_unref (stage->app);
+	if (stage->results != NULL)
+		g_object_unref (stage->results);
+	if (stage->error != NULL)
+		g_error_free (stage->error);
+	g_clear_pointer (&stage->progress.ptask, as_profile_task_free);
+	g_slice_free (GsPluginPackagekitStage, stage);
+}
+
+/**
+ * gs_plugin_packagekit_join_new:
+ *
+ * Must be freed in the same thread, as the context is pushed as the
+ * thread default so that the async calls complete in it.
+ **/
+static GsPluginPackagekitJoin *
+gs_plugin_packagekit_join_new (void)
+{
+	GsPluginPackagekitJoin *join = g_slice_new0 (GsPluginPackagekitJoin);
+	join->context = g_main_context_new ();
+	join->loop = g_main_loop_new (join->context, FALSE);
+	join->stages = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_plugin_packagekit_stage_free);
+	g_main_context_push_thread_default (join->context);
+	return join;
+}
+
+/**
+ * gs_plugin_packagekit_join_wait:
+ **/
+static void
+gs_plugin_packagekit_join_wait (GsPluginPackagekitJoin *join)
+{
+	if (join->pending > 0)
+		g_main_loop_run (join->loop);
+}
+
+/**
+ * gs_plugin_packagekit_join_free:
+ **/
+static void
+gs_plugin_packagekit_join_free (GsPluginPackagekitJoin *join)
+{
+	/* the callbacks reference the stages */
+	gs_plugin_packagekit_join_wait (join);
+	g_main_context_pop_thread_default (join->context);
+	g_ptr_array_unref (join->stages);
+	g_main_loop_unref (join->loop);
+	g_main_context_unref (join->context);
+	g_slice_free (GsPluginPackagekitJoin, join);
+}
+
+/**
+ * gs_plugin_packagekit_stage_ready_cb:
+ **/
+static void
+gs_plugin_packagekit_stage_ready_cb (GObject *source,
+				     GAsyncResult *res,
+				     gpointer user_data)
+{
+	GsPluginPackagekitStage *stage = (GsPluginPackagekitStage *) user_data;
+
+	stage->results = pk_client_generic_finish (PK_CLIENT (source), res,
+						   &stage->error);
+	if (--stage->join->pending == 0)
+		g_main_loop_quit (stage->join->loop);
+}
+
+/**
+ * gs_plugin_packagekit_join_add:
+ *
+ * Adds a stage, which the caller starts with gs_plugin_packagekit_stage_ready_cb()
+ * as the callback.
+ **/
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_join_add (GsPluginPackagekitJoin *join, GsPlugin *plugin)
+{
+	GsPluginPackagekitStage *stage = g_slice_new0 (GsPluginPackagekitStage);
+	stage->join = join;
+	stage->progress.plugin = plugin;
+	g_ptr_array_add (join->stages, stage);
+	join->pending++;
+	return stage;
+}
+
+/**
+ * gs_plugin_packagekit_stage_get_results:
+ *
+ * Returns the results of a finished stage. If @action is set the PackageKit
+ * error code is also checked.
+ **/
+static PkResults *
+gs_plugin_packagekit_stage_get_results (GsPluginPackagekitStage *stage,
+					const gchar *action,
+					GError **error)
+{
+	g_autoptr(PkError) error_code = NULL;
+
+	if (stage->results == NULL) {
+		g_propagate_error (error, stage->error);
+		stage->error = NULL;
+		return NULL;
+	}
+	if (action == NULL)
+		return stage->results;
+	error_code = pk_results_get_error_code (stage->results);
+	if (error_code != NULL) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "failed to %s: %s, %s",
+			     action,
+			     pk_error_enum_to_string (pk_error_get_code (error_code)),
+			     pk_error_get_details (error_code));
+		return NULL;
+	}
+	return stage->results;
+}
+
 /**
  * gs_plugin_packagekit_set_origin:
  **/
 static void
-gs_plugin_packagekit_set_origin (GsPlugin *plugin,
+gs_plugin_packagekit_set_origin (GHashTable *repos,
 				 GsApp *app,
 				 const gchar *id)
 {
-	const gchar *name;
-	name = g_hash_table_lookup (plugin->priv->sources, id);
+	const gchar *name = NULL;
+	if (repos != NULL)
+		name = g_hash_table_lookup (repos, id);
 	if (name != NULL)
 		gs_app_set_origin (app, name);
 	else
@@ -157,6 +576,7 @@ gs_plugin_packagekit_set_origin (GsPlugin *plugin,
 
 static void
 gs_plugin_packagekit_set_metadata_from_package (GsPlugin *plugin,
+                                                GHashTable *repos,
                                                 GsApp *app,
                                                 PkPackage *package)
 {
@@ -169,14 +589,14 @@ gs_plugin_packagekit_set_metadata_from_package (GsPlugin *plugin,
 	case PK_INFO_ENUM_INSTALLED:
 		data = pk_package_get_data (package);
 		if (g_str_has_prefix (data, "installed:")) {
-			gs_plugin_packagekit_set_origin (plugin,
+			gs_plugin_packagekit_set_origin (repos,
 							 app,
 							 data + 10);
 		}
 		break;
 	case PK_INFO_ENUM_UNAVAILABLE:
 		data = pk_package_get_data (package);
-		gs_plugin_packagekit_set_origin (plugin, app, data);
+		gs_plugin_packagekit_set_origin (repos, app, data);
 		gs_app_set_state (app, AS_APP_STATE_UNAVAILABLE);
 		gs_app_set_size (app, GS_APP_SIZE_MISSING);
 		break;
@@ -200,9 +620,11 @@ gs_plugin_packagekit_set_metadata_from_package (GsPlugin *plugin,
  **/
 static void
 gs_plugin_packagekit_resolve_packages_app (GsPlugin *plugin,
-					   GPtrArray *packages,
+					   GHashTable *repos,
+					   GHashTable *packages_by_name,
 					   GsApp *app)
 {
+	GPtrArray *packages;
 	GPtrArray *sources;
 	PkPackage *package;
 	const gchar *pkgname;
@@ -216,24 +638,26 @@ gs_plugin_packagekit_resolve_packages_app (GsPlugin *plugin,
 	sources = gs_app_get_sources (app);
 	for (j = 0; j < sources->len; j++) {
 		pkgname = g_ptr_array_index (sources, j);
+		packages = g_hash_table_lookup (packages_by_name, pkgname);
+		if (packages == NULL)
+			continue;
 		for (i = 0; i < packages->len; i++) {
 			package = g_ptr_array_index (packages, i);
-			if (g_strcmp0 (pk_package_get_name (package), pkgname) == 0) {
-				gs_plugin_packagekit_set_metadata_from_package (plugin, app, package);
-				switch (pk_package_get_info (package)) {
-				case PK_INFO_ENUM_INSTALLED:
-					number_installed++;
-					break;
-				case PK_INFO_ENUM_AVAILABLE:
-					number_available++;
-					break;
-				case PK_INFO_ENUM_UNAVAILABLE:
-					number_available++;
-					break;
-				default:
-					/* should we expect anything else? */
-					break;
-				}
+			gs_plugin_packagekit_set_metadata_from_package (plugin, repos,
+									app, package);
+			switch (pk_package_get_info (package)) {
+			case PK_INFO_ENUM_INSTALLED:
+				number_installed++;
+				break;
+			case PK_INFO_ENUM_AVAILABLE:
+				number_available++;
+				break;
+			case PK_INFO_ENUM_UNAVAILABLE:
+				number_available++;
+				break;
+			default:
+				/* should we expect anything else? */
+				break;
 			}
 		}
 	}
@@ -263,24 +687,21 @@ gs_plugin_packagekit_resolve_packages_app (GsPlugin *plugin,
 }
 
 /**
- * gs_plugin_packagekit_resolve_packages:
+ * gs_plugin_packagekit_resolve_packages_start:
  **/
-static gboolean
-gs_plugin_packagekit_resolve_packages (GsPlugin *plugin,
-				       GList *list,
-				       GCancellable *cancellable,
-				       GError **error)
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_resolve_packages_start (GsPlugin *plugin,
+					     GList *list,
+					     GsPluginPackagekitJoin *join,
+					     GCancellable *cancellable)
 {
 	GList *l;
 	GPtrArray *sources;
 	GsApp *app;
+	GsPluginPackagekitStage *stage;
 	const gchar *pkgname;
 	guint i;
-	ProgressData data;
-	g_autoptr(PkError) error_code = NULL;
-	g_autoptr(PkResults) results = NULL;
 	g_autoptr(GPtrArray) package_ids = NULL;
-	g_autoptr(GPtrArray) packages = NULL;
 
 	package_ids = g_ptr_array_new_with_free_func (g_free);
 	for (l = list; l != NULL; l = l->next) {
@@ -293,146 +714,336 @@ gs_plugin_packagekit_resolve_packages (GsPlugin *plugin,
 	}
 	g_ptr_array_add (package_ids, NULL);
 
-	data.plugin = plugin;
-	data.ptask = NULL;
-
 	/* resolve them all at once */
-	results = pk_client_resolve (plugin->priv->client,
-				     pk_bitfield_from_enums (PK_FILTER_ENUM_NEWEST, PK_FILTER_ENUM_ARCH, -1),
-				     (gchar **) package_ids->pdata,
-				     cancellable,
-				     gs_plugin_packagekit_progress_cb, &data,
-				     error);
-	if (results == NULL)
-		return FALSE;
+	stage = gs_plugin_packagekit_join_add (join, plugin);
+	pk_client_resolve_async (plugin->priv->client,
+				 pk_bitfield_from_enums (PK_FILTER_ENUM_NEWEST, PK_FILTER_ENUM_ARCH, -1),
+				 (gchar **) package_ids->pdata,
+				 cancellable,
+				 gs_plugin_packagekit_progress_cb, &stage->progress,
+				 gs_plugin_packagekit_stage_ready_cb, stage);
+	return stage;
+}
 
-	/* check error code */
-	error_code = pk_results_get_error_code (results);
-	if (error_code != NULL) {
-		g_set_error (error,
-			     GS_PLUGIN_ERROR,
-			     GS_PLUGIN_ERROR_FAILED,
-			     "failed to resolve: %s, %s",
-			     pk_error_enum_to_string (pk_error_get_code (error_code)),
-			     pk_error_get_details (error_code));
-		return FALSE;
+/**
+ * gs_plugin_packagekit_resolve_packages_array:
+ **/
+static void
+gs_plugin_packagekit_resolve_packages_array (GsPlugin *plugin,
+					     GHashTable *repos,
+					     GList *list,
+					     GPtrArray *packages)
+{
+	GList *l;
+	GsApp *app;
+	guint i;
+	g_autoptr(GHashTable) packages_by_name = NULL;
+
+	/* index by name */
+	packages_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  NULL, (GDestroyNotify) g_ptr_array_unref);
+	for (i = 0; i < packages->len; i++) {
+		GPtrArray *tmp;
+		PkPackage *package = g_ptr_array_index (packages, i);
+		tmp = g_hash_table_lookup (packages_by_name,
+					   pk_package_get_name (package));
+		if (tmp == NULL) {
+			tmp = g_ptr_array_new ();
+			g_hash_table_insert (packages_by_name,
+					     (gpointer) pk_package_get_name (package),
+					     tmp);
+		}
+		g_ptr_array_add (tmp, package);
 	}
-
-	/* get results */
-	packages = pk_results_get_package_array (results);
 	for (l = list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
 		if (gs_app_get_metadata_item (app, "PackageKit::local-filename") != NULL)
 			continue;
-		gs_plugin_packagekit_resolve_packages_app (plugin, packages, app);
+		gs_plugin_packagekit_resolve_packages_app (plugin, repos,
+							   packages_by_name, app);
 	}
+}
+
+/**
+ * gs_plugin_packagekit_resolve_packages:
+ **/
+static gboolean
+gs_plugin_packagekit_resolve_packages (GsPlugin *plugin,
+				       GHashTable *repos,
+				       GList *list,
+				       GsPluginPackagekitStage *stage,
+				       guint generation,
+				       GError **error)
+{
+	PkResults *results;
+	g_autoptr(GPtrArray) packages = NULL;
+
+	results = gs_plugin_packagekit_stage_get_results (stage, "resolve", error);
+	if (results == NULL)
+		return FALSE;
+	packages = pk_results_get_package_array (results);
+	gs_plugin_packagekit_resolve_cache_add (plugin, packages, generation);
+	gs_plugin_packagekit_resolve_packages_array (plugin, repos, list, packages);
 	return TRUE;
 }
 
+/**
+ * gs_plugin_packagekit_refine_from_desktop_start:
+ *
+ * Finds the installed packages owning the desktop files of all the apps
+ * with one SearchFiles transaction.
+ **/
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_refine_from_desktop_start (GsPlugin *plugin,
+						GList *list,
+						GsPluginPackagekitJoin *join,
+						GCancellable *cancellable)
+{
+	GList *l;
+	GsPluginPackagekitStage *stage;
+	const gchar *filename;
+	g_autoptr(GHashTable) filenames = NULL;
+	g_autoptr(GPtrArray) search = NULL;
+
+	filenames = g_hash_table_new (g_str_hash, g_str_equal);
+	search = g_ptr_array_new ();
+	for (l = list; l != NULL; l = l->next) {
+		filename = gs_app_get_metadata_item (GS_APP (l->data),
+						     "DataDir::desktop-filename");
+		if (!g_hash_table_add (filenames, (gpointer) filename))
+			continue;
+		g_ptr_array_add (search, (gpointer) filename);
+	}
+	g_ptr_array_add (search, NULL);
+
+	/* search for them all at once */
+	stage = gs_plugin_packagekit_join_add (join, plugin);
+	pk_client_search_files_async (plugin->priv->client,
+				      pk_bitfield_from_enums (PK_FILTER_ENUM_INSTALLED, -1),
+				      (gchar **) search->pdata,
+				      cancellable,
+				      gs_plugin_packagekit_progress_cb, &stage->progress,
+				      gs_plugin_packagekit_stage_ready_cb, stage);
+	return stage;
+}
+
+/**
+ * gs_plugin_packagekit_refine_from_desktop:
+ *
+ * SearchFiles does not say which file each package matched, so when more
+ * than one file was searched the file lists of the packages are fetched
+ * with one GetFiles transaction and used to map each package back to its
+ * desktop file.
+ **/
 static gboolean
 gs_plugin_packagekit_refine_from_desktop (GsPlugin *plugin,
-					  GsApp	 *app,
-					  const gchar *filename,
+					  GHashTable *repos,
+					  GList *list,
+					  GsPluginPackagekitStage *stage,
 					  GCancellable *cancellable,
 					  GError **error)
 {
-	const gchar *to_array[] = { NULL, NULL };
+	GHashTableIter iter;
+	GList *l;
+	GPtrArray *apps;
+	GsApp *app;
+	PkPackage *package;
+	PkResults *results;
 	ProgressData data;
-	g_autoptr(PkError) error_code = NULL;
-	g_autoptr(PkResults) results = NULL;
+	const gchar *filename;
+	gpointer key;
+	gpointer value;
+	guint i;
+	guint j;
+	g_autoptr(GHashTable) filenames = NULL;
+	g_autoptr(GHashTable) found = NULL;
+	g_autoptr(GHashTable) packages_by_id = NULL;
+	g_autoptr(GPtrArray) files = NULL;
 	g_autoptr(GPtrArray) packages = NULL;
+	g_autoptr(GPtrArray) package_ids = NULL;
+	g_autoptr(PkError) error_code = NULL;
+	g_autoptr(PkResults) results_files = NULL;
 
-	data.plugin = plugin;
-	data.ptask = NULL;
-
-	to_array[0] = filename;
-	results = pk_client_search_files (plugin->priv->client,
-					  pk_bitfield_from_enums (PK_FILTER_ENUM_INSTALLED, -1),
-					  (gchar **) to_array,
-					  cancellable,
-					  gs_plugin_packagekit_progress_cb, &data,
-					  error);
+	results = gs_plugin_packagekit_stage_get_results (stage, "search files", error);
 	if (results == NULL)
 		return FALSE;
 
-	/* check error code */
-	error_code = pk_results_get_error_code (results);
-	if (error_code != NULL) {
-		g_set_error (error,
-			     GS_PLUGIN_ERROR,
-			     GS_PLUGIN_ERROR_FAILED,
-			     "failed to search files: %s, %s",
-			     pk_error_enum_to_string (pk_error_get_code (error_code)),
-			     pk_error_get_details (error_code));
-		return FALSE;
+	/* desktop filename -> apps, as several apps can share one file */
+	filenames = g_hash_table_new_full (g_str_hash, g_str_equal,
+					   NULL, (GDestroyNotify) g_ptr_array_unref);
+	for (l = list; l != NULL; l = l->next) {
+		app = GS_APP (l->data);
+		filename = gs_app_get_metadata_item (app, "DataDir::desktop-filename");
+		apps = g_hash_table_lookup (filenames, filename);
+		if (apps == NULL) {
+			apps = g_ptr_array_new ();
+			g_hash_table_insert (filenames, (gpointer) filename, apps);
+		}
+		g_ptr_array_add (apps, app);
 	}
 
-	/* get results */
+	/* desktop filename -> packages */
 	packages = pk_results_get_package_array (results);
-	if (packages->len == 1) {
-		PkPackage *package;
-		package = g_ptr_array_index (packages, 0);
-		gs_plugin_packagekit_set_metadata_from_package (plugin, app, package);
-	} else {
-		g_warning ("Failed to find one package for %s, %s, [%d]",
-			   gs_app_get_id (app), filename, packages->len);
+	found = g_hash_table_new_full (g_str_hash, g_str_equal,
+				       NULL, (GDestroyNotify) g_ptr_array_unref);
+	if (g_hash_table_size (filenames) == 1) {
+		g_hash_table_iter_init (&iter, filenames);
+		if (g_hash_table_iter_next (&iter, &key, NULL))
+			g_hash_table_insert (found, key, g_ptr_array_ref (packages));
+	} else if (packages->len > 0) {
+		package_ids = g_ptr_array_new ();
+		packages_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+		for (i = 0; i < packages->len; i++) {
+			package = g_ptr_array_index (packages, i);
+			g_ptr_array_add (package_ids, (gpointer) pk_package_get_id (package));
+			g_hash_table_insert (packages_by_id,
+					     (gpointer) pk_package_get_id (package),
+					     package);
+		}
+		g_ptr_array_add (package_ids, NULL);
+		data.plugin = plugin;
+		data.ptask = NULL;
+		results_files = pk_client_get_files (plugin->priv->client,
+						     (gchar **) package_ids->pdata,
+						     cancellable,
+						     gs_plugin_packagekit_progress_cb, &data,
+						     error);
+		if (results_files == NULL)
+			return FALSE;
+		error_code = pk_results_get_error_code (results_files);
+		if (error_code != NULL) {
+			g_set_error (error,
+				     GS_PLUGIN_ERROR,
+				     GS_PLUGIN_ERROR_FAILED,
+				     "failed to get files: %s, %s",
+				     pk_error_enum_to_string (pk_error_get_code (error_code)),
+				     pk_error_get_details (error_code));
+			return FALSE;
+		}
+		files = pk_results_get_files_array (results_files);
+		for (i = 0; i < files->len; i++) {
+			PkFiles *item = g_ptr_array_index (files, i);
+			gchar **fns = pk_files_get_files (item);
+			package = g_hash_table_lookup (packages_by_id,
+						       pk_files_get_package_id (item));
+			if (package == NULL)
+				continue;
+			for (j = 0; fns != NULL && fns[j] != NULL; j++) {
+				GPtrArray *pkgs;
+				if (!g_hash_table_lookup_extended (filenames, fns[j],
+								   &key, NULL))
+					continue;
+				pkgs = g_hash_table_lookup (found, key);
+				if (pkgs == NULL) {
+					pkgs = g_ptr_array_new ();
+					g_hash_table_insert (found, key, pkgs);
+				}
+				g_ptr_array_add (pkgs, package);
+			}
+		}
+	}
+
+	/* set the package on every app using the desktop file */
+	g_hash_table_iter_init (&iter, filenames);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		GPtrArray *pkgs = g_hash_table_lookup (found, key);
+		apps = value;
+		for (i = 0; i < apps->len; i++) {
+			app = g_ptr_array_index (apps, i);
+			if (pkgs == NULL || pkgs->len != 1) {
+				g_warning ("Failed to find one package for %s, %s, [%d]",
+					   gs_app_get_id (app),
+					   (const gchar *) key,
+					   pkgs != NULL ? pkgs->len : 0);
+				continue;
+			}
+			package = g_ptr_array_index (pkgs, 0);
+			gs_plugin_packagekit_set_metadata_from_package (plugin, repos,
+									app, package);
+		}
 	}
 	return TRUE;
 }
 
+/**
+ * gs_plugin_packagekit_refine_updatedetails_start:
+ */
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_refine_updatedetails_start (GsPlugin *plugin,
+						 GList *list,
+						 GsPluginPackagekitJoin *join,
+						 GCancellable *cancellable)
+{
+	const gchar *package_id;
+	GList *l;
+	GsApp *app;
+	GsPluginPackagekitStage *stage;
+	guint i = 0;
+	guint size;
+	g_autofree const gchar **package_ids = NULL;
+
+	size = g_list_length (list);
+	package_ids = g_new0 (const gchar *, size + 1);
+	for (l = list; l != NULL; l = l->next) {
+		app = GS_APP (l->data);
+		package_id = gs_app_get_source_id_default (app);
+		package_ids[i++] = package_id;
+	}
+
+	/* get any update details */
+	stage = gs_plugin_packagekit_join_add (join, plugin);
+	pk_client_get_update_detail_async (plugin->priv->client,
+					   (gchar **) package_ids,
+					   cancellable,
+					   gs_plugin_packagekit_progress_cb, &stage->progress,
+					   gs_plugin_packagekit_stage_ready_cb, stage);
+	return stage;
+}
+
 /**
  * gs_plugin_packagekit_refine_updatedetails:
  */
 static gboolean
 gs_plugin_packagekit_refine_updatedetails (GsPlugin *plugin,
 					   GList *list,
-					   GCancellable *cancellable,
+					   GsPluginPackagekitStage *stage,
 					   GError **error)
 {
 	const gchar *package_id;
 	GList *l;
 	GsApp *app;
-	guint i = 0;
-	guint size;
-	PkUpdateDetail *update_detail;
-	ProgressData data;
-	g_autofree const gchar **package_ids = NULL;
-	g_autoptr(PkResults) results = NULL;
+	PkResults *results;
+	PkUpdateDetail *update_detail;
+	guint i;
+	g_autoptr(GHashTable) details_by_id = NULL;
 	g_autoptr(GPtrArray) array = NULL;
 
-	size = g_list_length (list);
-	package_ids = g_new0 (const gchar *, size + 1);
-	for (l = list; l != NULL; l = l->next) {
-		app = GS_APP (l->data);
-		package_id = gs_app_get_source_id_default (app);
-		package_ids[i++] = package_id;
-	}
-
-	data.plugin = plugin;
-	data.ptask = NULL;
-
-	/* get any update details */
-	results = pk_client_get_update_detail (plugin->priv->client,
-					       (gchar **) package_ids,
-					       cancellable,
-					       gs_plugin_packagekit_progress_cb, &data,
-					       error);
+	results = gs_plugin_packagekit_stage_get_results (stage, NULL, error);
 	if (results == NULL)
 		return FALSE;
 
-	/* set the update details for the update */
+	/* index by package-id, the first result wins */
 	array = pk_results_get_update_detail_array (results);
+	details_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < array->len; i++) {
+		update_detail = g_ptr_array_index (array, i);
+		package_id = pk_update_detail_get_package_id (update_detail);
+		if (package_id == NULL ||
+		    g_hash_table_contains (details_by_id, package_id))
+			continue;
+		g_hash_table_insert (details_by_id, (gpointer) package_id, update_detail);
+	}
+
+	/* set the update details for the update */
 	for (l = list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
 		package_id = gs_app_get_source_id_default (app);
-		for (i = 0; i < array->len; i++) {
-			/* right package? */
-			update_detail = g_ptr_array_index (array, i);
-			if (g_strcmp0 (package_id, pk_update_detail_get_package_id (update_detail)) != 0)
-				continue;
-			gs_app_set_update_details (app, pk_update_detail_get_update_text (update_detail));
-			break;
-		}
+		if (package_id == NULL)
+			continue;
+		update_detail = g_hash_table_lookup (details_by_id, package_id);
+		if (update_detail == NULL)
+			continue;
+		gs_app_set_update_details (app, pk_update_detail_get_update_text (update_detail));
 	}
 	return TRUE;
 }
@@ -451,26 +1062,22 @@ gs_pk_format_desc (const gchar *text)
 }
 
 /**
- * gs_pk_compare_ids:
+ * gs_pk_package_id_key:
  *
  * Do not compare the repo. Some backends do not append the origin.
  */
-static gboolean
-gs_pk_compare_ids (const gchar *package_id1, const gchar *package_id2)
-{
-	gboolean ret;
-	g_auto(GStrv) split1 = NULL;
-	g_auto(GStrv) split2 = NULL;
-
-	split1 = pk_package_id_split (package_id1);
-	split2 = pk_package_id_split (package_id2);
-	ret = (g_strcmp0 (split1[PK_PACKAGE_ID_NAME],
-			  split2[PK_PACKAGE_ID_NAME]) == 0 &&
-	       g_strcmp0 (split1[PK_PACKAGE_ID_VERSION],
-			  split2[PK_PACKAGE_ID_VERSION]) == 0 &&
-	       g_strcmp0 (split1[PK_PACKAGE_ID_ARCH],
-			  split2[PK_PACKAGE_ID_ARCH]) == 0);
-	return ret;
+static gchar *
+gs_pk_package_id_key (const gchar *package_id)
+{
+	g_auto(GStrv) split = NULL;
+
+	split = pk_package_id_split (package_id);
+	if (split == NULL)
+		return NULL;
+	return g_strdup_printf ("%s;%s;%s",
+				split[PK_PACKAGE_ID_NAME],
+				split[PK_PACKAGE_ID_VERSION],
+				split[PK_PACKAGE_ID_ARCH]);
 }
 
 /**
@@ -478,44 +1085,43 @@ gs_pk_compare_ids (const gchar *package_id1, const gchar *package_id2)
  */
 static void
 gs_plugin_packagekit_refine_details_app (GsPlugin *plugin,
-					 GPtrArray *array,
+					 GHashTable *details_by_id,
 					 GsApp *app)
 {
 	GPtrArray *source_ids;
 	PkDetails *details;
 	const gchar *package_id;
-	guint i;
 	guint j;
 	guint64 size = 0;
 
 	source_ids = gs_app_get_source_ids (app);
 	for (j = 0; j < source_ids->len; j++) {
+		g_autofree gchar *desc = NULL;
+		g_autofree gchar *key = NULL;
+
+		/* right package? */
 		package_id = g_ptr_array_index (source_ids, j);
-		for (i = 0; i < array->len; i++) {
-			g_autofree gchar *desc = NULL;
-			/* right package? */
-			details = g_ptr_array_index (array, i);
-			if (!gs_pk_compare_ids (package_id,
-						pk_details_get_package_id (details))) {
-				continue;
-			}
-			if (gs_app_get_licence (app) == NULL)
-				gs_app_set_licence (app, pk_details_get_license (details));
-			if (gs_app_get_url (app, AS_URL_KIND_HOMEPAGE) == NULL) {
-				gs_app_set_url (app,
-						AS_URL_KIND_HOMEPAGE,
-						pk_details_get_url (details));
-			}
-			size += pk_details_get_size (details);
-			desc = gs_pk_format_desc (pk_details_get_description (details));
-			gs_app_set_description (app,
-						GS_APP_QUALITY_LOWEST,
-						desc);
-			gs_app_set_summary (app,
-					    GS_APP_QUALITY_LOWEST,
-					    pk_details_get_summary (details));
-			break;
+		key = gs_pk_package_id_key (package_id);
+		if (key == NULL)
+			continue;
+		details = g_hash_table_lookup (details_by_id, key);
+		if (details == NULL)
+			continue;
+		if (gs_app_get_licence (app) == NULL)
+			gs_app_set_licence (app, pk_details_get_license (details));
+		if (gs_app_get_url (app, AS_URL_KIND_HOMEPAGE) == NULL) {
+			gs_app_set_url (app,
+					AS_URL_KIND_HOMEPAGE,
+					pk_details_get_url (details));
 		}
+		size += pk_details_get_size (details);
+		desc = gs_pk_format_desc (pk_details_get_description (details));
+		gs_app_set_description (app,
+					GS_APP_QUALITY_LOWEST,
+					desc);
+		gs_app_set_summary (app,
+				    GS_APP_QUALITY_LOWEST,
+				    pk_details_get_summary (details));
 	}
 
 	/* the size is the size of all sources */
@@ -524,23 +1130,21 @@ gs_plugin_packagekit_refine_details_app (GsPlugin *plugin,
 }
 
 /**
- * gs_plugin_packagekit_refine_details:
+ * gs_plugin_packagekit_refine_details_start:
  */
-static gboolean
-gs_plugin_packagekit_refine_details (GsPlugin *plugin,
-				     GList *list,
-				     GCancellable *cancellable,
-				     GError **error)
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_refine_details_start (GsPlugin *plugin,
+					   GList *list,
+					   GsPluginPackagekitJoin *join,
+					   GCancellable *cancellable)
 {
 	GList *l;
 	GPtrArray *source_ids;
 	GsApp *app;
+	GsPluginPackagekitStage *stage;
 	const gchar *package_id;
 	guint i;
-	ProgressData data;
-	g_autoptr(GPtrArray) array = NULL;
 	g_autoptr(GPtrArray) package_ids = NULL;
-	g_autoptr(PkResults) results = NULL;
 
 	package_ids = g_ptr_array_new_with_free_func (g_free);
 	for (l = list; l != NULL; l = l->next) {
@@ -553,59 +1157,204 @@ gs_plugin_packagekit_refine_details (GsPlugin *plugin,
 	}
 	g_ptr_array_add (package_ids, NULL);
 
-	data.plugin = plugin;
-	data.ptask = NULL;
-
 	/* get any details */
-	results = pk_client_get_details (plugin->priv->client,
-					 (gchar **) package_ids->pdata,
-					 cancellable,
-					 gs_plugin_packagekit_progress_cb, &data,
-					 error);
+	stage = gs_plugin_packagekit_join_add (join, plugin);
+	pk_client_get_details_async (plugin->priv->client,
+				     (gchar **) package_ids->pdata,
+				     cancellable,
+				     gs_plugin_packagekit_progress_cb, &stage->progress,
+				     gs_plugin_packagekit_stage_ready_cb, stage);
+	return stage;
+}
+
+/**
+ * gs_plugin_packagekit_refine_details:
+ */
+static gboolean
+gs_plugin_packagekit_refine_details (GsPlugin *plugin,
+				     GList *list,
+				     GsPluginPackagekitStage *stage,
+				     GError **error)
+{
+	GList *l;
+	GsApp *app;
+	PkResults *results;
+	guint i;
+	g_autoptr(GHashTable) details_by_id = NULL;
+	g_autoptr(GPtrArray) array = NULL;
+
+	results = gs_plugin_packagekit_stage_get_results (stage, NULL, error);
 	if (results == NULL)
 		return FALSE;
 
-	/* set the update details for the update */
+	/* index by name, version and arch, the first result wins */
 	array = pk_results_get_details_array (results);
+	details_by_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < array->len; i++) {
+		PkDetails *details = g_ptr_array_index (array, i);
+		gchar *key = gs_pk_package_id_key (pk_details_get_package_id (details));
+		if (key == NULL)
+			continue;
+		if (g_hash_table_contains (details_by_id, key)) {
+			g_free (key);
+			continue;
+		}
+		g_hash_table_insert (details_by_id, key, details);
+	}
+
+	/* set the update details for the update */
 	for (l = list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
-		gs_plugin_packagekit_refine_details_app (plugin, array, app);
+		gs_plugin_packagekit_refine_details_app (plugin, details_by_id, app);
 	}
 	return TRUE;
 }
 
+/**
+ * gs_plugin_packagekit_refine_update_severity_start:
+ */
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_refine_update_severity_start (GsPlugin *plugin,
+						   GsPluginPackagekitJoin *join,
+						   GCancellable *cancellable)
+{
+	GsPluginPackagekitStage *stage;
+
+	/* get the list of updates */
+	stage = gs_plugin_packagekit_join_add (join, plugin);
+	pk_client_get_updates_async (plugin->priv->client,
+				     pk_bitfield_value (PK_FILTER_ENUM_NONE),
+				     cancellable,
+				     gs_plugin_packagekit_progress_cb, &stage->progress,
+				     gs_plugin_packagekit_stage_ready_cb, stage);
+	return stage;
+}
+
+/**
+ * gs_plugin_packagekit_cache_get_updates:
+ *
+ * Returns a reference to the cached list of updates, or %NULL. If another
+ * refine is getting the list @wait is set, otherwise the caller has to get
+ * it and then call gs_plugin_packagekit_cache_updates_done().
+ */
+static PkPackageSack *
+gs_plugin_packagekit_cache_get_updates (GsPlugin *plugin, gboolean *wait)
+{
+	PkPackageSack *sack = NULL;
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	if (plugin->priv->updates != NULL)
+		sack = g_object_ref (plugin->priv->updates);
+	else if (plugin->priv->updates_running)
+		*wait = TRUE;
+	else
+		plugin->priv->updates_running = TRUE;
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+	return sack;
+}
+
+/**
+ * gs_plugin_packagekit_cache_updates_done:
+ *
+ * Wakes the refines waiting for the list of updates, whether it was
+ * cached or not.
+ */
+static void
+gs_plugin_packagekit_cache_updates_done (GsPlugin *plugin)
+{
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	plugin->priv->updates_running = FALSE;
+	g_cond_broadcast (&plugin->priv->updates_cond);
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+}
+
+/**
+ * gs_plugin_packagekit_cache_wait_updates:
+ *
+ * Waits for the GetUpdates started by another refine, and returns a
+ * reference to the list of updates if it was cached.
+ */
+static PkPackageSack *
+gs_plugin_packagekit_cache_wait_updates (GsPlugin *plugin)
+{
+	PkPackageSack *sack = NULL;
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	while (plugin->priv->updates_running)
+		g_cond_wait (&plugin->priv->updates_cond, &plugin->priv->cache_mutex);
+	if (plugin->priv->updates != NULL)
+		sack = g_object_ref (plugin->priv->updates);
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+	return sack;
+}
+
+/**
+ * gs_plugin_packagekit_get_updates:
+ *
+ * Gets the list of updates from the finished GetUpdates transaction and
+ * adds it to the cache.
+ */
+static PkPackageSack *
+gs_plugin_packagekit_get_updates (GsPlugin *plugin,
+				  GsPluginPackagekitStage *stage,
+				  guint generation,
+				  GError **error)
+{
+	PkPackageSack *sack = NULL;
+	PkResults *results;
+
+	results = gs_plugin_packagekit_stage_get_results (stage, NULL, error);
+	if (results == NULL)
+		return NULL;
+	sack = pk_results_get_package_sack (results);
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	if (generation == plugin->priv->cache_generation &&
+	    plugin->priv->updates == NULL)
+		plugin->priv->updates = g_object_ref (sack);
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+	return sack;
+}
+
+/**
+ * gs_plugin_packagekit_wait_updates:
+ *
+ * Gets the list of updates fetched by another refine, or fetches it again
+ * if that failed or was out of date.
+ */
+static PkPackageSack *
+gs_plugin_packagekit_wait_updates (GsPlugin *plugin,
+				   guint generation,
+				   GCancellable *cancellable,
+				   GError **error)
+{
+	GsPluginPackagekitJoin *join;
+	GsPluginPackagekitStage *stage;
+	PkPackageSack *sack;
+
+	sack = gs_plugin_packagekit_cache_wait_updates (plugin);
+	if (sack != NULL)
+		return sack;
+	join = gs_plugin_packagekit_join_new ();
+	stage = gs_plugin_packagekit_refine_update_severity_start (plugin,
+								   join,
+								   cancellable);
+	gs_plugin_packagekit_join_wait (join);
+	sack = gs_plugin_packagekit_get_updates (plugin, stage, generation, error);
+	gs_plugin_packagekit_join_free (join);
+	return sack;
+}
+
 /**
  * gs_plugin_packagekit_refine_update_severity:
  */
-static gboolean
+static void
 gs_plugin_packagekit_refine_update_severity (GsPlugin *plugin,
 					     GList *list,
-					     GCancellable *cancellable,
-					     GError **error)
+					     PkPackageSack *sack)
 {
 	GList *l;
 	GsApp *app;
 	const gchar *package_id;
-	PkBitfield filter;
-	ProgressData data;
-	g_autoptr(PkPackageSack) sack = NULL;
-	g_autoptr(PkResults) results = NULL;
-
-	data.plugin = plugin;
-	data.ptask = NULL;
-
-	/* get the list of updates */
-	filter = pk_bitfield_value (PK_FILTER_ENUM_NONE);
-	results = pk_client_get_updates (plugin->priv->client,
-					 filter,
-					 cancellable,
-					 gs_plugin_packagekit_progress_cb, &data,
-					 error);
-	if (results == NULL)
-		return FALSE;
 
 	/* set the update severity for the app */
-	sack = pk_results_get_package_sack (results);
 	for (l = list; l != NULL; l = l->next) {
 		g_autoptr (PkPackage) pkg = NULL;
 		app = GS_APP (l->data);
@@ -636,7 +1385,6 @@ gs_plugin_packagekit_refine_update_severity (GsPlugin *plugin,
 			break;
 		}
 	}
-	return TRUE;
 }
 
 /**
@@ -658,20 +1406,16 @@ gs_plugin_refine_app_needs_details (GsPlugin *plugin, GsApp *app)
 
 /**
  * gs_plugin_refine_require_details:
+ *
+ * Returns the apps that need GetDetails.
  */
-static gboolean
-gs_plugin_refine_require_details (GsPlugin *plugin,
-				  GList *list,
-				  GCancellable *cancellable,
-				  GError **error)
+static GList *
+gs_plugin_refine_require_details (GsPlugin *plugin, GList *list)
 {
 	GList *l;
+	GList *list_tmp = NULL;
 	GsApp *app;
-	gboolean ret = TRUE;
-	g_autoptr(GList) list_tmp = NULL;
-	g_autoptr(AsProfileTask) ptask = NULL;
 
-	ptask = as_profile_start_literal (plugin->profile, "packagekit-refine[source->licence]");
 	for (l = list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
 		if (gs_app_get_id_kind (app) == AS_ID_KIND_WEB_APP)
@@ -682,50 +1426,80 @@ gs_plugin_refine_require_details (GsPlugin *plugin,
 			continue;
 		list_tmp = g_list_prepend (list_tmp, app);
 	}
-	if (list_tmp == NULL)
-		return TRUE;
-	ret = gs_plugin_packagekit_refine_details (plugin,
-						   list_tmp,
-						   cancellable,
-						   error);
-	if (!ret)
-		return FALSE;
-	return TRUE;
+	return list_tmp;
 }
 
 /**
- * gs_plugin_packagekit_get_source_list:
+ * gs_plugin_packagekit_cache_get_sources:
+ *
+ * Returns a reference to the cached repo id to name table, or %NULL.
+ */
+static GHashTable *
+gs_plugin_packagekit_cache_get_sources (GsPlugin *plugin)
+{
+	GHashTable *repos = NULL;
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	if (plugin->priv->sources != NULL)
+		repos = g_hash_table_ref (plugin->priv->sources);
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+	return repos;
+}
+
+/**
+ * gs_plugin_packagekit_get_source_list_start:
  **/
-static gboolean
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_get_source_list_start (GsPlugin *plugin,
+					    GsPluginPackagekitJoin *join,
+					    GCancellable *cancellable)
+{
+	GsPluginPackagekitStage *stage;
+
+	/* ask PK for the repo details */
+	stage = gs_plugin_packagekit_join_add (join, plugin);
+	pk_client_get_repo_list_async (plugin->priv->client,
+				       pk_bitfield_from_enums (PK_FILTER_ENUM_NONE, -1),
+				       cancellable,
+				       gs_plugin_packagekit_progress_cb, &stage->progress,
+				       gs_plugin_packagekit_stage_ready_cb, stage);
+	return stage;
+}
+
+/**
+ * gs_plugin_packagekit_get_source_list:
+ *
+ * Gets the repo id to name table from the finished GetRepoList
+ * transaction and adds it to the cache.
+ */
+static GHashTable *
 gs_plugin_packagekit_get_source_list (GsPlugin *plugin,
-				      GCancellable *cancellable,
+				      GsPluginPackagekitStage *stage,
+				      guint generation,
 				      GError **error)
 {
+	GHashTable *repos;
 	PkRepoDetail *rd;
-	ProgressData data;
+	PkResults *results;
 	guint i;
-	g_autoptr(PkResults) results = NULL;
 	g_autoptr(GPtrArray) array = NULL;
 
-	data.plugin = plugin;
-	data.ptask = NULL;
-
-	/* ask PK for the repo details */
-	results = pk_client_get_repo_list (plugin->priv->client,
-					   pk_bitfield_from_enums (PK_FILTER_ENUM_NONE, -1),
-					   cancellable,
-					   gs_plugin_packagekit_progress_cb, &data,
-					   error);
+	results = gs_plugin_packagekit_stage_get_results (stage, NULL, error);
 	if (results == NULL)
-		return FALSE;
+		return NULL;
 	array = pk_results_get_repo_detail_array (results);
+	repos = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 	for (i = 0; i < array->len; i++) {
 		rd = g_ptr_array_index (array, i);
-		g_hash_table_insert (plugin->priv->sources,
+		g_hash_table_insert (repos,
 				     g_strdup (pk_repo_detail_get_id (rd)),
 				     g_strdup (pk_repo_detail_get_description (rd)));
 	}
-	return TRUE;
+	g_mutex_lock (&plugin->priv->cache_mutex);
+	if (generation == plugin->priv->cache_generation &&
+	    plugin->priv->sources == NULL)
+		plugin->priv->sources = g_hash_table_ref (repos);
+	g_mutex_unlock (&plugin->priv->cache_mutex);
+	return repos;
 }
 
 /**
@@ -832,32 +1606,44 @@ gs_plugin_app_upgrade_download (GsPlugin *plugin,
 	return results != NULL;
 }
 
+/**
+ * gs_plugin_packagekit_refine_distro_upgrade_start:
+ **/
+static GsPluginPackagekitStage *
+gs_plugin_packagekit_refine_distro_upgrade_start (GsPlugin *plugin,
+						  GsApp *app,
+						  GsPluginPackagekitJoin *join,
+						  GCancellable *cancellable)
+{
+	GsPluginPackagekitStage *stage;
+
+	/* ask PK to simulate upgrading the system */
+	stage = gs_plugin_packagekit_join_add (join, plugin);
+	stage->app = g_object_ref (app);
+	pk_client_upgrade_system_async (plugin->priv->client,
+					pk_bitfield_from_enums (PK_TRANSACTION_FLAG_ENUM_SIMULATE, -1),
+					gs_app_get_id (app),
+					PK_UPGRADE_KIND_ENUM_COMPLETE,
+					cancellable,
+					gs_plugin_packagekit_progress_cb, &stage->progress,
+					gs_plugin_packagekit_stage_ready_cb, stage);
+	return stage;
+}
+
 /**
  * gs_plugin_packagekit_refine_distro_upgrade:
  **/
 static gboolean
 gs_plugin_packagekit_refine_distro_upgrade (GsPlugin *plugin,
-					    GsApp *app,
-					    GCancellable *cancellable,
+					    GsPluginPackagekitStage *stage,
 					    GError **error)
 {
 	GList *l;
 	GsApp *app2;
-	ProgressData data;
-	g_autoptr(PkResults) results = NULL;
+	PkResults *results;
 	g_autoptr(GsAppList) list = NULL;
 
-	data.plugin = plugin;
-	data.ptask = NULL;
-
-	/* ask PK to simulate upgrading the system */
-	results = pk_client_upgrade_system (plugin->priv->client,
-					    pk_bitfield_from_enums (PK_TRANSACTION_FLAG_ENUM_SIMULATE, -1),
-					    gs_app_get_id (app),
-					    PK_UPGRADE_KIND_ENUM_COMPLETE,
-					    cancellable,
-					    gs_plugin_packagekit_progress_cb, &data,
-					    error);
+	results = gs_plugin_packagekit_stage_get_results (stage, NULL, error);
 	if (results == NULL)
 		return FALSE;
 	if (!gs_plugin_packagekit_add_results (plugin, &list, results, error))
@@ -868,13 +1654,20 @@ gs_plugin_packagekit_refine_distro_upgrade (GsPlugin *plugin,
 		app2 = GS_APP (l->data);
 		if (gs_app_get_state (app2) != AS_APP_STATE_AVAILABLE)
 			continue;
-		gs_app_add_related (app, app2);
+		gs_app_add_related (stage->app, app2);
 	}
 	return TRUE;
 }
 
 /**
  * gs_plugin_refine:
+ *
+ * The transactions run in up to three rounds, each of which is joined
+ * before the next is started:
+ *  1. the repo list, Resolve, SearchFiles for apps with no package name,
+ *     GetUpdates and any distro upgrade simulations
+ *  2. SearchFiles for resolved apps still without a package-id
+ *  3. GetUpdateDetail and GetDetails, which need the package-ids
  */
 gboolean
 gs_plugin_refine (GsPlugin *plugin,
@@ -886,40 +1679,65 @@ gs_plugin_refine (GsPlugin *plugin,
 	GList *l;
 	GPtrArray *sources;
 	GsApp *app;
+	GsPluginPackagekitJoin *join = NULL;
+	GsPluginPackagekitJoin *join_first = NULL;
+	GsPluginPackagekitStage *stage_desktop = NULL;
+	GsPluginPackagekitStage *stage_details = NULL;
+	GsPluginPackagekitStage *stage_repos = NULL;
+	GsPluginPackagekitStage *stage_resolve = NULL;
+	GsPluginPackagekitStage *stage_severity = NULL;
+	GsPluginPackagekitStage *stage_updatedetails = NULL;
 	const gchar *tmp;
 	gboolean ret = TRUE;
+	gboolean updates_wait = FALSE;
+	guint generation = 0;
+	guint i;
+	g_autoptr(GList) desktop_all = NULL;
+	g_autoptr(GList) details_all = NULL;
+	g_autoptr(GHashTable) resolve_set = NULL;
 	g_autoptr(GList) resolve_all = NULL;
+	g_autoptr(GList) resolve_cached = NULL;
+	g_autoptr(GList) resolve_missing = NULL;
+	g_autoptr(GPtrArray) packages_cached = NULL;
 	g_autoptr(GList) updatedetails_all = NULL;
+	g_autoptr(GHashTable) repos = NULL;
+	g_autoptr(GPtrArray) stages_upgrade = NULL;
+	g_autoptr(PkPackageSack) updates = NULL;
 	AsProfileTask *ptask = NULL;
 
+	/* first round */
+	ptask = as_profile_start_literal (plugin->profile, "packagekit-refine[name->id]");
+	join_first = gs_plugin_packagekit_join_new ();
+	generation = gs_plugin_packagekit_get_generation (plugin);
+
 	/* when we need the cannot-be-upgraded applications, we implement this
 	 * by doing a UpgradeSystem(SIMULATE) which adds the removed packages
 	 * to the related-apps list with a state of %AS_APP_STATE_AVAILABLE */
+	stages_upgrade = g_ptr_array_new ();
 	if (flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPGRADE_REMOVED) {
 		for (l = *list; l != NULL; l = l->next) {
 			app = GS_APP (l->data);
 			if (gs_app_get_kind (app) != GS_APP_KIND_DISTRO_UPGRADE)
 				continue;
-			if (!gs_plugin_packagekit_refine_distro_upgrade (plugin,
-									 app,
-									 cancellable,
-									 error))
-				return FALSE;
+			g_ptr_array_add (stages_upgrade,
+					 gs_plugin_packagekit_refine_distro_upgrade_start (plugin,
+											   app,
+											   join_first,
+											   cancellable));
 		}
 	}
 
 	/* get the repo_id -> repo_name mapping set up */
+	repos = gs_plugin_packagekit_cache_get_sources (plugin);
 	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN) > 0 &&
-	     g_hash_table_size (plugin->priv->sources) == 0) {
-		ret = gs_plugin_packagekit_get_source_list (plugin,
-							    cancellable,
-							    error);
-		if (!ret)
-			goto out;
+	    repos == NULL) {
+		stage_repos = gs_plugin_packagekit_get_source_list_start (plugin,
+									  join_first,
+									  cancellable);
 	}
 
 	/* can we resolve in one go? */
-	ptask = as_profile_start_literal (plugin->profile, "packagekit-refine[name->id]");
+	resolve_set = g_hash_table_new (g_direct_hash, g_direct_equal);
 	for (l = *list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
 		if (gs_app_get_id_kind (app) == AS_ID_KIND_WEB_APP)
@@ -932,43 +1750,146 @@ gs_plugin_refine (GsPlugin *plugin,
 		    gs_plugin_refine_requires_origin (app, flags) ||
 		    gs_plugin_refine_requires_version (app, flags)) {
 			resolve_all = g_list_prepend (resolve_all, app);
+			g_hash_table_add (resolve_set, app);
 		}
 	}
+
+	/* only ask PackageKit about the names not in the cache */
+	packages_cached = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	if (resolve_all != NULL) {
+		resolve_missing = gs_plugin_packagekit_resolve_cache_lookup (plugin,
+									     resolve_all,
+									     packages_cached,
+									     &resolve_cached);
+	}
+	if (resolve_missing != NULL) {
+		stage_resolve = gs_plugin_packagekit_resolve_packages_start (plugin,
+									     resolve_missing,
+									     join_first,
+									     cancellable);
+	}
+
+	/* set the package-id for an installed desktop file, the apps being
+	 * resolved are only searched for if that does not find a package */
+	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION) > 0) {
+		for (l = *list; l != NULL; l = l->next) {
+			app = GS_APP (l->data);
+			if (gs_app_get_source_id_default (app) != NULL)
+				continue;
+			if (g_hash_table_contains (resolve_set, app))
+				continue;
+			tmp = gs_app_get_metadata_item (app, "DataDir::desktop-filename");
+			if (tmp == NULL)
+				continue;
+			desktop_all = g_list_prepend (desktop_all, app);
+		}
+	}
+	if (desktop_all != NULL) {
+		stage_desktop = gs_plugin_packagekit_refine_from_desktop_start (plugin,
+										desktop_all,
+										join_first,
+										cancellable);
+	}
+
+	/* the list of updates does not depend on the package-ids, and is
+	 * shared with any other refine already getting it */
+	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY) > 0)
+		updates = gs_plugin_packagekit_cache_get_updates (plugin, &updates_wait);
+	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY) > 0 &&
+	    updates == NULL && !updates_wait) {
+		stage_severity = gs_plugin_packagekit_refine_update_severity_start (plugin,
+										    join_first,
+										    cancellable);
+	}
+
+	/* process in the same order as the stages used to run; the join is
+	 * kept until the end as the update severity is processed last */
+	gs_plugin_packagekit_join_wait (join_first);
+	for (i = 0; i < stages_upgrade->len; i++) {
+		ret = gs_plugin_packagekit_refine_distro_upgrade (plugin,
+								  g_ptr_array_index (stages_upgrade, i),
+								  error);
+		if (!ret)
+			goto out;
+	}
+	if (stage_repos != NULL) {
+		repos = gs_plugin_packagekit_get_source_list (plugin, stage_repos,
+							      generation, error);
+		if (repos == NULL) {
+			ret = FALSE;
+			goto out;
+		}
+	}
+	if (resolve_cached != NULL) {
+		gs_plugin_packagekit_resolve_packages_array (plugin,
+							     repos,
+							     resolve_cached,
+							     packages_cached);
+	}
+	if (stage_resolve != NULL) {
 		ret = gs_plugin_packagekit_resolve_packages (plugin,
-							     resolve_all,
-							     cancellable,
+							     repos,
+							     resolve_missing,
+							     stage_resolve,
+							     generation,
 							     error);
 		if (!ret)
 			goto out;
+		gs_plugin_packagekit_resolve_cache_save (plugin, FALSE);
+	}
+	if (stage_desktop != NULL) {
+		ret = gs_plugin_packagekit_refine_from_desktop (plugin,
+								repos,
+								desktop_all,
+								stage_desktop,
+								cancellable,
+								error);
+		if (!ret)
+			goto out;
 	}
-	as_profile_task_free (ptask);
+	g_clear_pointer (&ptask, as_profile_task_free);
 
-	/* set the package-id for an installed desktop file */
+	/* second round, only if resolving did not find a package */
 	ptask = as_profile_start_literal (plugin->profile,
 					  "packagekit-refine[desktop-filename->id]");
-	for (l = *list; l != NULL; l = l->next) {
-		if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION) == 0)
-			continue;
-		app = GS_APP (l->data);
-		if (gs_app_get_source_id_default (app) != NULL)
-			continue;
-		tmp = gs_app_get_metadata_item (app, "DataDir::desktop-filename");
-		if (tmp == NULL)
-			continue;
+	g_clear_pointer (&desktop_all, g_list_free);
+	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION) > 0) {
+		for (l = resolve_all; l != NULL; l = l->next) {
+			app = GS_APP (l->data);
+			if (gs_app_get_source_id_default (app) != NULL)
+				continue;
+			tmp = gs_app_get_metadata_item (app, "DataDir::desktop-filename");
+			if (tmp == NULL)
+				continue;
+			desktop_all = g_list_prepend (desktop_all, app);
+		}
+	}
+	if (desktop_all != NULL) {
+		join = gs_plugin_packagekit_join_new ();
+		stage_desktop = gs_plugin_packagekit_refine_from_desktop_start (plugin,
+										desktop_all,
+										join,
+										cancellable);
+		gs_plugin_packagekit_join_wait (join);
 		ret = gs_plugin_packagekit_refine_from_desktop (plugin,
-								app,
-								tmp,
+								repos,
+								desktop_all,
+								stage_desktop,
 								cancellable,
 								error);
 		if (!ret)
 			goto out;
+		gs_plugin_packagekit_join_free (join);
+		join = NULL;
 	}
-	as_profile_task_free (ptask);
+	g_clear_pointer (&ptask, as_profile_task_free);
 
-	/* any update details missing? */
+	/* third round */
 	ptask = as_profile_start_literal (plugin->profile,
-					  "packagekit-refine[id->update-details]");
+					  "packagekit-refine[id->details]");
+	join = gs_plugin_packagekit_join_new ();
+
+	/* any update details missing? */
 	for (l = *list; l != NULL; l = l->next) {
 		app = GS_APP (l->data);
 		if (gs_app_get_state (app) != AS_APP_STATE_UPDATABLE)
@@ -977,37 +1898,75 @@ gs_plugin_refine (GsPlugin *plugin,
 			updatedetails_all = g_list_prepend (updatedetails_all, app);
 	}
 	if (updatedetails_all != NULL) {
-		ret = gs_plugin_packagekit_refine_updatedetails (plugin,
-								 updatedetails_all,
-								 cancellable,
-								 error);
-		if (!ret)
-			goto out;
+		stage_updatedetails = gs_plugin_packagekit_refine_updatedetails_start (plugin,
+											updatedetails_all,
+											join,
+											cancellable);
 	}
-	as_profile_task_free (ptask);
 
 	/* any important details missing? */
 	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENCE) > 0 ||
 	    (flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL) > 0 ||
 	    (flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE) > 0 ||
 	    (flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION) > 0) {
-		ret = gs_plugin_refine_require_details (plugin,
-							*list,
-							cancellable,
-							error);
+		details_all = gs_plugin_refine_require_details (plugin, *list);
+	}
+	if (details_all != NULL) {
+		stage_details = gs_plugin_packagekit_refine_details_start (plugin,
+									   details_all,
+									   join,
+									   cancellable);
+	}
+
+	gs_plugin_packagekit_join_wait (join);
+	if (stage_updatedetails != NULL) {
+		ret = gs_plugin_packagekit_refine_updatedetails (plugin,
+								 updatedetails_all,
+								 stage_updatedetails,
+								 error);
 		if (!ret)
 			goto out;
 	}
-
-	/* get the update severity */
-	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY) > 0) {
-		ret = gs_plugin_packagekit_refine_update_severity (plugin,
-								   *list,
-								   cancellable,
-								   error);
+	if (stage_details != NULL) {
+		ret = gs_plugin_packagekit_refine_details (plugin,
+							   details_all,
+							   stage_details,
+							   error);
 		if (!ret)
 			goto out;
 	}
+
+	/* get the update severity, now the package-ids are known */
+	if (stage_severity != NULL) {
+		updates = gs_plugin_packagekit_get_updates (plugin,
+							    stage_severity,
+							    generation,
+							    error);
+		if (updates == NULL) {
+			ret = FALSE;
+			goto out;
+		}
+	}
+	if (updates_wait) {
+		updates = gs_plugin_packagekit_wait_updates (plugin,
+							     generation,
+							     cancellable,
+							     error);
+		if (updates == NULL) {
+			ret = FALSE;
+			goto out;
+		}
+	}
+	if (updates != NULL)
+		gs_plugin_packagekit_refine_update_severity (plugin, *list, updates);
 out:
+	if (join != NULL)
+		gs_plugin_packagekit_join_free (join);
+	if (join_first != NULL)
+		gs_plugin_packagekit_join_free (join_first);
+	if (stage_severity != NULL)
+		gs_plugin_packagekit_cache_updates_done (plugin);
+	if (ptask != NULL)
+		as_profile_task_free (ptask);
 	return ret;
 }
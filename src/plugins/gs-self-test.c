@@ -22,11 +22,21 @@
 #include "config.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <glib-object.h>
 #include <gtk/gtk.h>
+#include <libsoup/soup.h>
+#include <sqlite3.h>
 
+#include "gs-appstream-cache.h"
+#include "gs-appstream-index.h"
+#include "gs-fedora-tagger-import.h"
+#include "gs-http-validators.h"
 #include "gs-moduleset.h"
+#include "gs-self-test-server.h"
+#include "packagekit-history.h"
+#include "packagekit-resolve-cache.h"
 
 static void
 moduleset_func (void)
@@ -64,6 +74,768 @@ moduleset_func (void)
 	g_assert_cmpstr (data[1], ==, NULL);
 }
 
+static void
+appstream_index_func (void)
+{
+	AsApp *app;
+	gchar *values_name[] = { "calc", NULL };
+	gchar *values_both[] = { "office", "calc", NULL };
+	gchar *values_field[] = { "spreadcalc", NULL };
+	gchar *values_short[] = { "ab", NULL };
+	gchar *values_none[] = { "gimp", NULL };
+	gchar *child_ids[] = { "Spreadsheet", NULL };
+	g_autoptr(GPtrArray) apps = NULL;
+	g_autoptr(GPtrArray) results = NULL;
+	g_autoptr(GsAppstreamIndex) app_index = NULL;
+
+	apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	app = as_app_new ();
+	as_app_set_id (app, "libreoffice-calc.desktop");
+	as_app_set_name (app, NULL, "LibreOffice Calc");
+	as_app_set_comment (app, NULL, "Spreadsheet");
+	as_app_add_category (app, "Office");
+	as_app_add_category (app, "Spreadsheet");
+	g_ptr_array_add (apps, app);
+	app = as_app_new ();
+	as_app_set_id (app, "gnome-calculator.desktop");
+	as_app_set_name (app, NULL, "Calculator");
+	as_app_add_keyword (app, NULL, "office");
+	as_app_add_category (app, "Office");
+	g_ptr_array_add (apps, app);
+
+	app_index = gs_appstream_index_new ();
+	gs_appstream_index_add_category_other (app_index, "Office", child_ids, "other");
+	gs_appstream_index_build (app_index, apps);
+	g_assert_cmpint (gs_appstream_index_get_size (app_index), ==, 2);
+
+	/* substring match in the name, in store order */
+	results = gs_appstream_index_search (app_index, values_name);
+	g_assert_cmpint (results->len, ==, 2);
+	g_assert (g_ptr_array_index (results, 0) == g_ptr_array_index (apps, 0));
+	g_ptr_array_unref (results);
+
+	/* each term can match a different field */
+	results = gs_appstream_index_search (app_index, values_both);
+	g_assert_cmpint (results->len, ==, 2);
+	g_ptr_array_unref (results);
+
+	/* a single term has to be found in one field */
+	results = gs_appstream_index_search (app_index, values_field);
+	g_assert_cmpint (results->len, ==, 0);
+	g_ptr_array_unref (results);
+
+	/* too short to look up, so everything is a candidate */
+	results = gs_appstream_index_search (app_index, values_short);
+	g_assert_cmpint (results->len, ==, 2);
+	g_ptr_array_unref (results);
+
+	results = gs_appstream_index_search (app_index, values_none);
+	g_assert_cmpint (results->len, ==, 0);
+	g_ptr_array_unref (results);
+
+	/* categories */
+	g_assert_cmpint (gs_appstream_index_get_category_size (app_index, "Office", NULL), ==, 2);
+	g_assert_cmpint (gs_appstream_index_get_category_size (app_index, "Spreadsheet", "Office"), ==, 1);
+	results = gs_appstream_index_get_category_apps (app_index, "Spreadsheet", "Office");
+	g_assert_cmpint (results->len, ==, 1);
+	g_assert (g_ptr_array_index (results, 0) == g_ptr_array_index (apps, 0));
+	g_ptr_array_unref (results);
+
+	/* apps in none of the subcategories are put in 'other' when the
+	 * index is built, without changing the apps */
+	g_assert_cmpint (gs_appstream_index_get_category_size (app_index, "other", "Office"), ==, 1);
+	results = gs_appstream_index_get_category_apps (app_index, "other", "Office");
+	g_assert_cmpint (results->len, ==, 1);
+	g_assert (g_ptr_array_index (results, 0) == g_ptr_array_index (apps, 1));
+	g_assert (!as_app_has_category (g_ptr_array_index (apps, 1), "other"));
+}
+
+typedef struct {
+	GsAppstreamIndex	*app_index;
+	gchar			**values;
+	guint			 expected;
+} GsSelfTestSearch;
+
+static gpointer
+gs_self_test_search_thread_cb (gpointer user_data)
+{
+	GsSelfTestSearch *search = (GsSelfTestSearch *) user_data;
+	guint i;
+	guint j;
+
+	for (i = 0; i < 50; i++) {
+		guint matched = 0;
+		g_autoptr(GPtrArray) results = NULL;
+		results = gs_appstream_index_search (search->app_index, search->values);
+		for (j = 0; j < results->len; j++) {
+			if (as_app_search_matches_all (g_ptr_array_index (results, j),
+						       search->values) > 0)
+				matched++;
+		}
+		if (matched != search->expected)
+			return GUINT_TO_POINTER (FALSE);
+	}
+	return GUINT_TO_POINTER (TRUE);
+}
+
+static void
+appstream_index_threads_func (void)
+{
+	AsApp *app;
+	GThread *threads[8];
+	GsSelfTestSearch search;
+	gchar *values[] = { "viewer", NULL };
+	guint i;
+	g_autoptr(GPtrArray) apps = NULL;
+	g_autoptr(GsAppstreamIndex) app_index = NULL;
+
+	/* every third app matches */
+	apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	for (i = 0; i < 300; i++) {
+		g_autofree gchar *id = g_strdup_printf ("app%03u.desktop", i);
+		g_autofree gchar *name = g_strdup_printf ("%s %u",
+							  i % 3 == 0 ? "Viewer" : "Editor", i);
+		app = as_app_new ();
+		as_app_set_id (app, id);
+		as_app_set_name (app, NULL, name);
+		as_app_set_comment (app, NULL, "Works with documents");
+		g_ptr_array_add (apps, app);
+	}
+	app_index = gs_appstream_index_new ();
+	gs_appstream_index_build (app_index, apps);
+
+	/* score the candidates from several threads at once, as each
+	 * search request does in the plugin */
+	search.app_index = app_index;
+	search.values = values;
+	search.expected = 100;
+	for (i = 0; i < G_N_ELEMENTS (threads); i++)
+		threads[i] = g_thread_new ("gs-self-test-search",
+					   gs_self_test_search_thread_cb,
+					   &search);
+	for (i = 0; i < G_N_ELEMENTS (threads); i++)
+		g_assert (GPOINTER_TO_UINT (g_thread_join (threads[i])));
+}
+
+static void
+appstream_cache_func (void)
+{
+	AsApp *app;
+	AsIcon *icon;
+	AsProvide *provide;
+	AsScreenshot *ss;
+	gboolean ret;
+	gchar *paths[] = { "/nonexistent", NULL };
+	gchar *paths_new[] = { "/nonexistent", "/nonexistent2", NULL };
+	g_autoptr(GError) error = NULL;
+	g_autoptr(AsStore) store = NULL;
+	g_autoptr(AsStore) store_cache = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GPtrArray) changed = NULL;
+	g_autoptr(GVariant) stamps = NULL;
+	g_autoptr(GVariant) stamps_new = NULL;
+	g_autofree gchar *fn = NULL;
+	g_autofree gchar *fn_source = NULL;
+	gchar *paths_source[] = { NULL, NULL };
+
+	store = as_store_new ();
+	app = as_app_new ();
+	as_app_set_id (app, "gnome-calculator.desktop");
+	as_app_set_source_kind (app, AS_APP_SOURCE_KIND_DESKTOP);
+	as_app_set_name (app, NULL, "Calculator");
+	as_app_set_developer_name (app, NULL, "The GNOME Project");
+	as_app_add_keyword (app, NULL, "fedora");
+	as_app_add_category (app, "Utility");
+	provide = as_provide_new ();
+	as_provide_set_kind (provide, AS_PROVIDE_KIND_BINARY);
+	as_provide_set_value (provide, "gnome-calculator");
+	as_app_add_provide (app, provide);
+	g_object_unref (provide);
+	ss = as_screenshot_new ();
+	as_screenshot_set_caption (ss, "C", "Adding numbers");
+	as_app_add_screenshot (app, ss);
+	g_object_unref (ss);
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 16, 16);
+	gdk_pixbuf_fill (pixbuf, 0xff0000ff);
+	icon = as_icon_new ();
+	as_icon_set_kind (icon, AS_ICON_KIND_EMBEDDED);
+	as_icon_set_name (icon, "gnome-calculator.png");
+	as_icon_set_pixbuf (icon, pixbuf);
+	as_app_add_icon (app, icon);
+	g_object_unref (icon);
+	as_store_add_app (store, app);
+	g_object_unref (app);
+
+	/* save and load */
+	fn = g_build_filename (g_get_tmp_dir (), "gs-self-test-appstream.cache", NULL);
+	stamps = gs_appstream_cache_get_stamps (paths);
+	ret = gs_appstream_cache_save (store, fn, "C", stamps, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	store_cache = as_store_new ();
+	ret = gs_appstream_cache_load (store_cache, fn, "C", stamps, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	app = as_store_get_app_by_id (store_cache, "gnome-calculator.desktop");
+	g_assert (app != NULL);
+	g_assert_cmpint (as_app_get_source_kind (app), ==, AS_APP_SOURCE_KIND_DESKTOP);
+	g_assert_cmpstr (as_app_get_name (app, "C"), ==, "Calculator");
+	g_assert_cmpstr (g_ptr_array_index (as_app_get_keywords (app, "C"), 0), ==, "fedora");
+	g_assert (as_app_has_category (app, "Utility"));
+	g_assert_cmpstr (as_app_get_developer_name (app, "C"), ==, "The GNOME Project");
+	provide = g_ptr_array_index (as_app_get_provides (app), 0);
+	g_assert_cmpint (as_provide_get_kind (provide), ==, AS_PROVIDE_KIND_BINARY);
+	g_assert_cmpstr (as_provide_get_value (provide), ==, "gnome-calculator");
+	ss = g_ptr_array_index (as_app_get_screenshots (app), 0);
+	g_assert_cmpstr (as_screenshot_get_caption (ss, "C"), ==, "Adding numbers");
+	icon = as_app_get_icon_default (app);
+	g_assert (icon != NULL);
+	g_assert_cmpint (as_icon_get_kind (icon), ==, AS_ICON_KIND_EMBEDDED);
+	g_assert (as_icon_get_pixbuf (icon) != NULL);
+	g_assert_cmpint (gdk_pixbuf_get_width (as_icon_get_pixbuf (icon)), ==, 16);
+
+	/* different locale */
+	ret = gs_appstream_cache_load (store_cache, fn, "de", stamps, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* source files changed */
+	stamps_new = gs_appstream_cache_get_stamps (paths_new);
+	ret = gs_appstream_cache_load (store_cache, fn, "C", stamps_new, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* only the new path is reported */
+	changed = gs_appstream_cache_get_changed (stamps, stamps_new);
+	g_assert_cmpint (changed->len, ==, 1);
+	g_assert_cmpstr (g_ptr_array_index (changed, 0), ==, "/nonexistent2");
+	g_clear_pointer (&changed, g_ptr_array_unref);
+	g_clear_pointer (&stamps, g_variant_unref);
+	g_clear_pointer (&stamps_new, g_variant_unref);
+
+	/* a file replaced with the same size within the same second */
+	fn_source = g_build_filename (g_get_tmp_dir (), "gs-self-test-appstream.xml", NULL);
+	ret = g_file_set_contents (fn_source, "<components/>", -1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	paths_source[0] = fn_source;
+	stamps = gs_appstream_cache_get_stamps (paths_source);
+	ret = g_file_set_contents (fn_source, "<components/>", -1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	stamps_new = gs_appstream_cache_get_stamps (paths_source);
+	changed = gs_appstream_cache_get_changed (stamps, stamps_new);
+	g_assert_cmpint (changed->len, ==, 1);
+	g_assert_cmpstr (g_ptr_array_index (changed, 0), ==, fn_source);
+	g_unlink (fn_source);
+	g_unlink (fn);
+}
+
+static void
+packagekit_resolve_cache_func (void)
+{
+	GPtrArray *packages;
+	PkPackage *package_tmp;
+	gboolean ret;
+	const gchar *paths[] = { NULL, NULL };
+	g_autofree gchar *fn = NULL;
+	g_autofree gchar *fn_stamp = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) cache = NULL;
+	g_autoptr(GHashTable) cache2 = NULL;
+	g_autoptr(GHashTable) cache3 = NULL;
+	g_autoptr(PkPackage) package = NULL;
+	g_autoptr(GVariant) stamps = NULL;
+	g_autoptr(GVariant) stamps_new = NULL;
+
+	fn = g_build_filename (g_get_tmp_dir (), "gs-self-test-resolve.cache", NULL);
+	fn_stamp = g_build_filename (g_get_tmp_dir (), "gs-self-test-Packages", NULL);
+	ret = g_file_set_contents (fn_stamp, "installed", -1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	paths[0] = fn_stamp;
+
+	/* save one resolved package */
+	cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+				       g_free, (GDestroyNotify) g_ptr_array_unref);
+	package = pk_package_new ();
+	ret = pk_package_set_id (package, "gimp;2.8.16-1;x86_64;fedora", &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	pk_package_set_info (package, PK_INFO_ENUM_INSTALLED);
+	pk_package_set_summary (package, "GNU Image Manipulation Program");
+	packages = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	g_ptr_array_add (packages, g_object_ref (package));
+	g_hash_table_insert (cache, g_strdup ("gimp"), packages);
+	stamps = gs_packagekit_resolve_cache_get_stamps (paths);
+	ret = gs_packagekit_resolve_cache_save (cache, fn, stamps, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* reading the stamps again does not change them */
+	stamps_new = gs_packagekit_resolve_cache_get_stamps (paths);
+	cache2 = g_hash_table_new_full (g_str_hash, g_str_equal,
+					g_free, (GDestroyNotify) g_ptr_array_unref);
+	ret = gs_packagekit_resolve_cache_load (cache2, fn, stamps_new, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	packages = g_hash_table_lookup (cache2, "gimp");
+	g_assert (packages != NULL);
+	g_assert_cmpint (packages->len, ==, 1);
+	package_tmp = g_ptr_array_index (packages, 0);
+	g_assert_cmpstr (pk_package_get_id (package_tmp), ==, "gimp;2.8.16-1;x86_64;fedora");
+	g_assert_cmpint (pk_package_get_info (package_tmp), ==, PK_INFO_ENUM_INSTALLED);
+	g_assert_cmpstr (pk_package_get_summary (package_tmp), ==, "GNU Image Manipulation Program");
+
+	/* the package database changed */
+	ret = g_file_set_contents (fn_stamp, "installed and removed", -1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_variant_unref (stamps_new);
+	stamps_new = gs_packagekit_resolve_cache_get_stamps (paths);
+	cache3 = g_hash_table_new_full (g_str_hash, g_str_equal,
+					g_free, (GDestroyNotify) g_ptr_array_unref);
+	ret = gs_packagekit_resolve_cache_load (cache3, fn, stamps_new, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_assert_cmpint (g_hash_table_size (cache3), ==, 0);
+
+	g_unlink (fn);
+	g_unlink (fn_stamp);
+}
+
+static void
+packagekit_history_cache_func (void)
+{
+	gboolean ret;
+	g_autofree gchar *fn = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) cache = NULL;
+	g_autoptr(GHashTable) cache2 = NULL;
+	g_autoptr(GVariant) history = NULL;
+	g_autoptr(GVariant) history_tmp = NULL;
+
+	/* one package with one event */
+	history = g_variant_new_parsed ("[{'info': <@u 12>, "
+					"'timestamp': <@t 1454000000>, "
+					"'version': <'2.8.16-1'>}]");
+	g_variant_ref_sink (history);
+	cache = gs_packagekit_history_cache_new ();
+	gs_packagekit_history_cache_add (cache, "gimp",
+					 "gimp;2.8.16-1;x86_64;installed;installed",
+					 history);
+	gs_packagekit_history_cache_add (cache, "inkscape",
+					 "inkscape;0.91-1;x86_64;installed;installed",
+					 history);
+
+	/* survives a save and load */
+	fn = g_build_filename (g_get_tmp_dir (), "gs-self-test-history.cache", NULL);
+	ret = gs_packagekit_history_cache_save (cache, fn, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	cache2 = gs_packagekit_history_cache_new ();
+	ret = gs_packagekit_history_cache_load (cache2, fn, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* hit */
+	history_tmp = gs_packagekit_history_cache_lookup (cache2, "gimp",
+							  "gimp;2.8.16-1;x86_64;installed;installed");
+	g_assert (history_tmp != NULL);
+	g_assert (g_variant_equal (history_tmp, history));
+	g_clear_pointer (&history_tmp, g_variant_unref);
+
+	/* only the package that was updated is a miss */
+	history_tmp = gs_packagekit_history_cache_lookup (cache2, "gimp",
+							  "gimp;2.8.18-1;x86_64;installed;installed");
+	g_assert (history_tmp == NULL);
+	history_tmp = gs_packagekit_history_cache_lookup (cache2, "inkscape",
+							  "inkscape;0.91-1;x86_64;installed;installed");
+	g_assert (history_tmp != NULL);
+	g_clear_pointer (&history_tmp, g_variant_unref);
+
+	/* never fetched */
+	history_tmp = gs_packagekit_history_cache_lookup (cache2, "gedit", "");
+	g_assert (history_tmp == NULL);
+
+	g_unlink (fn);
+}
+
+/* a stand-in for the PackageKit history method, run in its own thread */
+typedef struct {
+	GMainContext	*context;
+	GMainLoop	*loop;
+	GThread		*thread;
+	GDBusConnection	*connection;
+	GDBusNodeInfo	*introspection;
+	guint		 registration;
+	gint		 calls;
+} GsSelfTestHistory;
+
+static const gchar gs_self_test_history_xml[] =
+	"<node>"
+	"  <interface name='org.freedesktop.PackageKit'>"
+	"    <method name='GetPackageHistory'>"
+	"      <arg type='as' name='names' direction='in'/>"
+	"      <arg type='u' name='count' direction='in'/>"
+	"      <arg type='a{saa{sv}}' name='history' direction='out'/>"
+	"    </method>"
+	"  </interface>"
+	"</node>";
+
+static gboolean
+gs_self_test_history_reply_cb (gpointer user_data)
+{
+	GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
+	g_dbus_method_invocation_return_value (g_object_ref (invocation),
+					       g_variant_new_parsed ("(@a{saa{sv}} {},)"));
+	return G_SOURCE_REMOVE;
+}
+
+static void
+gs_self_test_history_method_cb (GDBusConnection *connection,
+				const gchar *sender,
+				const gchar *object_path,
+				const gchar *interface_name,
+				const gchar *method_name,
+				GVariant *parameters,
+				GDBusMethodInvocation *invocation,
+				gpointer user_data)
+{
+	GsSelfTestHistory *helper = (GsSelfTestHistory *) user_data;
+	GVariantBuilder builder;
+	guint i;
+	g_autofree const gchar **names = NULL;
+
+	g_atomic_int_inc (&helper->calls);
+	g_variant_get (parameters, "(^a&su)", &names, NULL);
+
+	/* the reply for this chunk is only sent after the client gave up */
+	if (g_strv_contains ((const gchar * const *) names, "gs-self-test-slow")) {
+		g_autoptr(GSource) source = g_timeout_source_new (1000);
+		g_source_set_callback (source,
+				       gs_self_test_history_reply_cb,
+				       g_object_ref (invocation),
+				       g_object_unref);
+		g_source_attach (source, helper->context);
+		return;
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{saa{sv}}"));
+	for (i = 0; names[i] != NULL; i++) {
+		g_variant_builder_add_parsed (&builder,
+					      "{%s, [{'info': <@u 12>, "
+					      "'timestamp': <@t 1454000000>, "
+					      "'version': <'1.0-1'>}]}",
+					      names[i]);
+	}
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_new ("(a{saa{sv}})", &builder));
+}
+
+static const GDBusInterfaceVTable gs_self_test_history_vtable = {
+	gs_self_test_history_method_cb,
+	NULL,
+	NULL
+};
+
+static gpointer
+gs_self_test_history_thread_cb (gpointer user_data)
+{
+	GsSelfTestHistory *helper = (GsSelfTestHistory *) user_data;
+	g_main_context_push_thread_default (helper->context);
+	g_main_loop_run (helper->loop);
+	g_main_context_pop_thread_default (helper->context);
+	return NULL;
+}
+
+static void
+gs_self_test_history_start (GsSelfTestHistory *helper, const gchar *address)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) reply = NULL;
+
+	helper->introspection = g_dbus_node_info_new_for_xml (gs_self_test_history_xml,
+							      &error);
+	g_assert_no_error (error);
+	helper->context = g_main_context_new ();
+	helper->loop = g_main_loop_new (helper->context, FALSE);
+
+	/* the methods are dispatched in the context of the thread */
+	g_main_context_push_thread_default (helper->context);
+	helper->connection = g_dbus_connection_new_for_address_sync (address,
+								     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+								     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+								     NULL, NULL, &error);
+	g_assert_no_error (error);
+	helper->registration = g_dbus_connection_register_object (helper->connection,
+								  "/org/freedesktop/PackageKit",
+								  helper->introspection->interfaces[0],
+								  &gs_self_test_history_vtable,
+								  helper, NULL, &error);
+	g_assert_no_error (error);
+	g_main_context_pop_thread_default (helper->context);
+
+	/* own the name before any client asks for it */
+	reply = g_dbus_connection_call_sync (helper->connection,
+					     "org.freedesktop.DBus",
+					     "/org/freedesktop/DBus",
+					     "org.freedesktop.DBus",
+					     "RequestName",
+					     g_variant_new ("(su)",
+							    "org.freedesktop.PackageKit",
+							    G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE),
+					     G_VARIANT_TYPE ("(u)"),
+					     G_DBUS_CALL_FLAGS_NONE,
+					     -1, NULL, &error);
+	g_assert_no_error (error);
+	helper->thread = g_thread_new ("gs-self-test-history",
+				       gs_self_test_history_thread_cb,
+				       helper);
+}
+
+static void
+gs_self_test_history_stop (GsSelfTestHistory *helper)
+{
+	g_main_loop_quit (helper->loop);
+	g_thread_join (helper->thread);
+	g_dbus_connection_unregister_object (helper->connection,
+					     helper->registration);
+	g_dbus_connection_close_sync (helper->connection, NULL, NULL);
+	g_object_unref (helper->connection);
+	g_dbus_node_info_unref (helper->introspection);
+	g_main_loop_unref (helper->loop);
+	g_main_context_unref (helper->context);
+}
+
+static void
+packagekit_history_timeout_func (void)
+{
+	GsSelfTestHistory helper = { NULL };
+	GVariant *history;
+	gboolean ret;
+	const gchar *names_all[] = { "gimp", "inkscape",
+				     "gedit", "gnome-calculator",
+				     "gs-self-test-slow", "eog",
+				     "totem", NULL };
+	guint i;
+	g_autoptr(GDBusConnection) connection = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) results = NULL;
+	g_autoptr(GPtrArray) names = NULL;
+	g_autoptr(GTestDBus) bus = NULL;
+
+	bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_test_dbus_up (bus);
+	gs_self_test_history_start (&helper, g_test_dbus_get_bus_address (bus));
+	connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+							     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+							     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+							     NULL, NULL, &error);
+	g_assert_no_error (error);
+	names = g_ptr_array_new ();
+	results = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 g_free, (GDestroyNotify) g_variant_unref);
+
+	/* every chunk replies in time */
+	for (i = 0; i < 4; i++)
+		g_ptr_array_add (names, (gpointer) names_all[i]);
+	ret = gs_packagekit_history_fetch (connection, names, results,
+					   2, 5000, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (g_atomic_int_get (&helper.calls), ==, 2);
+	g_assert_cmpint (g_hash_table_size (results), ==, 4);
+	history = g_hash_table_lookup (results, "gnome-calculator");
+	g_assert (history != NULL);
+	g_assert_cmpint (g_variant_n_children (history), ==, 1);
+
+	/* the third chunk is too slow, so the fourth is never asked for */
+	g_hash_table_remove_all (results);
+	g_atomic_int_set (&helper.calls, 0);
+	g_ptr_array_set_size (names, 0);
+	for (i = 0; names_all[i] != NULL; i++)
+		g_ptr_array_add (names, (gpointer) names_all[i]);
+	ret = gs_packagekit_history_fetch (connection, names, results,
+					   2, 200, NULL, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+	g_assert (!ret);
+	g_assert_cmpint (g_atomic_int_get (&helper.calls), ==, 3);
+	g_assert_cmpint (g_hash_table_size (results), ==, 4);
+	g_assert (!g_hash_table_contains (results, "eog"));
+	g_assert (!g_hash_table_contains (results, "totem"));
+
+	g_dbus_connection_close_sync (connection, NULL, NULL);
+	gs_self_test_history_stop (&helper);
+	g_test_dbus_down (bus);
+}
+
+typedef struct {
+	GString		*body;
+	const gchar	*etag;
+} GsSelfTestResponse;
+
+static void
+gs_self_test_response_cb (SoupServer *server,
+			  SoupMessage *msg,
+			  const char *path,
+			  GHashTable *query,
+			  SoupClientContext *client,
+			  gpointer user_data)
+{
+	GsSelfTestResponse *response = (GsSelfTestResponse *) user_data;
+	const gchar *tmp;
+
+	if (response->etag != NULL) {
+		soup_message_headers_replace (msg->response_headers,
+					      "ETag", response->etag);
+		tmp = soup_message_headers_get_one (msg->request_headers,
+						    "If-None-Match");
+		if (g_strcmp0 (tmp, response->etag) == 0) {
+			soup_message_set_status (msg, SOUP_STATUS_NOT_MODIFIED);
+			return;
+		}
+	}
+	soup_message_set_response (msg, "text/plain", SOUP_MEMORY_COPY,
+				   response->body->str, response->body->len);
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+}
+
+static void
+fedora_tagger_import_func (void)
+{
+	GsSelfTestResponse response = { NULL };
+	GsSelfTestServer *server;
+	gboolean ret;
+	gint rc;
+	guint i;
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(SoupMessage) msg = NULL;
+	g_autoptr(SoupSession) session = NULL;
+
+	/* a large dump, with the average vote count being 5.5 */
+	response.body = g_string_new ("# pkgname\trating\tvote_count\tuser_count\n");
+	for (i = 0; i < 50000; i++) {
+		g_string_append_printf (response.body, "pkg%05u\t%u\t%u\t1\n",
+					i, i % 100, i % 10 + 1);
+	}
+	g_string_append (response.body, "invalid\tline\n\n");
+
+	/* serve it from a local stand-in server */
+	server = gs_self_test_server_new (gs_self_test_response_cb, &response);
+	uri = g_strdup_printf ("http://127.0.0.1:%u/api/v1/rating/dump/",
+			       gs_self_test_server_get_port (server));
+
+	/* same table as the fedora-tagger-ratings plugin */
+	rc = sqlite3_open (":memory:", &db);
+	g_assert_cmpint (rc, ==, SQLITE_OK);
+	rc = sqlite3_exec (db,
+			   "CREATE TABLE ratings ("
+			   "pkgname TEXT PRIMARY KEY,"
+			   "rating INTEGER DEFAULT 0,"
+			   "vote_count INTEGER DEFAULT 0,"
+			   "user_count INTEGER DEFAULT 0,"
+			   "confidence INTEGER DEFAULT 0);",
+			   NULL, NULL, NULL);
+	g_assert_cmpint (rc, ==, SQLITE_OK);
+
+	/* stream the response into the database */
+	session = soup_session_new ();
+	msg = soup_message_new (SOUP_METHOD_GET, uri);
+	stream = soup_session_send (session, msg, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (stream != NULL);
+	g_assert_cmpint (msg->status_code, ==, SOUP_STATUS_OK);
+	ret = gs_fedora_tagger_import (db, stream, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* every valid line was added */
+	rc = sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM ratings;", -1, &stmt, NULL);
+	g_assert_cmpint (rc, ==, SQLITE_OK);
+	g_assert_cmpint (sqlite3_step (stmt), ==, SQLITE_ROW);
+	g_assert_cmpint (sqlite3_column_int (stmt, 0), ==, 50000);
+	sqlite3_finalize (stmt);
+
+	/* with the confidence from the average vote count */
+	rc = sqlite3_prepare_v2 (db,
+				 "SELECT rating, vote_count, confidence FROM ratings "
+				 "WHERE pkgname = 'pkg00009';",
+				 -1, &stmt, NULL);
+	g_assert_cmpint (rc, ==, SQLITE_OK);
+	g_assert_cmpint (sqlite3_step (stmt), ==, SQLITE_ROW);
+	g_assert_cmpint (sqlite3_column_int (stmt, 0), ==, 9);
+	g_assert_cmpint (sqlite3_column_int (stmt, 1), ==, 10);
+	g_assert_cmpint (sqlite3_column_int (stmt, 2), ==, 182);
+	sqlite3_finalize (stmt);
+	sqlite3_close (db);
+
+	gs_self_test_server_free (server);
+	g_string_free (response.body, TRUE);
+}
+
+static void
+http_validators_func (void)
+{
+	GsSelfTestResponse response = { NULL };
+	GsSelfTestServer *server;
+	gboolean ret;
+	guint status_code;
+	g_autofree gchar *fn = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SoupMessage) msg1 = NULL;
+	g_autoptr(SoupMessage) msg2 = NULL;
+	g_autoptr(SoupMessage) msg3 = NULL;
+	g_autoptr(SoupSession) session = NULL;
+
+	/* serve a resource with an ETag from a local stand-in server */
+	response.body = g_string_new ("payload");
+	response.etag = "\"v1\"";
+	server = gs_self_test_server_new (gs_self_test_response_cb, &response);
+	uri = g_strdup_printf ("http://127.0.0.1:%u/firmware.xml.gz",
+			       gs_self_test_server_get_port (server));
+	fn = g_build_filename (g_get_tmp_dir (), "gs-self-test.validators", NULL);
+	g_unlink (fn);
+	session = soup_session_new ();
+
+	/* nothing saved, so the body is sent */
+	msg1 = soup_message_new (SOUP_METHOD_GET, uri);
+	gs_http_validators_add (msg1, fn);
+	status_code = soup_session_send_message (session, msg1);
+	g_assert_cmpint (status_code, ==, SOUP_STATUS_OK);
+	g_assert_cmpint (msg1->response_body->length, ==, 7);
+	ret = gs_http_validators_save (msg1, fn, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* unchanged, so no body */
+	msg2 = soup_message_new (SOUP_METHOD_GET, uri);
+	gs_http_validators_add (msg2, fn);
+	status_code = soup_session_send_message (session, msg2);
+	g_assert_cmpint (status_code, ==, SOUP_STATUS_NOT_MODIFIED);
+	g_assert_cmpint (msg2->response_body->length, ==, 0);
+
+	/* changed on the server, so the body is sent again */
+	response.etag = "\"v2\"";
+	msg3 = soup_message_new (SOUP_METHOD_GET, uri);
+	gs_http_validators_add (msg3, fn);
+	status_code = soup_session_send_message (session, msg3);
+	g_assert_cmpint (status_code, ==, SOUP_STATUS_OK);
+	g_assert_cmpint (msg3->response_body->length, ==, 7);
+	g_assert_cmpint (gs_self_test_server_get_requests (server), ==, 3);
+	g_unlink (fn);
+
+	gs_self_test_server_free (server);
+	g_string_free (response.body, TRUE);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -76,6 +848,14 @@ main (int argc, char **argv)
 
 	/* tests go here */
 	g_test_add_func ("/moduleset", moduleset_func);
+	g_test_add_func ("/appstream-index", appstream_index_func);
+	g_test_add_func ("/appstream-index{threads}", appstream_index_threads_func);
+	g_test_add_func ("/appstream-cache", appstream_cache_func);
+	g_test_add_func ("/packagekit-resolve-cache", packagekit_resolve_cache_func);
+	g_test_add_func ("/packagekit-history-cache", packagekit_history_cache_func);
+	g_test_add_func ("/packagekit-history{timeout}", packagekit_history_timeout_func);
+	g_test_add_func ("/fedora-tagger-import", fedora_tagger_import_func);
+	g_test_add_func ("/http-validators", http_validators_func);
 
 	return g_test_run ();
 }
@@ -0,0 +1,265 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "config.h"
+
+#include "packagekit-history.h"
+
+/*
+ * The cache maps a package name to the history GetPackageHistory()
+ * returned for it, along with a key the caller makes from the state of
+ * the package, e.g. the package-id and whether it is installed. An entry
+ * is only used while the key is the same, so installing, updating or
+ * removing a package only invalidates the history of that package.
+ */
+
+#define GS_PACKAGEKIT_HISTORY_CACHE_VERSION	3
+#define GS_PACKAGEKIT_HISTORY_CACHE_FORMAT	"(ua{s(saa{sv})})"
+
+/**
+ * gs_packagekit_history_cache_new:
+ *
+ * Returns: (transfer full): a #GHashTable for the other cache functions
+ **/
+GHashTable *
+gs_packagekit_history_cache_new (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal,
+				      g_free, (GDestroyNotify) g_variant_unref);
+}
+
+/**
+ * gs_packagekit_history_cache_lookup:
+ * @cache: a #GHashTable from gs_packagekit_history_cache_new()
+ * @name: a package name
+ * @key: the current key of the package
+ *
+ * Returns: (transfer full): the history of type aa{sv}, or %NULL if it
+ * is not cached or was cached with a different key
+ **/
+GVariant *
+gs_packagekit_history_cache_lookup (GHashTable *cache,
+				    const gchar *name,
+				    const gchar *key)
+{
+	GVariant *value;
+	const gchar *key_old;
+	GVariant *history;
+
+	value = g_hash_table_lookup (cache, name);
+	if (value == NULL)
+		return NULL;
+	g_variant_get (value, "(&s@aa{sv})", &key_old, &history);
+	if (g_strcmp0 (key_old, key) != 0) {
+		g_variant_unref (history);
+		return NULL;
+	}
+	return history;
+}
+
+/**
+ * gs_packagekit_history_cache_add:
+ * @cache: a #GHashTable from gs_packagekit_history_cache_new()
+ * @name: a package name
+ * @key: the current key of the package
+ * @history: the history of type aa{sv}
+ *
+ * Adds or replaces the history of a package.
+ **/
+void
+gs_packagekit_history_cache_add (GHashTable *cache,
+				 const gchar *name,
+				 const gchar *key,
+				 GVariant *history)
+{
+	GVariant *value;
+
+	value = g_variant_new ("(s@aa{sv})", key, history);
+	g_hash_table_insert (cache, g_strdup (name), g_variant_ref_sink (value));
+}
+
+/**
+ * gs_packagekit_history_cache_load:
+ * @cache: a #GHashTable from gs_packagekit_history_cache_new()
+ * @filename: the cache file
+ * @error: a #GError, or %NULL
+ *
+ * Adds the entries in @filename to @cache.
+ *
+ * Returns: %TRUE if the cache was loaded
+ **/
+gboolean
+gs_packagekit_history_cache_load (GHashTable *cache,
+				  const gchar *filename,
+				  GError **error)
+{
+	GVariantIter iter;
+	GVariant *value;
+	const gchar *name;
+	gchar *data = NULL;
+	gsize len;
+	guint32 version;
+	g_autoptr(GVariant) entries = NULL;
+	g_autoptr(GVariant) variant = NULL;
+
+	if (!g_file_get_contents (filename, &data, &len, error))
+		return FALSE;
+	variant = g_variant_new_from_data (G_VARIANT_TYPE (GS_PACKAGEKIT_HISTORY_CACHE_FORMAT),
+					   data, len, FALSE, g_free, data);
+	g_variant_ref_sink (variant);
+	g_variant_get (variant, "(u@a{s(saa{sv})})", &version, &entries);
+	if (version != GS_PACKAGEKIT_HISTORY_CACHE_VERSION) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "cache version %u, expected %u",
+			     version, (guint) GS_PACKAGEKIT_HISTORY_CACHE_VERSION);
+		return FALSE;
+	}
+	g_variant_iter_init (&iter, entries);
+	while (g_variant_iter_next (&iter, "{&s@(saa{sv})}", &name, &value))
+		g_hash_table_insert (cache, g_strdup (name), value);
+	return TRUE;
+}
+
+/**
+ * gs_packagekit_history_cache_save:
+ * @cache: a #GHashTable from gs_packagekit_history_cache_new()
+ * @filename: the cache file
+ * @error: a #GError, or %NULL
+ *
+ * Saves @cache to @filename.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_packagekit_history_cache_save (GHashTable *cache,
+				  const gchar *filename,
+				  GError **error)
+{
+	GHashTableIter iter;
+	GVariantBuilder builder;
+	gpointer key;
+	gpointer value;
+	g_autoptr(GVariant) variant = NULL;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(saa{sv})}"));
+	g_hash_table_iter_init (&iter, cache);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_variant_builder_add (&builder, "{s@(saa{sv})}",
+				       (const gchar *) key, (GVariant *) value);
+	}
+	variant = g_variant_new (GS_PACKAGEKIT_HISTORY_CACHE_FORMAT,
+				 (guint32) GS_PACKAGEKIT_HISTORY_CACHE_VERSION,
+				 &builder);
+	g_variant_ref_sink (variant);
+	return g_file_set_contents (filename,
+				    g_variant_get_data (variant),
+				    (gssize) g_variant_get_size (variant),
+				    error);
+}
+
+/**
+ * gs_packagekit_history_fetch:
+ * @connection: a #GDBusConnection to the system bus
+ * @names: (element-type utf8): package names
+ * @results: a #GHashTable of package name to a #GVariant of type aa{sv}
+ * @chunk_size: the most packages to ask for in one call
+ * @timeout: the timeout in ms for all the calls together
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: a #GError, or %NULL
+ *
+ * Asks PackageKit for the history of @names in chunks of @chunk_size, and
+ * adds it to @results. Packages without any history get an empty array.
+ *
+ * All the calls share one deadline, so a slow daemon delays the refine by
+ * at most @timeout. The first chunk that does not finish in time stops
+ * the fetch with %G_IO_ERROR_TIMED_OUT, and @results then only has the
+ * chunks that finished before it.
+ *
+ * Returns: %TRUE if the history of every package was added
+ **/
+gboolean
+gs_packagekit_history_fetch (GDBusConnection *connection,
+			     GPtrArray *names,
+			     GHashTable *results,
+			     guint chunk_size,
+			     guint timeout,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	gint64 deadline;
+	gint64 remaining;
+	guint i;
+	guint j;
+
+	deadline = g_get_monotonic_time () + (gint64) timeout * 1000;
+	for (i = 0; i < names->len; i += chunk_size) {
+		const gchar *name;
+		guint len = MIN (chunk_size, names->len - i);
+		g_autofree const gchar **package_names = NULL;
+		g_autoptr(GVariant) result = NULL;
+		g_autoptr(GVariant) tuple = NULL;
+
+		/* the deadline may have passed while the previous chunk was
+		 * still being added */
+		remaining = (deadline - g_get_monotonic_time ()) / 1000;
+		if (remaining <= 0) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_TIMED_OUT,
+				     "No time left for %u packages",
+				     names->len - i);
+			return FALSE;
+		}
+
+		package_names = g_new0 (const gchar *, len + 1);
+		for (j = 0; j < len; j++)
+			package_names[j] = g_ptr_array_index (names, i + j);
+		g_debug ("getting history for %u packages", len);
+		result = g_dbus_connection_call_sync (connection,
+						      "org.freedesktop.PackageKit",
+						      "/org/freedesktop/PackageKit",
+						      "org.freedesktop.PackageKit",
+						      "GetPackageHistory",
+						      g_variant_new ("(^asu)", package_names, 0),
+						      G_VARIANT_TYPE ("(a{saa{sv}})"),
+						      G_DBUS_CALL_FLAGS_NONE,
+						      (gint) remaining,
+						      cancellable,
+						      error);
+		if (result == NULL)
+			return FALSE;
+
+		tuple = g_variant_get_child_value (result, 0);
+		for (j = 0; j < len; j++) {
+			GVariant *history = NULL;
+			name = package_names[j];
+			if (!g_variant_lookup (tuple, name, "@aa{sv}", &history)) {
+				history = g_variant_new_array (G_VARIANT_TYPE ("a{sv}"), NULL, 0);
+				g_variant_ref_sink (history);
+			}
+			g_hash_table_insert (results, g_strdup (name), history);
+		}
+	}
+	return TRUE;
+}
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __PACKAGEKIT_HISTORY_H
+#define __PACKAGEKIT_HISTORY_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+GHashTable	*gs_packagekit_history_cache_new	(void);
+GVariant	*gs_packagekit_history_cache_lookup	(GHashTable		*cache,
+							 const gchar		*name,
+							 const gchar		*key);
+void		 gs_packagekit_history_cache_add	(GHashTable		*cache,
+							 const gchar		*name,
+							 const gchar		*key,
+							 GVariant		*history);
+gboolean	 gs_packagekit_history_cache_load	(GHashTable		*cache,
+							 const gchar		*filename,
+							 GError			**error);
+gboolean	 gs_packagekit_history_cache_save	(GHashTable		*cache,
+							 const gchar		*filename,
+							 GError			**error);
+gboolean	 gs_packagekit_history_fetch		(GDBusConnection	*connection,
+							 GPtrArray		*names,
+							 GHashTable		*results,
+							 guint			 chunk_size,
+							 guint			 timeout,
+							 GCancellable		*cancellable,
+							 GError			**error);
+
+G_END_DECLS
+
+#endif /* __PACKAGEKIT_HISTORY_H */
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,315 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include "packagekit-resolve-cache.h"
+
+/*
+ * The cache maps a package name to the packages Resolve() returned for
+ * it, and is saved as a single GVariant. It is only loaded if the stamps
+ * of the package and repo databases still match the ones it was saved
+ * with, so the stamped files must only change when the installed
+ * packages or the repos do.
+ */
+
+#define GS_PACKAGEKIT_RESOLVE_CACHE_VERSION	1
+#define GS_PACKAGEKIT_RESOLVE_CACHE_FORMAT	"(ua(stt)a(ssus))"
+
+/**
+ * gs_packagekit_resolve_cache_add_stamp:
+ */
+static void
+gs_packagekit_resolve_cache_add_stamp (GVariantBuilder *builder, const gchar *filename)
+{
+	GStatBuf buf;
+
+	if (g_stat (filename, &buf) != 0) {
+		g_variant_builder_add (builder, "(stt)", filename,
+				       (guint64) 0, (guint64) 0);
+		return;
+	}
+	g_variant_builder_add (builder, "(stt)", filename,
+			       (guint64) buf.st_mtime,
+			       (guint64) buf.st_size);
+}
+
+/**
+ * gs_packagekit_resolve_cache_compare_cb:
+ */
+static gint
+gs_packagekit_resolve_cache_compare_cb (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*((const gchar **) a), *((const gchar **) b));
+}
+
+/**
+ * gs_packagekit_resolve_cache_get_children:
+ *
+ * Returns: the sorted paths in @path, as the order of g_dir_read_name()
+ * is not defined
+ */
+static GPtrArray *
+gs_packagekit_resolve_cache_get_children (const gchar *path)
+{
+	GPtrArray *children;
+	const gchar *tmp;
+	g_autoptr(GDir) dir = NULL;
+
+	children = g_ptr_array_new_with_free_func (g_free);
+	dir = g_dir_open (path, 0, NULL);
+	if (dir == NULL)
+		return children;
+	while ((tmp = g_dir_read_name (dir)) != NULL)
+		g_ptr_array_add (children, g_build_filename (path, tmp, NULL));
+	g_ptr_array_sort (children, gs_packagekit_resolve_cache_compare_cb);
+	return children;
+}
+
+/**
+ * gs_packagekit_resolve_cache_add_paths:
+ */
+static void
+gs_packagekit_resolve_cache_add_paths (GVariantBuilder *builder,
+				       const gchar * const *paths)
+{
+	guint i;
+	guint j;
+
+	for (i = 0; paths[i] != NULL; i++) {
+		g_autoptr(GPtrArray) children = NULL;
+		gs_packagekit_resolve_cache_add_stamp (builder, paths[i]);
+		children = gs_packagekit_resolve_cache_get_children (paths[i]);
+		for (j = 0; j < children->len; j++)
+			gs_packagekit_resolve_cache_add_stamp (builder, g_ptr_array_index (children, j));
+	}
+}
+
+/**
+ * gs_packagekit_resolve_cache_get_stamps:
+ * @paths: files or directories
+ *
+ * Gets the modification time and size of each of @paths, and of every
+ * file directly inside the ones that are directories.
+ *
+ * Returns: (transfer full): a #GVariant of type a(stt)
+ **/
+GVariant *
+gs_packagekit_resolve_cache_get_stamps (const gchar * const *paths)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stt)"));
+	gs_packagekit_resolve_cache_add_paths (&builder, paths);
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * gs_packagekit_resolve_cache_add_dirs:
+ *
+ * Adds the stamps of @path and of the directories below it, but not of
+ * the files. Downloading new metadata replaces files, which changes the
+ * directories they are in, while the backends rewrite some files in
+ * place, e.g. the solv caches, when the metadata is only read.
+ */
+static void
+gs_packagekit_resolve_cache_add_dirs (GVariantBuilder *builder,
+				      const gchar *path,
+				      guint depth)
+{
+	const gchar *fn;
+	guint i;
+	g_autoptr(GPtrArray) children = NULL;
+
+	gs_packagekit_resolve_cache_add_stamp (builder, path);
+	if (depth == 0)
+		return;
+	children = gs_packagekit_resolve_cache_get_children (path);
+	for (i = 0; i < children->len; i++) {
+		fn = g_ptr_array_index (children, i);
+		if (!g_file_test (fn, G_FILE_TEST_IS_DIR) ||
+		    g_file_test (fn, G_FILE_TEST_IS_SYMLINK))
+			continue;
+		gs_packagekit_resolve_cache_add_dirs (builder, fn, depth - 1);
+	}
+}
+
+/**
+ * gs_packagekit_get_package_db_stamps:
+ *
+ * Gets the stamps of the files of the common backends that are only
+ * written when packages are installed, reinstalled or removed, or repos
+ * are changed. The environment files next to the rpm database and the
+ * PackageKit transaction database change on plain reads, so are left out.
+ *
+ * The metadata caches of the backends are stamped too, as a refresh can
+ * make a newer package available without changing any of the files
+ * above; see gs_packagekit_resolve_cache_add_dirs() for how.
+ *
+ * Returns: (transfer full): a #GVariant of type a(stt)
+ **/
+GVariant *
+gs_packagekit_get_package_db_stamps (void)
+{
+	GVariantBuilder builder;
+	guint i;
+	const gchar *paths[] = { "/var/lib/rpm/Packages",
+				 "/var/lib/rpm/rpmdb.sqlite",
+				 "/var/lib/dpkg/status",
+				 "/var/lib/pacman/local",
+				 "/etc/yum.repos.d",
+				 "/etc/apt/sources.list",
+				 "/etc/apt/sources.list.d",
+				 NULL };
+	const gchar *metadata[] = { "/var/cache/PackageKit",
+				    "/var/cache/dnf",
+				    "/var/cache/yum",
+				    "/var/lib/apt/lists",
+				    "/var/lib/pacman/sync",
+				    NULL };
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stt)"));
+	gs_packagekit_resolve_cache_add_paths (&builder, paths);
+	for (i = 0; metadata[i] != NULL; i++)
+		gs_packagekit_resolve_cache_add_dirs (&builder, metadata[i], 4);
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * gs_packagekit_resolve_cache_load:
+ * @cache: a #GHashTable of name to a #GPtrArray of #PkPackage
+ * @filename: the cache file
+ * @stamps: the current stamps
+ * @error: a #GError, or %NULL
+ *
+ * Adds the packages in @filename to @cache, if it was saved with @stamps.
+ *
+ * Returns: %TRUE if the cache was loaded
+ **/
+gboolean
+gs_packagekit_resolve_cache_load (GHashTable *cache,
+				  const gchar *filename,
+				  GVariant *stamps,
+				  GError **error)
+{
+	GVariantIter iter;
+	const gchar *name;
+	const gchar *package_id;
+	const gchar *summary;
+	gchar *data = NULL;
+	gsize len;
+	guint32 info;
+	guint32 version;
+	g_autoptr(GVariant) entries = NULL;
+	g_autoptr(GVariant) stamps_old = NULL;
+	g_autoptr(GVariant) variant = NULL;
+
+	if (!g_file_get_contents (filename, &data, &len, error))
+		return FALSE;
+	variant = g_variant_new_from_data (G_VARIANT_TYPE (GS_PACKAGEKIT_RESOLVE_CACHE_FORMAT),
+					   data, len, FALSE, g_free, data);
+	g_variant_ref_sink (variant);
+	g_variant_get (variant, "(u@a(stt)@a(ssus))",
+		       &version, &stamps_old, &entries);
+	if (version != GS_PACKAGEKIT_RESOLVE_CACHE_VERSION) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "cache version %u, expected %u",
+			     version, (guint) GS_PACKAGEKIT_RESOLVE_CACHE_VERSION);
+		return FALSE;
+	}
+	if (!g_variant_equal (stamps, stamps_old)) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "package databases changed");
+		return FALSE;
+	}
+	g_variant_iter_init (&iter, entries);
+	while (g_variant_iter_next (&iter, "(&s&su&s)",
+				    &name, &package_id, &info, &summary)) {
+		GPtrArray *packages;
+		g_autoptr(PkPackage) package = pk_package_new ();
+		if (!pk_package_set_id (package, package_id, NULL))
+			continue;
+		pk_package_set_info (package, info);
+		pk_package_set_summary (package, summary);
+		packages = g_hash_table_lookup (cache, name);
+		if (packages == NULL) {
+			packages = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+			g_hash_table_insert (cache, g_strdup (name), packages);
+		}
+		g_ptr_array_add (packages, g_object_ref (package));
+	}
+	return TRUE;
+}
+
+/**
+ * gs_packagekit_resolve_cache_save:
+ * @cache: a #GHashTable of name to a #GPtrArray of #PkPackage
+ * @filename: the cache file
+ * @stamps: the current stamps
+ * @error: a #GError, or %NULL
+ *
+ * Saves @cache to @filename along with @stamps.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_packagekit_resolve_cache_save (GHashTable *cache,
+				  const gchar *filename,
+				  GVariant *stamps,
+				  GError **error)
+{
+	GHashTableIter iter;
+	GVariantBuilder builder;
+	gpointer key;
+	gpointer value;
+	guint i;
+	g_autoptr(GVariant) variant = NULL;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssus)"));
+	g_hash_table_iter_init (&iter, cache);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		GPtrArray *packages = value;
+		for (i = 0; i < packages->len; i++) {
+			PkPackage *package = g_ptr_array_index (packages, i);
+			g_variant_builder_add (&builder, "(ssus)",
+					       (const gchar *) key,
+					       pk_package_get_id (package),
+					       (guint32) pk_package_get_info (package),
+					       pk_package_get_summary (package) != NULL ?
+					       pk_package_get_summary (package) : "");
+		}
+	}
+	variant = g_variant_new (GS_PACKAGEKIT_RESOLVE_CACHE_FORMAT,
+				 (guint32) GS_PACKAGEKIT_RESOLVE_CACHE_VERSION,
+				 stamps, &builder);
+	g_variant_ref_sink (variant);
+	return g_file_set_contents (filename,
+				    g_variant_get_data (variant),
+				    (gssize) g_variant_get_size (variant),
+				    error);
+}
+
+/* vim: set noexpandtab: */
@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __PACKAGEKIT_RESOLVE_CACHE_H
+#define __PACKAGEKIT_RESOLVE_CACHE_H
+
+#include <glib.h>
+
+#define I_KNOW_THE_PACKAGEKIT_GLIB2_API_IS_SUBJECT_TO_CHANGE
+#include <packagekit-glib2/packagekit.h>
+
+G_BEGIN_DECLS
+
+GVariant	*gs_packagekit_resolve_cache_get_stamps	(const gchar * const	*paths);
+GVariant	*gs_packagekit_get_package_db_stamps	(void);
+gboolean	 gs_packagekit_resolve_cache_load	(GHashTable		*cache,
+							 const gchar		*filename,
+							 GVariant		*stamps,
+							 GError			**error);
+gboolean	 gs_packagekit_resolve_cache_save	(GHashTable		*cache,
+							 const gchar		*filename,
+							 GVariant		*stamps,
+							 GError			**error);
+
+G_END_DECLS
+
+#endif /* __PACKAGEKIT_RESOLVE_CACHE_H */
+
+/* vim: set noexpandtab: */